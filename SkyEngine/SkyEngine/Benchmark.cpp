@@ -0,0 +1,163 @@
+#include "Benchmark.h"
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+void BenchmarkPath::initFromFile(std::string path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open keyframe file " + path + "!");
+    }
+
+    keyframes.clear();
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+
+        std::istringstream fields(line);
+        BenchmarkKeyframe key;
+        fields >> key.time
+            >> key.position.x >> key.position.y >> key.position.z
+            >> key.target.x >> key.target.y >> key.target.z
+            >> key.sunElevation >> key.sunAzimuth;
+        if (fields.fail()) {
+            throw std::runtime_error("failed to parse keyframe on line " + std::to_string(lineNumber) + " of " + path + "!");
+        }
+        if (!keyframes.empty() && key.time <= keyframes.back().time) {
+            throw std::runtime_error("keyframes out of order on line " + std::to_string(lineNumber) + " of " + path + "!");
+        }
+        keyframes.push_back(key);
+    }
+
+    if (keyframes.empty()) {
+        throw std::runtime_error("no keyframes in " + path + "!");
+    }
+}
+
+BenchmarkKeyframe BenchmarkPath::evaluate(float time) const {
+    if (time <= keyframes.front().time) return keyframes.front();
+    if (time >= keyframes.back().time) return keyframes.back();
+
+    // first keyframe after time, there is always one before it
+    auto next = std::upper_bound(keyframes.begin(), keyframes.end(), time,
+        [](float t, const BenchmarkKeyframe& key) { return t < key.time; });
+    const BenchmarkKeyframe& a = *(next - 1);
+    const BenchmarkKeyframe& b = *next;
+    float t = (time - a.time) / (b.time - a.time);
+
+    BenchmarkKeyframe result;
+    result.time = time;
+    result.position = glm::mix(a.position, b.position, t);
+    result.target = glm::mix(a.target, b.target, t);
+    result.sunElevation = glm::mix(a.sunElevation, b.sunElevation, t);
+    result.sunAzimuth = glm::mix(a.sunAzimuth, b.sunAzimuth, t);
+    return result;
+}
+
+namespace {
+    struct Stats {
+        double min, avg, p99;
+    };
+
+    Stats computeStats(std::vector<double> values) {
+        Stats stats = { 0.0, 0.0, 0.0 };
+        if (values.empty()) return stats;
+
+        std::sort(values.begin(), values.end());
+        double sum = 0.0;
+        for (double v : values) sum += v;
+
+        // nearest-rank percentile
+        size_t rank = static_cast<size_t>(std::ceil(0.99 * values.size()));
+        stats.min = values.front();
+        stats.avg = sum / values.size();
+        stats.p99 = values[std::max<size_t>(rank, 1) - 1];
+        return stats;
+    }
+
+    void writeStats(std::ofstream& out, const char* name, const std::vector<double>& values, bool last) {
+        Stats stats = computeStats(values);
+        out << "    \"" << name << "\": { \"min\": " << stats.min << ", \"avg\": " << stats.avg << ", \"p99\": " << stats.p99 << " }"
+            << (last ? "\n" : ",\n");
+    }
+
+    // keyframe paths on Windows are full of backslashes
+    std::string escape(const std::string& s) {
+        std::string result;
+        for (char c : s) {
+            if (c == '"' || c == '\\') result += '\\';
+            result += c;
+        }
+        return result;
+    }
+}
+
+void BenchmarkReport::writeJSON(std::string path) const {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+        throw std::runtime_error("failed to open benchmark output " + path + "!");
+    }
+    out << std::fixed << std::setprecision(4);
+
+    std::vector<double> cpu, frame, gpuCompute, gpuGraphics;
+    for (const BenchmarkFrame& f : frames) {
+        cpu.push_back(f.cpuMs);
+        frame.push_back(f.frameMs);
+        gpuCompute.push_back(f.gpuComputeMs);
+        gpuGraphics.push_back(f.gpuGraphicsMs);
+    }
+
+    out << "{\n";
+    out << "  \"keyframes\": \"" << escape(keyframePath) << "\",\n";
+    out << "  \"device\": \"" << escape(deviceName) << "\",\n";
+    out << "  \"width\": " << width << ",\n";
+    out << "  \"height\": " << height << ",\n";
+    out << "  \"timestep\": " << timestep << ",\n";
+    out << "  \"frameCount\": " << frames.size() << ",\n";
+    out << "  \"gpuTimestamps\": " << (gpuTimestamps ? "true" : "false") << ",\n";
+
+    out << "  \"stats\": {\n";
+    writeStats(out, "cpuMs", cpu, false);
+    if (gpuTimestamps) {
+        writeStats(out, "frameMs", frame, false);
+        writeStats(out, "gpuComputeMs", gpuCompute, false);
+        writeStats(out, "gpuGraphicsMs", gpuGraphics, gpuPassNames.empty());
+        for (size_t p = 0; p < gpuPassNames.size(); p++) {
+            std::vector<double> pass;
+            for (const BenchmarkFrame& f : frames) {
+                pass.push_back(p < f.gpuPassMs.size() ? f.gpuPassMs[p] : 0.0);
+            }
+            writeStats(out, (gpuPassNames[p] + "Ms").c_str(), pass, p + 1 == gpuPassNames.size());
+        }
+    }
+    else {
+        writeStats(out, "frameMs", frame, true);
+    }
+    out << "  },\n";
+
+    out << "  \"frames\": [\n";
+    for (size_t i = 0; i < frames.size(); i++) {
+        const BenchmarkFrame& f = frames[i];
+        out << "    { \"frame\": " << i << ", \"time\": " << f.time
+            << ", \"cpuMs\": " << f.cpuMs << ", \"frameMs\": " << f.frameMs
+            << ", \"cloudSamplesEvaluated\": " << f.cloudSamplesEvaluated << ", \"cloudSamplesSkipped\": " << f.cloudSamplesSkipped
+            << ", \"cloudPixelsRemarched\": " << f.cloudPixelsRemarched << ", \"cloudPixelsDeferred\": " << f.cloudPixelsDeferred;
+        if (gpuTimestamps) {
+            out << ", \"gpuComputeMs\": " << f.gpuComputeMs << ", \"gpuGraphicsMs\": " << f.gpuGraphicsMs;
+            for (size_t p = 0; p < gpuPassNames.size() && p < f.gpuPassMs.size(); p++) {
+                out << ", \"" << gpuPassNames[p] << "Ms\": " << f.gpuPassMs[p];
+            }
+        }
+        out << " }" << (i + 1 < frames.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
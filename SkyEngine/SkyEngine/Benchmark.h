@@ -0,0 +1,60 @@
+#pragma once
+#include <glm/vec3.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// One sample of a scripted camera / sun path.
+struct BenchmarkKeyframe {
+    float time = 0.0f; // seconds from the start of the run
+    glm::vec3 position = glm::vec3(0.0f, 1.0f, 1.0f);
+    glm::vec3 target = glm::vec3(0.0f);
+    float sunElevation = 0.0f; // same units as SkyManager::rebuildSkyFromNewSun
+    float sunAzimuth = 0.25f;
+};
+
+// Keyframe file replayed by benchmark mode. Plain text, one keyframe per line, '#' starts a comment:
+//   time  posX posY posZ  targetX targetY targetZ  sunElevation sunAzimuth
+// Keyframes must be in increasing time; the path is linearly interpolated and clamped at both ends.
+class BenchmarkPath
+{
+private:
+    std::vector<BenchmarkKeyframe> keyframes;
+public:
+    void initFromFile(std::string path);
+    BenchmarkKeyframe evaluate(float time) const;
+    float getDuration() const { return keyframes.empty() ? 0.0f : keyframes.back().time; }
+};
+
+// Timings of a single benchmarked frame, in milliseconds. GPU times are left out of the report without timestamp support.
+struct BenchmarkFrame {
+    float time;
+    double cpuMs;    // uniform update, command recording and queue submission
+    double frameMs;  // cpuMs plus waiting for the GPU to finish the frame
+    double gpuComputeMs;
+    double gpuGraphicsMs;
+    std::vector<double> gpuPassMs; // one per BenchmarkReport::gpuPassNames
+    uint64_t cloudSamplesEvaluated; // see CloudMarchCounters
+    uint64_t cloudSamplesSkipped;
+    uint64_t cloudPixelsRemarched; // adaptive temporal pattern only, see TemporalScheduler.h
+    uint64_t cloudPixelsDeferred;
+};
+
+class BenchmarkReport
+{
+private:
+    std::vector<BenchmarkFrame> frames;
+public:
+    std::string keyframePath;
+    std::string deviceName;
+    uint32_t width = 0, height = 0;
+    float timestep = 0.0f;
+    bool gpuTimestamps = false;
+    std::vector<std::string> gpuPassNames;
+
+    void addFrame(const BenchmarkFrame& frame) { frames.push_back(frame); }
+
+    // Per-frame timings plus min/avg/p99 of each column
+    void writeJSON(std::string path) const;
+};
@@ -0,0 +1,51 @@
+#include "CloudLightVolume.h"
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+// See compute-clouds.comp
+#define WIND_STRENGTH 20.0f
+#define WIND_SHEAR 0.112f // length of the shear, vec3(0.1, 0.05, 0)
+#define LIGHT_CONE_HEIGHT 0.27f // most relative height between a cone sample and the one it lights, 18 high resolution steps
+
+bool CloudLightVolume::isStale(const glm::vec3& sunDirection, const glm::vec4& wind, const glm::vec3& cameraPosition) const {
+    if (glm::dot(glm::normalize(sunDirection), glm::normalize(this->sunDirection)) < LIGHT_VOLUME_SUN_COS) return true;
+    if (glm::vec3(wind) != this->wind) return true;
+
+    // the volume follows the wind, but the shear moves higher cone samples further as time goes on
+    if (WIND_STRENGTH * WIND_SHEAR * LIGHT_CONE_HEIGHT * std::abs(wind.w - windTime) > LIGHT_VOLUME_WIND_DRIFT) return true;
+
+    glm::vec2 moved(cameraPosition.x - this->cameraPosition.x, cameraPosition.z - this->cameraPosition.z);
+    return glm::length(moved) > LIGHT_VOLUME_CAMERA_DISTANCE;
+}
+
+LightVolumeBake CloudLightVolume::schedule(const glm::vec3& sunDirection, const glm::vec4& wind, const glm::vec3& cameraPosition) {
+    LightVolumeBake bake;
+
+    if (!baked || isStale(sunDirection, wind, cameraPosition)) {
+        this->sunDirection = sunDirection;
+        this->wind = glm::vec3(wind);
+        windTime = wind.w;
+        this->cameraPosition = cameraPosition;
+        layersLeft = LIGHT_VOLUME_LAYERS;
+    }
+
+    if (!baked) {
+        // nothing to read yet
+        baked = true;
+        nextLayer = 0;
+        layersLeft = 0;
+        bake.layerCount = LIGHT_VOLUME_LAYERS;
+        return bake;
+    }
+
+    if (layersLeft == 0) return bake;
+
+    // batches never wrap, LIGHT_VOLUME_LAYERS_PER_FRAME divides LIGHT_VOLUME_LAYERS
+    bake.firstLayer = nextLayer;
+    bake.layerCount = std::min<uint32_t>(LIGHT_VOLUME_LAYERS_PER_FRAME, layersLeft);
+    nextLayer = (nextLayer + bake.layerCount) % LIGHT_VOLUME_LAYERS;
+    layersLeft -= bake.layerCount;
+    return bake;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include <cstdint>
+
+// Light transmittance volume for the cloud raymarch (Shaders/compute-clouds.comp, --cloud-lighting volume).
+// Instead of sampling 6 points towards the sun for every sample in a cloud, the march reads the density summed along that
+// cone from one R32F volume. The volume is laid over the inner atmosphere shell around the camera (see lightVolumeCoord),
+// in wind displaced coordinates so drifting clouds keep their lighting, and is baked by the same shader in a second pipeline.
+// The bake only depends on the sun, the wind and where the camera is, so a layer is only baked again after one of them
+// changed enough, a few layers per frame.
+#define LIGHT_VOLUME_WIDTH 128 // texels along x and z
+#define LIGHT_VOLUME_LAYERS 32 // texels along the relative height
+#define LIGHT_VOLUME_LAYERS_PER_FRAME 4
+#define LIGHT_VOLUME_WORKGROUP_SIZE 32 // local size of the bake pipeline of compute-clouds.comp, divides LIGHT_VOLUME_WIDTH
+
+// How far things may move before the volume is baked again
+#define LIGHT_VOLUME_SUN_COS 0.99985f // about one degree of sun movement
+#define LIGHT_VOLUME_CAMERA_DISTANCE 500.0f // the noise is fixed in the world, the placement map follows the camera
+#define LIGHT_VOLUME_WIND_DRIFT 100.0f // distance the wind shear moved the cone samples relative to each other
+
+// A range of layers to bake this frame, none if layerCount is 0
+struct LightVolumeBake {
+    uint32_t firstLayer = 0;
+    uint32_t layerCount = 0;
+};
+
+class CloudLightVolume
+{
+private:
+    bool baked = false;
+    // what the last started refresh baked for
+    glm::vec3 sunDirection;
+    glm::vec3 wind;
+    float windTime = 0.0f;
+    glm::vec3 cameraPosition;
+
+    uint32_t nextLayer = 0;
+    uint32_t layersLeft = 0; // of the refresh in progress
+
+    bool isStale(const glm::vec3& sunDirection, const glm::vec4& wind, const glm::vec3& cameraPosition) const;
+public:
+    // Call once per frame with the uniforms the frame is rendered with. The first frame bakes every layer.
+    // While a refresh is in progress, a change restarts it from the layer it is at, so every layer is baked again
+    // within LIGHT_VOLUME_LAYERS / LIGHT_VOLUME_LAYERS_PER_FRAME frames of the last change.
+    LightVolumeBake schedule(const glm::vec3& sunDirection, const glm::vec4& wind, const glm::vec3& cameraPosition);
+    bool isRefreshing() const { return layersLeft > 0; }
+};
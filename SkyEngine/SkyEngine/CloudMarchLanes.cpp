@@ -0,0 +1,281 @@
+#include "CloudMarchLanes.h"
+#include "SimdLanes.h"
+
+// Constants mirrored from Shaders/compute-clouds.comp
+#define ATMOSPHERE_RADIUS 2000000.0f
+#define WIND_STRENGTH 20.0f
+
+static_assert(CLOUD_MARCH_LANES == SIMD_WIDTH, "the march is handed one ray per SIMD lane");
+
+const bool CLOUD_MARCH_LANES_AVX2 = SIMD_LANES_AVX2 != 0;
+
+// Everything below is static or in the SimdLanes namespace of this build, so nothing is shared with other files
+
+/// Lane helpers
+
+static vec3x8 loadVec3x8(const float p[3][CLOUD_MARCH_LANES]) {
+    return vec3x8(float8::load(p[0]), float8::load(p[1]), float8::load(p[2]));
+}
+
+// Texture reads are gathers, so they run lane by lane for the active lanes only
+static void sampleLanes(const CloudMarchSampler& sampler, CloudMarchTexture texture, const float8& u, const float8& v, const mask8& active, float8 out[4]) {
+    alignas(32) float tu[8], tv[8], r[4][8] = {};
+    u.store(tu);
+    v.store(tv);
+    sampler.sample(texture, tu, tv, tv, active.bits(), r);
+    for (int c = 0; c < 4; c++) out[c] = float8::load(r[c]);
+}
+
+static void sampleLanes(const CloudMarchSampler& sampler, CloudMarchTexture texture, const vec3x8& uvw, const mask8& active, float8 out[4]) {
+    alignas(32) float tu[8], tv[8], tw[8], r[4][8] = {};
+    uvw.x.store(tu);
+    uvw.y.store(tv);
+    uvw.z.store(tw);
+    sampler.sample(texture, tu, tv, tw, active.bits(), r);
+    for (int c = 0; c < 4; c++) out[c] = float8::load(r[c]);
+}
+
+static float8 remap8(const float8& value, const float8& oldMin, const float8& oldMax, const float8& newMin, const float8& newMax) {
+    return newMin + (((value - oldMin) / (oldMax - oldMin)) * (newMax - newMin));
+}
+
+static float8 remapClamped8(const float8& value, const float8& oldMin, const float8& oldMax, const float8& newMin, const float8& newMax) {
+    return clamp8(remap8(value, oldMin, oldMax, newMin, newMax), newMin, newMax);
+}
+
+static vec3x8 getProjectedShellPoint8(const vec3x8& pt, const vec3x8& center) {
+    return normalize8(pt - center) * float8(0.5f * ATMOSPHERE_RADIUS) + center;
+}
+
+static float8 getRelativeHeight8(const vec3x8& pt, const vec3x8& projectedPt, float thickness) {
+    return clamp8(length8(pt - projectedPt) / float8(thickness), float8(0.0f), float8(1.0f));
+}
+
+static float8 cloudLayerDensity8(float8 relativeHeight, const float8& cloudType) {
+    const float8 zero(0.0f), one(1.0f);
+    relativeHeight = clamp8(relativeHeight, zero, one);
+
+    float8 cumulus = max8(zero, remap8(relativeHeight, 0.0f, 0.2f, 0.0f, 1.0f) * remap8(relativeHeight, 0.7f, 0.9f, 1.0f, 0.0f));
+    float8 stratocumulus = max8(zero, remap8(relativeHeight, 0.0f, 0.2f, 0.0f, 1.0f) * remap8(relativeHeight, 0.2f, 0.7f, 1.0f, 0.0f));
+    float8 stratus = max8(zero, remap8(relativeHeight, 0.0f, 0.1f, 0.0f, 1.0f) * remap8(relativeHeight, 0.2f, 0.3f, 1.0f, 0.0f));
+
+    float8 d1 = mix8(stratus, stratocumulus, clamp8(cloudType * 2.0f, zero, one));
+    float8 d2 = mix8(stratocumulus, cumulus, clamp8((cloudType - 0.5f) * 2.0f, zero, one));
+    return mix8(d1, d2, cloudType);
+}
+
+static float8 heightBiasCoverage8(const float8& coverage, const float8& height) {
+    return pow8(coverage, clamp8(remap8(height, 0.7f, 0.8f, 1.0f, 0.8f), float8(0.8f), float8(1.0f)));
+}
+
+/// March
+
+namespace {
+    // The frame constants as lanes, built once per call of marchCloudLanes
+    struct MarchLanes {
+        const CloudMarchFrame& frame;
+        const CloudMarchSampler& sampler;
+        vec3x8 cameraPos;
+        vec3x8 earthCenter;
+        float maxSteps;
+        int lightConeSamples;
+
+        MarchLanes(const CloudMarchFrame& frame, const CloudMarchSampler& sampler)
+            : frame(frame), sampler(sampler), cameraPos(frame.cameraPos), earthCenter(frame.earthCenter),
+            maxSteps(static_cast<float>(frame.budget.maxSteps)),
+            lightConeSamples(frame.budget.lightConeSamples < 1 ? 1 : frame.budget.lightConeSamples > 6 ? 6 : static_cast<int>(frame.budget.lightConeSamples)) {}
+    };
+}
+
+// Per lane number of samples the skip map guarantees empty, 0 where cloudTest has to run
+static float8 emptySamples(const MarchLanes& m, const vec3x8& samplePos, const float8& relativeHeight, const float8& t,
+    const float8& tEnd, const float8& stepSize, const float8& steps, const mask8& candidates) {
+    mask8 above = candidates & (relativeHeight >= float8(m.frame.cloudTopMin));
+    if (!above.any()) return float8(0.0f);
+
+    // the placement uv cloudTest would sample at
+    vec3x8 sampleProj = getProjectedShellPoint8(samplePos, m.earthCenter);
+    // none past the end of the march
+    float8 remaining = min8(-floor8((t - tEnd) / stepSize), float8(m.maxSteps + 1.0f) - steps);
+
+    alignas(32) float u[8], v[8], h[8], step[8], left[8], result[8] = {};
+    ((sampleProj.x - m.cameraPos.x) * 0.000009f).store(u);
+    ((sampleProj.z - m.cameraPos.z) * 0.000009f).store(v);
+    relativeHeight.store(h);
+    stepSize.store(step);
+    remaining.store(left);
+    m.sampler.emptySamples(u, v, h, step, left, above.bits(), result);
+    return float8::load(result);
+}
+
+static float8 cloudTest(const MarchLanes& m, const vec3x8& pos, const float8& relativeHeight, const mask8& active, float8& coverage) {
+    vec3x8 currentProj = getProjectedShellPoint8(pos, m.earthCenter);
+
+    float8 cloudInfo[4];
+    sampleLanes(m.sampler, CLOUD_MARCH_PLACEMENT,
+        (currentProj.x - m.cameraPos.x) * 0.000009f,
+        (currentProj.z - m.cameraPos.z) * 0.000009f,
+        active, cloudInfo);
+    float8 layerDensity = cloudLayerDensity8(relativeHeight, cloudInfo[2]);
+
+    float8 densityNoise[4];
+    sampleLanes(m.sampler, CLOUD_MARCH_LOW_RES_SHAPE, pos * float8(0.00002f), active, densityNoise);
+
+    float8 density = layerDensity * remapClamped8(densityNoise[0], 0.3f, 1.0f, 0.0f, 1.0f);
+
+    // early out before the more expensive math, per lane
+    mask8 dense = active & (density >= float8(0.0001f));
+    coverage = float8(0.0f);
+    if (!dense.any()) return float8(0.0f);
+
+    float8 laneCoverage = heightBiasCoverage8(relativeHeight, min8(float8(0.85f), cloudInfo[0]));
+
+    float8 erosion = densityNoise[1] * 0.625f + densityNoise[2] * 0.25f + densityNoise[3] * 0.125f;
+    erosion = remapClamped8(erosion, laneCoverage, 1.0f, 0.0f, 1.0f);
+    density = remapClamped8(density, erosion, 1.0f, 0.0f, 1.0f);
+
+    coverage = select8(dense, laneCoverage, float8(0.0f));
+    return select8(dense, density, float8(0.0f));
+}
+
+static float8 cloudHiRes(const MarchLanes& m, const vec3x8& pos, const float8& curlStrength, const float8& origDensity, const float8& relativeHeight, const mask8& active) {
+    float8 curl[4];
+    sampleLanes(m.sampler, CLOUD_MARCH_CURL_NOISE, pos.x * 0.0001f, pos.z * 0.0001f, active, curl);
+
+    vec3x8 curlDir(curl[0] * 2.0f - 1.0f, curl[1] * 2.0f - 1.0f, curl[2] * 2.0f - 1.0f);
+    vec3x8 offsetPos = pos + curlDir * (curlStrength * 1.9f);
+
+    float8 densityNoise[4];
+    sampleLanes(m.sampler, CLOUD_MARCH_HI_RES_SHAPE, offsetPos * float8(0.0004f), active, densityNoise);
+    float8 erosion = densityNoise[0] * 0.625f + densityNoise[1] * 0.25f + densityNoise[2] * 0.125f;
+
+    erosion = mix8(erosion, float8(1.0f) - erosion, clamp8(relativeHeight * 10.0f, float8(0.0f), float8(1.0f)));
+    return select8(active, remapClamped8(origDensity, erosion, 1.0f, 0.0f, 1.0f), float8(0.0f));
+}
+
+void marchCloudLanes(const CloudMarchFrame& frame, const CloudMarchSampler& sampler, const CloudMarchRays& rays, CloudMarchResult& result) {
+    const MarchLanes m(frame, sampler);
+    const vec3x8 rayDirection = loadVec3x8(rays.direction);
+    const float8 tEnd = float8::load(rays.tOuter);
+    const float8 cosTheta = float8::load(rays.cosTheta);
+    const float8 henyeyGreenstein = float8::load(rays.henyeyGreenstein);
+    const float8 zero(0.0f), one(1.0f);
+    const vec3x8 windDir(frame.wind);
+    const float windShearValues[3] = { 0.1f, 0.05f, 0.0f };
+    const vec3x8 windShear(windShearValues);
+    const float timeOffset = frame.wind[3];
+
+    float8 t = float8::load(rays.tInner);
+    float8 stepSize(0.05f * frame.atmosphereThickness);
+    float8 accumDensity(0.0f);
+    float8 transmittance(1.0f);
+    float8 misses(0.0f);
+    float8 steps(0.0f);
+    mask8 noHits(true);
+    mask8 active = mask8::fromBits(rays.marchBits) & (t < tEnd);
+
+    // Each iteration is one step of the shader's for loop, lanes leave the loop by dropping out of the active mask
+    while (active.any()) {
+        vec3x8 currentPos = m.cameraPos + rayDirection * t;
+        vec3x8 currentProj = getProjectedShellPoint8(currentPos, m.earthCenter);
+        float8 rHeight = getRelativeHeight8(currentPos, currentProj, frame.atmosphereThickness);
+        vec3x8 windOffset = (windDir + windShear * rHeight) * ((rHeight * 200.0f + timeOffset) * WIND_STRENGTH);
+        vec3x8 samplePos = currentPos + windOffset;
+
+        // lanes still on the low resolution march jump over samples the skip map guarantees empty
+        float8 empty = emptySamples(m, samplePos, rHeight, t, tEnd, stepSize, steps, active & noHits);
+        mask8 skipping = active & (empty > zero);
+        mask8 evaluated = active.andNot(skipping);
+        result.evaluated += evaluated.count();
+
+        float8 coverage;
+        float8 density = cloudTest(m, samplePos, rHeight, evaluated, coverage);
+        float8 loDensity = density;
+
+        mask8 hit = active & (density > zero);
+        misses = select8(hit, zero, misses);
+
+        // first hit: step back and switch to the high resolution march
+        mask8 firstHit = hit & noHits;
+        t = select8(firstHit, t - stepSize, t);
+        stepSize = select8(firstHit, stepSize * 0.3f, stepSize);
+        noHits = noHits.andNot(firstHit);
+
+        mask8 refine = hit.andNot(firstHit);
+        mask8 skipped;
+        if (refine.any()) {
+            density = cloudHiRes(m, samplePos, stepSize, density, rHeight, refine);
+            mask8 lit = refine & (density >= float8(0.0001f));
+            skipped = refine.andNot(lit);
+
+            if (lit.any()) {
+                float8 densityAlongLight(0.0f);
+
+                // Sample light propogation for Beer's law in a cone towards the light
+                for (int i = 0; i < m.lightConeSamples; i++) {
+                    vec3x8 lsPos = currentPos + vec3x8(frame.coneSamples[i]) * (stepSize * 3.0f);
+                    vec3x8 lsProj = getProjectedShellPoint8(lsPos, m.earthCenter);
+                    float8 lsHeight = getRelativeHeight8(lsPos, lsProj, frame.atmosphereThickness);
+                    vec3x8 lsWind = (windDir + windShear * lsHeight) * ((lsHeight * 200.0f + timeOffset) * WIND_STRENGTH);
+
+                    float8 lsDensity = cloudTest(m, lsPos + lsWind, lsHeight, lit, coverage);
+                    mask8 lsHit = lit & (lsDensity > zero);
+                    if (lsHit.any()) {
+                        lsDensity = cloudHiRes(m, lsPos + lsWind, stepSize, lsDensity, lsHeight, lsHit);
+                        densityAlongLight = select8(lsHit, densityAlongLight + lsDensity, densityAlongLight);
+                    }
+                }
+
+                // a shorter cone stands in for the full one
+                densityAlongLight = densityAlongLight * (6.0f / m.lightConeSamples);
+
+                float8 beersLaw = exp8(-densityAlongLight);
+                float8 beersModulated = max8(beersLaw, exp8(densityAlongLight * -0.25f) * 0.7f);
+                beersLaw = mix8(beersLaw, beersModulated, cosTheta * -0.5f + 0.5f);
+                float8 inScatter = pow8(loDensity, remapClamped8(rHeight, 0.3f, 0.85f, 0.5f, 2.0f)) + 0.09f;
+                inScatter = inScatter * pow8(remapClamped8(rHeight, 0.07f, 0.34f, 0.1f, 1.0f), float8(0.8f));
+
+                transmittance = select8(lit, mix8(transmittance, inScatter * henyeyGreenstein * beersLaw, one - accumDensity), transmittance);
+                accumDensity = select8(lit, accumDensity + density, accumDensity);
+            }
+        }
+
+        // a run of misses reverts to the low resolution march
+        mask8 missed = active.andNot(hit).andNot(noHits);
+        misses = select8(missed, misses + 1.0f, misses);
+        mask8 revert = missed & (misses >= float8(10.0f));
+        noHits = noHits | revert;
+        stepSize = select8(revert, stepSize / 0.3f, stepSize);
+
+        // a skipped run of samples counts towards maxSteps as if each had been taken, so the image does not change.
+        // The last one is the usual step below.
+        if (skipping.any()) {
+            alignas(32) float runs[8];
+            empty.store(runs);
+            for (int i = 0; i < SIMD_WIDTH; i++) result.skipped += static_cast<uint64_t>(runs[i]);
+            float8 extra = select8(skipping, empty - one, zero);
+            steps = steps + extra;
+            t = t + extra * stepSize;
+        }
+
+        // lanes that hit a `continue` in the shader skip the termination checks
+        mask8 counted = active.andNot(firstHit).andNot(skipped);
+        mask8 opaque = counted & (accumDensity > float8(0.99f));
+        accumDensity = select8(opaque, one, accumDensity);
+        mask8 stepped = counted.andNot(opaque);
+        steps = select8(stepped, steps + 1.0f, steps);
+        mask8 exhausted = stepped & (steps > float8(m.maxSteps));
+
+        active = active.andNot(opaque | exhausted);
+        t = select8(active, t + stepSize, t);
+        active = active & (t < tEnd);
+    }
+
+    // opacity fades to prevent hard cutoff at horizon
+    float8 horizon = clamp8(remap8(rayDirection.y, 0.0f, 0.1f, 0.0f, 1.0f), zero, one);
+    horizon = horizon * horizon * (float8(3.0f) - horizon * 2.0f);
+    accumDensity = min8(accumDensity * horizon, float8(0.999f));
+
+    accumDensity.store(result.accumDensity);
+    transmittance.store(result.transmittance);
+}
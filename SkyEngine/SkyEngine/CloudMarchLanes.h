@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+
+// The ray march of CloudRendererCPU, SIMD_WIDTH rays at a time. CloudMarchLanes.cpp is the only file built with AVX2
+// (see SkyEngine.vcxproj), so it includes nothing but SimdLanes.h and this header, which only uses plain C++ types:
+// any glm, standard library or Vulkan inline function it used would be emitted with AVX2 instructions, and the linker
+// may keep that copy for the files built without AVX2 too. Texture reads and the skip map go through
+// CloudMarchSampler, which CloudRendererCPU implements outside of this file.
+
+#define CLOUD_MARCH_LANES 8 // SIMD_WIDTH
+
+// True when CloudMarchLanes.cpp was built with AVX2, so the CPU has to support it before marchCloudLanes is called
+extern const bool CLOUD_MARCH_LANES_AVX2;
+
+enum CloudMarchTexture {
+    CLOUD_MARCH_PLACEMENT,       // 2D, sampled at placement uvs
+    CLOUD_MARCH_CURL_NOISE,      // 2D
+    CLOUD_MARCH_LOW_RES_SHAPE,   // 3D
+    CLOUD_MARCH_HI_RES_SHAPE     // 3D
+};
+
+// Lane by lane queries of the march. Lanes that are not in laneBits must be left as zero.
+class CloudMarchSampler
+{
+public:
+    // RGBA of a texture at each lane's coordinates, w is ignored for the 2D textures
+    virtual void sample(CloudMarchTexture texture, const float* u, const float* v, const float* w, int laneBits,
+        float out[4][CLOUD_MARCH_LANES]) const = 0;
+    // Samples guaranteed empty from each lane's placement uv on, no more than remaining (see CloudSkipMap::emptySamples)
+    virtual void emptySamples(const float* u, const float* v, const float* relativeHeight, const float* stepSize,
+        const float* remaining, int laneBits, float* out) const = 0;
+};
+
+// The part of CloudMarchSettings (Shader.h) the lane march follows, so it stops where the compute shader does
+struct CloudMarchBudget {
+    uint32_t maxSteps = 100;       // samples along a view ray, skipped ones included
+    uint32_t lightConeSamples = 6; // samples of the cone towards the sun, 1 to 6
+};
+
+// Everything the march reads that is constant across a frame, see CloudRendererCPU::render
+struct CloudMarchFrame {
+    float cameraPos[3];
+    float earthCenter[3];
+    float atmosphereThickness;
+    float coneSamples[6][3];
+    float wind[4];     // UniformSkyObject::wind, xyz direction and w time
+    float cloudTopMin; // CLOUD_TOP_MIN, emptySamples is only asked about samples at or above it
+    CloudMarchBudget budget;
+};
+
+// One ray per lane, rays that are not in marchBits are not marched
+struct CloudMarchRays {
+    float direction[3][CLOUD_MARCH_LANES];
+    float tInner[CLOUD_MARCH_LANES];
+    float tOuter[CLOUD_MARCH_LANES];
+    float cosTheta[CLOUD_MARCH_LANES];
+    float henyeyGreenstein[CLOUD_MARCH_LANES];
+    int marchBits;
+};
+
+struct CloudMarchResult {
+    float accumDensity[CLOUD_MARCH_LANES]; // opacity, faded towards the horizon
+    float transmittance[CLOUD_MARCH_LANES];
+    uint64_t evaluated; // added to, see CloudMarchCounters
+    uint64_t skipped;
+};
+
+// The for loop of Shaders/compute-clouds.comp, with per-lane masks standing in for shader divergence
+void marchCloudLanes(const CloudMarchFrame& frame, const CloudMarchSampler& sampler, const CloudMarchRays& rays, CloudMarchResult& result);
@@ -0,0 +1,411 @@
+#include "CloudRendererCPU.h"
+#include "SimdLanes.h" // cpuSupportsAVX2
+#include <stb_image.h>
+#include <stb_image_write.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+
+// Constants mirrored from Shaders/compute-clouds.comp
+#define ATMOSPHERE_RADIUS 2000000.0f
+#define PI_F 3.14159265f
+#define ONE_OVER_FOURPI 0.07957747154594767f
+#define THREE_OVER_SIXTEENPI 0.05968310365946075f
+#define SUN_ANGULAR_COS 0.999956676946448443553574619906976478926848692873900859324
+#define WIND_STRENGTH 20.0f
+
+#define TILE_SIZE 32
+
+/// CPUTexture
+
+void CPUTexture::initFromFile(std::string path) {
+    int channels;
+    stbi_uc* pixels = stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+
+    if (!pixels) {
+        throw std::runtime_error("failed to load texture image!");
+    }
+
+    depth = 1;
+    texels.assign(pixels, pixels + static_cast<size_t>(width) * height * 4);
+    stbi_image_free(pixels);
+}
+
+void CPUTexture::initFromSlices(std::string path, int sliceCount) {
+    int channels;
+    depth = sliceCount;
+
+    for (int i = 0; i < sliceCount; ++i) {
+        stbi_uc* pixels = stbi_load((path + "(" + std::to_string(i) + ").tga").c_str(), &width, &height, &channels, STBI_rgb_alpha);
+
+        if (!pixels) {
+            throw std::runtime_error("failed to load texture image!");
+        }
+
+        if (i == 0) texels.resize(static_cast<size_t>(width) * height * 4 * depth);
+        memcpy(&texels[static_cast<size_t>(i) * width * height * 4], pixels, static_cast<size_t>(width) * height * 4);
+        stbi_image_free(pixels);
+    }
+}
+
+glm::vec4 CPUTexture::fetch(int x, int y, int z) const {
+    // repeat addressing
+    x = ((x % width) + width) % width;
+    y = ((y % height) + height) % height;
+    z = ((z % depth) + depth) % depth;
+    const unsigned char* t = &texels[((static_cast<size_t>(z) * height + y) * width + x) * 4];
+    return glm::vec4(t[0], t[1], t[2], t[3]) * (1.0f / 255.0f);
+}
+
+glm::vec4 CPUTexture::sample(glm::vec2 uv) const {
+    float fx = uv.x * width - 0.5f;
+    float fy = uv.y * height - 0.5f;
+    float x0 = std::floor(fx);
+    float y0 = std::floor(fy);
+    float tx = fx - x0;
+    float ty = fy - y0;
+    int ix = static_cast<int>(x0);
+    int iy = static_cast<int>(y0);
+
+    glm::vec4 a = glm::mix(fetch(ix, iy, 0), fetch(ix + 1, iy, 0), tx);
+    glm::vec4 b = glm::mix(fetch(ix, iy + 1, 0), fetch(ix + 1, iy + 1, 0), tx);
+    return glm::mix(a, b, ty);
+}
+
+glm::vec4 CPUTexture::sample(glm::vec3 uvw) const {
+    float fx = uvw.x * width - 0.5f;
+    float fy = uvw.y * height - 0.5f;
+    float fz = uvw.z * depth - 0.5f;
+    float x0 = std::floor(fx);
+    float y0 = std::floor(fy);
+    float z0 = std::floor(fz);
+    float tx = fx - x0;
+    float ty = fy - y0;
+    float tz = fz - z0;
+    int ix = static_cast<int>(x0);
+    int iy = static_cast<int>(y0);
+    int iz = static_cast<int>(z0);
+
+    glm::vec4 a0 = glm::mix(fetch(ix, iy, iz), fetch(ix + 1, iy, iz), tx);
+    glm::vec4 b0 = glm::mix(fetch(ix, iy + 1, iz), fetch(ix + 1, iy + 1, iz), tx);
+    glm::vec4 a1 = glm::mix(fetch(ix, iy, iz + 1), fetch(ix + 1, iy, iz + 1), tx);
+    glm::vec4 b1 = glm::mix(fetch(ix, iy + 1, iz + 1), fetch(ix + 1, iy + 1, iz + 1), tx);
+    return glm::mix(glm::mix(a0, b0, ty), glm::mix(a1, b1, ty), tz);
+}
+
+/// Helpers
+
+static float hgPhase(float cosTheta, float g) {
+    float g2 = g * g;
+    float inv = 1.0f / std::pow(1.0f - 2.0f * g * cosTheta + g2, 1.5f);
+    return ONE_OVER_FOURPI * ((1.0f - g2) * inv);
+}
+
+static float rayleighPhase(float cosTheta) {
+    return THREE_OVER_SIXTEENPI * (1.0f + cosTheta * cosTheta);
+}
+
+static float smoothstep(float edge0, float edge1, float x) {
+    float t = glm::clamp((x - edge0) / (edge1 - edge0), 0.0f, 1.0f);
+    return t * t * (3.0f - 2.0f * t);
+}
+
+// Returns the shader's (quirky) t: distance from the sphere-local origin to the world space hit point
+static bool raySphereIntersection(glm::vec3 ro, glm::vec3 rd, glm::vec4 sphere, glm::vec3& point, float& t) {
+    ro -= glm::vec3(sphere);
+    ro /= sphere.w;
+
+    float A = glm::dot(rd, rd);
+    float B = 2.0f * glm::dot(rd, ro);
+    float C = glm::dot(ro, ro) - 0.25f;
+    float discriminant = B * B - 4.0f * A * C;
+
+    point = glm::vec3(0);
+    t = 0.0f;
+    if (discriminant < 0.0f) return false;
+    float tHit = (-std::sqrt(discriminant) - B) / A * 0.5f;
+    if (tHit < 0.0f) tHit = (std::sqrt(discriminant) - B) / A * 0.5f;
+    if (tHit < 0.0f) return false;
+
+    glm::vec3 p = ro + rd * tHit;
+    p *= sphere.w;
+    p += glm::vec3(sphere);
+    point = p;
+    t = glm::length(p - ro);
+    return true;
+}
+
+static glm::vec3 getProjectedShellPoint(glm::vec3 pt, glm::vec3 center) {
+    return 0.5f * ATMOSPHERE_RADIUS * glm::normalize(pt - center) + center;
+}
+
+/// CloudRendererCPU
+
+CloudRendererCPU::CloudRendererCPU(ThreadPool& pool, const CloudMarchBudget& budget) : pool(&pool), budget(budget) {
+    if (!isSupported()) {
+        throw std::runtime_error("failed to create the CPU renderer, it was built for AVX2 and this CPU does not support it!");
+    }
+}
+
+void CloudRendererCPU::initTextures() {
+    cloudPlacement.initFromFile("Textures/CloudPlacement.png");
+    cloudSkipMap.initFromFile("Textures/CloudPlacement.png");
+    nightSkyMap.initFromFile("Textures/NightSky/nightSky_noOrange.png");
+    curlNoise.initFromFile("Textures/CurlNoiseFBM.png");
+    lowResCloudShape.initFromSlices("Textures/3DTextures/lowResCloudShape/lowResCloud", 128);
+    hiResCloudShape.initFromSlices("Textures/3DTextures/hiResCloudShape/hiResClouds ", 32);
+}
+
+glm::vec3 CloudRendererCPU::getAtmosphereColorPhysical(const FrameConstants& fc, glm::vec3 dir) const {
+    // ATMOSPHERE COLOR: adapted from open source of zz85 on Github, math from Preetham Model,
+    // initially implemented by Simon Wallner and Martin Upitis. See compute-clouds.comp.
+    float sunE = fc.sun.intensity;
+    glm::vec3 BetaR = glm::vec3(fc.sky.betaR);
+    glm::vec3 BetaM = glm::vec3(fc.sky.betaV);
+
+    // optical length
+    float zenith = std::acos(std::max(0.0f, dir.y));
+    float inverse = 1.0f / (std::cos(zenith) + 0.15f * std::pow(93.885f - ((zenith * 180.0f) / PI_F), -1.253f));
+    float sR = 8.4E3f * inverse;
+    float sM = 1.25E3f * inverse;
+
+    glm::vec3 fex = glm::exp(-BetaR * sR + BetaM * sM);
+
+    float cosTheta = glm::dot(fc.sunDir, dir);
+
+    float rPhase = rayleighPhase(cosTheta * 0.5f + 0.5f);
+    glm::vec3 betaRTheta = BetaR * rPhase;
+    float mPhase = hgPhase(cosTheta, fc.sky.mie_directional);
+    glm::vec3 betaMTheta = BetaM * mPhase;
+
+    float yDot = 1.0f - fc.sunDir.y;
+    yDot *= yDot * yDot * yDot * yDot;
+    glm::vec3 betas = (betaRTheta + betaMTheta) / (BetaR + BetaM);
+    glm::vec3 Lin = glm::pow(sunE * betas * (glm::vec3(1.0f) - fex), glm::vec3(1.5f));
+    Lin *= glm::mix(glm::vec3(1.0f), glm::pow(sunE * betas * fex, glm::vec3(0.5f)), glm::clamp(yDot, 0.0f, 1.0f));
+
+    // the shader zeroes its sun disk term, so only the ambient part of L0 remains
+    glm::vec3 L0 = 0.1f * fex;
+
+    return (Lin + L0) * 0.04f + glm::vec3(0.0f, 0.0003f, 0.00075f);
+}
+
+void CloudRendererCPU::sample(CloudMarchTexture texture, const float* u, const float* v, const float* w, int laneBits,
+    float out[4][CLOUD_MARCH_LANES]) const {
+    const CPUTexture* textures[] = { &cloudPlacement, &curlNoise, &lowResCloudShape, &hiResCloudShape };
+    const CPUTexture& tex = *textures[texture];
+    const bool volume = texture == CLOUD_MARCH_LOW_RES_SHAPE || texture == CLOUD_MARCH_HI_RES_SHAPE;
+    for (int i = 0; i < CLOUD_MARCH_LANES; i++) {
+        if (!((laneBits >> i) & 1)) continue;
+        glm::vec4 s = volume ? tex.sample(glm::vec3(u[i], v[i], w[i])) : tex.sample(glm::vec2(u[i], v[i]));
+        out[0][i] = s.x; out[1][i] = s.y; out[2][i] = s.z; out[3][i] = s.w;
+    }
+}
+
+void CloudRendererCPU::emptySamples(const float* u, const float* v, const float* relativeHeight, const float* stepSize,
+    const float* remaining, int laneBits, float* out) const {
+    // base mip only like CPUTexture
+    for (int i = 0; i < CLOUD_MARCH_LANES; i++) {
+        if (!((laneBits >> i) & 1)) continue;
+        int empty = cloudSkipMap.emptySamples(glm::vec2(u[i], v[i]), relativeHeight[i], 0, placementUVRate, stepSize[i]);
+        out[i] = std::min(static_cast<float>(empty), remaining[i]);
+    }
+}
+
+void CloudRendererCPU::setupRay(const FrameConstants& fc, uint32_t x, uint32_t y, RaySetup& ray) const {
+    glm::vec2 uv = glm::vec2(x, y) / glm::vec2(fc.width, fc.height);
+    glm::vec2 screenPoint = uv * 2.0f - 1.0f;
+
+    glm::vec3 refPoint = fc.cameraPos - fc.camLook;
+    glm::vec3 p = refPoint + fc.camera.cameraParams.x * screenPoint.x * fc.camera.cameraParams.y * fc.camRight
+        - screenPoint.y * fc.camera.cameraParams.y * fc.camUp;
+    glm::vec3 rayDirection = glm::normalize(p - fc.cameraPos);
+    ray.direction = rayDirection;
+
+    float dotToSun = std::max(0.0f, glm::dot(fc.sunDir, rayDirection));
+    float skyAmbient = dotToSun * 0.18f;
+    skyAmbient *= skyAmbient * skyAmbient;
+    float sunDisk = smoothstep((float)SUN_ANGULAR_COS, (float)SUN_ANGULAR_COS + 0.00003f, dotToSun);
+    dotToSun *= dotToSun * dotToSun * dotToSun;
+    dotToSun *= dotToSun * dotToSun * dotToSun;
+    dotToSun *= dotToSun * dotToSun * dotToSun;
+    dotToSun *= dotToSun * dotToSun * dotToSun;
+    dotToSun *= dotToSun * dotToSun;
+    if (fc.sun.direction.y < 0.0f) {
+        dotToSun *= dotToSun * dotToSun * dotToSun * dotToSun * dotToSun * dotToSun;
+    }
+    sunDisk = std::max(0.0f, std::max(sunDisk, dotToSun));
+
+    ray.finalColor = glm::vec4(0.0f);
+    ray.backgroundCol = glm::vec3(0.0f);
+    if (fc.sun.direction.y >= 0.0f) {
+        ray.backgroundCol = getAtmosphereColorPhysical(fc, rayDirection);
+        ray.finalColor = glm::vec4(ray.backgroundCol, std::max(skyAmbient, sunDisk));
+    }
+
+    ray.march = false;
+    ray.tInner = ray.tOuter = 0.0f;
+    // below the horizon: keep the background, as the shader does
+    if (glm::dot(rayDirection, glm::vec3(0, 1, 0)) < 0.0f) return;
+
+    glm::vec3 innerPoint, outerPoint;
+    raySphereIntersection(fc.cameraPos, rayDirection, glm::vec4(fc.earthCenter, ATMOSPHERE_RADIUS), innerPoint, ray.tInner);
+    raySphereIntersection(fc.cameraPos, rayDirection, glm::vec4(fc.earthCenter, ATMOSPHERE_RADIUS * 1.02f), outerPoint, ray.tOuter);
+
+    if (fc.sun.direction.y < 0.0f) {
+        glm::vec3 rotatedRayDir = fc.nightRotation * rayDirection;
+        glm::vec3 rotatedRayOrigin = fc.nightRotation * fc.cameraPos;
+        glm::vec3 point = ray.tOuter * rotatedRayDir + rotatedRayOrigin;
+        glm::vec3 projectedPoint = getProjectedShellPoint(point, fc.earthCenter);
+        glm::vec2 nightUV = 0.00002f * (glm::vec2(projectedPoint.x, projectedPoint.z) - glm::vec2(fc.cameraPos.x, fc.cameraPos.z)) + 0.35f;
+        glm::vec3 backgroundCol = glm::vec3(nightSkyMap.sample(nightUV));
+        backgroundCol *= glm::sqrt(backgroundCol) * 0.75f;
+        backgroundCol = glm::pow(backgroundCol, glm::vec3(2.2f));
+        backgroundCol *= 10.0f;
+        backgroundCol *= std::pow(rayDirection.y, 6.0f);
+        backgroundCol = glm::mix(glm::vec3(0.3f, 0.6f, 4.0f) * 0.05f, backgroundCol, std::pow(rayDirection.y, 0.03125f));
+        backgroundCol += sunDisk;
+        ray.backgroundCol = backgroundCol;
+        ray.finalColor.a = sunDisk;
+    }
+
+    ray.cosTheta = glm::dot(rayDirection, fc.sunDir);
+    ray.henyeyGreenstein = std::max(hgPhase(ray.cosTheta, 0.6f), 0.7f * hgPhase(ray.cosTheta, 0.99f - 0.1f));
+    ray.march = true;
+}
+
+void CloudRendererCPU::marchLanes(const FrameConstants& fc, const RaySetup* rays, int laneCount, glm::vec4* out, CloudMarchCounters& counters) const {
+    CloudMarchRays lanes = {};
+    for (int i = 0; i < laneCount; i++) {
+        for (int c = 0; c < 3; c++) lanes.direction[c][i] = rays[i].direction[c];
+        lanes.tInner[i] = rays[i].tInner;
+        lanes.tOuter[i] = rays[i].tOuter;
+        lanes.cosTheta[i] = rays[i].cosTheta;
+        lanes.henyeyGreenstein[i] = rays[i].henyeyGreenstein;
+        if (rays[i].march) lanes.marchBits |= 1 << i;
+    }
+
+    CloudMarchResult result = {};
+    marchCloudLanes(fc.march, *this, lanes, result);
+    counters.evaluated += result.evaluated;
+    counters.skipped += result.skipped;
+
+    const glm::vec3 sunColor = glm::vec3(fc.sun.color);
+    for (int i = 0; i < laneCount; i++) {
+        const RaySetup& ray = rays[i];
+        if (!ray.march) {
+            out[i] = ray.finalColor;
+            continue;
+        }
+
+        float accum = result.accumDensity[i];
+        float trans = result.transmittance[i];
+        glm::vec3 ambient = fc.sun.direction.y >= 0.0f ? ray.backgroundCol
+            : glm::vec3(0.3f, 0.6f, 4.0f) * 0.05f * std::pow(ray.direction.y, 0.03125f);
+        glm::vec3 cloudColor = sunColor * (fc.sun.intensity * glm::vec3(std::max(0.0f, trans)) + 0.08f * ambient * std::exp(-trans));
+
+        out[i] = glm::vec4(glm::mix(ray.backgroundCol, cloudColor, accum), ray.finalColor.a * std::max(1.0f - accum, 0.0f));
+    }
+}
+
+void CloudRendererCPU::renderTile(const FrameConstants& fc, uint32_t tileX, uint32_t tileY, glm::vec4* target, CloudMarchCounters& counters) const {
+    const uint32_t x0 = tileX * TILE_SIZE;
+    const uint32_t y0 = tileY * TILE_SIZE;
+    const uint32_t x1 = std::min(x0 + TILE_SIZE, fc.width);
+    const uint32_t y1 = std::min(y0 + TILE_SIZE, fc.height);
+
+    RaySetup rays[CLOUD_MARCH_LANES];
+    glm::vec4 colors[CLOUD_MARCH_LANES];
+    for (uint32_t y = y0; y < y1; y++) {
+        for (uint32_t x = x0; x < x1; x += CLOUD_MARCH_LANES) {
+            int laneCount = static_cast<int>(std::min<uint32_t>(CLOUD_MARCH_LANES, x1 - x));
+            for (int i = 0; i < laneCount; i++) {
+                setupRay(fc, x + i, y, rays[i]);
+            }
+            marchLanes(fc, rays, laneCount, colors, counters);
+            for (int i = 0; i < laneCount; i++) {
+                target[static_cast<size_t>(y) * fc.width + x + i] = colors[i];
+            }
+        }
+    }
+}
+
+void CloudRendererCPU::render(const UniformCameraObject& camera, const UniformSunObject& sun, const UniformSkyObject& sky,
+    uint32_t width, uint32_t height, std::vector<glm::vec4>& target) {
+    FrameConstants fc;
+    fc.camera = camera;
+    fc.sun = sun;
+    fc.sky = sky;
+    fc.width = width;
+    fc.height = height;
+
+    fc.cameraPos = glm::vec3(camera.cameraPosition);
+    fc.camLook = glm::vec3(camera.view[0][2], camera.view[1][2], camera.view[2][2]);
+    fc.camRight = glm::vec3(camera.view[0][0], camera.view[1][0], camera.view[2][0]);
+    fc.camUp = glm::vec3(camera.view[0][1], camera.view[1][1], camera.view[2][1]);
+    fc.sunDir = glm::normalize(glm::vec3(sun.directionBasis[1]));
+
+    fc.earthCenter = fc.cameraPos;
+    fc.earthCenter.y = -ATMOSPHERE_RADIUS * 0.5f * 0.995f;
+
+    CloudMarchFrame& march = fc.march;
+    for (int c = 0; c < 3; c++) {
+        march.cameraPos[c] = fc.cameraPos[c];
+        march.earthCenter[c] = fc.earthCenter[c];
+    }
+    march.atmosphereThickness = 0.5f * ATMOSPHERE_RADIUS * 0.02f;
+    for (int c = 0; c < 4; c++) march.wind[c] = sky.wind[c];
+    march.cloudTopMin = CLOUD_TOP_MIN;
+    march.budget = budget;
+
+    glm::mat3 basis = glm::mat3(sun.directionBasis);
+    const glm::vec3 coneSamples[6] = {
+        basis * glm::vec3(0, 0.6, 0),
+        basis * glm::vec3(0, 0.5, 0.05),
+        basis * glm::vec3(0.1, 0.75, 0),
+        basis * glm::vec3(0.2, 2.5, 0.3),
+        basis * glm::vec3(0, 6, 0),
+        basis * glm::vec3(-0.1, 1, -0.2)
+    };
+    for (int i = 0; i < 6; i++) {
+        for (int c = 0; c < 3; c++) march.coneSamples[i][c] = coneSamples[i][c];
+    }
+
+    // The sky should appear to rotate as the earth rotates, same as fromAngleAxis in the shader
+    fc.nightRotation = glm::mat3(glm::rotate(glm::mat4(1.0f), sun.direction.y * 0.5f, glm::normalize(glm::vec3(1.0f, 0.0f, 1.0f))));
+
+    // Bound on how fast the placement uv of a sample moves along a ray. The projection onto the inner shell never stretches
+    // distances above it, and the wind offset moves with the relative height, which changes by at most 1 / atmosphereThickness.
+    const glm::vec3 windShear(0.1f, 0.05f, 0.0f);
+    float windRate = WIND_STRENGTH * (glm::length(windShear) * (std::abs(sky.wind.w) + 200.0f)
+        + 200.0f * (glm::length(glm::vec3(sky.wind)) + glm::length(windShear))) / march.atmosphereThickness;
+    placementUVRate = 0.000009f * (1.0f + windRate);
+
+    target.resize(static_cast<size_t>(width) * height);
+
+    const uint32_t tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    const uint32_t tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    glm::vec4* pixels = target.data();
+    std::atomic<uint64_t> evaluated(0), skipped(0);
+    pool->parallelFor(tilesX * tilesY, [&](uint32_t tile) {
+        CloudMarchCounters counters;
+        renderTile(fc, tile % tilesX, tile / tilesX, pixels, counters);
+        evaluated += counters.evaluated;
+        skipped += counters.skipped;
+    });
+    lastCounters.evaluated = evaluated;
+    lastCounters.skipped = skipped;
+}
+
+bool CloudRendererCPU::isSupported() {
+    return !CLOUD_MARCH_LANES_AVX2 || cpuSupportsAVX2();
+}
+
+void CloudRendererCPU::saveHDR(std::string path, uint32_t width, uint32_t height, const std::vector<glm::vec4>& pixels) {
+    if (!stbi_write_hdr(path.c_str(), width, height, 4, &pixels[0].x)) {
+        throw std::runtime_error("failed to write image!");
+    }
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include "UniformObjects.h"
+#include "ThreadPool.h"
+#include "CloudMarchLanes.h"
+#include "CloudSkipMap.h"
+#include <glm/vec3.hpp>
+#include <glm/mat3x3.hpp>
+
+#include <string>
+#include <vector>
+
+// RGBA8 image kept in system memory and sampled the same way as our Vulkan samplers:
+// linear filtering, repeat addressing, base mip only.
+class CPUTexture
+{
+private:
+    std::vector<unsigned char> texels;
+public:
+    int width = 0, height = 0, depth = 1;
+
+    void initFromFile(std::string path);
+    // Same slice naming as Texture3D::initFromFile
+    void initFromSlices(std::string path, int sliceCount);
+
+    glm::vec4 fetch(int x, int y, int z) const;
+    glm::vec4 sample(glm::vec2 uv) const;
+    glm::vec4 sample(glm::vec3 uvw) const;
+};
+
+// CPU reference of Shaders/compute-clouds.comp.
+// The frame is split into 32x32 tiles (the compute workgroup size) that are run on a work-stealing pool;
+// inside a tile, rays are set up one by one here and marched CLOUD_MARCH_LANES at a time by marchCloudLanes, which reads
+// the textures through the CloudMarchSampler this class implements.
+// Unlike the compute shader this traces every pixel each call, there is no reprojection.
+class CloudRendererCPU : private CloudMarchSampler
+{
+private:
+    ThreadPool* pool;
+    CloudMarchBudget budget;
+
+    CPUTexture cloudPlacement;
+    CloudSkipMap cloudSkipMap;
+    CPUTexture nightSkyMap;
+    CPUTexture curlNoise;
+    CPUTexture lowResCloudShape;
+    CPUTexture hiResCloudShape;
+
+    CloudMarchCounters lastCounters;
+
+    // Everything that is constant across a frame, derived from the uniforms once
+    struct FrameConstants {
+        UniformCameraObject camera;
+        UniformSunObject sun;
+        UniformSkyObject sky;
+        uint32_t width, height;
+
+        glm::vec3 cameraPos;
+        glm::vec3 camLook, camRight, camUp;
+        glm::vec3 sunDir;
+        glm::vec3 earthCenter;
+        glm::mat3 nightRotation;
+        CloudMarchFrame march;
+    };
+
+    // Per-ray values computed before the march
+    struct RaySetup {
+        glm::vec3 direction;
+        glm::vec3 backgroundCol;
+        glm::vec4 finalColor;
+        float tInner, tOuter;
+        float cosTheta;
+        float henyeyGreenstein;
+        bool march;
+    };
+
+    void setupRay(const FrameConstants& fc, uint32_t x, uint32_t y, RaySetup& ray) const;
+    void marchLanes(const FrameConstants& fc, const RaySetup* rays, int laneCount, glm::vec4* out, CloudMarchCounters& counters) const;
+    void renderTile(const FrameConstants& fc, uint32_t tileX, uint32_t tileY, glm::vec4* target, CloudMarchCounters& counters) const;
+    glm::vec3 getAtmosphereColorPhysical(const FrameConstants& fc, glm::vec3 dir) const;
+
+    // CloudMarchSampler, lane by lane on the textures and the skip map above
+    float placementUVRate = 0.0f; // of the frame being rendered, see CloudSkipMap::emptySamples
+    void sample(CloudMarchTexture texture, const float* u, const float* v, const float* w, int laneBits,
+        float out[4][CLOUD_MARCH_LANES]) const override;
+    void emptySamples(const float* u, const float* v, const float* relativeHeight, const float* stepSize,
+        const float* remaining, int laneBits, float* out) const override;
+
+public:
+    // The budget is the one of the compute shader to compare against, CloudMarchSettings converts to it.
+    // The tiles are rendered on pool, which has to outlive the renderer. Throws when the renderer was built for AVX2 and
+    // the CPU lacks it.
+    CloudRendererCPU(ThreadPool& pool, const CloudMarchBudget& budget = CloudMarchBudget());
+
+    // Loads the same textures VulkanApplication::initializeTextures does, and builds the skip map of the placement
+    void initTextures();
+
+    // Renders a width x height frame into target (row-major, top row first) in HDR, alpha as in the compute shader
+    void render(const UniformCameraObject& camera, const UniformSunObject& sun, const UniformSkyObject& sky,
+        uint32_t width, uint32_t height, std::vector<glm::vec4>& target);
+    // Summed over every pixel of the last render
+    CloudMarchCounters getLastCounters() const { return lastCounters; }
+
+    // False when this build of the renderer needs instructions the CPU does not have
+    static bool isSupported();
+    static void saveHDR(std::string path, uint32_t width, uint32_t height, const std::vector<glm::vec4>& pixels);
+};
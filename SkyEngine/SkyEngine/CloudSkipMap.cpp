@@ -0,0 +1,112 @@
+#include "CloudSkipMap.h"
+#include "Mipmaps.h"
+#include <stb_image.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+void CloudSkipMap::initFromFile(std::string path) {
+    int w, h, channels;
+    stbi_uc* pixels = stbi_load(path.c_str(), &w, &h, &channels, STBI_rgb_alpha);
+
+    if (!pixels) {
+        throw std::runtime_error("failed to load texture image!");
+    }
+
+    initFromPixels(pixels, static_cast<uint32_t>(w), static_cast<uint32_t>(h));
+    stbi_image_free(pixels);
+}
+
+void CloudSkipMap::initFromPixels(const uint8_t* pixels, uint32_t width, uint32_t height) {
+    this->width = width;
+    this->height = height;
+    levels = getMipLevelCount(width, height, 1);
+    chain.resize(static_cast<size_t>(getMipChainSize(width, height, 1, 1, levels)));
+    levelOffsets.resize(levels);
+
+    // rounded up so the stored top is never below the real one
+    std::vector<uint8_t> tops(static_cast<size_t>(width) * height);
+    for (size_t i = 0; i < tops.size(); i++) {
+        tops[i] = static_cast<uint8_t>(std::ceil(cloudTop(pixels[i * 4 + 2] / 255.0f) * 255.0f));
+    }
+
+    size_t offset = 0;
+    for (uint32_t level = 0; level < levels; level++) {
+        VkExtent3D d = getMipExtent(width, height, 1, level);
+
+        // max of the 2x2 block under each texel, collapsed along axes that are already 1 texel wide
+        if (level > 0) {
+            VkExtent3D s = getMipExtent(width, height, 1, level - 1);
+            std::vector<uint8_t> reduced(static_cast<size_t>(d.width) * d.height);
+            for (uint32_t y = 0; y < d.height; y++) {
+                uint32_t y0 = std::min(y * 2, s.height - 1), y1 = std::min(y * 2 + 1, s.height - 1);
+                for (uint32_t x = 0; x < d.width; x++) {
+                    uint32_t x0 = std::min(x * 2, s.width - 1), x1 = std::min(x * 2 + 1, s.width - 1);
+                    reduced[static_cast<size_t>(y) * d.width + x] = std::max(
+                        std::max(tops[static_cast<size_t>(y0) * s.width + x0], tops[static_cast<size_t>(y0) * s.width + x1]),
+                        std::max(tops[static_cast<size_t>(y1) * s.width + x0], tops[static_cast<size_t>(y1) * s.width + x1]));
+                }
+            }
+            tops.swap(reduced);
+        }
+
+        // dilate by one texel of this level, wrapping like the placement sampler, which covers the bilinear
+        // footprint of every finer mip level
+        levelOffsets[level] = offset;
+        for (uint32_t y = 0; y < d.height; y++) {
+            for (uint32_t x = 0; x < d.width; x++) {
+                uint8_t top = 0;
+                for (int dy = -1; dy <= 1; dy++) {
+                    uint32_t ny = (y + d.height + dy) % d.height;
+                    for (int dx = -1; dx <= 1; dx++) {
+                        uint32_t nx = (x + d.width + dx) % d.width;
+                        top = std::max(top, tops[static_cast<size_t>(ny) * d.width + nx]);
+                    }
+                }
+                chain[offset + static_cast<size_t>(y) * d.width + x] = top;
+            }
+        }
+        offset += static_cast<size_t>(d.width) * d.height;
+    }
+}
+
+float CloudSkipMap::fetch(int x, int y, uint32_t level) const {
+    VkExtent3D extent = getMipExtent(width, height, 1, level);
+    int w = static_cast<int>(extent.width);
+    int h = static_cast<int>(extent.height);
+    x = ((x % w) + w) % w;
+    y = ((y % h) + h) % h;
+    return chain[levelOffsets[level] + static_cast<size_t>(y) * w + x] * (1.0f / 255.0f);
+}
+
+int CloudSkipMap::emptySamples(glm::vec2 uv, float relativeHeight, uint32_t minLevel, float uvPerDistance, float stepSize) const {
+    if (relativeHeight < CLOUD_TOP_MIN) return 0;
+
+    // coarser levels only bound higher, so stop at the first one the sample is not above. Of the levels it is above,
+    // take the one where the ray can travel furthest before it could leave the texel.
+    uv -= glm::floor(uv);
+    float span = -1.0f;
+    for (uint32_t level = minLevel; level < levels; level++) {
+        VkExtent3D extent = getMipExtent(width, height, 1, level);
+        glm::vec2 size(static_cast<float>(extent.width), static_cast<float>(extent.height));
+        glm::vec2 texel = uv * size;
+        glm::vec2 cell = glm::floor(texel);
+        if (relativeHeight < fetch(static_cast<int>(cell.x), static_cast<int>(cell.y), level)) break;
+
+        glm::vec2 f = texel - cell;
+        glm::vec2 edge = glm::min(f, glm::vec2(1.0f) - f) / size;
+        span = std::max(span, std::min(edge.x, edge.y));
+    }
+    if (span < 0.0f) return 0;
+
+    return 1 + static_cast<int>(span / (uvPerDistance * stepSize));
+}
+
+float CloudSkipMap::cloudTop(float cloudType) {
+    // see cloudLayerDensity: stratus alone at type 0, stratocumulus mixes in above it, cumulus above 0.5
+    if (cloudType <= 0.0f) return 0.3f;
+    if (cloudType <= 0.5f) return 0.7f;
+    return 0.9f;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <glm/vec2.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Empty space skipping for the cloud raymarch (Shaders/compute-clouds.comp and CloudRendererCPU).
+// cloudTest scales the density by cloudLayerDensity, which is zero above the top of the cloud type in the blue channel
+// of the placement map: 0.3 for stratus, 0.7 once stratocumulus mixes in, 0.9 once cumulus does. Coverage (red) only
+// biases the erosion, it never empties a column. The skip map is a max pyramid of those tops in which every texel also
+// covers its 8 neighbours, so a texel of level L bounds every filtered placement sample taken inside it at a finer mip.
+// Rays only climb through the shell, so once a sample is above the bound every later one is too until the ray leaves the texel.
+#define CLOUD_TOP_MIN 0.3f // lowest top of any cloud type, samples below it are never skipped
+
+// Samples along the view rays of a frame (the light cone samples are not counted): evaluated with cloudTest, or
+// skipped as guaranteed empty
+struct CloudMarchCounters {
+    uint64_t evaluated = 0;
+    uint64_t skipped = 0;
+    uint64_t remarched = 0; // pixels marched besides the scheduled ones because their reprojection was invalid
+    uint64_t deferred = 0;  // invalid pixels left for a later frame, over the remarch budget of their block
+};
+
+class CloudSkipMap
+{
+private:
+    uint32_t width = 0, height = 0, levels = 0;
+    // R8 unorm tops, level after level in the layout of Mipmaps.h
+    std::vector<uint8_t> chain;
+    std::vector<size_t> levelOffsets;
+public:
+    // Builds the pyramid from the blue channel of an RGBA8 placement map
+    void initFromFile(std::string path);
+    void initFromPixels(const uint8_t* pixels, uint32_t width, uint32_t height);
+
+    uint32_t getWidth() const { return width; }
+    uint32_t getHeight() const { return height; }
+    uint32_t getLevels() const { return levels; }
+    const std::vector<uint8_t>& getChain() const { return chain; }
+
+    // Highest relative height a cloud reaches around a texel of a level, repeat addressing
+    float fetch(int x, int y, uint32_t level) const;
+
+    // How many march samples stepSize apart, starting with the one at placement uv and relativeHeight, are guaranteed empty.
+    // uvPerDistance bounds how fast the placement uv of a sample moves along the ray, the placement map is sampled at mip
+    // levels below minLevel. Mirrors emptySamples in Shaders/compute-clouds.comp.
+    int emptySamples(glm::vec2 uv, float relativeHeight, uint32_t minLevel, float uvPerDistance, float stepSize) const;
+
+    // Relative height above which cloudLayerDensity is zero for a cloud type
+    static float cloudTop(float cloudType);
+};
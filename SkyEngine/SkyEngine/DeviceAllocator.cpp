@@ -0,0 +1,281 @@
+#include "DeviceAllocator.h"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+void DeviceAllocator::init(VkDevice device, VkPhysicalDevice physicalDevice) {
+    this->device = device;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    separateOptimal = properties.limits.bufferImageGranularity > DEVICE_MEMORY_MIN_NODE;
+
+    maxOrder = 0;
+    while ((DEVICE_MEMORY_MIN_NODE << maxOrder) < DEVICE_MEMORY_BLOCK_SIZE) {
+        maxOrder++;
+    }
+}
+
+void DeviceAllocator::cleanup() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (Pool& pool : pools) {
+        for (Block& block : pool.blocks) {
+            if (block.memory != VK_NULL_HANDLE) {
+                vkFreeMemory(device, block.memory, nullptr);
+            }
+        }
+    }
+    pools.clear();
+    stats = DeviceMemoryStats();
+}
+
+uint32_t DeviceAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const {
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+        if ((typeFilter & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+    throw std::runtime_error("failed to find suitable memory type!");
+}
+
+uint32_t DeviceAllocator::getPool(uint32_t memoryType, bool optimal) {
+    optimal = optimal && separateOptimal;
+    for (uint32_t i = 0; i < pools.size(); i++) {
+        if (pools[i].memoryType == memoryType && pools[i].optimal == optimal) {
+            return i;
+        }
+    }
+    Pool pool;
+    pool.memoryType = memoryType;
+    pool.optimal = optimal;
+    pools.push_back(pool);
+    return static_cast<uint32_t>(pools.size() - 1);
+}
+
+VkDeviceMemory DeviceAllocator::allocateMemory(uint32_t memoryType, VkDeviceSize size, void** mapped) {
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate device memory!");
+    }
+
+    *mapped = nullptr;
+    if (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        if (vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS) {
+            vkFreeMemory(device, memory, nullptr);
+            throw std::runtime_error("failed to map device memory!");
+        }
+    }
+
+    stats.deviceMemoryCount++;
+    stats.allocatedBytes += size;
+    return memory;
+}
+
+/// --- Buddy nodes
+
+bool DeviceAllocator::allocateNode(Block& block, uint32_t order, VkDeviceSize& offset) {
+    // smallest free node that fits
+    uint32_t found = order;
+    while (found <= maxOrder && block.freeNodes[found].empty()) {
+        found++;
+    }
+    if (found > maxOrder) {
+        return false;
+    }
+
+    offset = *block.freeNodes[found].begin();
+    block.freeNodes[found].erase(block.freeNodes[found].begin());
+
+    // split it down, the upper halves stay free
+    while (found > order) {
+        found--;
+        block.freeNodes[found].insert(offset + (DEVICE_MEMORY_MIN_NODE << found));
+    }
+    return true;
+}
+
+void DeviceAllocator::freeNode(Block& block, uint32_t order, VkDeviceSize offset) {
+    // merge with the buddy for as long as it is free too
+    while (order < maxOrder) {
+        VkDeviceSize buddy = offset ^ (DEVICE_MEMORY_MIN_NODE << order);
+        auto it = block.freeNodes[order].find(buddy);
+        if (it == block.freeNodes[order].end()) {
+            break;
+        }
+        block.freeNodes[order].erase(it);
+        offset = std::min(offset, buddy);
+        order++;
+    }
+    block.freeNodes[order].insert(offset);
+}
+
+/// --- Allocations
+
+DeviceAllocation DeviceAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool optimalTiling) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    DeviceAllocation allocation;
+    allocation.requestedSize = requirements.size;
+    uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+
+    // alignments are powers of two, and a node is aligned to its size
+    VkDeviceSize needed = std::max(std::max(requirements.size, requirements.alignment), static_cast<VkDeviceSize>(DEVICE_MEMORY_MIN_NODE));
+    uint32_t order = 0;
+    while ((DEVICE_MEMORY_MIN_NODE << order) < needed) {
+        order++;
+    }
+
+    if (order >= maxOrder) {
+        allocation.dedicated = true;
+        allocation.size = requirements.size;
+        allocation.memory = allocateMemory(memoryType, requirements.size, &allocation.mapped);
+        stats.dedicatedCount++;
+    }
+    else {
+        allocation.pool = getPool(memoryType, optimalTiling);
+        allocation.order = order;
+        allocation.size = DEVICE_MEMORY_MIN_NODE << order;
+        Pool& pool = pools[allocation.pool];
+
+        bool placed = false;
+        for (uint32_t b = 0; b < pool.blocks.size() && !placed; b++) {
+            if (pool.blocks[b].memory != VK_NULL_HANDLE && allocateNode(pool.blocks[b], order, allocation.offset)) {
+                allocation.block = b;
+                placed = true;
+            }
+        }
+
+        if (!placed) {
+            // reuse a released slot so the indices of live allocations stay valid
+            uint32_t b = 0;
+            while (b < pool.blocks.size() && pool.blocks[b].memory != VK_NULL_HANDLE) {
+                b++;
+            }
+            if (b == pool.blocks.size()) {
+                pool.blocks.push_back(Block());
+            }
+
+            Block& block = pool.blocks[b];
+            void* mapped;
+            block.memory = allocateMemory(memoryType, DEVICE_MEMORY_BLOCK_SIZE, &mapped);
+            block.mapped = static_cast<char*>(mapped);
+            block.used = 0;
+            block.freeNodes.assign(maxOrder + 1, std::set<VkDeviceSize>());
+            block.freeNodes[maxOrder].insert(0);
+            stats.blockCount++;
+
+            allocateNode(block, order, allocation.offset);
+            allocation.block = b;
+        }
+
+        Block& block = pool.blocks[allocation.block];
+        block.used += allocation.size;
+        allocation.memory = block.memory;
+        allocation.mapped = block.mapped != nullptr ? block.mapped + allocation.offset : nullptr;
+    }
+
+    stats.allocationCount++;
+    stats.reservedBytes += allocation.size;
+    stats.requestedBytes += allocation.requestedSize;
+    return allocation;
+}
+
+void DeviceAllocator::free(DeviceAllocation& allocation) {
+    if (allocation.memory == VK_NULL_HANDLE) return;
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (allocation.dedicated) {
+        vkFreeMemory(device, allocation.memory, nullptr);
+        stats.deviceMemoryCount--;
+        stats.dedicatedCount--;
+        stats.allocatedBytes -= allocation.size;
+    }
+    else {
+        Pool& pool = pools[allocation.pool];
+        Block& block = pool.blocks[allocation.block];
+        freeNode(block, allocation.order, allocation.offset);
+        block.used -= allocation.size;
+
+        // keep one empty block per pool around so staging buffers don't allocate a new block every time
+        if (block.used == 0) {
+            for (uint32_t b = 0; b < pool.blocks.size(); b++) {
+                if (b != allocation.block && pool.blocks[b].memory != VK_NULL_HANDLE && pool.blocks[b].used == 0) {
+                    vkFreeMemory(device, block.memory, nullptr);
+                    block.memory = VK_NULL_HANDLE;
+                    block.mapped = nullptr;
+                    block.freeNodes.clear();
+                    stats.deviceMemoryCount--;
+                    stats.blockCount--;
+                    stats.allocatedBytes -= DEVICE_MEMORY_BLOCK_SIZE;
+                    break;
+                }
+            }
+        }
+    }
+
+    stats.allocationCount--;
+    stats.reservedBytes -= allocation.size;
+    stats.requestedBytes -= allocation.requestedSize;
+    allocation = DeviceAllocation();
+}
+
+DeviceAllocation DeviceAllocator::allocateBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties) {
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+    DeviceAllocation allocation = allocate(memRequirements, properties, false);
+    if (vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset) != VK_SUCCESS) {
+        free(allocation);
+        throw std::runtime_error("failed to bind buffer memory!");
+    }
+    return allocation;
+}
+
+DeviceAllocation DeviceAllocator::allocateImage(VkImage image, VkMemoryPropertyFlags properties, VkImageTiling tiling) {
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(device, image, &memRequirements);
+
+    DeviceAllocation allocation = allocate(memRequirements, properties, tiling == VK_IMAGE_TILING_OPTIMAL);
+    if (vkBindImageMemory(device, image, allocation.memory, allocation.offset) != VK_SUCCESS) {
+        free(allocation);
+        throw std::runtime_error("failed to bind image memory!");
+    }
+    return allocation;
+}
+
+void DeviceAllocator::invalidate(const DeviceAllocation& allocation) {
+    // nodes are multiples of any nonCoherentAtomSize, dedicated allocations are invalidated whole
+    VkMappedMemoryRange range = {};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = allocation.memory;
+    range.offset = allocation.dedicated ? 0 : allocation.offset;
+    range.size = allocation.dedicated ? VK_WHOLE_SIZE : allocation.size;
+    vkInvalidateMappedMemoryRanges(device, 1, &range);
+}
+
+/// --- Statistics
+
+DeviceMemoryStats DeviceAllocator::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+std::string DeviceAllocator::getSummary() const {
+    DeviceMemoryStats s = getStats();
+    const double mb = 1024.0 * 1024.0;
+
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1)
+        << "device memory: " << s.allocationCount << " allocations in " << s.deviceMemoryCount << " vkAllocateMemory ("
+        << s.blockCount << " blocks, " << s.dedicatedCount << " dedicated) | "
+        << s.allocatedBytes / mb << " MB allocated, " << s.reservedBytes / mb << " MB reserved, "
+        << s.requestedBytes / mb << " MB requested";
+    return ss.str();
+}
@@ -0,0 +1,96 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+// Size of each pooled VkDeviceMemory block. Requests larger than half a block get a dedicated allocation.
+#define DEVICE_MEMORY_BLOCK_SIZE (64ull * 1024 * 1024)
+// Smallest buddy node. No device may have a nonCoherentAtomSize above this, so every node can be flushed or invalidated on its own.
+#define DEVICE_MEMORY_MIN_NODE 256ull
+
+// A range of device memory handed out by the DeviceAllocator
+struct DeviceAllocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;          // reserved size, at least what was requested
+    VkDeviceSize requestedSize = 0;
+    void* mapped = nullptr;         // start of the range, host visible memory only
+
+    // where the range came from
+    bool dedicated = false;
+    uint32_t pool = 0;
+    uint32_t block = 0;
+    uint32_t order = 0;
+};
+
+struct DeviceMemoryStats {
+    uint32_t deviceMemoryCount = 0; // live vkAllocateMemory allocations
+    uint32_t blockCount = 0;
+    uint32_t allocationCount = 0;
+    uint32_t dedicatedCount = 0;
+    VkDeviceSize allocatedBytes = 0; // total size of the VkDeviceMemory objects
+    VkDeviceSize reservedBytes = 0;  // handed out, including the rounding to buddy nodes
+    VkDeviceSize requestedBytes = 0; // what the resources asked for
+};
+
+// Sub-allocates buffers and images from a few large VkDeviceMemory blocks per memory type instead of
+// one vkAllocateMemory each. Every block is a buddy allocator: nodes are powers of two and aligned to
+// their own size, so any power of two alignment up to the node size comes for free.
+// Host visible blocks stay mapped for their whole lifetime; allocations point into that mapping.
+class DeviceAllocator
+{
+private:
+    struct Block {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        char* mapped = nullptr;
+        VkDeviceSize used = 0;
+        std::vector<std::set<VkDeviceSize>> freeNodes; // offsets of the free nodes of each order
+    };
+
+    // Linear resources (buffers, linear images) and optimal images are only kept in separate pools when
+    // bufferImageGranularity is larger than the smallest node; otherwise no two resources can share a page.
+    struct Pool {
+        uint32_t memoryType;
+        bool optimal;
+        std::vector<Block> blocks; // empty slots have no memory and are reused
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties memoryProperties = {};
+    bool separateOptimal = false;
+    uint32_t maxOrder = 0;
+
+    std::vector<Pool> pools;
+    DeviceMemoryStats stats;
+    mutable std::mutex mutex;
+
+    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+    uint32_t getPool(uint32_t memoryType, bool optimal);
+    VkDeviceMemory allocateMemory(uint32_t memoryType, VkDeviceSize size, void** mapped);
+
+    bool allocateNode(Block& block, uint32_t order, VkDeviceSize& offset);
+    void freeNode(Block& block, uint32_t order, VkDeviceSize offset);
+
+public:
+    void init(VkDevice device, VkPhysicalDevice physicalDevice);
+    // Everything must have been freed before
+    void cleanup();
+
+    // optimalTiling is true for images created with VK_IMAGE_TILING_OPTIMAL
+    DeviceAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool optimalTiling);
+    void free(DeviceAllocation& allocation);
+
+    // Allocate and bind
+    DeviceAllocation allocateBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties);
+    DeviceAllocation allocateImage(VkImage image, VkMemoryPropertyFlags properties, VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL);
+
+    // Makes device writes visible to the host for memory that is not host coherent
+    void invalidate(const DeviceAllocation& allocation);
+
+    DeviceMemoryStats getStats() const;
+    std::string getSummary() const;
+};
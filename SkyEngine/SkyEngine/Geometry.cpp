@@ -1,53 +1,212 @@
 #include "Geometry.h"
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <tiny_obj_loader.h>
+#include "MeshCache.h"
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
 
 void Geometry::cleanup() {
     vkDestroyBuffer(device, vertexBuffer, nullptr);
-    vkFreeMemory(device, vertexDeviceMemory, nullptr);
+    allocator->free(vertexDeviceMemory);
     vkDestroyBuffer(device, indexBuffer, nullptr);
-    vkFreeMemory(device, indexDeviceMemory, nullptr);
+    allocator->free(indexDeviceMemory);
+    if (indirectBuffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(device, indirectBuffer, nullptr);
+        allocator->free(indirectDeviceMemory);
+        indirectBuffer = VK_NULL_HANDLE;
+    }
 }
 
-void Geometry::createVertexBuffer() {
-    VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+namespace {
+    // Octahedral normal encoding: project onto the octahedron |x| + |y| + |z| = 1 and fold the lower half over the
+    // upper one, so two snorm values cover the sphere with nearly uniform precision
+    glm::vec2 encodeOctahedral(glm::vec3 n) {
+        n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+        glm::vec2 e(n.x, n.y);
+        if (n.z < 0.0f) {
+            e = glm::vec2((1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+                (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+        }
+        return e;
+    }
+
+    uint16_t toUnorm16(float v) {
+        return static_cast<uint16_t>(std::round(glm::clamp(v, 0.0f, 1.0f) * 65535.0f));
+    }
+
+    int16_t toSnorm16(float v) {
+        return static_cast<int16_t>(std::round(glm::clamp(v, -1.0f, 1.0f) * 32767.0f));
+    }
+}
+
+PackedVertex PackedVertex::pack(const Vertex& vertex, const glm::vec3& boundsMin, const glm::vec3& boundsExtent) {
+    PackedVertex packed;
+    glm::vec3 unorm = (vertex.pos - boundsMin) / boundsExtent;
+    packed.pos[0] = toUnorm16(unorm.x);
+    packed.pos[1] = toUnorm16(unorm.y);
+    packed.pos[2] = toUnorm16(unorm.z);
+    packed.pos[3] = 0;
+
+    packed.uv[0] = static_cast<uint16_t>(glm::packHalf1x16(vertex.uv.x));
+    packed.uv[1] = static_cast<uint16_t>(glm::packHalf1x16(vertex.uv.y));
+
+    float length = glm::length(vertex.nor);
+    glm::vec2 octahedral = length > 0.0f ? encodeOctahedral(vertex.nor / length) : glm::vec2(0.0f);
+    packed.nor[0] = toSnorm16(octahedral.x);
+    packed.nor[1] = toSnorm16(octahedral.y);
+    return packed;
+}
 
+void Geometry::createDeviceLocalBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, DeviceAllocation& memory) {
     VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    DeviceAllocation stagingBufferMemory;
+    createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
 
-    void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, vertices.data(), (size_t)bufferSize);
-    vkUnmapMemory(device, stagingBufferMemory);
+    memcpy(stagingBufferMemory.mapped, data, (size_t)size);
 
-    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexDeviceMemory);
+    createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, memory);
 
-    copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
+    copyBuffer(stagingBuffer, buffer, size);
 
     vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    allocator->free(stagingBufferMemory);
+}
+
+void Geometry::createVertexBuffer() {
+    if (vertexFormat == VERTEX_FLOAT) {
+        positionOffset = glm::vec3(0.0f);
+        positionScale = glm::vec3(1.0f);
+        quantizationError = 0.0f;
+        createDeviceLocalBuffer(vertices.data(), sizeof(vertices[0]) * vertices.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, vertexDeviceMemory);
+        return;
+    }
+
+    glm::vec3 boundsMin = vertices[0].pos;
+    glm::vec3 boundsMax = vertices[0].pos;
+    for (const Vertex& vertex : vertices) {
+        boundsMin = glm::min(boundsMin, vertex.pos);
+        boundsMax = glm::max(boundsMax, vertex.pos);
+    }
+    positionOffset = boundsMin;
+    // a flat axis still needs a scale to divide by, every vertex ends up at 0 on it
+    positionScale = glm::max(boundsMax - boundsMin, glm::vec3(1e-6f));
+    quantizationError = 0.5f * glm::length(positionScale) / 65535.0f;
+
+    std::vector<PackedVertex> packedVertices(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        packedVertices[i] = PackedVertex::pack(vertices[i], positionOffset, positionScale);
+    }
+    createDeviceLocalBuffer(packedVertices.data(), sizeof(packedVertices[0]) * packedVertices.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, vertexDeviceMemory);
 }
 
 void Geometry::createIndexBuffer() {
-    VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+    // primitive restart is off, so 0xFFFF is an ordinary index
+    if (vertices.size() <= 0x10000) {
+        indexType = VK_INDEX_TYPE_UINT16;
+        std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+        createDeviceLocalBuffer(shortIndices.data(), sizeof(shortIndices[0]) * shortIndices.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexBuffer, indexDeviceMemory);
+    }
+    else {
+        indexType = VK_INDEX_TYPE_UINT32;
+        createDeviceLocalBuffer(indices.data(), sizeof(indices[0]) * indices.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexBuffer, indexDeviceMemory);
+    }
+}
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+void Geometry::createIndirectBuffer() {
+    if (chunks.empty()) return;
 
-    void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, indices.data(), (size_t)bufferSize);
-    vkUnmapMemory(device, stagingBufferMemory);
+    VkDeviceSize bufferSize = sizeof(VkDrawIndexedIndirectCommand) * chunks.size() * MAX_FRAMES_IN_FLIGHT;
+    createBuffer(bufferSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, indirectBuffer, indirectDeviceMemory);
+    drawCounts.fill(0);
 
-    // note that this is specified as an index buffer
-    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexDeviceMemory);
+    // VulkanApplication enables the feature whenever the device has it
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &features);
+    multiDrawIndirect = features.multiDrawIndirect == VK_TRUE;
+}
 
-    copyBuffer(stagingBuffer, indexBuffer, bufferSize);
+ChunkCullStats Geometry::cullChunks(uint32_t frame, const glm::mat4& model, const glm::mat4& viewProj, const glm::vec3& cameraPosition, float pixelsPerUnit) {
+    ChunkCullStats stats;
+    if (chunks.empty()) return stats;
+
+    // frustum planes in model space from the rows of the clip matrix, pointing inwards (Gribb and Hartmann).
+    // The near plane is taken as -w <= z, looser than Vulkan's 0 <= z so a change of depth convention can't cull more.
+    glm::mat4 m = glm::transpose(viewProj * model);
+    glm::vec4 planes[6] = { m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1], m[3] + m[2], m[3] - m[2] };
+    for (glm::vec4& plane : planes) plane /= glm::length(glm::vec3(plane));
+
+    // the cone test is exact in model space
+    glm::vec3 cameraPositionModel = glm::vec3(glm::inverse(model) * glm::vec4(cameraPosition, 1.0f));
+    ChunkLodSelector lodSelector(model, lodScale, pixelsPerUnit);
+
+    VkDrawIndexedIndirectCommand* commands = static_cast<VkDrawIndexedIndirectCommand*>(indirectDeviceMemory.mapped) + chunks.size() * frame;
+    for (const MeshChunk& chunk : chunks) {
+        float radius = chunk.radius + quantizationError;
+
+        bool outside = false;
+        for (const glm::vec4& plane : planes) {
+            if (glm::dot(glm::vec3(plane), chunk.center) + plane.w < -radius) {
+                outside = true;
+                break;
+            }
+        }
+        if (outside) continue;
+
+        // every normal is within the cone, so if the whole sphere sees the cone from behind every triangle is a back face
+        glm::vec3 view = chunk.center - cameraPositionModel;
+        if (glm::dot(view, chunk.coneAxis) >= chunk.coneCutoff * glm::length(view) + radius) continue;
+
+        uint32_t level = lodSelector.select(chunk, cameraPosition, quantizationError);
+        const MeshLod& lod = chunk.lods[level];
+        if (level > 0) stats.coarseChunks++;
+        VkDrawIndexedIndirectCommand& command = commands[stats.chunks++];
+        command.indexCount = lod.indexCount;
+        command.instanceCount = 1;
+        command.firstIndex = lod.firstIndex;
+        command.vertexOffset = 0;
+        command.firstInstance = 0;
+        stats.triangles += lod.indexCount / 3;
+    }
 
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    drawCounts[frame] = stats.chunks;
+    return stats;
+}
+
+ChunkLodSelector::ChunkLodSelector(const glm::mat4& model, glm::vec3 lodScale, float pixelsPerUnit) : model(model), pixelsPerUnit(pixelsPerUnit) {
+    boxExtent = glm::mat3(model);
+    for (int c = 0; c < 3; c++) boxExtent[c] = glm::abs(boxExtent[c]);
+
+    // Errors are distances along a surface normal in lod space, model space scaled by lodScale. What is left of the
+    // transform, R = model / lodScale, scales them by 1 / |N n| with N its normal matrix, at least 1 / the largest axis
+    // scale of R; the column lengths below are exact for rotations and scales. Through model space, with M the model's
+    // normal matrix, that is |M n| / |n / lodScale| for a model space normal n, which the normal cone bounds.
+    glm::mat3 lodToWorld = glm::mat3(model);
+    for (int c = 0; c < 3; c++) lodToWorld[c] /= lodScale[c];
+    lodToWorldScale = std::max(glm::length(lodToWorld[0]), std::max(glm::length(lodToWorld[1]), glm::length(lodToWorld[2])));
+    lodStretchMax = 1.0f / std::min(lodScale.x, std::min(lodScale.y, lodScale.z));
+    normalMatrix = glm::inverse(glm::transpose(glm::mat3(model)));
+    normalScaleMax = std::max(glm::length(normalMatrix[0]), std::max(glm::length(normalMatrix[1]), glm::length(normalMatrix[2])));
+}
+
+uint32_t ChunkLodSelector::select(const MeshChunk& chunk, const glm::vec3& cameraPosition, float margin) const {
+    // the closest point of the box sees the largest projected error. Not the sphere: scaled by the largest axis it would
+    // contain the camera from almost anywhere on a mesh as flattened as the terrain.
+    glm::vec3 centerWorld = glm::vec3(model * glm::vec4(chunk.center, 1.0f));
+    glm::vec3 halfExtent = boxExtent * (chunk.extent + margin);
+    float distance = glm::length(glm::max(glm::abs(cameraPosition - centerWorld) - halfExtent, glm::vec3(0.0f)));
+    if (distance <= 0.0f) return 0;
+
+    // the smallest |M n| of a normal within the cone is at most the chord between it and the axis away from |M axis|
+    float normalScale = 1.0f / lodToWorldScale;
+    if (chunk.coneCutoff < 1.0f) {
+        float chord = 2.0f * std::sin(0.5f * std::asin(chunk.coneCutoff));
+        normalScale = std::max(normalScale, (glm::length(normalMatrix * chunk.coneAxis) - chord * normalScaleMax) / lodStretchMax);
+    }
+
+    for (uint32_t l = chunk.lodCount - 1; l > 0; l--) {
+        if (chunk.lods[l].error * pixelsPerUnit <= LOD_PIXEL_ERROR * distance * normalScale) return l;
+    }
+    return 0;
 }
 
 /* Calls commands to ready the buffers for drawing.
@@ -58,12 +217,39 @@ void Geometry::enqueueDrawCommands(VkCommandBuffer& commandBuffer) {
     VkBuffer vertexBuffers[] = { vertexBuffer };
     VkDeviceSize offsets[] = { 0 };
     vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, indexType);
     vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
 }
 
+void Geometry::enqueueDrawCommands(VkCommandBuffer& commandBuffer, uint32_t frame) {
+    if (!initialized) return;
+    if (chunks.empty()) {
+        enqueueDrawCommands(commandBuffer);
+        return;
+    }
+    if (drawCounts[frame] == 0) return;
+
+    VkBuffer vertexBuffers[] = { vertexBuffer };
+    VkDeviceSize offsets[] = { 0 };
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, indexType);
+
+    const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+    VkDeviceSize frameOffset = static_cast<VkDeviceSize>(stride) * chunks.size() * frame;
+    if (multiDrawIndirect) {
+        vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer, frameOffset, drawCounts[frame], stride);
+    }
+    else {
+        for (uint32_t i = 0; i < drawCounts[frame]; i++) {
+            vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer, frameOffset + stride * i, 1, stride);
+        }
+    }
+}
+
 void Geometry::setupAsQuad() {
     if (initialized) cleanup();
+    vertexFormat = VERTEX_FLOAT;
+    chunks.clear();
 
     vertices = {
         { { -0.5f, -0.5f, 0.0f },{ 1.0f, 0.0f, 0.0f },{ 1.0f, 0.0f }, {0.0f, 0.0f, -1.0f} },
@@ -90,6 +276,8 @@ void Geometry::setupAsQuad() {
 
 void Geometry::setupAsBackgroundQuad() {
     if (initialized) cleanup();
+    vertexFormat = VERTEX_FLOAT;
+    chunks.clear();
 
     vertices = {
         { { -1.0f, -1.0f, 0.999f },{ 1.0f, 1.0f, 1.0f },{ 0.0f, 0.0f },{ 0.0f, 0.0f, -1.0f } },
@@ -139,59 +327,17 @@ void Geometry::initializeTBN() {
     */
 }
 
-void Geometry::setupFromMesh(std::string path) {
+void Geometry::setupFromMesh(std::string path, VertexFormat format, glm::vec3 lodScale) {
     if (initialized) cleanup();
 
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-    std::string err;
-
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, path.c_str())) {
-        throw std::runtime_error(err);
-    }
-
-    std::unordered_map<Vertex, uint32_t> uniqueVertices = {};
-
-    for (const auto& shape : shapes) {
-
-        for (const auto& index : shape.mesh.indices) {
-            Vertex vertex = {};
-            
-            vertex.pos = {
-                attrib.vertices[3 * index.vertex_index + 0],
-                attrib.vertices[3 * index.vertex_index + 1],
-                attrib.vertices[3 * index.vertex_index + 2]
-            };
-
-            vertex.uv = {
-                attrib.texcoords[2 * index.texcoord_index + 0],
-                1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-            };
-
-            vertex.col = { 1.0f, 1.0f, 1.0f };
-
-            vertex.nor = {
-                attrib.normals[3 * index.normal_index + 0],
-                attrib.normals[3 * index.normal_index + 1],
-                attrib.normals[3 * index.normal_index + 2]
-            };
-
-            //vertex.tan = { 0.f, 0.f, 0.f }; // going to handle in shader for now
-            //vertex.bit = { 0.f, 0.f, 0.f };
-
-            if (uniqueVertices.count(vertex) == 0) {
-                uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-                vertices.push_back(vertex);
-            }
-
-            indices.push_back(uniqueVertices[vertex]);
-        }
-    }
+    MeshCache::load(path, vertices, indices, chunks, lodScale);
+    this->lodScale = lodScale;
+    vertexFormat = format;
 
     createVertexBuffer();
     createIndexBuffer();
+    createIndirectBuffer();
     initializeTBN();
 
     initialized = true;
-}
\ No newline at end of file
+}
@@ -51,10 +51,112 @@ struct Vertex {
 
 };
 
+// Vertex layouts a Geometry can upload. VERTEX_PACKED is a third of the size of VERTEX_FLOAT, see PackedVertex.
+enum VertexFormat
+{
+    VERTEX_FLOAT = 0, VERTEX_PACKED
+};
+
+// 16 byte vertex for meshes: positions as 16 bit fractions of the mesh bounds, octahedral normals and half float UVs,
+// no color. model.vert dequantizes it with the bounds in UniformModelObject when specialized for VERTEX_PACKED.
+// Locations match Vertex, so both layouts feed the same shader inputs.
+struct PackedVertex {
+    uint16_t pos[4]; // xyz unorm within the bounds, w unused
+    uint16_t uv[2]; // half floats
+    int16_t nor[2]; // snorm octahedral encoding
+
+    // Quantizes a vertex into the bounds given by boundsMin and boundsExtent
+    static PackedVertex pack(const Vertex& vertex, const glm::vec3& boundsMin, const glm::vec3& boundsExtent);
+
+    static VkVertexInputBindingDescription getBindingDescription() {
+        VkVertexInputBindingDescription bindingDescription = {};
+        bindingDescription.binding = 0;
+        bindingDescription.stride = sizeof(PackedVertex);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+        return bindingDescription;
+    }
+
+    static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions() {
+        std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions = {};
+        attributeDescriptions[0].binding = 0;
+        attributeDescriptions[0].location = 0;
+        attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+        attributeDescriptions[0].offset = offsetof(PackedVertex, pos);
+
+        attributeDescriptions[1].binding = 0;
+        attributeDescriptions[1].location = 2;
+        attributeDescriptions[1].format = VK_FORMAT_R16G16_SFLOAT;
+        attributeDescriptions[1].offset = offsetof(PackedVertex, uv);
+
+        attributeDescriptions[2].binding = 0;
+        attributeDescriptions[2].location = 3;
+        attributeDescriptions[2].format = VK_FORMAT_R16G16_SNORM;
+        attributeDescriptions[2].offset = offsetof(PackedVertex, nor);
+
+        return attributeDescriptions;
+    }
+};
+static_assert(sizeof(PackedVertex) == 16, "PackedVertex must stay tightly packed");
+
+// Most levels of detail of a chunk, each has about half the triangles of the one before
+#define MESH_CHUNK_LODS 5
+// Largest simplification error, in pixels on screen, a chunk may be drawn with
+#define LOD_PIXEL_ERROR 1.0f
+
+// One level of detail of a chunk, a run of the index buffer. Every level indexes the same vertices.
+struct MeshLod {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error; // how far the level may be from the full detail surface, in model space scaled by the mesh's lodScale
+};
+
+// A spatially compact part of a mesh, culled as a whole (see cullChunks). Built by MeshOptimizer, stored in the mesh cache.
+// The vertices on its outline are the same in every level, so neighbouring chunks at different levels meet without cracks.
+struct MeshChunk {
+    glm::vec3 center; // bounding sphere of the chunk's vertices
+    float radius;
+    glm::vec3 extent; // half size of their bounding box, which is centered on the sphere
+    glm::vec3 coneAxis; // average direction of the triangle normals of every level
+    float coneCutoff; // sine of the widest angle between a triangle normal and the axis, 1 if no view sees only backs
+    uint32_t lodCount;
+    MeshLod lods[MESH_CHUNK_LODS]; // lods[0] is full detail
+};
+static_assert(sizeof(MeshChunk) == 108, "the mesh chunk is part of the mesh cache format");
+
+// Picks the levels of detail of the chunks of a mesh drawn with one model matrix (see Geometry::cullChunks). Errors are
+// taken at the closest point of a chunk's bounding box in world space and scaled by what the model matrix adds to lodScale.
+class ChunkLodSelector
+{
+private:
+    glm::mat4 model;
+    glm::mat3 boxExtent; // model matrix with absolute values, maps a model space box extent to a world space one
+    glm::mat3 normalMatrix;
+    float normalScaleMax;
+    float lodToWorldScale; // largest axis scale of the model matrix divided by lodScale
+    float lodStretchMax;   // longest a unit normal gets when divided by lodScale
+    float pixelsPerUnit;
+public:
+    // pixelsPerUnit is the size in pixels of one world space unit at distance 1, proj[1][1] * viewport height / 2
+    ChunkLodSelector(const glm::mat4& model, glm::vec3 lodScale, float pixelsPerUnit);
+
+    // The coarsest level whose error covers at most LOD_PIXEL_ERROR pixels, seen from cameraPosition with the chunk's box
+    // grown by margin in model space
+    uint32_t select(const MeshChunk& chunk, const glm::vec3& cameraPosition, float margin = 0.0f) const;
+};
+
+// What cullChunks kept for one frame
+struct ChunkCullStats {
+    uint32_t chunks = 0;
+    uint32_t coarseChunks = 0; // drawn at a level below full detail
+    uint32_t triangles = 0;
+};
+
 namespace std {
     template<> struct hash<Vertex> {
         size_t operator()(Vertex const& vertex) const {
-            return ((hash<glm::vec3>()(vertex.pos) ^ (hash<glm::vec3>()(vertex.col) << 1)) >> 1) ^ (hash<glm::vec2>()(vertex.uv) << 1);
+            size_t h = ((hash<glm::vec3>()(vertex.pos) ^ (hash<glm::vec3>()(vertex.col) << 1)) >> 1) ^ (hash<glm::vec2>()(vertex.uv) << 1);
+            // vertices on hard edges only differ in their normal
+            return h ^ (hash<glm::vec3>()(vertex.nor) << 2);
         }
     };
 }
@@ -68,12 +170,32 @@ private:
     std::vector<Vertex> vertices;
     std::vector<uint32_t> indices;
 
+    VertexFormat vertexFormat = VERTEX_FLOAT;
+    // dequantizes packed positions, pos = positionOffset + unorm * positionScale
+    glm::vec3 positionOffset = glm::vec3(0.0f);
+    glm::vec3 positionScale = glm::vec3(1.0f);
+    // 16 bit whenever every index fits
+    VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+
     VkBuffer vertexBuffer;
-    VkDeviceMemory vertexDeviceMemory;
+    DeviceAllocation vertexDeviceMemory;
 
     VkBuffer indexBuffer;
-    VkDeviceMemory indexDeviceMemory;
-
+    DeviceAllocation indexDeviceMemory;
+
+    // Meshes are drawn chunk by chunk from a host visible buffer of indirect commands, one stride of chunks.size()
+    // commands per frame in flight, filled by cullChunks
+    std::vector<MeshChunk> chunks;
+    VkBuffer indirectBuffer = VK_NULL_HANDLE;
+    DeviceAllocation indirectDeviceMemory;
+    std::array<uint32_t, MAX_FRAMES_IN_FLIGHT> drawCounts = {};
+    bool multiDrawIndirect = false; // otherwise one vkCmdDrawIndexedIndirect per chunk
+    float quantizationError = 0.0f; // how far packed positions may be from the ones the chunk bounds were built from
+    glm::vec3 lodScale = glm::vec3(1.0f); // scale the levels of detail were simplified at, see setupFromMesh
+    void createIndirectBuffer();
+
+    // Copies data into a new device local buffer through a staging buffer
+    void createDeviceLocalBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, DeviceAllocation& memory);
     void createVertexBuffer();
     void createIndexBuffer();
 
@@ -88,8 +210,24 @@ public:
     // not terribly neat, but better than subclasses for now...
     void setupAsQuad();
     void setupAsBackgroundQuad();
-    void setupFromMesh(std::string path);
+    // Loads an OBJ through its mesh cache, see MeshCache.h. The levels of detail are simplified with the positions scaled by
+    // lodScale, so when it matches the axis scales of the model matrix their errors are world space distances.
+    void setupFromMesh(std::string path, VertexFormat format = VERTEX_PACKED, glm::vec3 lodScale = glm::vec3(1.0f));
+
+    VertexFormat getVertexFormat() const { return vertexFormat; }
+    glm::vec3 getPositionOffset() const { return positionOffset; }
+    glm::vec3 getPositionScale() const { return positionScale; }
+
+    uint32_t getChunkCount() const { return static_cast<uint32_t>(chunks.size()); }
+
+    // Writes the indirect commands of frame for the chunks that intersect the frustum of viewProj and are not entirely
+    // back facing from cameraPosition, each at the coarsest level whose error covers at most LOD_PIXEL_ERROR pixels.
+    // pixelsPerUnit is the size in pixels of one world space unit at distance 1, proj[1][1] * viewport height / 2.
+    ChunkCullStats cullChunks(uint32_t frame, const glm::mat4& model, const glm::mat4& viewProj, const glm::vec3& cameraPosition, float pixelsPerUnit);
 
+    // Draws the whole mesh
     void enqueueDrawCommands(VkCommandBuffer& commandBuffer);
+    // Draws the chunks cullChunks kept for frame, or the whole mesh if it has no chunks
+    void enqueueDrawCommands(VkCommandBuffer& commandBuffer, uint32_t frame);
 };
 
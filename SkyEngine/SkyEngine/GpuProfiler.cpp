@@ -0,0 +1,161 @@
+#include "GpuProfiler.h"
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+const char* GpuProfiler::getPassName(Pass pass) {
+    switch (pass) {
+    case REPROJECT: return "reproject";
+    case LIGHT_VOLUME: return "lightVolume";
+    case CLOUDS: return "clouds";
+    case BACKGROUND: return "background";
+    case GOD_RAYS: return "godRays";
+    case RADIAL_BLUR: return "radialBlur";
+    case MESH: return "mesh";
+    case TONEMAP: return "tonemap";
+    default: return "unknown";
+    }
+}
+
+void GpuProfiler::init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t graphicsFamily, uint32_t computeFamily) {
+    this->device = device;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    timestampPeriod = properties.limits.timestampPeriod;
+
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    uint32_t computeBits = queueFamilies[computeFamily].timestampValidBits;
+    uint32_t graphicsBits = queueFamilies[graphicsFamily].timestampValidBits;
+    if (computeBits == 0 || graphicsBits == 0) {
+        std::cerr << "timestamps are not supported on these queues, GPU profiling is disabled" << std::endl;
+        return;
+    }
+    computeMask = computeBits >= 64 ? ~0ull : (1ull << computeBits) - 1;
+    graphicsMask = graphicsBits >= 64 ? ~0ull : (1ull << graphicsBits) - 1;
+
+    VkQueryPoolCreateInfo queryPoolInfo = {};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = PROFILER_FRAME_SLOTS * PASS_COUNT * 2;
+
+    if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create query pool!");
+    }
+
+    history.reserve(PROFILER_HISTORY);
+}
+
+void GpuProfiler::cleanup() {
+    if (queryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, queryPool, nullptr);
+        queryPool = VK_NULL_HANDLE;
+    }
+    if (csv.is_open()) {
+        csv.close();
+    }
+}
+
+void GpuProfiler::openCSV(std::string path) {
+    csv.open(path);
+    if (!csv.is_open()) {
+        throw std::runtime_error("failed to open profiler output " + path + "!");
+    }
+
+    csv << "frame";
+    for (int p = 0; p < PASS_COUNT; p++) {
+        csv << "," << getPassName(static_cast<Pass>(p));
+    }
+    csv << std::endl;
+}
+
+void GpuProfiler::cmdReset(VkCommandBuffer commandBuffer, uint32_t slot, bool computeQueue) {
+    if (!isEnabled()) return;
+
+    // compute passes come first in the slot, graphics passes are the rest
+    Pass first = computeQueue ? REPROJECT : BACKGROUND;
+    uint32_t count = computeQueue ? (CLOUDS + 1) * 2 : (PASS_COUNT - BACKGROUND) * 2;
+    vkCmdResetQueryPool(commandBuffer, queryPool, getQuery(slot, first, false), count);
+}
+
+void GpuProfiler::cmdBegin(VkCommandBuffer commandBuffer, uint32_t slot, Pass pass) {
+    if (!isEnabled()) return;
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, getQuery(slot, pass, false));
+}
+
+void GpuProfiler::cmdEnd(VkCommandBuffer commandBuffer, uint32_t slot, Pass pass) {
+    if (!isEnabled()) return;
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, getQuery(slot, pass, true));
+}
+
+bool GpuProfiler::collect(uint32_t slot, bool wait) {
+    if (!isEnabled() || !pending[slot]) return false;
+
+    uint64_t timestamps[PASS_COUNT * 2];
+    VkQueryResultFlags flags = VK_QUERY_RESULT_64_BIT | (wait ? VK_QUERY_RESULT_WAIT_BIT : 0);
+    VkResult result = vkGetQueryPoolResults(device, queryPool, getQuery(slot, REPROJECT, false), PASS_COUNT * 2,
+        sizeof(timestamps), timestamps, sizeof(uint64_t), flags);
+    if (result == VK_NOT_READY) {
+        return false;
+    }
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("failed to read timestamp queries!");
+    }
+    pending[slot] = false;
+
+    for (int p = 0; p < PASS_COUNT; p++) {
+        uint64_t mask = isComputePass(static_cast<Pass>(p)) ? computeMask : graphicsMask;
+        uint64_t ticks = (timestamps[p * 2 + 1] - timestamps[p * 2]) & mask;
+        latest[p] = static_cast<float>(ticks * timestampPeriod / 1000000.0);
+    }
+
+    if (history.size() < PROFILER_HISTORY) {
+        history.push_back(latest);
+    }
+    else {
+        history[historyNext] = latest;
+    }
+    historyNext = (historyNext + 1) % PROFILER_HISTORY;
+
+    if (csv.is_open()) {
+        csv << collectedFrames;
+        for (int p = 0; p < PASS_COUNT; p++) {
+            csv << "," << latest[p];
+        }
+        csv << "\n";
+    }
+    collectedFrames++;
+
+    return true;
+}
+
+float GpuProfiler::getAverage(Pass pass) const {
+    if (history.empty()) return 0.0f;
+
+    float sum = 0.0f;
+    for (const auto& frame : history) {
+        sum += frame[pass];
+    }
+    return sum / history.size();
+}
+
+std::string GpuProfiler::getSummary() const {
+    if (!isEnabled()) return "";
+
+    float total = 0.0f;
+    for (int p = 0; p < PASS_COUNT; p++) {
+        total += getAverage(static_cast<Pass>(p));
+    }
+
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(2) << "gpu " << total << " ms";
+    for (int p = 0; p < PASS_COUNT; p++) {
+        ss << " | " << getPassName(static_cast<Pass>(p)) << " " << getAverage(static_cast<Pass>(p));
+    }
+    return ss.str();
+}
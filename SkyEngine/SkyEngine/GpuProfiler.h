@@ -0,0 +1,76 @@
+#pragma once
+#include "VulkanObject.h"
+#include <array>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Each frame in flight writes its own query slot. A slot is only read back once that frame's fence has
+// signaled, right before the slot is recorded again, which never stalls.
+#define PROFILER_FRAME_SLOTS MAX_FRAMES_IN_FLIGHT
+
+// Number of frames the rolling averages are taken over
+#define PROFILER_HISTORY 120
+
+// Per-pass GPU timings from timestamp queries.
+// Every pass is bracketed by a begin (top of pipe) and end (bottom of pipe) timestamp in the per-frame command buffers.
+class GpuProfiler
+{
+public:
+    enum Pass {
+        REPROJECT = 0,
+        LIGHT_VOLUME,
+        CLOUDS,
+        BACKGROUND,
+        GOD_RAYS,
+        RADIAL_BLUR,
+        MESH,
+        TONEMAP,
+        PASS_COUNT
+    };
+    static const char* getPassName(Pass pass);
+    static bool isComputePass(Pass pass) { return pass <= CLOUDS; }
+
+private:
+    VkDevice device = VK_NULL_HANDLE;
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    float timestampPeriod = 0.0f; // nanoseconds per tick
+    uint64_t computeMask = 0;
+    uint64_t graphicsMask = 0;
+
+    bool pending[PROFILER_FRAME_SLOTS] = {};
+    std::array<float, PASS_COUNT> latest = {};
+    std::vector<std::array<float, PASS_COUNT>> history;
+    uint32_t historyNext = 0;
+    uint64_t collectedFrames = 0;
+
+    std::ofstream csv;
+
+    uint32_t getQuery(uint32_t slot, Pass pass, bool end) const { return (slot * PASS_COUNT + pass) * 2 + (end ? 1 : 0); }
+
+public:
+    // Leaves the profiler disabled if either queue family has no timestamp support
+    void init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t graphicsFamily, uint32_t computeFamily);
+    void cleanup();
+    bool isEnabled() const { return queryPool != VK_NULL_HANDLE; }
+
+    // Appends one line of pass timings per collected frame
+    void openCSV(std::string path);
+
+    /// --- Recording
+    // Resets the queries one queue writes for a slot; record before the first cmdBegin of that queue
+    void cmdReset(VkCommandBuffer commandBuffer, uint32_t slot, bool computeQueue);
+    void cmdBegin(VkCommandBuffer commandBuffer, uint32_t slot, Pass pass);
+    void cmdEnd(VkCommandBuffer commandBuffer, uint32_t slot, Pass pass);
+
+    /// --- Results
+    void markSubmitted(uint32_t slot) { pending[slot] = true; }
+    // Reads back the last submission of a slot. Without wait this returns false if the GPU is not done with it yet.
+    bool collect(uint32_t slot, bool wait);
+
+    // Milliseconds, of the last collected frame or averaged over the history
+    float getLatest(Pass pass) const { return latest[pass]; }
+    float getAverage(Pass pass) const;
+    // Short rolling summary for the window title
+    std::string getSummary() const;
+};
@@ -8,5 +8,26 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/vec3.hpp>
 #include <string>
+#include "VolumeFile.h"
 
-void GenerateCurlNoise(std::string path);
+class ThreadPool;
+
+#define CURL_DIM 128
+
+// Tileable curl noise, each channel normalized to [0, 1] over the whole map. Tiles of the map are generated in parallel on pool.
+// Fills dim x dim RGBA8 texels, dim a multiple of 4, e.g. straight into a staging buffer
+void GenerateCurlNoise(uint32_t dim, uint8_t* pixels, ThreadPool& pool);
+void GenerateCurlNoise(std::string path, uint32_t dim = CURL_DIM);
+// Times the scalar central difference curl against the SSE2 analytic gradient one over a dim x dim map and prints both
+void BenchmarkCurlNoise(uint32_t dim);
+
+// Tileable RGBA8 cloud noise volumes in the channel layout the cloud shaders sample
+enum CloudNoiseVolume {
+    CLOUD_SHAPE_NOISE,  // lowResCloudShape: R perlin-worley, GBA worley FBM at increasing frequency
+    CLOUD_DETAIL_NOISE  // hiResCloudShape: RGB worley FBM at increasing frequency, A unused
+};
+
+// Fills dim^3 * 4 bytes, slice after slice, with every slice generated on its own worker of pool
+void GenerateCloudNoise(CloudNoiseVolume type, uint32_t dim, uint8_t* texels, ThreadPool& pool);
+// Generates a volume straight into a packed file (see VolumeFile.h)
+VolumeHeader GenerateCloudNoiseVolume(CloudNoiseVolume type, uint32_t dim, std::string path);
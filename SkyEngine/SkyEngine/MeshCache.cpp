@@ -0,0 +1,266 @@
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
+#define TINYOBJLOADER_IMPLEMENTATION
+#include <tiny_obj_loader.h>
+
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+    struct SourceInfo {
+        uint64_t size;
+        int64_t time;
+    };
+
+    bool getSourceInfo(const std::string& path, SourceInfo& info) {
+        struct stat status;
+        if (stat(path.c_str(), &status) != 0) return false;
+        info.size = static_cast<uint64_t>(status.st_size);
+        info.time = static_cast<int64_t>(status.st_mtime);
+        return true;
+    }
+
+    // FNV-1a over the whole file
+    uint64_t hashSource(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        uint64_t hash = 0xcbf29ce484222325ull;
+        char buffer[1 << 16];
+        while (file) {
+            file.read(buffer, sizeof(buffer));
+            std::streamsize count = file.gcount();
+            for (std::streamsize i = 0; i < count; i++) {
+                hash ^= static_cast<unsigned char>(buffer[i]);
+                hash *= 0x100000001b3ull;
+            }
+        }
+        return hash;
+    }
+}
+
+void MeshCache::loadObj(std::string path, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string err;
+
+    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, path.c_str())) {
+        throw std::runtime_error(err);
+    }
+
+    vertices.clear();
+    indices.clear();
+    std::unordered_map<Vertex, uint32_t> uniqueVertices = {};
+
+    for (const auto& shape : shapes) {
+
+        for (const auto& index : shape.mesh.indices) {
+            Vertex vertex = {};
+
+            vertex.pos = {
+                attrib.vertices[3 * index.vertex_index + 0],
+                attrib.vertices[3 * index.vertex_index + 1],
+                attrib.vertices[3 * index.vertex_index + 2]
+            };
+
+            vertex.uv = {
+                attrib.texcoords[2 * index.texcoord_index + 0],
+                1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
+            };
+
+            vertex.col = { 1.0f, 1.0f, 1.0f };
+
+            vertex.nor = {
+                attrib.normals[3 * index.normal_index + 0],
+                attrib.normals[3 * index.normal_index + 1],
+                attrib.normals[3 * index.normal_index + 2]
+            };
+
+            auto inserted = uniqueVertices.insert({ vertex, static_cast<uint32_t>(vertices.size()) });
+            if (inserted.second) {
+                vertices.push_back(vertex);
+            }
+
+            indices.push_back(inserted.first->second);
+        }
+    }
+}
+
+bool MeshCache::read(std::string path, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, std::vector<MeshChunk>& chunks,
+    glm::vec3 lodScale) {
+    std::string cachePath = path + MESH_CACHE_EXTENSION;
+    std::fstream file(cachePath, std::ios::binary | std::ios::in | std::ios::out);
+    if (!file.is_open()) return false;
+
+    MeshCacheHeader header;
+    MeshCacheHeader expected;
+    SourceInfo source;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        header.magic != expected.magic || header.version != expected.version ||
+        header.vertexStride != expected.vertexStride || header.indexStride != expected.indexStride ||
+        header.lodScale[0] != lodScale.x || header.lodScale[1] != lodScale.y || header.lodScale[2] != lodScale.z ||
+        !getSourceInfo(path, source) || header.sourceSize != source.size) {
+        return false;
+    }
+
+    if (header.sourceTime != source.time) {
+        if (header.sourceHash != hashSource(path)) return false;
+
+        // same contents, remember the new time so the next launch skips the hash
+        header.sourceTime = source.time;
+        file.seekp(0);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.seekg(sizeof(header));
+    }
+
+    vertices.resize(static_cast<size_t>(header.vertexCount));
+    indices.resize(static_cast<size_t>(header.indexCount));
+    chunks.resize(static_cast<size_t>(header.chunkCount));
+    file.read(reinterpret_cast<char*>(vertices.data()), vertices.size() * sizeof(Vertex));
+    file.read(reinterpret_cast<char*>(indices.data()), indices.size() * sizeof(uint32_t));
+    file.read(reinterpret_cast<char*>(chunks.data()), chunks.size() * sizeof(MeshChunk));
+    if (!file) {
+        std::cerr << cachePath << " is truncated, parsing " << path << " again" << std::endl;
+        return false;
+    }
+
+    // a damaged cache must not index past the vertex buffer
+    for (uint32_t index : indices) {
+        if (index >= header.vertexCount) {
+            std::cerr << cachePath << " is damaged, parsing " << path << " again" << std::endl;
+            return false;
+        }
+    }
+    for (const MeshChunk& chunk : chunks) {
+        bool damaged = chunk.lodCount == 0 || chunk.lodCount > MESH_CHUNK_LODS;
+        for (uint32_t l = 0; l < chunk.lodCount && !damaged; l++) {
+            damaged = static_cast<uint64_t>(chunk.lods[l].firstIndex) + chunk.lods[l].indexCount > header.indexCount;
+        }
+        if (damaged) {
+            std::cerr << cachePath << " is damaged, parsing " << path << " again" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void MeshCache::write(std::string path, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, const std::vector<MeshChunk>& chunks,
+    glm::vec3 lodScale) {
+    MeshCacheHeader header;
+    SourceInfo source;
+    if (!getSourceInfo(path, source)) return;
+    header.lodScale[0] = lodScale.x;
+    header.lodScale[1] = lodScale.y;
+    header.lodScale[2] = lodScale.z;
+    header.vertexCount = vertices.size();
+    header.indexCount = indices.size();
+    header.chunkCount = chunks.size();
+    header.sourceSize = source.size;
+    header.sourceTime = source.time;
+    header.sourceHash = hashSource(path);
+
+    // a crash halfway through writing must not leave a damaged cache behind
+    std::string cachePath = path + MESH_CACHE_EXTENSION;
+    std::string tempPath = cachePath + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(vertices.data()), vertices.size() * sizeof(Vertex));
+        file.write(reinterpret_cast<const char*>(indices.data()), indices.size() * sizeof(uint32_t));
+        file.write(reinterpret_cast<const char*>(chunks.data()), chunks.size() * sizeof(MeshChunk));
+        if (!file.good()) {
+            std::cerr << "failed to write " << tempPath << std::endl;
+            return;
+        }
+    }
+    std::remove(cachePath.c_str()); // rename does not replace existing files on Windows
+    if (std::rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+        std::cerr << "failed to replace " << cachePath << std::endl;
+    }
+}
+
+void MeshCache::load(std::string path, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, std::vector<MeshChunk>& chunks,
+    glm::vec3 lodScale) {
+    if (read(path, vertices, indices, chunks, lodScale)) return;
+
+    loadObj(path, vertices, indices);
+    MeshOptimizationReport report = optimizeMesh(vertices, indices, chunks, lodScale);
+    std::cout << "optimized " << path << ": " << report.toString() << std::endl;
+    write(path, vertices, indices, chunks, lodScale);
+}
+
+void MeshCache::benchmark(std::string path, uint32_t iterations, glm::vec3 lodScale) {
+    std::vector<Vertex> parsedVertices, cachedVertices;
+    std::vector<uint32_t> parsedIndices, cachedIndices;
+    std::vector<MeshChunk> parsedChunks, cachedChunks;
+    iterations = std::max(iterations, 1u);
+
+    MeshOptimizationReport report;
+    auto startTime = std::chrono::high_resolution_clock::now();
+    for (uint32_t i = 0; i < iterations; i++) {
+        loadObj(path, parsedVertices, parsedIndices);
+        report = optimizeMesh(parsedVertices, parsedIndices, parsedChunks, lodScale);
+    }
+    double parseMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count() / iterations;
+
+    write(path, parsedVertices, parsedIndices, parsedChunks, lodScale);
+
+    startTime = std::chrono::high_resolution_clock::now();
+    for (uint32_t i = 0; i < iterations; i++) {
+        if (!read(path, cachedVertices, cachedIndices, cachedChunks, lodScale)) {
+            throw std::runtime_error("failed to read back the mesh cache of " + path + "!");
+        }
+    }
+    double cacheMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count() / iterations;
+
+    bool identical = cachedVertices.size() == parsedVertices.size() && cachedIndices == parsedIndices &&
+        std::equal(cachedVertices.begin(), cachedVertices.end(), parsedVertices.begin()) &&
+        cachedChunks.size() == parsedChunks.size() &&
+        std::memcmp(cachedChunks.data(), parsedChunks.data(), cachedChunks.size() * sizeof(MeshChunk)) == 0;
+
+    std::cout << std::fixed << std::setprecision(3)
+        << path << ": " << parsedVertices.size() << " vertices, " << parsedIndices.size() / 3 << " triangles, average of " << iterations << " loads" << std::endl
+        << "  OBJ parse, deduplication and optimization: " << parseMs << " ms" << std::endl
+        << "  mesh cache:                                " << cacheMs << " ms, " << parseMs / cacheMs << "x faster"
+        << (identical ? "" : ", MISMATCH") << std::endl
+        << "  " << report.toString() << std::endl;
+
+    // the levels of detail cullChunks picks with a model matrix of lodScale, so the errors are world space distances, in a
+    // 1080 pixel tall view with a 45 degree field of view. Near the ground the distant chunks should be coarser.
+    glm::vec3 low(std::numeric_limits<float>::max()), high(-std::numeric_limits<float>::max());
+    for (const Vertex& vertex : parsedVertices) {
+        low = glm::min(low, vertex.pos * lodScale);
+        high = glm::max(high, vertex.pos * lodScale);
+    }
+    glm::mat4 model(1.0f);
+    model[0][0] = lodScale.x;
+    model[1][1] = lodScale.y;
+    model[2][2] = lodScale.z;
+    ChunkLodSelector lodSelector(model, lodScale, 0.5f * 1080.0f / std::tan(glm::radians(22.5f)));
+
+    bool simplified = false, coarser = false;
+    for (const MeshChunk& chunk : parsedChunks) simplified = simplified || chunk.lodCount > 1;
+    std::cout << "  chunks at each level of detail, seen from above the middle of the mesh:" << std::endl;
+    for (uint32_t height = 1; height <= 10000; height *= 10) {
+        glm::vec3 camera((low.x + high.x) * 0.5f, high.y + static_cast<float>(height), (low.z + high.z) * 0.5f);
+        uint32_t levels[MESH_CHUNK_LODS] = {};
+        for (const MeshChunk& chunk : parsedChunks) levels[lodSelector.select(chunk, camera)]++;
+        coarser = coarser || levels[0] < parsedChunks.size();
+
+        std::cout << "    " << std::setw(5) << height << " above:";
+        for (uint32_t l = 0; l < MESH_CHUNK_LODS; l++) std::cout << " " << std::setw(4) << levels[l];
+        std::cout << std::endl;
+    }
+    if (simplified && !coarser) {
+        std::cout << "  NO CHUNK PICKS A COARSER LEVEL" << std::endl;
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "Geometry.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Binary cache of a mesh after parsing, vertex deduplication, chunking and reordering (see MeshOptimizer.h), written next
+// to the source as "<source>.meshcache".
+// The header is followed by the vertices, the indices of every chunk's levels of detail and the chunks. Vertices and
+// indices are stored exactly as they are copied into the staging buffers.
+#define MESH_CACHE_MAGIC 0x48534D53 // "SMSH"
+#define MESH_CACHE_VERSION 5 // 2: vertex cache, overdraw and vertex fetch optimized order, 3: chunks, 4: chunk LODs, 5: LOD scale and chunk boxes
+#define MESH_CACHE_EXTENSION ".meshcache"
+
+struct MeshCacheHeader {
+    uint32_t magic = MESH_CACHE_MAGIC;
+    uint32_t version = MESH_CACHE_VERSION;
+    uint32_t vertexStride = sizeof(Vertex); // a changed Vertex layout invalidates old caches
+    uint32_t indexStride = sizeof(uint32_t);
+    uint64_t vertexCount = 0;
+    uint64_t indexCount = 0;
+    // The source the cache was built from. Size and modification time are the quick check, the hash of the contents
+    // is only compared when the time changed, so a touched but unchanged file keeps its cache.
+    uint64_t sourceSize = 0;
+    int64_t sourceTime = 0;
+    uint64_t sourceHash = 0;
+    uint64_t chunkCount = 0;
+    float lodScale[3] = { 1.0f, 1.0f, 1.0f }; // the levels of detail were simplified at, a different one rebuilds them
+    uint32_t reserved = 0;
+};
+static_assert(sizeof(MeshCacheHeader) == 80, "the mesh cache header is part of the file format");
+
+class MeshCache
+{
+public:
+    // Parses an OBJ and deduplicates its vertices
+    static void loadObj(std::string path, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+    // Reads the cache of a source file. Returns false if there is none, it is out of date or built at another lodScale.
+    static bool read(std::string path, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, std::vector<MeshChunk>& chunks,
+        glm::vec3 lodScale);
+    // Writes the cache of a source file. A failure is only reported, the mesh is parsed again next time.
+    static void write(std::string path, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, const std::vector<MeshChunk>& chunks,
+        glm::vec3 lodScale);
+
+    // The cached mesh if the cache is valid, otherwise the parsed and optimized OBJ (see optimizeMesh), which is then cached
+    static void load(std::string path, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, std::vector<MeshChunk>& chunks,
+        glm::vec3 lodScale = glm::vec3(1.0f));
+
+    // Times parsing and optimizing the OBJ against reading its cache and prints both, with the optimization report and
+    // how many chunks pick a coarser level of detail as the camera backs away from them
+    static void benchmark(std::string path, uint32_t iterations, glm::vec3 lodScale = glm::vec3(1.0f));
+};
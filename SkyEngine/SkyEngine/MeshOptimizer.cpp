@@ -0,0 +1,613 @@
+#include "MeshOptimizer.h"
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <numeric>
+#include <sstream>
+#include <unordered_map>
+
+namespace {
+    // Forsyth's constants
+    const float CACHE_DECAY_POWER = 1.5f;
+    const float LAST_TRIANGLE_SCORE = 0.75f;
+    const float VALENCE_BOOST_SCALE = 2.0f;
+    const float VALENCE_BOOST_POWER = 0.5f;
+
+    float vertexScore(int cachePosition, uint32_t remainingTriangles) {
+        if (remainingTriangles == 0) return -1.0f;
+
+        float score = 0.0f;
+        if (cachePosition >= 0) {
+            // the last triangle's vertices get a fixed score so its neighbours aren't favoured over each other
+            if (cachePosition < 3) {
+                score = LAST_TRIANGLE_SCORE;
+            }
+            else {
+                float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+                score = std::pow(1.0f - (cachePosition - 3) * scaler, CACHE_DECAY_POWER);
+            }
+        }
+        // finish off vertices with few triangles left, lone triangles would cost a whole miss later
+        return score + VALENCE_BOOST_SCALE * std::pow(static_cast<float>(remainingTriangles), -VALENCE_BOOST_POWER);
+    }
+
+    // FIFO simulation with timestamps: a vertex is cached if it missed less than cacheSize misses ago.
+    // Bumping the clock by more than cacheSize flushes the whole cache.
+    struct FifoCache {
+        std::vector<uint32_t> stamps;
+        uint32_t clock;
+        uint32_t size;
+
+        FifoCache(size_t vertexCount, uint32_t size) : stamps(vertexCount, 0), clock(size + 1), size(size) {}
+        void flush() { clock += size + 1; }
+        // true on a miss
+        bool access(uint32_t vertex) {
+            if (clock - stamps[vertex] > size) {
+                stamps[vertex] = clock++;
+                return true;
+            }
+            return false;
+        }
+    };
+}
+
+std::string MeshOptimizationReport::toString() const {
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(3)
+        << "ACMR " << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr
+        << " (FIFO " << VERTEX_CACHE_SIZE << "), " << chunks << " chunks, " << clusters << " overdraw clusters, LOD triangles";
+    for (uint32_t l = 0; l < MESH_CHUNK_LODS; l++) ss << (l ? " / " : " ") << lodTriangles[l];
+    return ss.str();
+}
+
+VertexCacheStats analyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize) {
+    VertexCacheStats stats;
+    if (indices.empty() || vertexCount == 0) return stats;
+
+    FifoCache cache(vertexCount, cacheSize);
+    std::vector<bool> used(vertexCount, false);
+    size_t misses = 0, usedVertices = 0;
+    for (uint32_t index : indices) {
+        if (cache.access(index)) misses++;
+        if (!used[index]) {
+            used[index] = true;
+            usedVertices++;
+        }
+    }
+
+    stats.acmr = static_cast<float>(misses) / (indices.size() / 3);
+    stats.atvr = static_cast<float>(misses) / usedVertices;
+    return stats;
+}
+
+void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount) {
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) return;
+
+    // triangles of every vertex, the first remaining[v] entries of a vertex are the ones not emitted yet
+    std::vector<uint32_t> remaining(vertexCount, 0);
+    for (uint32_t index : indices) remaining[index]++;
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++) offsets[v + 1] = offsets[v] + remaining[v];
+    std::vector<uint32_t> adjacency(indices.size());
+    {
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++) {
+            adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> scores(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++) scores[v] = vertexScore(-1, remaining[v]);
+
+    auto triangleScore = [&](uint32_t t) {
+        return scores[indices[t * 3]] + scores[indices[t * 3 + 1]] + scores[indices[t * 3 + 2]];
+    };
+
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    std::vector<uint32_t> cache, nextCache;
+    cache.reserve(FORSYTH_CACHE_SIZE + 3);
+    nextCache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+    size_t cursor = 0; // every triangle before it has been emitted
+    int64_t best = -1;
+    while (result.size() < indices.size()) {
+        if (best < 0) {
+            // dead end, nothing in the cache has triangles left: start again from the next one in the input
+            while (emitted[cursor]) cursor++;
+            best = static_cast<int64_t>(cursor);
+        }
+
+        uint32_t triangle = static_cast<uint32_t>(best);
+        emitted[triangle] = true;
+        const uint32_t* corners = &indices[triangle * 3];
+        nextCache.assign(corners, corners + 3);
+        for (int c = 0; c < 3; c++) {
+            uint32_t v = corners[c];
+            result.push_back(v);
+
+            // swap the triangle out of the vertex's remaining ones
+            uint32_t* list = &adjacency[offsets[v]];
+            for (uint32_t i = 0; i < remaining[v]; i++) {
+                if (list[i] == triangle) {
+                    std::swap(list[i], list[remaining[v] - 1]);
+                    break;
+                }
+            }
+            remaining[v]--;
+        }
+
+        // the triangle's vertices move to the front, everything else shifts back and the tail falls out
+        for (uint32_t v : cache) {
+            if (v != corners[0] && v != corners[1] && v != corners[2]) nextCache.push_back(v);
+        }
+        for (size_t i = 0; i < nextCache.size(); i++) {
+            uint32_t v = nextCache[i];
+            cachePosition[v] = i < FORSYTH_CACHE_SIZE ? static_cast<int>(i) : -1;
+            scores[v] = vertexScore(cachePosition[v], remaining[v]);
+        }
+        if (nextCache.size() > FORSYTH_CACHE_SIZE) nextCache.resize(FORSYTH_CACHE_SIZE);
+        std::swap(cache, nextCache);
+
+        // the next triangle is the best one touching the cache
+        best = -1;
+        float bestScore = -1.0f;
+        for (uint32_t v : cache) {
+            const uint32_t* list = &adjacency[offsets[v]];
+            for (uint32_t i = 0; i < remaining[v]; i++) {
+                float score = triangleScore(list[i]);
+                if (score > bestScore) {
+                    bestScore = score;
+                    best = list[i];
+                }
+            }
+        }
+    }
+
+    indices.swap(result);
+}
+
+uint32_t optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, float threshold) {
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) return 0;
+
+    // hard boundaries: triangles missing all three vertices restart the cache anyway, so cutting there is free
+    FifoCache cache(vertices.size(), VERTEX_CACHE_SIZE);
+    std::vector<uint8_t> misses(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++) {
+        misses[t] = static_cast<uint8_t>(cache.access(indices[t * 3]) + cache.access(indices[t * 3 + 1]) + cache.access(indices[t * 3 + 2]));
+    }
+    std::vector<size_t> hardStarts;
+    for (size_t t = 0; t < triangleCount; t++) {
+        if (t == 0 || misses[t] == 3) hardStarts.push_back(t);
+    }
+    hardStarts.push_back(triangleCount);
+
+    // soft boundaries: within a hard cluster, cut once the part so far, drawn from a cold cache, is within threshold
+    // of the cluster's own ACMR
+    std::vector<size_t> starts;
+    for (size_t h = 0; h + 1 < hardStarts.size(); h++) {
+        size_t begin = hardStarts[h], end = hardStarts[h + 1];
+        uint32_t clusterMisses = 0;
+        for (size_t t = begin; t < end; t++) clusterMisses += misses[t];
+        float limit = threshold * clusterMisses / (end - begin);
+
+        starts.push_back(begin);
+        cache.flush();
+        uint32_t partMisses = 0;
+        size_t partStart = begin;
+        for (size_t t = begin; t < end; t++) {
+            partMisses += cache.access(indices[t * 3]) + cache.access(indices[t * 3 + 1]) + cache.access(indices[t * 3 + 2]);
+            if (t + 1 < end && static_cast<float>(partMisses) / (t + 1 - partStart) <= limit) {
+                starts.push_back(t + 1);
+                cache.flush();
+                partMisses = 0;
+                partStart = t + 1;
+            }
+        }
+    }
+    const uint32_t clusterCount = static_cast<uint32_t>(starts.size());
+    starts.push_back(triangleCount);
+
+    // area weighted centroid and normal of every cluster, and of the whole mesh
+    std::vector<glm::vec3> centroids(clusterCount, glm::vec3(0.0f)), normals(clusterCount, glm::vec3(0.0f));
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    for (uint32_t c = 0; c < clusterCount; c++) {
+        float area = 0.0f;
+        for (size_t t = starts[c]; t < starts[c + 1]; t++) {
+            const glm::vec3& a = vertices[indices[t * 3]].pos;
+            const glm::vec3& b = vertices[indices[t * 3 + 1]].pos;
+            const glm::vec3& d = vertices[indices[t * 3 + 2]].pos;
+            glm::vec3 normal = glm::cross(b - a, d - a); // twice the area long
+            float triangleArea = glm::length(normal);
+            centroids[c] += triangleArea * (a + b + d) / 3.0f;
+            normals[c] += normal;
+            area += triangleArea;
+        }
+        meshCentroid += centroids[c];
+        meshArea += area;
+        if (area > 0.0f) centroids[c] /= area;
+    }
+    if (meshArea > 0.0f) meshCentroid /= meshArea;
+
+    // clusters facing away from the middle of the mesh are the ones most likely in front, draw them first
+    std::vector<float> keys(clusterCount, 0.0f);
+    for (uint32_t c = 0; c < clusterCount; c++) {
+        float length = glm::length(normals[c]);
+        if (length > 0.0f) keys[c] = glm::dot(centroids[c] - meshCentroid, normals[c] / length);
+    }
+    std::vector<uint32_t> order(clusterCount);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    for (uint32_t c : order) {
+        result.insert(result.end(), indices.begin() + starts[c] * 3, indices.begin() + starts[c + 1] * 3);
+    }
+    indices.swap(result);
+    return clusterCount;
+}
+
+void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+    const uint32_t unused = ~0u;
+    std::vector<uint32_t> remap(vertices.size(), unused);
+    std::vector<Vertex> result;
+    result.reserve(vertices.size());
+
+    for (uint32_t& index : indices) {
+        if (remap[index] == unused) {
+            remap[index] = static_cast<uint32_t>(result.size());
+            result.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    // vertices no triangle uses are dropped
+    vertices.swap(result);
+}
+
+namespace {
+    // Symmetric 4x4 matrix of a sum of squared plane distances, weighted by area (Garland and Heckbert)
+    struct Quadric {
+        double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+        double weight = 0;
+
+        void addPlane(const glm::dvec3& n, double d, double w) {
+            a2 += w * n.x * n.x; ab += w * n.x * n.y; ac += w * n.x * n.z; ad += w * n.x * d;
+            b2 += w * n.y * n.y; bc += w * n.y * n.z; bd += w * n.y * d;
+            c2 += w * n.z * n.z; cd += w * n.z * d;
+            d2 += w * d * d;
+            weight += w;
+        }
+        void add(const Quadric& q) {
+            a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad; b2 += q.b2; bc += q.bc; bd += q.bd; c2 += q.c2; cd += q.cd; d2 += q.d2;
+            weight += q.weight;
+        }
+        // area weighted RMS distance of p to the planes
+        double distance(const glm::dvec3& p) const {
+            double e = a2 * p.x * p.x + 2 * ab * p.x * p.y + 2 * ac * p.x * p.z + 2 * ad * p.x
+                + b2 * p.y * p.y + 2 * bc * p.y * p.z + 2 * bd * p.y
+                + c2 * p.z * p.z + 2 * cd * p.z + d2;
+            return weight > 0 ? std::sqrt(std::max(e, 0.0) / weight) : 0.0;
+        }
+    };
+
+    struct Collapse {
+        uint32_t from, to;
+        double error;
+    };
+}
+
+float simplifyMesh(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, size_t targetTriangles) {
+    const size_t vertexCount = vertices.size();
+    float maxError = 0.0f;
+
+    // vertices on an edge with a single triangle are locked: the outline of the list stays exactly as it is
+    std::vector<bool> locked(vertexCount, false);
+    {
+        std::unordered_map<uint64_t, uint32_t> edgeUses;
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            for (int e = 0; e < 3; e++) {
+                uint32_t a = indices[i + e], b = indices[i + (e + 1) % 3];
+                edgeUses[(static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b)]++;
+            }
+        }
+        for (const auto& edge : edgeUses) {
+            if (edge.second == 1) {
+                locked[static_cast<uint32_t>(edge.first >> 32)] = true;
+                locked[static_cast<uint32_t>(edge.first)] = true;
+            }
+        }
+        // vertices split by a UV or normal seam would tear apart if only one side moved
+        std::unordered_map<glm::vec3, uint32_t> positions;
+        for (uint32_t index : indices) {
+            auto inserted = positions.insert({ vertices[index].pos, index });
+            if (!inserted.second && inserted.first->second != index) {
+                locked[index] = true;
+                locked[inserted.first->second] = true;
+            }
+        }
+    }
+
+    std::vector<uint32_t> remap(vertexCount);
+    std::vector<bool> touched(vertexCount);
+    std::vector<Quadric> quadrics(vertexCount);
+    std::vector<uint32_t> offsets(vertexCount + 1), adjacency;
+    std::vector<Collapse> collapses;
+    while (indices.size() / 3 > targetTriangles) {
+        const size_t triangleCount = indices.size() / 3;
+
+        // quadrics and triangles of the current list, rebuilt every pass
+        std::fill(quadrics.begin(), quadrics.end(), Quadric());
+        std::fill(offsets.begin(), offsets.end(), 0);
+        for (size_t t = 0; t < triangleCount; t++) {
+            glm::dvec3 a = vertices[indices[t * 3]].pos, b = vertices[indices[t * 3 + 1]].pos, c = vertices[indices[t * 3 + 2]].pos;
+            glm::dvec3 normal = glm::cross(b - a, c - a);
+            double area = glm::length(normal);
+            for (int k = 0; k < 3; k++) offsets[indices[t * 3 + k] + 1]++;
+            if (area == 0.0) continue;
+            normal /= area;
+            for (int k = 0; k < 3; k++) quadrics[indices[t * 3 + k]].addPlane(normal, -glm::dot(normal, a), area);
+        }
+        for (size_t v = 0; v < vertexCount; v++) offsets[v + 1] += offsets[v];
+        adjacency.resize(indices.size());
+        {
+            std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+            for (size_t i = 0; i < indices.size(); i++) adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+
+        // every free endpoint of every edge may move onto the other one
+        collapses.clear();
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            for (int e = 0; e < 3; e++) {
+                uint32_t a = indices[i + e], b = indices[i + (e + 1) % 3];
+                for (int direction = 0; direction < 2; direction++) {
+                    uint32_t from = direction ? b : a, to = direction ? a : b;
+                    if (locked[from]) continue;
+                    Quadric q = quadrics[from];
+                    q.add(quadrics[to]);
+                    collapses.push_back({ from, to, q.distance(vertices[to].pos) });
+                }
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.error < y.error; });
+
+        // cheapest first; a vertex whose triangles changed this pass waits for the next one, so the adjacency stays valid
+        std::iota(remap.begin(), remap.end(), 0);
+        std::fill(touched.begin(), touched.end(), false);
+        size_t remaining = triangleCount;
+        size_t collapsed = 0;
+        for (const Collapse& collapse : collapses) {
+            if (remaining <= targetTriangles) break;
+            if (touched[collapse.from] || touched[collapse.to]) continue;
+
+            // reject collapses that fold a triangle over
+            bool flips = false;
+            uint32_t removed = 0;
+            for (uint32_t j = offsets[collapse.from]; j < offsets[collapse.from + 1] && !flips; j++) {
+                const uint32_t* corners = &indices[adjacency[j] * 3];
+                if (corners[0] == collapse.to || corners[1] == collapse.to || corners[2] == collapse.to) {
+                    removed++;
+                    continue;
+                }
+                glm::vec3 p[3], q[3];
+                for (int k = 0; k < 3; k++) {
+                    p[k] = vertices[corners[k]].pos;
+                    q[k] = corners[k] == collapse.from ? vertices[collapse.to].pos : p[k];
+                }
+                glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+                flips = glm::dot(before, after) <= 0.0f;
+            }
+            if (flips) continue;
+
+            remap[collapse.from] = collapse.to;
+            for (uint32_t j = offsets[collapse.from]; j < offsets[collapse.from + 1]; j++) {
+                const uint32_t* corners = &indices[adjacency[j] * 3];
+                touched[corners[0]] = touched[corners[1]] = touched[corners[2]] = true;
+            }
+            remaining -= removed;
+            collapsed++;
+            maxError = std::max(maxError, static_cast<float>(collapse.error));
+        }
+        if (collapsed == 0) break;
+
+        // move the collapsed vertices and drop the triangles that lost their area
+        size_t write = 0;
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            uint32_t a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+            if (a == b || b == c || c == a) continue;
+            indices[write++] = a;
+            indices[write++] = b;
+            indices[write++] = c;
+        }
+        indices.resize(write);
+    }
+
+    return maxError;
+}
+
+std::vector<MeshChunk> splitChunks(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, uint32_t maxTriangles) {
+    std::vector<MeshChunk> chunks;
+    const uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+    if (triangleCount == 0) return chunks;
+    maxTriangles = std::max(maxTriangles, 1u);
+
+    std::vector<glm::vec3> centroids(triangleCount);
+    for (uint32_t t = 0; t < triangleCount; t++) {
+        centroids[t] = (vertices[indices[t * 3]].pos + vertices[indices[t * 3 + 1]].pos + vertices[indices[t * 3 + 2]].pos) / 3.0f;
+    }
+    std::vector<uint32_t> triangles(triangleCount);
+    std::iota(triangles.begin(), triangles.end(), 0);
+
+    // split [begin, end) at the median of its longest axis until every part is small enough, depth first so the chunks
+    // come out in spatial order
+    std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0, triangleCount } };
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    while (!stack.empty()) {
+        uint32_t begin = stack.back().first, end = stack.back().second;
+        stack.pop_back();
+
+        if (end - begin <= maxTriangles) {
+            MeshChunk chunk = {};
+            chunk.lodCount = 1;
+            chunk.lods[0].firstIndex = static_cast<uint32_t>(result.size());
+            chunk.lods[0].indexCount = (end - begin) * 3;
+            chunks.push_back(chunk);
+            for (uint32_t i = begin; i < end; i++) {
+                const uint32_t* corners = &indices[triangles[i] * 3];
+                result.insert(result.end(), corners, corners + 3);
+            }
+            continue;
+        }
+
+        glm::vec3 low = centroids[triangles[begin]], high = low;
+        for (uint32_t i = begin; i < end; i++) {
+            low = glm::min(low, centroids[triangles[i]]);
+            high = glm::max(high, centroids[triangles[i]]);
+        }
+        glm::vec3 size = high - low;
+        int axis = size.x >= size.y && size.x >= size.z ? 0 : (size.y >= size.z ? 1 : 2);
+
+        uint32_t middle = begin + (end - begin) / 2;
+        std::nth_element(triangles.begin() + begin, triangles.begin() + middle, triangles.begin() + end,
+            [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+        stack.push_back({ middle, end });
+        stack.push_back({ begin, middle });
+    }
+
+    indices.swap(result);
+    return chunks;
+}
+
+void computeChunkBounds(std::vector<MeshChunk>& chunks, const std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices) {
+    for (MeshChunk& chunk : chunks) {
+        // every level uses a subset of the full detail vertices, so the sphere only needs those
+        const uint32_t* chunkIndices = &indices[chunk.lods[0].firstIndex];
+        const uint32_t indexCount = chunk.lods[0].indexCount;
+
+        // sphere around the middle of the bounding box
+        glm::vec3 low = vertices[chunkIndices[0]].pos, high = low;
+        for (uint32_t i = 0; i < indexCount; i++) {
+            low = glm::min(low, vertices[chunkIndices[i]].pos);
+            high = glm::max(high, vertices[chunkIndices[i]].pos);
+        }
+        chunk.center = (low + high) * 0.5f;
+        chunk.extent = (high - low) * 0.5f;
+        chunk.radius = 0.0f;
+        for (uint32_t i = 0; i < indexCount; i++) {
+            chunk.radius = std::max(chunk.radius, glm::length(vertices[chunkIndices[i]].pos - chunk.center));
+        }
+
+        // counter-clockwise faces are the front ones, so these normals point out of the front. The cone has to hold
+        // the triangles of whichever level is drawn.
+        std::vector<glm::vec3> normals;
+        glm::vec3 axis(0.0f);
+        for (uint32_t l = 0; l < chunk.lodCount; l++) {
+            const uint32_t* lodIndices = &indices[chunk.lods[l].firstIndex];
+            for (uint32_t i = 0; i < chunk.lods[l].indexCount; i += 3) {
+                const glm::vec3& a = vertices[lodIndices[i]].pos;
+                glm::vec3 normal = glm::cross(vertices[lodIndices[i + 1]].pos - a, vertices[lodIndices[i + 2]].pos - a);
+                float length = glm::length(normal);
+                if (length == 0.0f) continue; // degenerate triangles are never rasterized
+                normals.push_back(normal / length);
+                axis += normals.back();
+            }
+        }
+
+        chunk.coneAxis = glm::vec3(0.0f, 1.0f, 0.0f);
+        chunk.coneCutoff = 1.0f;
+        float axisLength = glm::length(axis);
+        if (axisLength == 0.0f) continue;
+        chunk.coneAxis = axis / axisLength;
+
+        float minDot = 1.0f;
+        for (const glm::vec3& normal : normals) minDot = std::min(minDot, glm::dot(normal, chunk.coneAxis));
+        // a cone wider than a hemisphere always shows some front face
+        if (minDot > 0.0f) chunk.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+    }
+}
+
+namespace {
+    // Runs the vertex cache and overdraw passes on one chunk and builds its levels of detail, with its vertices
+    // renumbered so the passes only touch the chunk's own. The levels are appended to lodIndices, their firstIndex
+    // relative to its start. localIndex must be all ~0u and is left that way.
+    uint32_t optimizeChunk(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, MeshChunk& chunk, std::vector<uint32_t>& localIndex,
+        std::vector<uint32_t>& lodIndices, glm::vec3 lodScale) {
+        const uint32_t unused = ~0u;
+        const MeshLod& full = chunk.lods[0];
+        std::vector<uint32_t> globalIndex;
+        std::vector<Vertex> localVertices;
+        std::vector<uint32_t> localIndices(full.indexCount);
+        for (uint32_t i = 0; i < full.indexCount; i++) {
+            uint32_t v = indices[full.firstIndex + i];
+            if (localIndex[v] == unused) {
+                localIndex[v] = static_cast<uint32_t>(globalIndex.size());
+                globalIndex.push_back(v);
+                localVertices.push_back(vertices[v]);
+            }
+            localIndices[i] = localIndex[v];
+        }
+
+        optimizeVertexCache(localIndices, localVertices.size());
+        uint32_t clusters = optimizeOverdraw(localIndices, localVertices);
+        for (uint32_t i = 0; i < full.indexCount; i++) indices[full.firstIndex + i] = globalIndex[localIndices[i]];
+
+        // each level simplifies the last one to half its triangles, at lodScale. The errors add up, so a level's error
+        // bounds its distance from the full detail surface, not just from the level before.
+        for (Vertex& vertex : localVertices) vertex.pos *= lodScale;
+        float error = 0.0f;
+        while (chunk.lodCount < MESH_CHUNK_LODS) {
+            size_t triangles = localIndices.size() / 3;
+            error += simplifyMesh(localIndices, localVertices, triangles / 2);
+            // the locked outline stops the simplification eventually
+            if (localIndices.size() / 3 > triangles * 9 / 10) break;
+
+            optimizeVertexCache(localIndices, localVertices.size());
+            MeshLod& lod = chunk.lods[chunk.lodCount++];
+            lod.firstIndex = static_cast<uint32_t>(lodIndices.size());
+            lod.indexCount = static_cast<uint32_t>(localIndices.size());
+            lod.error = error;
+            for (uint32_t index : localIndices) lodIndices.push_back(globalIndex[index]);
+        }
+
+        for (uint32_t v : globalIndex) localIndex[v] = unused;
+        return clusters;
+    }
+}
+
+MeshOptimizationReport optimizeMesh(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, std::vector<MeshChunk>& chunks, glm::vec3 lodScale) {
+    MeshOptimizationReport report;
+    report.before = analyzeVertexCache(indices, vertices.size());
+
+    chunks = splitChunks(indices, vertices);
+    std::vector<uint32_t> localIndex(vertices.size(), ~0u);
+    std::vector<uint32_t> lodIndices;
+    for (MeshChunk& chunk : chunks) {
+        report.clusters += optimizeChunk(indices, vertices, chunk, localIndex, lodIndices, lodScale);
+    }
+
+    // the full detail levels come first, so they get the front of the vertex buffer
+    const size_t fullIndexCount = indices.size();
+    for (MeshChunk& chunk : chunks) {
+        for (uint32_t l = 1; l < chunk.lodCount; l++) chunk.lods[l].firstIndex += static_cast<uint32_t>(fullIndexCount);
+    }
+    indices.insert(indices.end(), lodIndices.begin(), lodIndices.end());
+    optimizeVertexFetch(vertices, indices);
+    computeChunkBounds(chunks, indices, vertices);
+
+    report.chunks = static_cast<uint32_t>(chunks.size());
+    for (const MeshChunk& chunk : chunks) {
+        // chunks with fewer levels are drawn at their coarsest one
+        for (uint32_t l = 0; l < MESH_CHUNK_LODS; l++) report.lodTriangles[l] += chunk.lods[std::min(l, chunk.lodCount - 1)].indexCount / 3;
+    }
+    report.after = analyzeVertexCache(std::vector<uint32_t>(indices.begin(), indices.begin() + fullIndexCount), vertices.size());
+    return report;
+}
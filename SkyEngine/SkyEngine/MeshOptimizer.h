@@ -0,0 +1,63 @@
+#pragma once
+#include "Geometry.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Triangle and vertex reordering for indexed triangle lists, run once when a mesh is parsed (see MeshCache).
+
+// Entries of the LRU cache Forsyth's scoring models while reordering
+#define FORSYTH_CACHE_SIZE 32
+// Entries of the FIFO post-transform cache the statistics are measured with, a conservative size for current GPUs
+#define VERTEX_CACHE_SIZE 16
+// How much worse than the cache optimized order a cluster's ACMR may get before the overdraw pass stops splitting it
+#define OVERDRAW_THRESHOLD 1.05f
+// Most triangles in a chunk, the unit the renderer culls meshes in
+#define MESH_CHUNK_TRIANGLES 256
+
+struct VertexCacheStats {
+    float acmr = 0.0f; // vertex shader invocations per triangle, 0.5 is the ideal for a regular grid, 3 the worst
+    float atvr = 0.0f; // vertex shader invocations per vertex, 1 is the ideal
+};
+
+struct MeshOptimizationReport {
+    VertexCacheStats before;
+    VertexCacheStats after;
+    uint32_t chunks = 0;
+    uint32_t clusters = 0; // groups of triangles the overdraw pass sorted
+    uint32_t lodTriangles[MESH_CHUNK_LODS] = {}; // triangles of the whole mesh at each level of detail
+    std::string toString() const;
+};
+
+// Simulates a FIFO post-transform cache of cacheSize entries over the index buffer
+VertexCacheStats analyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// Tom Forsyth's linear-speed vertex cache optimization: greedily emits the triangle whose vertices score highest,
+// favouring vertices recently used and vertices with few triangles left
+void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount);
+
+// Splits the cache optimized order into clusters where the cache restarts anyway (or the ACMR stays within threshold),
+// then sorts the clusters to draw outward facing ones first, so fewer hidden fragments get shaded (Sander et al.)
+uint32_t optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, float threshold = OVERDRAW_THRESHOLD);
+
+// Reorders vertices by first use in the index buffer so vertex fetches walk memory forward, and remaps the indices
+void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+// Quadric error metric simplification (Garland and Heckbert) of an indexed triangle list to about targetTriangles, by
+// moving vertices onto their neighbours, so the result indexes the same vertices. Vertices on edges with a single
+// triangle and vertices sharing their position with another are locked, so the outline never changes and lists
+// simplified separately still meet without cracks. Returns the largest error of a collapse, as a distance.
+float simplifyMesh(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, size_t targetTriangles);
+
+// Splits the triangles into chunks of at most maxTriangles by repeatedly halving the longest axis of their centroids,
+// and reorders the index buffer so every chunk is contiguous. The chunks have no bounds yet.
+std::vector<MeshChunk> splitChunks(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, uint32_t maxTriangles = MESH_CHUNK_TRIANGLES);
+
+// Bounding sphere and normal cone of every chunk, the cone covering every level of detail
+void computeChunkBounds(std::vector<MeshChunk>& chunks, const std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices);
+
+// Splits the mesh into chunks, runs the vertex cache and overdraw passes within each chunk and builds its levels of detail
+// (appended after the full detail indices) from the positions scaled by lodScale, then runs the vertex fetch pass
+MeshOptimizationReport optimizeMesh(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, std::vector<MeshChunk>& chunks,
+    glm::vec3 lodScale = glm::vec3(1.0f));
@@ -0,0 +1,175 @@
+#include "Mipmaps.h"
+#include <algorithm>
+#include <vector>
+
+uint32_t getMipLevelCount(uint32_t width, uint32_t height, uint32_t depth) {
+    uint32_t largest = std::max(std::max(width, height), depth);
+    uint32_t levels = 1;
+    while (largest > 1) {
+        largest >>= 1;
+        levels++;
+    }
+    return levels;
+}
+
+VkExtent3D getMipExtent(uint32_t width, uint32_t height, uint32_t depth, uint32_t level) {
+    return { std::max(width >> level, 1u), std::max(height >> level, 1u), std::max(depth >> level, 1u) };
+}
+
+VkDeviceSize getMipChainSize(uint32_t width, uint32_t height, uint32_t depth, uint32_t texelSize, uint32_t levels) {
+    VkDeviceSize size = 0;
+    for (uint32_t level = 0; level < levels; level++) {
+        VkExtent3D extent = getMipExtent(width, height, depth, level);
+        size += static_cast<VkDeviceSize>(extent.width) * extent.height * extent.depth * texelSize;
+    }
+    return size;
+}
+
+bool canBlitMipmaps(VkPhysicalDevice physicalDevice, VkFormat format) {
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+    const VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    return (props.optimalTilingFeatures & needed) == needed;
+}
+
+bool canDownsampleOnCPU(VkFormat format) {
+    return format == VK_FORMAT_R8G8B8A8_UNORM || format == VK_FORMAT_B8G8R8A8_UNORM;
+}
+
+uint32_t getFormatTexelSize(VkFormat format) {
+    switch (format) {
+    case VK_FORMAT_R8_UNORM:
+        return 1;
+    case VK_FORMAT_R8G8_UNORM:
+    case VK_FORMAT_R16_SFLOAT:
+        return 2;
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+    case VK_FORMAT_R16G16_SFLOAT:
+    case VK_FORMAT_R32_SFLOAT:
+        return 4;
+    case VK_FORMAT_R16G16B16A16_SFLOAT:
+    case VK_FORMAT_R32G32_SFLOAT:
+        return 8;
+    case VK_FORMAT_R32G32B32A32_SFLOAT:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+void downsampleMipChainRGBA8(uint8_t* chain, uint32_t width, uint32_t height, uint32_t depth, uint32_t levels) {
+    uint8_t* src = chain;
+    for (uint32_t level = 1; level < levels; level++) {
+        VkExtent3D s = getMipExtent(width, height, depth, level - 1);
+        VkExtent3D d = getMipExtent(width, height, depth, level);
+        uint8_t* dst = src + static_cast<size_t>(s.width) * s.height * s.depth * 4;
+
+        // average the 2x2x2 block under each texel, collapsed along axes that are already 1 texel wide
+        for (uint32_t z = 0; z < d.depth; z++) {
+            uint32_t z0 = std::min(z * 2, s.depth - 1), z1 = std::min(z * 2 + 1, s.depth - 1);
+            for (uint32_t y = 0; y < d.height; y++) {
+                uint32_t y0 = std::min(y * 2, s.height - 1), y1 = std::min(y * 2 + 1, s.height - 1);
+                for (uint32_t x = 0; x < d.width; x++) {
+                    uint32_t x0 = std::min(x * 2, s.width - 1), x1 = std::min(x * 2 + 1, s.width - 1);
+                    const uint32_t zs[2] = { z0, z1 }, ys[2] = { y0, y1 }, xs[2] = { x0, x1 };
+
+                    uint32_t sum[4] = { 0, 0, 0, 0 };
+                    for (uint32_t k = 0; k < 8; k++) {
+                        const uint8_t* texel = src + ((static_cast<size_t>(zs[k >> 2]) * s.height + ys[(k >> 1) & 1]) * s.width + xs[k & 1]) * 4;
+                        for (int c = 0; c < 4; c++) sum[c] += texel[c];
+                    }
+
+                    uint8_t* out = dst + ((static_cast<size_t>(z) * d.height + y) * d.width + x) * 4;
+                    for (int c = 0; c < 4; c++) out[c] = static_cast<uint8_t>((sum[c] + 4) / 8);
+                }
+            }
+        }
+        src = dst;
+    }
+}
+
+void recordMipChainCopy(VkCommandBuffer commandBuffer, VkBuffer buffer, VkImage image,
+    uint32_t width, uint32_t height, uint32_t depth, uint32_t texelSize, uint32_t levels) {
+    std::vector<VkBufferImageCopy> regions(levels);
+    VkDeviceSize offset = 0;
+    for (uint32_t level = 0; level < levels; level++) {
+        VkExtent3D extent = getMipExtent(width, height, depth, level);
+
+        VkBufferImageCopy& region = regions[level];
+        region = {};
+        region.bufferOffset = offset;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = level;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = { 0, 0, 0 };
+        region.imageExtent = extent;
+
+        offset += static_cast<VkDeviceSize>(extent.width) * extent.height * extent.depth * texelSize;
+    }
+
+    vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, levels, regions.data());
+}
+
+void recordMipBlits(VkCommandBuffer commandBuffer, VkImage image, uint32_t width, uint32_t height, uint32_t depth, uint32_t levels) {
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+
+    for (uint32_t level = 1; level < levels; level++) {
+        // the level above is complete, read from it
+        barrier.subresourceRange.baseMipLevel = level - 1;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+            0, nullptr, 0, nullptr, 1, &barrier);
+
+        VkExtent3D src = getMipExtent(width, height, depth, level - 1);
+        VkExtent3D dst = getMipExtent(width, height, depth, level);
+
+        VkImageBlit blit = {};
+        blit.srcOffsets[0] = { 0, 0, 0 };
+        blit.srcOffsets[1] = { static_cast<int32_t>(src.width), static_cast<int32_t>(src.height), static_cast<int32_t>(src.depth) };
+        blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.srcSubresource.mipLevel = level - 1;
+        blit.srcSubresource.baseArrayLayer = 0;
+        blit.srcSubresource.layerCount = 1;
+        blit.dstOffsets[0] = { 0, 0, 0 };
+        blit.dstOffsets[1] = { static_cast<int32_t>(dst.width), static_cast<int32_t>(dst.height), static_cast<int32_t>(dst.depth) };
+        blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.dstSubresource.mipLevel = level;
+        blit.dstSubresource.baseArrayLayer = 0;
+        blit.dstSubresource.layerCount = 1;
+
+        vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            1, &blit, VK_FILTER_LINEAR);
+
+        // done with the level above
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+            0, nullptr, 0, nullptr, 1, &barrier);
+    }
+
+    // the last level was only ever written
+    barrier.subresourceRange.baseMipLevel = levels - 1;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+        0, nullptr, 0, nullptr, 1, &barrier);
+}
@@ -0,0 +1,31 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <cstdint>
+
+// Mip chain helpers shared by Texture and Texture3D. 2D images pass a depth of 1.
+// A chain is stored level after level, largest first, each level tightly packed like a vkCmdCopyBufferToImage source.
+
+// Levels down to 1x1x1
+uint32_t getMipLevelCount(uint32_t width, uint32_t height, uint32_t depth);
+VkExtent3D getMipExtent(uint32_t width, uint32_t height, uint32_t depth, uint32_t level);
+VkDeviceSize getMipChainSize(uint32_t width, uint32_t height, uint32_t depth, uint32_t texelSize, uint32_t levels);
+
+// Whether vkCmdBlitImage can build the chain on the GPU: the format has to be a linear filterable blit source and destination
+bool canBlitMipmaps(VkPhysicalDevice physicalDevice, VkFormat format);
+// Formats the CPU fallback knows how to filter
+bool canDownsampleOnCPU(VkFormat format);
+// Bytes per texel of the uncompressed color formats the textures use, 0 for any other format
+uint32_t getFormatTexelSize(VkFormat format);
+
+// Box filters level 0 of a RGBA8 chain into all the other levels, in place
+void downsampleMipChainRGBA8(uint8_t* chain, uint32_t width, uint32_t height, uint32_t depth, uint32_t levels);
+
+// One copy region per level of a chain in a staging buffer
+void recordMipChainCopy(VkCommandBuffer commandBuffer, VkBuffer buffer, VkImage image,
+    uint32_t width, uint32_t height, uint32_t depth, uint32_t texelSize, uint32_t levels);
+
+// Expects every level in TRANSFER_DST_OPTIMAL with level 0 filled in. Blits each level from the one above it and
+// leaves the whole image in SHADER_READ_ONLY_OPTIMAL.
+void recordMipBlits(VkCommandBuffer commandBuffer, VkImage image, uint32_t width, uint32_t height, uint32_t depth, uint32_t levels);
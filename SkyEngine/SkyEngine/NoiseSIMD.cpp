@@ -0,0 +1,357 @@
+#include "NoiseSIMD.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    // SSE2 has no 32 bit multiply keeping the low halves
+    inline __m128i mullo(__m128i a, __m128i b) {
+        __m128i even = _mm_mul_epu32(a, b);
+        __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+        return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+    }
+
+    inline __m128i hash4(__m128i x, __m128i y, __m128i z, uint32_t seed) {
+        __m128i h = _mm_xor_si128(mullo(x, _mm_set1_epi32(0x8da6b343)), mullo(y, _mm_set1_epi32(0xd8163841)));
+        h = _mm_xor_si128(h, mullo(z, _mm_set1_epi32(0xcb1ab31f)));
+        h = _mm_xor_si128(h, _mm_set1_epi32(static_cast<int>(seed)));
+        h = _mm_xor_si128(h, _mm_srli_epi32(h, 13));
+        h = mullo(h, _mm_set1_epi32(0x5bd1e995));
+        return _mm_xor_si128(h, _mm_srli_epi32(h, 15));
+    }
+
+    // same hash, one lane
+    inline uint32_t hash1(int32_t x, int32_t y, int32_t z, uint32_t seed) {
+        uint32_t h = (static_cast<uint32_t>(x) * 0x8da6b343u) ^ (static_cast<uint32_t>(y) * 0xd8163841u) ^ (static_cast<uint32_t>(z) * 0xcb1ab31fu) ^ seed;
+        h ^= h >> 13;
+        h *= 0x5bd1e995u;
+        return h ^ (h >> 15);
+    }
+
+    inline __m128 select(__m128 mask, __m128 a, __m128 b) {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+
+    // SSE2 only truncates, step down where that rounded up
+    inline __m128i floor4(__m128 x) {
+        __m128i i = _mm_cvttps_epi32(x);
+        return _mm_add_epi32(i, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(i), x)));
+    }
+
+    // into [0, period) from one period either side
+    inline __m128i wrap4(__m128i i, int32_t period) {
+        __m128i p = _mm_set1_epi32(period);
+        i = _mm_sub_epi32(i, _mm_and_si128(p, _mm_cmpgt_epi32(i, _mm_set1_epi32(period - 1))));
+        return _mm_add_epi32(i, _mm_and_si128(p, _mm_cmplt_epi32(i, _mm_setzero_si128())));
+    }
+
+    // Perlin's 12 cube edge gradients from the low 4 bits of the hash, 4 of them twice
+    inline __m128 grad4(__m128i h, __m128 x, __m128 y, __m128 z) {
+        h = _mm_and_si128(h, _mm_set1_epi32(15));
+        __m128 below8 = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(8)));
+        __m128 below4 = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(4)));
+        __m128 is12or14 = _mm_castsi128_ps(_mm_or_si128(_mm_cmpeq_epi32(h, _mm_set1_epi32(12)), _mm_cmpeq_epi32(h, _mm_set1_epi32(14))));
+
+        __m128 u = select(below8, x, y);
+        __m128 v = select(below4, y, select(is12or14, x, z));
+        u = _mm_xor_ps(u, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(1)), 31)));
+        v = _mm_xor_ps(v, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(2)), 30)));
+        return _mm_add_ps(u, v);
+    }
+
+    // the same gradients as vectors, for the analytic derivative
+    inline void gradVector4(__m128i h, __m128& gx, __m128& gy, __m128& gz) {
+        h = _mm_and_si128(h, _mm_set1_epi32(15));
+        __m128 below8 = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(8)));
+        __m128 below4 = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(4)));
+        __m128 is12or14 = _mm_castsi128_ps(_mm_or_si128(_mm_cmpeq_epi32(h, _mm_set1_epi32(12)), _mm_cmpeq_epi32(h, _mm_set1_epi32(14))));
+
+        __m128 ones = _mm_set1_ps(1.0f);
+        __m128 su = _mm_xor_ps(ones, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(1)), 31)));
+        __m128 sv = _mm_xor_ps(ones, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(2)), 30)));
+
+        // u picks x below 8 and y otherwise, v picks y below 4, then x for 12 and 14, z for the rest
+        __m128 vOnX = _mm_andnot_ps(below4, is12or14);
+        __m128 vOnZ = _mm_andnot_ps(below4, _mm_andnot_ps(is12or14, _mm_castsi128_ps(_mm_set1_epi32(-1))));
+        gx = _mm_add_ps(_mm_and_ps(below8, su), _mm_and_ps(vOnX, sv));
+        gy = _mm_add_ps(_mm_andnot_ps(below8, su), _mm_and_ps(below4, sv));
+        gz = _mm_and_ps(vOnZ, sv);
+    }
+
+    inline __m128 lerp4(__m128 a, __m128 b, __m128 t) {
+        return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+    }
+
+    // smootherstep, 6t^5 - 15t^4 + 10t^3
+    inline __m128 fade4(__m128 t) {
+        __m128 inner = _mm_add_ps(_mm_mul_ps(t, _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f))), _mm_set1_ps(10.0f));
+        return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(t, t), t), inner);
+    }
+
+    // derivative of fade4, 30t^2 (t - 1)^2
+    inline __m128 fadeDerivative4(__m128 t) {
+        __m128 s = _mm_mul_ps(t, _mm_sub_ps(t, _mm_set1_ps(1.0f)));
+        return _mm_mul_ps(_mm_set1_ps(30.0f), _mm_mul_ps(s, s));
+    }
+
+    inline __m128 dot4(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz) {
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+    }
+
+    struct NoiseGrad4 {
+        __m128 value, dx, dy, dz;
+    };
+
+    // Trilinear blend of the 8 corner values k0 + k1 u + k2 v + k3 w + k4 uv + k5 vw + k6 wu + k7 uvw, differentiated
+    // through both the fade curves and the corner gradients
+    inline NoiseGrad4 perlinNoiseGrad4(__m128 x, __m128 y, __m128 z, int32_t period, uint32_t seed) {
+        __m128i ix = floor4(x), iy = floor4(y), iz = floor4(z);
+        __m128 fx = _mm_sub_ps(x, _mm_cvtepi32_ps(ix));
+        __m128 fy = _mm_sub_ps(y, _mm_cvtepi32_ps(iy));
+        __m128 fz = _mm_sub_ps(z, _mm_cvtepi32_ps(iz));
+
+        __m128i one = _mm_set1_epi32(1);
+        __m128i x0 = wrap4(ix, period), x1 = wrap4(_mm_add_epi32(ix, one), period);
+        __m128i y0 = wrap4(iy, period), y1 = wrap4(_mm_add_epi32(iy, one), period);
+        __m128i z0 = wrap4(iz, period), z1 = wrap4(_mm_add_epi32(iz, one), period);
+
+        __m128 ones = _mm_set1_ps(1.0f);
+        __m128 hx = _mm_sub_ps(fx, ones), hy = _mm_sub_ps(fy, ones), hz = _mm_sub_ps(fz, ones);
+
+        // corners a..h are 000, 100, 010, 110, 001, 101, 011, 111
+        __m128 g[8][3];
+        gradVector4(hash4(x0, y0, z0, seed), g[0][0], g[0][1], g[0][2]);
+        gradVector4(hash4(x1, y0, z0, seed), g[1][0], g[1][1], g[1][2]);
+        gradVector4(hash4(x0, y1, z0, seed), g[2][0], g[2][1], g[2][2]);
+        gradVector4(hash4(x1, y1, z0, seed), g[3][0], g[3][1], g[3][2]);
+        gradVector4(hash4(x0, y0, z1, seed), g[4][0], g[4][1], g[4][2]);
+        gradVector4(hash4(x1, y0, z1, seed), g[5][0], g[5][1], g[5][2]);
+        gradVector4(hash4(x0, y1, z1, seed), g[6][0], g[6][1], g[6][2]);
+        gradVector4(hash4(x1, y1, z1, seed), g[7][0], g[7][1], g[7][2]);
+
+        __m128 va = dot4(g[0][0], g[0][1], g[0][2], fx, fy, fz);
+        __m128 vb = dot4(g[1][0], g[1][1], g[1][2], hx, fy, fz);
+        __m128 vc = dot4(g[2][0], g[2][1], g[2][2], fx, hy, fz);
+        __m128 vd = dot4(g[3][0], g[3][1], g[3][2], hx, hy, fz);
+        __m128 ve = dot4(g[4][0], g[4][1], g[4][2], fx, fy, hz);
+        __m128 vf = dot4(g[5][0], g[5][1], g[5][2], hx, fy, hz);
+        __m128 vg = dot4(g[6][0], g[6][1], g[6][2], fx, hy, hz);
+        __m128 vh = dot4(g[7][0], g[7][1], g[7][2], hx, hy, hz);
+
+        __m128 u = fade4(fx), v = fade4(fy), w = fade4(fz);
+        __m128 du = fadeDerivative4(fx), dv = fadeDerivative4(fy), dw = fadeDerivative4(fz);
+        __m128 uv = _mm_mul_ps(u, v), vw = _mm_mul_ps(v, w), wu = _mm_mul_ps(w, u), uvw = _mm_mul_ps(uv, w);
+
+        __m128 k1 = _mm_sub_ps(vb, va);
+        __m128 k2 = _mm_sub_ps(vc, va);
+        __m128 k3 = _mm_sub_ps(ve, va);
+        __m128 k4 = _mm_sub_ps(_mm_add_ps(va, vd), _mm_add_ps(vb, vc));
+        __m128 k5 = _mm_sub_ps(_mm_add_ps(va, vg), _mm_add_ps(vc, ve));
+        __m128 k6 = _mm_sub_ps(_mm_add_ps(va, vf), _mm_add_ps(vb, ve));
+        __m128 k7 = _mm_sub_ps(_mm_add_ps(_mm_add_ps(vb, vc), _mm_add_ps(ve, vh)), _mm_add_ps(_mm_add_ps(va, vd), _mm_add_ps(vf, vg)));
+
+        NoiseGrad4 result;
+        result.value = _mm_add_ps(_mm_add_ps(_mm_add_ps(va, _mm_mul_ps(k1, u)), _mm_add_ps(_mm_mul_ps(k2, v), _mm_mul_ps(k3, w))),
+            _mm_add_ps(_mm_add_ps(_mm_mul_ps(k4, uv), _mm_mul_ps(k5, vw)), _mm_add_ps(_mm_mul_ps(k6, wu), _mm_mul_ps(k7, uvw))));
+
+        // the corner gradients blended with the same weights, one axis at a time
+        __m128 blended[3];
+        for (int c = 0; c < 3; c++) {
+            __m128 j1 = _mm_sub_ps(g[1][c], g[0][c]);
+            __m128 j2 = _mm_sub_ps(g[2][c], g[0][c]);
+            __m128 j3 = _mm_sub_ps(g[4][c], g[0][c]);
+            __m128 j4 = _mm_sub_ps(_mm_add_ps(g[0][c], g[3][c]), _mm_add_ps(g[1][c], g[2][c]));
+            __m128 j5 = _mm_sub_ps(_mm_add_ps(g[0][c], g[6][c]), _mm_add_ps(g[2][c], g[4][c]));
+            __m128 j6 = _mm_sub_ps(_mm_add_ps(g[0][c], g[5][c]), _mm_add_ps(g[1][c], g[4][c]));
+            __m128 j7 = _mm_sub_ps(_mm_add_ps(_mm_add_ps(g[1][c], g[2][c]), _mm_add_ps(g[4][c], g[7][c])),
+                _mm_add_ps(_mm_add_ps(g[0][c], g[3][c]), _mm_add_ps(g[5][c], g[6][c])));
+            blended[c] = _mm_add_ps(_mm_add_ps(_mm_add_ps(g[0][c], _mm_mul_ps(j1, u)), _mm_add_ps(_mm_mul_ps(j2, v), _mm_mul_ps(j3, w))),
+                _mm_add_ps(_mm_add_ps(_mm_mul_ps(j4, uv), _mm_mul_ps(j5, vw)), _mm_add_ps(_mm_mul_ps(j6, wu), _mm_mul_ps(j7, uvw))));
+        }
+
+        result.dx = _mm_add_ps(blended[0], _mm_mul_ps(du, _mm_add_ps(_mm_add_ps(k1, _mm_mul_ps(k4, v)), _mm_add_ps(_mm_mul_ps(k6, w), _mm_mul_ps(k7, vw)))));
+        result.dy = _mm_add_ps(blended[1], _mm_mul_ps(dv, _mm_add_ps(_mm_add_ps(k2, _mm_mul_ps(k5, w)), _mm_add_ps(_mm_mul_ps(k4, u), _mm_mul_ps(k7, wu)))));
+        result.dz = _mm_add_ps(blended[2], _mm_mul_ps(dw, _mm_add_ps(_mm_add_ps(k3, _mm_mul_ps(k6, u)), _mm_add_ps(_mm_mul_ps(k5, v), _mm_mul_ps(k7, uv)))));
+        return result;
+    }
+
+    // Loads lanes [0, valid) of 4 floats, the rest are zero, so the last group of a count that is not a multiple of 4 reads
+    // nothing past the end
+    inline __m128 loadPartial4(const float* p, uint32_t valid) {
+        if (valid >= 4) {
+            return _mm_loadu_ps(p);
+        }
+        alignas(16) float lanes[4] = {};
+        for (uint32_t i = 0; i < valid; i++) {
+            lanes[i] = p[i];
+        }
+        return _mm_load_ps(lanes);
+    }
+
+    // Stores lanes [0, valid) of v and leaves the rest of the caller's array alone
+    inline void storePartial4(float* p, __m128 v, uint32_t valid) {
+        if (valid >= 4) {
+            _mm_storeu_ps(p, v);
+            return;
+        }
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, v);
+        for (uint32_t i = 0; i < valid; i++) {
+            p[i] = lanes[i];
+        }
+    }
+}
+
+__m128 perlinNoise4(__m128 x, __m128 y, __m128 z, int32_t period, uint32_t seed) {
+    __m128i ix = floor4(x), iy = floor4(y), iz = floor4(z);
+    __m128 fx = _mm_sub_ps(x, _mm_cvtepi32_ps(ix));
+    __m128 fy = _mm_sub_ps(y, _mm_cvtepi32_ps(iy));
+    __m128 fz = _mm_sub_ps(z, _mm_cvtepi32_ps(iz));
+
+    __m128i one = _mm_set1_epi32(1);
+    __m128i x0 = wrap4(ix, period), x1 = wrap4(_mm_add_epi32(ix, one), period);
+    __m128i y0 = wrap4(iy, period), y1 = wrap4(_mm_add_epi32(iy, one), period);
+    __m128i z0 = wrap4(iz, period), z1 = wrap4(_mm_add_epi32(iz, one), period);
+
+    __m128 ones = _mm_set1_ps(1.0f);
+    __m128 gx = _mm_sub_ps(fx, ones), gy = _mm_sub_ps(fy, ones), gz = _mm_sub_ps(fz, ones);
+
+    __m128 nnn = grad4(hash4(x0, y0, z0, seed), fx, fy, fz);
+    __m128 pnn = grad4(hash4(x1, y0, z0, seed), gx, fy, fz);
+    __m128 npn = grad4(hash4(x0, y1, z0, seed), fx, gy, fz);
+    __m128 ppn = grad4(hash4(x1, y1, z0, seed), gx, gy, fz);
+    __m128 nnp = grad4(hash4(x0, y0, z1, seed), fx, fy, gz);
+    __m128 pnp = grad4(hash4(x1, y0, z1, seed), gx, fy, gz);
+    __m128 npp = grad4(hash4(x0, y1, z1, seed), fx, gy, gz);
+    __m128 ppp = grad4(hash4(x1, y1, z1, seed), gx, gy, gz);
+
+    __m128 u = fade4(fx), v = fade4(fy), w = fade4(fz);
+    __m128 nn = lerp4(nnn, pnn, u);
+    __m128 pn = lerp4(npn, ppn, u);
+    __m128 np = lerp4(nnp, pnp, u);
+    __m128 pp = lerp4(npp, ppp, u);
+    return lerp4(lerp4(nn, pn, v), lerp4(np, pp, v), w);
+}
+
+__m128 perlinFBM4(__m128 x, __m128 y, __m128 z, int32_t period, int octaves, uint32_t seed) {
+    __m128 noise = _mm_setzero_ps();
+    float weight = 1.0f;
+    float totalWeight = 0.0f;
+    for (int i = 0; i < octaves; i++) {
+        noise = _mm_add_ps(noise, _mm_mul_ps(_mm_set1_ps(weight), perlinNoise4(x, y, z, period, seed + i)));
+        totalWeight += weight;
+        x = _mm_add_ps(x, x);
+        y = _mm_add_ps(y, y);
+        z = _mm_add_ps(z, z);
+        period *= 2;
+        weight *= 0.5f;
+    }
+    return _mm_mul_ps(noise, _mm_set1_ps(1.0f / totalWeight));
+}
+
+void perlinFBMGrad(const float* x, const float* y, const float* z, uint32_t count, int32_t period, int octaves, uint32_t seed,
+    float* value, float* dx, float* dy, float* dz) {
+    const uint32_t groups = NOISE_BATCH / 4;
+    for (uint32_t start = 0; start < count; start += NOISE_BATCH) {
+        uint32_t remaining = std::min<uint32_t>(NOISE_BATCH, count - start);
+        uint32_t active = (remaining + 3) / 4; // the last group may only be partly filled
+
+        __m128 px[groups], py[groups], pz[groups];
+        NoiseGrad4 sum[groups];
+        for (uint32_t i = 0; i < active; i++) {
+            uint32_t valid = remaining - i * 4;
+            px[i] = loadPartial4(x + start + i * 4, valid);
+            py[i] = loadPartial4(y + start + i * 4, valid);
+            pz[i] = loadPartial4(z + start + i * 4, valid);
+            sum[i].value = sum[i].dx = sum[i].dy = sum[i].dz = _mm_setzero_ps();
+        }
+
+        int32_t octavePeriod = period;
+        float weight = 1.0f;
+        float frequency = 1.0f;
+        float totalWeight = 0.0f;
+        for (int octave = 0; octave < octaves; octave++) {
+            __m128 w = _mm_set1_ps(weight);
+            __m128 slope = _mm_set1_ps(weight * frequency); // the chain rule brings down the frequency
+            __m128 f = _mm_set1_ps(frequency);
+            for (uint32_t i = 0; i < active; i++) {
+                NoiseGrad4 n = perlinNoiseGrad4(_mm_mul_ps(px[i], f), _mm_mul_ps(py[i], f), _mm_mul_ps(pz[i], f), octavePeriod, seed + octave);
+                sum[i].value = _mm_add_ps(sum[i].value, _mm_mul_ps(w, n.value));
+                sum[i].dx = _mm_add_ps(sum[i].dx, _mm_mul_ps(slope, n.dx));
+                sum[i].dy = _mm_add_ps(sum[i].dy, _mm_mul_ps(slope, n.dy));
+                sum[i].dz = _mm_add_ps(sum[i].dz, _mm_mul_ps(slope, n.dz));
+            }
+            totalWeight += weight;
+            octavePeriod *= 2;
+            frequency *= 2.0f;
+            weight *= 0.5f;
+        }
+
+        __m128 normalize = _mm_set1_ps(1.0f / totalWeight);
+        for (uint32_t i = 0; i < active; i++) {
+            uint32_t valid = remaining - i * 4;
+            storePartial4(value + start + i * 4, _mm_mul_ps(sum[i].value, normalize), valid);
+            storePartial4(dx + start + i * 4, _mm_mul_ps(sum[i].dx, normalize), valid);
+            storePartial4(dy + start + i * 4, _mm_mul_ps(sum[i].dy, normalize), valid);
+            storePartial4(dz + start + i * 4, _mm_mul_ps(sum[i].dz, normalize), valid);
+        }
+    }
+}
+
+WorleyCells::WorleyCells(int32_t period, uint32_t seed) : period(period), points(static_cast<size_t>(period + 2) * (period + 2) * (period + 2) * 3) {
+    // stored with a border of one cell on every side, copied from the other end of the tile
+    float* point = points.data();
+    for (int32_t z = -1; z <= period; z++) {
+        for (int32_t y = -1; y <= period; y++) {
+            for (int32_t x = -1; x <= period; x++, point += 3) {
+                int32_t wx = (x + period) % period, wy = (y + period) % period, wz = (z + period) % period;
+                for (uint32_t c = 0; c < 3; c++) {
+                    point[c] = (hash1(wx, wy, wz, seed + c) >> 8) * (1.0f / 16777216.0f);
+                }
+            }
+        }
+    }
+}
+
+const float* WorleyCells::getPoint(int32_t x, int32_t y, int32_t z) const {
+    int32_t stride = period + 2;
+    return &points[((static_cast<size_t>(z + 1) * stride + (y + 1)) * stride + (x + 1)) * 3];
+}
+
+float worleyNoise(const WorleyCells& cells, WorleyNeighbourhood& cache, float x, float y, float z) {
+    int32_t period = cells.getPeriod();
+    int32_t cx = std::min(static_cast<int32_t>(std::floor(x)), period - 1);
+    int32_t cy = std::min(static_cast<int32_t>(std::floor(y)), period - 1);
+    int32_t cz = std::min(static_cast<int32_t>(std::floor(z)), period - 1);
+
+    if (cx != cache.cellX || cy != cache.cellY || cz != cache.cellZ) {
+        int i = 0;
+        for (int32_t oz = -1; oz <= 1; oz++) {
+            for (int32_t oy = -1; oy <= 1; oy++) {
+                for (int32_t ox = -1; ox <= 1; ox++) {
+                    const float* point = cells.getPoint(cx + ox, cy + oy, cz + oz);
+                    cache.x[i] = cx + ox + point[0];
+                    cache.y[i] = cy + oy + point[1];
+                    cache.z[i] = cz + oz + point[2];
+                    i++;
+                }
+            }
+        }
+        // padding lane, never the closest
+        cache.x[27] = cache.y[27] = cache.z[27] = 1.0e6f;
+        cache.cellX = cx;
+        cache.cellY = cy;
+        cache.cellZ = cz;
+    }
+
+    __m128 px = _mm_set1_ps(x), py = _mm_set1_ps(y), pz = _mm_set1_ps(z);
+    __m128 closest = _mm_set1_ps(1.0e30f);
+    for (int i = 0; i < 28; i += 4) {
+        __m128 dx = _mm_sub_ps(_mm_load_ps(cache.x + i), px);
+        __m128 dy = _mm_sub_ps(_mm_load_ps(cache.y + i), py);
+        __m128 dz = _mm_sub_ps(_mm_load_ps(cache.z + i), pz);
+        closest = _mm_min_ps(closest, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+    }
+    closest = _mm_min_ps(closest, _mm_shuffle_ps(closest, closest, _MM_SHUFFLE(1, 0, 3, 2)));
+    closest = _mm_min_ps(closest, _mm_shuffle_ps(closest, closest, _MM_SHUFFLE(2, 3, 0, 1)));
+    return std::sqrt(_mm_cvtss_f32(closest));
+}
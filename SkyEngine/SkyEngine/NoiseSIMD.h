@@ -0,0 +1,49 @@
+#pragma once
+#include <emmintrin.h>
+
+#include <cstdint>
+#include <vector>
+
+// SSE2 noise kernels for the offline noise generators. Every lattice tiles: integer coordinates wrap at a whole number
+// period, so a volume sampled over [0, period) in each axis repeats seamlessly.
+// These stay on raw SSE2 rather than the float8 lanes of SimdLanes.h. The generators run in files built without AVX2,
+// where SimdLanes falls back to plain loops, while SSE2 is always there on x64 and needs no CPU check. The lattice hash
+// also needs 32 bit integer lanes (multiply, shifts, compares), which SimdLanes does not have.
+// Coordinates are in lattice units and may lie up to one period outside of [0, period).
+
+// Gradient noise at 4 points, roughly in [-1, 1]
+__m128 perlinNoise4(__m128 x, __m128 y, __m128 z, int32_t period, uint32_t seed);
+// Octaves of perlinNoise4, each at twice the frequency (and period) and half the weight of the last, normalized to [-1, 1]
+__m128 perlinFBM4(__m128 x, __m128 y, __m128 z, int32_t period, int octaves, uint32_t seed);
+
+// Value and analytic gradient (d/dx, d/dy, d/dz in lattice units) of perlinFBM4 at count points, any count.
+// Up to NOISE_BATCH points go through each octave together, so their independent hash and gradient math overlaps.
+#define NOISE_BATCH 16
+void perlinFBMGrad(const float* x, const float* y, const float* z, uint32_t count, int32_t period, int octaves, uint32_t seed,
+    float* value, float* dx, float* dy, float* dz);
+
+// One random feature point per cell of a period^3 grid
+class WorleyCells
+{
+private:
+    int32_t period;
+    std::vector<float> points; // xyz in [0, 1) relative to the cell corner
+
+public:
+    WorleyCells(int32_t period, uint32_t seed);
+    int32_t getPeriod() const { return period; }
+    // Cells -1 and period are the wrapped neighbours of the ones at the other end
+    const float* getPoint(int32_t x, int32_t y, int32_t z) const;
+};
+
+// The 27 feature points around the last cell a thread looked up, laid out so 4 distances are taken at once.
+// Neighbouring texels mostly share a cell, so the points are only gathered again when the cell changes.
+struct WorleyNeighbourhood {
+    int32_t cellX = INT32_MIN, cellY = INT32_MIN, cellZ = INT32_MIN;
+    alignas(16) float x[28];
+    alignas(16) float y[28];
+    alignas(16) float z[28];
+};
+
+// Distance from a point in cell units, within [0, period), to the closest feature point (F1)
+float worleyNoise(const WorleyCells& cells, WorleyNeighbourhood& cache, float x, float y, float z);
@@ -0,0 +1,120 @@
+#include "PipelineCache.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+void PipelineCache::init(VkDevice device, VkPhysicalDevice physicalDevice, std::string path) {
+    this->device = device;
+    this->path = path;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    std::vector<char> data;
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (file.is_open()) {
+        data.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(data.data(), data.size());
+        if (!file.good() || !validate(data)) {
+            data.clear();
+        }
+    }
+    else {
+        coldReason = "no " + path;
+    }
+
+    VkPipelineCacheCreateInfo cacheInfo = {};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.initialDataSize = data.size();
+    cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+    if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &cache) != VK_SUCCESS) {
+        // the header looked right but the driver still refused it, start over with an empty cache
+        cacheInfo.initialDataSize = 0;
+        cacheInfo.pInitialData = nullptr;
+        coldReason = "driver rejected " + path;
+        data.clear();
+        if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &cache) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline cache!");
+        }
+    }
+    loadedSize = data.size();
+}
+
+// Layout of VK_PIPELINE_CACHE_HEADER_VERSION_ONE:
+// uint32 header size, uint32 header version, uint32 vendor ID, uint32 device ID, uint8[VK_UUID_SIZE] pipeline cache UUID
+bool PipelineCache::validate(const std::vector<char>& data) {
+    const size_t headerSize = 4 * sizeof(uint32_t) + VK_UUID_SIZE;
+    if (data.size() < headerSize) {
+        coldReason = path + " is truncated";
+        return false;
+    }
+
+    uint32_t fields[4];
+    memcpy(fields, data.data(), sizeof(fields));
+    const uint8_t* uuid = reinterpret_cast<const uint8_t*>(data.data()) + sizeof(fields);
+
+    if (fields[0] < headerSize || fields[0] > data.size() || fields[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) {
+        coldReason = path + " has an unknown header";
+        return false;
+    }
+    if (fields[2] != properties.vendorID || fields[3] != properties.deviceID) {
+        coldReason = path + " is from another GPU";
+        return false;
+    }
+    if (memcmp(uuid, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+        coldReason = path + " is from another driver version";
+        return false;
+    }
+    return true;
+}
+
+void PipelineCache::save() {
+    if (cache == VK_NULL_HANDLE) return;
+
+    size_t size = 0;
+    if (vkGetPipelineCacheData(device, cache, &size, nullptr) != VK_SUCCESS || size == 0) {
+        return;
+    }
+    std::vector<char> data(size);
+    if (vkGetPipelineCacheData(device, cache, &size, data.data()) != VK_SUCCESS) {
+        return;
+    }
+
+    // a crash halfway through writing must not leave a damaged cache behind
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        file.write(data.data(), size);
+        if (!file.good()) {
+            std::cerr << "failed to write " << tempPath << std::endl;
+            return;
+        }
+    }
+    std::remove(path.c_str()); // rename does not replace existing files on Windows
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        std::cerr << "failed to replace " << path << std::endl;
+    }
+}
+
+void PipelineCache::cleanup() {
+    if (cache != VK_NULL_HANDLE) {
+        vkDestroyPipelineCache(device, cache, nullptr);
+        cache = VK_NULL_HANDLE;
+    }
+}
+
+std::string PipelineCache::getReport(double pipelineMs) const {
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1) << "pipelines created in " << pipelineMs << " ms, ";
+    if (isWarm()) {
+        ss << "warm start from " << loadedSize / 1024.0 << " KB " << path;
+    }
+    else {
+        ss << "cold start (" << coldReason << ")";
+    }
+    return ss.str();
+}
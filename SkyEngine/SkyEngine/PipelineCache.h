@@ -0,0 +1,35 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+
+// A VkPipelineCache kept on disk between runs, so pipelines are only compiled from scratch on the first launch
+// or after a driver update. The file is the raw vkGetPipelineCacheData blob; its header is checked against the
+// current device before it is handed to the driver, and a mismatching or damaged file is treated as a cold start.
+class PipelineCache
+{
+private:
+    VkDevice device = VK_NULL_HANDLE;
+    VkPipelineCache cache = VK_NULL_HANDLE;
+    VkPhysicalDeviceProperties properties = {};
+    std::string path;
+
+    size_t loadedSize = 0;  // 0 on a cold start
+    std::string coldReason; // why the file on disk was not used
+
+    bool validate(const std::vector<char>& data);
+
+public:
+    void init(VkDevice device, VkPhysicalDevice physicalDevice, std::string path);
+    // Writes the current contents to disk, replacing the old file only once the new one is complete
+    void save();
+    void cleanup();
+
+    VkPipelineCache getCache() const { return cache; }
+    bool isWarm() const { return loadedSize > 0; }
+
+    // One line on where the pipelines came from and how long creating them took
+    std::string getReport(double pipelineMs) const;
+};
@@ -1,4 +1,40 @@
 #include "Shader.h"
+#include <cstring>
+
+VkPipelineCache Shader::pipelineCache = VK_NULL_HANDLE;
+
+VkDescriptorSetLayoutBinding UniformCameraObject::getLayoutBinding(uint32_t bind) {
+    VkDescriptorSetLayoutBinding uboLayoutBinding = {};
+    uboLayoutBinding.binding = bind;
+    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    uboLayoutBinding.descriptorCount = 1;
+    uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+    uboLayoutBinding.pImmutableSamplers = nullptr;
+
+    return uboLayoutBinding;
+}
+
+VkDescriptorSetLayoutBinding UniformSunObject::getLayoutBinding(uint32_t bind) {
+    VkDescriptorSetLayoutBinding uboLayoutBinding = {};
+    uboLayoutBinding.binding = bind;
+    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    uboLayoutBinding.descriptorCount = 1;
+    uboLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+    uboLayoutBinding.pImmutableSamplers = nullptr;
+
+    return uboLayoutBinding;
+}
+
+VkDescriptorSetLayoutBinding UniformSkyObject::getLayoutBinding(uint32_t bind) {
+    VkDescriptorSetLayoutBinding uboLayoutBinding = {};
+    uboLayoutBinding.binding = bind;
+    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    uboLayoutBinding.descriptorCount = 1;
+    uboLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    uboLayoutBinding.pImmutableSamplers = nullptr;
+
+    return uboLayoutBinding;
+}
 
 void Shader::cleanup() {
     vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
@@ -21,17 +57,29 @@ VkShaderModule Shader::createShaderModule(const std::vector<char>& code, VkDevic
     return shaderModule;
 }
 
+void SpecializationConstants::set(uint32_t constantId, uint32_t value) {
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].constantID == constantId) {
+            data[i] = value;
+            return;
+        }
+    }
+    entries.push_back({ constantId, static_cast<uint32_t>(data.size() * sizeof(uint32_t)), sizeof(uint32_t) });
+    data.push_back(value);
+}
+
+const VkSpecializationInfo* SpecializationConstants::getInfo() {
+    info.mapEntryCount = static_cast<uint32_t>(entries.size());
+    info.pMapEntries = entries.data();
+    info.dataSize = data.size() * sizeof(uint32_t);
+    info.pData = data.data();
+    return &info;
+}
+
 /// Mesh Shader
 
 void MeshShader::cleanupUniforms() {
-    vkDestroyBuffer(device, uniformCameraBuffer, nullptr);
-    vkDestroyBuffer(device, uniformModelBuffer, nullptr);
-    vkFreeMemory(device, uniformCameraBufferMemory, nullptr);
-    vkFreeMemory(device, uniformModelBufferMemory, nullptr);
-    vkDestroyBuffer(device, uniformSunBuffer, nullptr);
-    vkFreeMemory(device, uniformSunBufferMemory, nullptr);
-    vkDestroyBuffer(device, uniformSkyBuffer, nullptr);
-    vkFreeMemory(device, uniformSkyBufferMemory, nullptr);
+    // the uniforms live in the UniformRing
 }
 
 void MeshShader::createDescriptorSetLayout() {
@@ -58,7 +106,7 @@ void MeshShader::createDescriptorSetLayout() {
 
 void MeshShader::createDescriptorPool() {
     std::array<VkDescriptorPoolSize, 6> poolSizes = {};
-    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     poolSizes[0].descriptorCount = 4;
     poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     poolSizes[1].descriptorCount = 1;
@@ -95,23 +143,23 @@ void MeshShader::createDescriptorSet() {
     }
 
     VkDescriptorBufferInfo cameraBufferInfo = {};
-    cameraBufferInfo.buffer = uniformCameraBuffer;
-    cameraBufferInfo.offset = 0;
+    cameraBufferInfo.buffer = uniformRing->getBuffer();
+    cameraBufferInfo.offset = offsetof(FrameUniforms, camera);
     cameraBufferInfo.range = sizeof(UniformCameraObject);
 
     VkDescriptorBufferInfo modelBufferInfo = {};
-    modelBufferInfo.buffer = uniformModelBuffer;
-    modelBufferInfo.offset = 0;
+    modelBufferInfo.buffer = uniformRing->getBuffer();
+    modelBufferInfo.offset = offsetof(FrameUniforms, model);
     modelBufferInfo.range = sizeof(UniformModelObject);
 
     VkDescriptorBufferInfo sunBufferInfo = {};
-    sunBufferInfo.buffer = uniformSunBuffer;
-    sunBufferInfo.offset = 0;
+    sunBufferInfo.buffer = uniformRing->getBuffer();
+    sunBufferInfo.offset = offsetof(FrameUniforms, sun);
     sunBufferInfo.range = sizeof(UniformSunObject);
 
     VkDescriptorBufferInfo skyBufferInfo = {};
-    skyBufferInfo.buffer = uniformSkyBuffer;
-    skyBufferInfo.offset = 0;
+    skyBufferInfo.buffer = uniformRing->getBuffer();
+    skyBufferInfo.offset = offsetof(FrameUniforms, sky);
     skyBufferInfo.range = sizeof(UniformSkyObject);
 
     VkDescriptorImageInfo imageInfo = {};
@@ -145,7 +193,7 @@ void MeshShader::createDescriptorSet() {
     descriptorWrites[0].dstSet = descriptorSet;
     descriptorWrites[0].dstBinding = 0;
     descriptorWrites[0].dstArrayElement = 0;
-    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     descriptorWrites[0].descriptorCount = 1;
     descriptorWrites[0].pBufferInfo = &cameraBufferInfo;
 
@@ -153,7 +201,7 @@ void MeshShader::createDescriptorSet() {
     descriptorWrites[1].dstSet = descriptorSet;
     descriptorWrites[1].dstBinding = 1;
     descriptorWrites[1].dstArrayElement = 0;
-    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     descriptorWrites[1].descriptorCount = 1;
     descriptorWrites[1].pBufferInfo = &modelBufferInfo;
 
@@ -161,7 +209,7 @@ void MeshShader::createDescriptorSet() {
     descriptorWrites[2].dstSet = descriptorSet;
     descriptorWrites[2].dstBinding = 2;
     descriptorWrites[2].dstArrayElement = 0;
-    descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     descriptorWrites[2].descriptorCount = 1;
     descriptorWrites[2].pBufferInfo = &sunBufferInfo;
 
@@ -169,7 +217,7 @@ void MeshShader::createDescriptorSet() {
     descriptorWrites[3].dstSet = descriptorSet;
     descriptorWrites[3].dstBinding = 3;
     descriptorWrites[3].dstArrayElement = 0;
-    descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     descriptorWrites[3].descriptorCount = 1;
     descriptorWrites[3].pBufferInfo = &skyBufferInfo;
 
@@ -230,6 +278,11 @@ void MeshShader::createPipeline() {
     vertShaderStageInfo.module = vertShaderModule;
     vertShaderStageInfo.pName = "main";
 
+    // constant_id 0 in model.vert selects how the vertex inputs are decoded
+    SpecializationConstants specialization;
+    specialization.setBool(0, vertexFormat == VERTEX_PACKED);
+    vertShaderStageInfo.pSpecializationInfo = specialization.getInfo();
+
     VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
     fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
@@ -238,8 +291,18 @@ void MeshShader::createPipeline() {
 
     VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
 
-    auto bindingDescription = Vertex::getBindingDescription();
-    auto attributeDescriptions = Vertex::getAttributeDescriptions();
+    VkVertexInputBindingDescription bindingDescription;
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+    if (vertexFormat == VERTEX_PACKED) {
+        bindingDescription = PackedVertex::getBindingDescription();
+        auto packedAttributes = PackedVertex::getAttributeDescriptions();
+        attributeDescriptions.assign(packedAttributes.begin(), packedAttributes.end());
+    }
+    else {
+        bindingDescription = Vertex::getBindingDescription();
+        auto floatAttributes = Vertex::getAttributeDescriptions();
+        attributeDescriptions.assign(floatAttributes.begin(), floatAttributes.end());
+    }
 
     VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
@@ -364,7 +427,7 @@ void MeshShader::createPipeline() {
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
     pipelineInfo.basePipelineIndex = -1; // Optional
 
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
+    if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
         throw std::runtime_error("failed to create graphics pipeline!");
     }
 
@@ -373,14 +436,7 @@ void MeshShader::createPipeline() {
 }
 
 void MeshShader::createUniformBuffer() {
-    VkDeviceSize bufferSize = sizeof(UniformCameraObject);
-    VulkanObject::createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformCameraBuffer, uniformCameraBufferMemory);
-    VkDeviceSize bufferSize2 = sizeof(UniformModelObject);
-    VulkanObject::createBuffer(bufferSize2, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformModelBuffer, uniformModelBufferMemory);
-    VkDeviceSize bufferSize3 = sizeof(UniformSunObject);
-    VulkanObject::createBuffer(bufferSize3, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformSunBuffer, uniformSunBufferMemory);
-    VkDeviceSize bufferSize4 = sizeof(UniformSkyObject);
-    VulkanObject::createBuffer(bufferSize4, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformSkyBuffer, uniformSkyBufferMemory);
+    // the uniforms live in the UniformRing
 }
 
 /// Background Shader
@@ -616,7 +672,7 @@ void BackgroundShader::createPipeline() {
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
     pipelineInfo.basePipelineIndex = -1; // Optional
 
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
+    if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
         throw std::runtime_error("failed to create graphics pipeline!");
     }
 
@@ -631,23 +687,19 @@ void BackgroundShader::createUniformBuffer() {
 /// Compute Shader
 
 void ComputeShader::cleanupUniforms() {
-    vkDestroyBuffer(device, uniformCameraBuffer, nullptr);
-    vkFreeMemory(device, uniformCameraBufferMemory, nullptr);
-    vkDestroyBuffer(device, uniformCameraBufferPrev, nullptr);
-    vkFreeMemory(device, uniformCameraBufferMemoryPrev, nullptr);
-
-    vkDestroyBuffer(device, uniformSkyBuffer, nullptr);
-    vkFreeMemory(device, uniformSkyBufferMemory, nullptr);
-    vkDestroyBuffer(device, uniformSunBuffer, nullptr);
-    vkFreeMemory(device, uniformSunBufferMemory, nullptr);
-
     vkDestroyDescriptorSetLayout(device, storageSetLayout, nullptr);
+    vkDestroyBuffer(device, counterBuffer, nullptr);
+    allocator->free(counterBufferMemory);
+    vkDestroyBuffer(device, counterReadbackBuffer, nullptr);
+    allocator->free(counterReadbackMemory);
+    vkDestroyPipeline(device, bakePipeline, nullptr);
 }
 
 void ComputeShader::createStorageSetLayout() {
     VkDescriptorSetLayoutBinding storageImageLayoutBinding = UniformStorageImageObject::getLayoutBinding(0);
+    VkDescriptorSetLayoutBinding ageImageLayoutBinding = UniformStorageImageObject::getLayoutBinding(1);
 
-    std::array<VkDescriptorSetLayoutBinding, 1> bindings = { storageImageLayoutBinding };
+    std::array<VkDescriptorSetLayoutBinding, 2> bindings = { storageImageLayoutBinding, ageImageLayoutBinding };
 
     VkDescriptorSetLayoutCreateInfo layoutInfo = {};
     layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -680,7 +732,26 @@ void ComputeShader::createDescriptorSetLayout() {
     // Hi res cloud shape
     VkDescriptorSetLayoutBinding samplerLayoutBinding3 = Texture3D::getLayoutBinding(8);
 
-    std::array<VkDescriptorSetLayoutBinding, 9> bindings = { camLayoutBinding, camLayoutBindingPrev, sunLayoutBinding, skyLayoutBinding, samplerLayoutBinding, samplerLayoutBindingNightSky, samplerLayoutBindingCurl, samplerLayoutBinding2, samplerLayoutBinding3 };
+    // Skip map of the cloud placement
+    VkDescriptorSetLayoutBinding samplerLayoutBindingSkipMap = Texture::getLayoutBinding(9);
+    samplerLayoutBindingSkipMap.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    // March counters
+    VkDescriptorSetLayoutBinding counterLayoutBinding = {};
+    counterLayoutBinding.binding = 10;
+    counterLayoutBinding.descriptorCount = 1;
+    counterLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    counterLayoutBinding.pImmutableSamplers = nullptr;
+    counterLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    // Light volume, read by the march and written by the bake
+    VkDescriptorSetLayoutBinding samplerLayoutBindingLightVolume = Texture3D::getLayoutBinding(11);
+    VkDescriptorSetLayoutBinding storageLayoutBindingLightVolume = UniformStorageImageObject::getLayoutBinding(12);
+
+    VkDescriptorSetLayoutBinding temporalLayoutBinding = UniformTemporalObject::getLayoutBinding(13);
+
+    std::array<VkDescriptorSetLayoutBinding, 14> bindings = { camLayoutBinding, camLayoutBindingPrev, sunLayoutBinding, skyLayoutBinding, samplerLayoutBinding, samplerLayoutBindingNightSky, samplerLayoutBindingCurl, samplerLayoutBinding2, samplerLayoutBinding3,
+        samplerLayoutBindingSkipMap, counterLayoutBinding, samplerLayoutBindingLightVolume, storageLayoutBindingLightVolume, temporalLayoutBinding };
 
     VkDescriptorSetLayoutCreateInfo layoutInfo = {};
     layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -693,13 +764,15 @@ void ComputeShader::createDescriptorSetLayout() {
 }
 
 void ComputeShader::createDescriptorPool() {
-    std::array<VkDescriptorPoolSize, 3> poolSizes = {};
+    std::array<VkDescriptorPoolSize, 4> poolSizes = {};
     poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-    poolSizes[0].descriptorCount = 2;
-    poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSizes[1].descriptorCount = 4;
+    poolSizes[0].descriptorCount = 5;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    poolSizes[1].descriptorCount = 5;
     poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[2].descriptorCount = 5;
+    poolSizes[2].descriptorCount = 7;
+    poolSizes[3].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[3].descriptorCount = 1;
 
     VkDescriptorPoolCreateInfo poolInfo = {};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
@@ -739,7 +812,18 @@ void ComputeShader::createStorageDescriptorSets() {
     imageInfoPrev.imageView = textures[1]->textureImageView;
     imageInfoPrev.sampler = textures[1]->textureSampler;
 
-    std::array<VkWriteDescriptorSet, 1> descriptorWrites = {};
+    // Ages of both
+    VkDescriptorImageInfo imageInfoAge = {};
+    imageInfoAge.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageInfoAge.imageView = textures[6]->textureImageView;
+    imageInfoAge.sampler = textures[6]->textureSampler;
+
+    VkDescriptorImageInfo imageInfoAgePrev = {};
+    imageInfoAgePrev.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageInfoAgePrev.imageView = textures[7]->textureImageView;
+    imageInfoAgePrev.sampler = textures[7]->textureSampler;
+
+    std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
     
     descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
     descriptorWrites[0].dstSet = storageBufferSetA;
@@ -749,6 +833,14 @@ void ComputeShader::createStorageDescriptorSets() {
     descriptorWrites[0].descriptorCount = 1;
     descriptorWrites[0].pImageInfo = &imageInfo;
 
+    descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[1].dstSet = storageBufferSetA;
+    descriptorWrites[1].dstBinding = 1;
+    descriptorWrites[1].dstArrayElement = 0;
+    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    descriptorWrites[1].descriptorCount = 1;
+    descriptorWrites[1].pImageInfo = &imageInfoAge;
+
     vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 
     // B
@@ -764,6 +856,9 @@ void ComputeShader::createStorageDescriptorSets() {
     descriptorWrites[0].descriptorCount = 1;
     descriptorWrites[0].pImageInfo = &imageInfoPrev;
 
+    descriptorWrites[1].dstSet = storageBufferSetB;
+    descriptorWrites[1].pImageInfo = &imageInfoAgePrev;
+
     vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 
 }
@@ -781,23 +876,23 @@ void ComputeShader::createDescriptorSet() {
     }
 
     VkDescriptorBufferInfo cameraBufferInfo = {};
-    cameraBufferInfo.buffer = uniformCameraBuffer;
-    cameraBufferInfo.offset = 0;
+    cameraBufferInfo.buffer = uniformRing->getBuffer();
+    cameraBufferInfo.offset = offsetof(FrameUniforms, camera);
     cameraBufferInfo.range = sizeof(UniformCameraObject);
 
     VkDescriptorBufferInfo cameraBufferInfoPrev = {};
-    cameraBufferInfoPrev.buffer = uniformCameraBufferPrev;
-    cameraBufferInfoPrev.offset = 0;
+    cameraBufferInfoPrev.buffer = uniformRing->getBuffer();
+    cameraBufferInfoPrev.offset = offsetof(FrameUniforms, cameraPrev);
     cameraBufferInfoPrev.range = sizeof(UniformCameraObject);
 
     VkDescriptorBufferInfo sunBufferInfo = {};
-    sunBufferInfo.buffer = uniformSunBuffer;
-    sunBufferInfo.offset = 0;
+    sunBufferInfo.buffer = uniformRing->getBuffer();
+    sunBufferInfo.offset = offsetof(FrameUniforms, sun);
     sunBufferInfo.range = sizeof(UniformSunObject);
 
     VkDescriptorBufferInfo skyBufferInfo = {};
-    skyBufferInfo.buffer = uniformSkyBuffer;
-    skyBufferInfo.offset = 0;
+    skyBufferInfo.buffer = uniformRing->getBuffer();
+    skyBufferInfo.offset = offsetof(FrameUniforms, sky);
     skyBufferInfo.range = sizeof(UniformSkyObject);
 
     // TODO: other relevant textures
@@ -828,15 +923,35 @@ void ComputeShader::createDescriptorSet() {
     imageInfo4.imageView = textures3D[1]->textureImageView;
     imageInfo4.sampler = textures3D[1]->textureSampler;
 
+    VkDescriptorImageInfo imageInfoSkipMap = {};
+    imageInfoSkipMap.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageInfoSkipMap.imageView = textures[5]->textureImageView;
+    imageInfoSkipMap.sampler = textures[5]->textureSampler;
 
-    std::array<VkWriteDescriptorSet, 9> descriptorWrites = {};
+    VkDescriptorBufferInfo counterBufferInfo = {};
+    counterBufferInfo.buffer = counterBuffer;
+    counterBufferInfo.offset = 0;
+    counterBufferInfo.range = VK_WHOLE_SIZE;
+
+    VkDescriptorImageInfo imageInfoLightVolume = {};
+    imageInfoLightVolume.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageInfoLightVolume.imageView = textures3D[2]->textureImageView;
+    imageInfoLightVolume.sampler = textures3D[2]->textureSampler;
+
+    VkDescriptorBufferInfo temporalBufferInfo = {};
+    temporalBufferInfo.buffer = uniformRing->getBuffer();
+    temporalBufferInfo.offset = offsetof(FrameUniforms, temporal);
+    temporalBufferInfo.range = sizeof(UniformTemporalObject);
+
+
+    std::array<VkWriteDescriptorSet, 14> descriptorWrites = {};
 
 
     descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
     descriptorWrites[0].dstSet = descriptorSet;
     descriptorWrites[0].dstBinding = 0;
     descriptorWrites[0].dstArrayElement = 0;
-    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     descriptorWrites[0].descriptorCount = 1;
     descriptorWrites[0].pBufferInfo = &cameraBufferInfo;
 
@@ -844,7 +959,7 @@ void ComputeShader::createDescriptorSet() {
     descriptorWrites[1].dstSet = descriptorSet;
     descriptorWrites[1].dstBinding = 1;
     descriptorWrites[1].dstArrayElement = 0;
-    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     descriptorWrites[1].descriptorCount = 1;
     descriptorWrites[1].pBufferInfo = &cameraBufferInfoPrev;
 
@@ -852,7 +967,7 @@ void ComputeShader::createDescriptorSet() {
     descriptorWrites[2].dstSet = descriptorSet;
     descriptorWrites[2].dstBinding = 2;
     descriptorWrites[2].dstArrayElement = 0;
-    descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     descriptorWrites[2].descriptorCount = 1;
     descriptorWrites[2].pBufferInfo = &sunBufferInfo;
 
@@ -860,7 +975,7 @@ void ComputeShader::createDescriptorSet() {
     descriptorWrites[3].dstSet = descriptorSet;
     descriptorWrites[3].dstBinding = 3;
     descriptorWrites[3].dstArrayElement = 0;
-    descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     descriptorWrites[3].descriptorCount = 1;
     descriptorWrites[3].pBufferInfo = &skyBufferInfo;
 
@@ -903,6 +1018,46 @@ void ComputeShader::createDescriptorSet() {
     descriptorWrites[8].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     descriptorWrites[8].descriptorCount = 1;
     descriptorWrites[8].pImageInfo = &imageInfo4;
+
+    descriptorWrites[9].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[9].dstSet = descriptorSet;
+    descriptorWrites[9].dstBinding = 9;
+    descriptorWrites[9].dstArrayElement = 0;
+    descriptorWrites[9].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrites[9].descriptorCount = 1;
+    descriptorWrites[9].pImageInfo = &imageInfoSkipMap;
+
+    descriptorWrites[10].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[10].dstSet = descriptorSet;
+    descriptorWrites[10].dstBinding = 10;
+    descriptorWrites[10].dstArrayElement = 0;
+    descriptorWrites[10].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorWrites[10].descriptorCount = 1;
+    descriptorWrites[10].pBufferInfo = &counterBufferInfo;
+
+    descriptorWrites[11].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[11].dstSet = descriptorSet;
+    descriptorWrites[11].dstBinding = 11;
+    descriptorWrites[11].dstArrayElement = 0;
+    descriptorWrites[11].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrites[11].descriptorCount = 1;
+    descriptorWrites[11].pImageInfo = &imageInfoLightVolume;
+
+    descriptorWrites[12].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[12].dstSet = descriptorSet;
+    descriptorWrites[12].dstBinding = 12;
+    descriptorWrites[12].dstArrayElement = 0;
+    descriptorWrites[12].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    descriptorWrites[12].descriptorCount = 1;
+    descriptorWrites[12].pImageInfo = &imageInfoLightVolume;
+
+    descriptorWrites[13].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[13].dstSet = descriptorSet;
+    descriptorWrites[13].dstBinding = 13;
+    descriptorWrites[13].dstArrayElement = 0;
+    descriptorWrites[13].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    descriptorWrites[13].descriptorCount = 1;
+    descriptorWrites[13].pBufferInfo = &temporalBufferInfo;
     
     vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 }
@@ -919,15 +1074,34 @@ void ComputeShader::createPipeline() {
     shaderStageInfo.module = computeShaderModule;
     shaderStageInfo.pName = "main";
 
+    // constant_id 0 in compute-clouds.comp makes the pipeline bake the light volume, constant_id 1 makes the march read it.
+    // The rest are the local size, the image size and the sample budgets.
+    SpecializationConstants specialization;
+    specialization.setBool(0, false);
+    specialization.setBool(1, settings.lightVolume);
+    specialization.set(2, settings.workgroup.width);
+    specialization.set(3, settings.workgroup.height);
+    specialization.set(4, extent.width);
+    specialization.set(5, extent.height);
+    specialization.set(6, settings.maxSteps);
+    specialization.set(7, settings.lightConeSamples);
+    shaderStageInfo.pSpecializationInfo = specialization.getInfo();
+
     std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { storageSetLayout, storageSetLayout, descriptorSetLayout };
 
+    // the first light volume layer a bake dispatch writes
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(int32_t);
+
     // Create pipeline layout
     VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
     pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts.data();
-    pipelineLayoutInfo.pushConstantRangeCount = 0;
-    pipelineLayoutInfo.pPushConstantRanges = 0;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
     // Create that layout
     if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
@@ -945,59 +1119,128 @@ void ComputeShader::createPipeline() {
     pipelineInfo.basePipelineIndex = -1;
 
     // Create that pipeline
-    if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
+    if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create compute pipeline");
     }
 
+    // the bake dispatches whole layers of the light volume in workgroups of its own size
+    if (settings.lightVolume) {
+        specialization.setBool(0, true);
+        specialization.set(2, LIGHT_VOLUME_WORKGROUP_SIZE);
+        specialization.set(3, LIGHT_VOLUME_WORKGROUP_SIZE);
+        pipelineInfo.stage.pSpecializationInfo = specialization.getInfo();
+        if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &bakePipeline) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create compute pipeline");
+        }
+    }
+
     // No longer need shader module
     vkDestroyShaderModule(device, computeShaderModule, nullptr);
 }
 
+void ComputeShader::bindDescriptorSets(VkCommandBuffer commandBuffer) {
+    if (swappedBuffers) {
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &storageBufferSetB, 0, nullptr);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 1, 1, &storageBufferSetA, 0, nullptr);
+
+    }
+    else {
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &storageBufferSetA, 0, nullptr);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 1, 1, &storageBufferSetB, 0, nullptr);
+
+    }
+
+    // camera, previous camera, sun, sky and temporal
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 2, 1, &descriptorSet, 5, dynamicOffsets.data());
+}
+
+void ComputeShader::cmdBakeLightVolume(VkCommandBuffer commandBuffer, const LightVolumeBake& bake) {
+    if (!settings.lightVolume || bake.layerCount == 0) return;
+
+    // earlier marches read the layers, earlier bakes wrote them
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, bakePipeline);
+    bindDescriptorSets(commandBuffer);
+    int32_t firstLayer = static_cast<int32_t>(bake.firstLayer);
+    vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(int32_t), &firstLayer);
+    vkCmdDispatch(commandBuffer, LIGHT_VOLUME_WIDTH / LIGHT_VOLUME_WORKGROUP_SIZE, LIGHT_VOLUME_WIDTH / LIGHT_VOLUME_WORKGROUP_SIZE, bake.layerCount);
+
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void ComputeShader::cmdMarch(VkCommandBuffer commandBuffer, uint32_t blockSize) {
+    const uint32_t blocksX = (extent.width + blockSize - 1) / blockSize;
+    const uint32_t blocksY = (extent.height + blockSize - 1) / blockSize;
+    vkCmdDispatch(commandBuffer,
+        (blocksX + settings.workgroup.width - 1) / settings.workgroup.width,
+        (blocksY + settings.workgroup.height - 1) / settings.workgroup.height,
+        1);
+}
+
+
 void ComputeShader::createUniformBuffer() {
-    VkDeviceSize bufferSize2 = sizeof(UniformCameraObject);
-    VulkanObject::createBuffer(bufferSize2, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformCameraBuffer, uniformCameraBufferMemory);
-    VulkanObject::createBuffer(bufferSize2, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformCameraBufferPrev, uniformCameraBufferMemoryPrev);
-
-    VkDeviceSize sunBufferSize = sizeof(UniformSunObject);
-    VulkanObject::createBuffer(sunBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformSunBuffer, uniformSunBufferMemory);
-    VkDeviceSize skyBufferSize = sizeof(UniformSkyObject);
-    VulkanObject::createBuffer(skyBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformSkyBuffer, uniformSkyBufferMemory);
+    // the uniforms live in the UniformRing, only the counters need buffers
+    createBuffer(MARCH_COUNTERS * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, counterBuffer, counterBufferMemory);
+    createBuffer(MAX_FRAMES_IN_FLIGHT * MARCH_COUNTERS * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, counterReadbackBuffer, counterReadbackMemory);
+    memset(counterReadbackMemory.mapped, 0, MAX_FRAMES_IN_FLIGHT * MARCH_COUNTERS * sizeof(uint32_t));
 }
 
-void ComputeShader::updateUniformBuffers(UniformCameraObject &cam, UniformCameraObject &camPrev, UniformSkyObject &sky, UniformSunObject &sun) {
-    UniformCameraObject a = cam;
-    UniformSunObject b = sun;
-    UniformSkyObject c = sky;
-    UniformCameraObject dc = camPrev;
-    
-    void* data;
-    vkMapMemory(device, uniformCameraBufferMemory, 0, sizeof(cam), 0, &data);
-    memcpy(data, &cam, sizeof(cam));
-    vkUnmapMemory(device, uniformCameraBufferMemory);
-
-    void* data2;
-    vkMapMemory(device, uniformSkyBufferMemory, 0, sizeof(c), 0, &data2);
-    memcpy(data2, &c, sizeof(c));
-    vkUnmapMemory(device, uniformSkyBufferMemory);
-
-    void* data3;
-    vkMapMemory(device, uniformSunBufferMemory, 0, sizeof(b), 0, &data3);
-    memcpy(data3, &b, sizeof(b));
-    vkUnmapMemory(device, uniformSunBufferMemory);
-
-    void* data4;
-    vkMapMemory(device, uniformCameraBufferMemoryPrev, 0, sizeof(camPrev), 0, &data4);
-    memcpy(data4, &camPrev, sizeof(camPrev));
-    vkUnmapMemory(device, uniformCameraBufferMemoryPrev);
+void ComputeShader::cmdResetCounters(VkCommandBuffer commandBuffer) {
+    // the previous frame's copy has to read the counters before they are cleared
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    vkCmdFillBuffer(commandBuffer, counterBuffer, 0, VK_WHOLE_SIZE, 0);
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void ComputeShader::cmdCopyCounters(VkCommandBuffer commandBuffer) {
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    VkBufferCopy region = {};
+    region.srcOffset = 0;
+    region.dstOffset = currentFrame * MARCH_COUNTERS * sizeof(uint32_t);
+    region.size = MARCH_COUNTERS * sizeof(uint32_t);
+    vkCmdCopyBuffer(commandBuffer, counterBuffer, counterReadbackBuffer, 1, &region);
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+CloudMarchCounters ComputeShader::getCounters(uint32_t frame) const {
+    const uint32_t* slot = static_cast<const uint32_t*>(counterReadbackMemory.mapped) + frame * MARCH_COUNTERS;
+    CloudMarchCounters counters;
+    counters.evaluated = slot[0];
+    counters.skipped = slot[1];
+    counters.remarched = slot[2];
+    counters.deferred = slot[3];
+    return counters;
 }
 
 /// Post Process Shader
 
 void PostProcessShader::cleanupUniforms() {
-    vkDestroyBuffer(device, uniformCameraBuffer, nullptr);
-    vkFreeMemory(device, uniformCameraBufferMemory, nullptr);
-    vkDestroyBuffer(device, uniformSunBuffer, nullptr);
-    vkFreeMemory(device, uniformSunBufferMemory, nullptr);
+    // the uniforms live in the UniformRing
 }
 
 void PostProcessShader::createDescriptorSetLayout() {
@@ -1022,9 +1265,9 @@ void PostProcessShader::createDescriptorPool() {
 
     poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     poolSizes[0].descriptorCount = 1;
-    poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER; // camera
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC; // camera
     poolSizes[1].descriptorCount = 1;
-    poolSizes[2].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER; // sun
+    poolSizes[2].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC; // sun
     poolSizes[2].descriptorCount = 1;
 
     VkDescriptorPoolCreateInfo poolInfo = {};
@@ -1051,13 +1294,13 @@ void PostProcessShader::createDescriptorSet() {
     }
 
     VkDescriptorBufferInfo cameraBufferInfo = {};
-    cameraBufferInfo.buffer = uniformCameraBuffer;
-    cameraBufferInfo.offset = 0;
+    cameraBufferInfo.buffer = uniformRing->getBuffer();
+    cameraBufferInfo.offset = offsetof(FrameUniforms, camera);
     cameraBufferInfo.range = sizeof(UniformCameraObject);
 
     VkDescriptorBufferInfo sunBufferInfo = {};
-    sunBufferInfo.buffer = uniformSunBuffer;
-    sunBufferInfo.offset = 0;
+    sunBufferInfo.buffer = uniformRing->getBuffer();
+    sunBufferInfo.offset = offsetof(FrameUniforms, sun);
     sunBufferInfo.range = sizeof(UniformSunObject);
 
     std::array<VkWriteDescriptorSet, 3> descriptorWrites = {};
@@ -1074,7 +1317,7 @@ void PostProcessShader::createDescriptorSet() {
     descriptorWrites[1].dstSet = descriptorSet;
     descriptorWrites[1].dstBinding = 1;
     descriptorWrites[1].dstArrayElement = 0;
-    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     descriptorWrites[1].descriptorCount = 1;
     descriptorWrites[1].pBufferInfo = &cameraBufferInfo;
 
@@ -1082,7 +1325,7 @@ void PostProcessShader::createDescriptorSet() {
     descriptorWrites[2].dstSet = descriptorSet;
     descriptorWrites[2].dstBinding = 2;
     descriptorWrites[2].dstArrayElement = 0;
-    descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     descriptorWrites[2].descriptorCount = 1;
     descriptorWrites[2].pBufferInfo = &sunBufferInfo;
 
@@ -1237,7 +1480,7 @@ void PostProcessShader::createPipeline() {
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
     pipelineInfo.basePipelineIndex = -1; // Optional
 
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
+    if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
         throw std::runtime_error("failed to create graphics pipeline!");
     }
 
@@ -1246,26 +1489,7 @@ void PostProcessShader::createPipeline() {
 }
 
 void PostProcessShader::createUniformBuffer() {
-    VkDeviceSize camBufferSize = sizeof(UniformCameraObject);
-    VulkanObject::createBuffer(camBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformCameraBuffer, uniformCameraBufferMemory);
-
-    VkDeviceSize sunBufferSize = sizeof(UniformSunObject);
-    VulkanObject::createBuffer(sunBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformSunBuffer, uniformSunBufferMemory);
-}
-
-void PostProcessShader::updateUniformBuffers(UniformCameraObject &cam, UniformSunObject &sun) {
-    UniformCameraObject a = cam;
-    UniformSunObject b = sun;
-
-    void* data;
-    vkMapMemory(device, uniformCameraBufferMemory, 0, sizeof(cam), 0, &data);
-    memcpy(data, &cam, sizeof(cam));
-    vkUnmapMemory(device, uniformCameraBufferMemory);
-
-    void* data2;
-    vkMapMemory(device, uniformSunBufferMemory, 0, sizeof(b), 0, &data2);
-    memcpy(data2, &b, sizeof(b));
-    vkUnmapMemory(device, uniformSunBufferMemory);
+    // the uniforms live in the UniformRing
 }
 
 
@@ -1273,23 +1497,14 @@ void PostProcessShader::updateUniformBuffers(UniformCameraObject &cam, UniformSu
 
 
 void ReprojectShader::cleanupUniforms() {
-    
-    vkDestroyBuffer(device, uniformSkyBuffer, nullptr);
-    vkFreeMemory(device, uniformSkyBufferMemory, nullptr);
-    vkDestroyBuffer(device, uniformSunBuffer, nullptr);
-    vkFreeMemory(device, uniformSunBufferMemory, nullptr);
-    vkDestroyBuffer(device, uniformCameraBuffer, nullptr);
-    vkFreeMemory(device, uniformCameraBufferMemory, nullptr);
-    vkDestroyBuffer(device, uniformCameraBufferPrev, nullptr);
-    vkFreeMemory(device, uniformCameraBufferMemoryPrev, nullptr);
-
     vkDestroyDescriptorSetLayout(device, uniformSetLayout, nullptr);
 }
 
 void ReprojectShader::createDescriptorSetLayout() {
     VkDescriptorSetLayoutBinding samplerLayoutBinding = UniformStorageImageObject::getLayoutBinding(0);
+    VkDescriptorSetLayoutBinding ageLayoutBinding = UniformStorageImageObject::getLayoutBinding(1);
 
-    std::array<VkDescriptorSetLayoutBinding, 1> bindings = { samplerLayoutBinding };
+    std::array<VkDescriptorSetLayoutBinding, 2> bindings = { samplerLayoutBinding, ageLayoutBinding };
     VkDescriptorSetLayoutCreateInfo layoutInfo = {};
     layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
     layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
@@ -1317,36 +1532,12 @@ void ReprojectShader::createDescriptorSetLayout() {
 
 }
 
-void ReprojectShader::updateUniformBuffers(UniformCameraObject& cam, UniformCameraObject& camPrev, UniformSkyObject& sky, UniformSunObject& sun) {
-    
-    void* data;
-    vkMapMemory(device, uniformCameraBufferMemory, 0, sizeof(cam), 0, &data);
-    memcpy(data, &cam, sizeof(cam));
-    vkUnmapMemory(device, uniformCameraBufferMemory);
-
-    void* data2;
-    vkMapMemory(device, uniformSkyBufferMemory, 0, sizeof(sky), 0, &data2);
-    memcpy(data2, &sky, sizeof(sky));
-    vkUnmapMemory(device, uniformSkyBufferMemory);
-
-    void* data3;
-    vkMapMemory(device, uniformSunBufferMemory, 0, sizeof(sun), 0, &data3);
-    memcpy(data3, &sun, sizeof(sun));
-    vkUnmapMemory(device, uniformSunBufferMemory);
-
-    void* data4;
-    vkMapMemory(device, uniformCameraBufferMemoryPrev, 0, sizeof(camPrev), 0, &data4);
-    memcpy(data4, &camPrev, sizeof(camPrev));
-    vkUnmapMemory(device, uniformCameraBufferMemoryPrev);
-
-}
-
 void ReprojectShader::createDescriptorPool() {
     std::array<VkDescriptorPoolSize, 2> poolSizes = {};
 
     poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-    poolSizes[0].descriptorCount = 2;
-    poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    poolSizes[0].descriptorCount = 4;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     poolSizes[1].descriptorCount = 4;
 
     VkDescriptorPoolCreateInfo poolInfo = {};
@@ -1378,7 +1569,12 @@ void ReprojectShader::createDescriptorSet() {
     imageInfo.imageView = textures[0]->textureImageView;
     imageInfo.sampler = textures[0]->textureSampler;
 
-    std::array<VkWriteDescriptorSet, 1> descriptorWrites = {};
+    VkDescriptorImageInfo ageInfo = {};
+    ageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    ageInfo.imageView = textures[2]->textureImageView;
+    ageInfo.sampler = textures[2]->textureSampler;
+
+    std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
 
     descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
     descriptorWrites[0].dstSet = descriptorSet;
@@ -1388,6 +1584,14 @@ void ReprojectShader::createDescriptorSet() {
     descriptorWrites[0].descriptorCount = 1;
     descriptorWrites[0].pImageInfo = &imageInfo;
 
+    descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[1].dstSet = descriptorSet;
+    descriptorWrites[1].dstBinding = 1;
+    descriptorWrites[1].dstArrayElement = 0;
+    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    descriptorWrites[1].descriptorCount = 1;
+    descriptorWrites[1].pImageInfo = &ageInfo;
+
     vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 
     // B
@@ -1398,8 +1602,11 @@ void ReprojectShader::createDescriptorSet() {
     // Swapped background image
     imageInfo.imageView = textures[1]->textureImageView;
     imageInfo.sampler = textures[1]->textureSampler;
+    ageInfo.imageView = textures[3]->textureImageView;
+    ageInfo.sampler = textures[3]->textureSampler;
 
     descriptorWrites[0].dstSet = descriptorSetB;
+    descriptorWrites[1].dstSet = descriptorSetB;
 
     vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 
@@ -1416,23 +1623,23 @@ void ReprojectShader::createDescriptorSet() {
     }
 
     VkDescriptorBufferInfo cameraBufferInfo = {};
-    cameraBufferInfo.buffer = uniformCameraBuffer;
-    cameraBufferInfo.offset = 0;
+    cameraBufferInfo.buffer = uniformRing->getBuffer();
+    cameraBufferInfo.offset = offsetof(FrameUniforms, camera);
     cameraBufferInfo.range = sizeof(UniformCameraObject);
 
     VkDescriptorBufferInfo cameraBufferInfoPrev = {};
-    cameraBufferInfoPrev.buffer = uniformCameraBufferPrev;
-    cameraBufferInfoPrev.offset = 0;
+    cameraBufferInfoPrev.buffer = uniformRing->getBuffer();
+    cameraBufferInfoPrev.offset = offsetof(FrameUniforms, cameraPrev);
     cameraBufferInfoPrev.range = sizeof(UniformCameraObject);
 
     VkDescriptorBufferInfo sunBufferInfo = {};
-    sunBufferInfo.buffer = uniformSunBuffer;
-    sunBufferInfo.offset = 0;
+    sunBufferInfo.buffer = uniformRing->getBuffer();
+    sunBufferInfo.offset = offsetof(FrameUniforms, sun);
     sunBufferInfo.range = sizeof(UniformSunObject);
 
     VkDescriptorBufferInfo skyBufferInfo = {};
-    skyBufferInfo.buffer = uniformSkyBuffer;
-    skyBufferInfo.offset = 0;
+    skyBufferInfo.buffer = uniformRing->getBuffer();
+    skyBufferInfo.offset = offsetof(FrameUniforms, sky);
     skyBufferInfo.range = sizeof(UniformSkyObject);
 
     std::array<VkWriteDescriptorSet, 4> descriptorWritesU = {};
@@ -1441,7 +1648,7 @@ void ReprojectShader::createDescriptorSet() {
     descriptorWritesU[0].dstSet = uniformSet;
     descriptorWritesU[0].dstBinding = 0;
     descriptorWritesU[0].dstArrayElement = 0;
-    descriptorWritesU[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    descriptorWritesU[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     descriptorWritesU[0].descriptorCount = 1;
     descriptorWritesU[0].pBufferInfo = &cameraBufferInfo;
 
@@ -1449,7 +1656,7 @@ void ReprojectShader::createDescriptorSet() {
     descriptorWritesU[1].dstSet = uniformSet;
     descriptorWritesU[1].dstBinding = 1;
     descriptorWritesU[1].dstArrayElement = 0;
-    descriptorWritesU[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    descriptorWritesU[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     descriptorWritesU[1].descriptorCount = 1;
     descriptorWritesU[1].pBufferInfo = &cameraBufferInfoPrev;
 
@@ -1457,7 +1664,7 @@ void ReprojectShader::createDescriptorSet() {
     descriptorWritesU[2].dstSet = uniformSet;
     descriptorWritesU[2].dstBinding = 2;
     descriptorWritesU[2].dstArrayElement = 0;
-    descriptorWritesU[2].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    descriptorWritesU[2].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     descriptorWritesU[2].descriptorCount = 1;
     descriptorWritesU[2].pBufferInfo = &sunBufferInfo;
 
@@ -1465,7 +1672,7 @@ void ReprojectShader::createDescriptorSet() {
     descriptorWritesU[3].dstSet = uniformSet;
     descriptorWritesU[3].dstBinding = 3;
     descriptorWritesU[3].dstArrayElement = 0;
-    descriptorWritesU[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    descriptorWritesU[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     descriptorWritesU[3].descriptorCount = 1;
     descriptorWritesU[3].pBufferInfo = &skyBufferInfo;
 
@@ -1474,14 +1681,7 @@ void ReprojectShader::createDescriptorSet() {
 
 
 void ReprojectShader::createUniformBuffer() {
-
-    VkDeviceSize skyBufferSize = sizeof(UniformSkyObject);
-    VulkanObject::createBuffer(skyBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformSkyBuffer, uniformSkyBufferMemory);
-    VkDeviceSize sunBufferSize = sizeof(UniformSunObject);
-    VulkanObject::createBuffer(sunBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformSunBuffer, uniformSunBufferMemory);
-    VkDeviceSize cameraBufferSize = sizeof(UniformCameraObject);
-    VulkanObject::createBuffer(cameraBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformCameraBuffer, uniformCameraBufferMemory);
-    VulkanObject::createBuffer(cameraBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformCameraBufferPrev, uniformCameraBufferMemoryPrev);
+    // the uniforms live in the UniformRing
 }
 
 void ReprojectShader::createPipeline() {
@@ -1495,6 +1695,12 @@ void ReprojectShader::createPipeline() {
     shaderStageInfo.module = computeShaderModule;
     shaderStageInfo.pName = "main";
 
+    // constant_id 0 and 1 in reproject.comp are the local size
+    SpecializationConstants specialization;
+    specialization.set(0, workgroup.width);
+    specialization.set(1, workgroup.height);
+    shaderStageInfo.pSpecializationInfo = specialization.getInfo();
+
     std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { descriptorSetLayout, descriptorSetLayout, uniformSetLayout };
 
     // Create pipeline layout
@@ -1521,7 +1727,7 @@ void ReprojectShader::createPipeline() {
     pipelineInfo.basePipelineIndex = -1;
 
     // Create that pipeline
-    if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
+    if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create compute pipeline");
     }
 
@@ -2,6 +2,11 @@
 #include "Texture.h"
 #include "Geometry.h"
 #include "SkyManager.h"
+#include "UniformRing.h"
+#include "CloudLightVolume.h"
+#include "TemporalScheduler.h"
+#include "CloudMarchLanes.h"
+#include <cstddef>
 #include <fstream>
 
 // Need to move this
@@ -21,34 +26,18 @@ static std::vector<char> readFile(const std::string& filename) {
     return buffer;
 }
 
-struct UniformCameraObject {
-    glm::mat4 view;
-    glm::mat4 proj;
-    glm::vec4 cameraPosition;
-    glm::vec4 cameraParams;
-
-    static VkDescriptorSetLayoutBinding getLayoutBinding(uint32_t bind)
-    {
-        VkDescriptorSetLayoutBinding uboLayoutBinding = {};
-        uboLayoutBinding.binding = bind;
-        uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        uboLayoutBinding.descriptorCount = 1;
-        uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
-        uboLayoutBinding.pImmutableSamplers = nullptr;
-
-        return uboLayoutBinding;
-    }
-};
-
 struct UniformModelObject {
     glm::mat4 model;
     glm::mat4 invTranspose;
+    // dequantizes VERTEX_PACKED positions into model space, see Geometry::getPositionOffset
+    glm::vec4 positionOffset;
+    glm::vec4 positionScale;
 
     static VkDescriptorSetLayoutBinding getLayoutBinding(uint32_t bind)
     {
         VkDescriptorSetLayoutBinding uboLayoutBinding = {};
         uboLayoutBinding.binding = bind;
-        uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
         uboLayoutBinding.descriptorCount = 1;
         uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
         uboLayoutBinding.pImmutableSamplers = nullptr;
@@ -72,6 +61,41 @@ struct UniformStorageImageObject {
     }
 };
 
+// Everything the shaders read from uniforms in one frame, in a single block of the UniformRing.
+// Members start on 256 byte boundaries, the largest minUniformBufferOffsetAlignment allowed, so each can be bound on its own.
+struct FrameUniforms {
+    alignas(256) UniformCameraObject camera;
+    alignas(256) UniformCameraObject cameraPrev;
+    alignas(256) UniformModelObject model;
+    alignas(256) UniformSunObject sun;
+    alignas(256) UniformSkyObject sky;
+    alignas(256) UniformTemporalObject temporal;
+};
+
+// Values of the constant_id specialization constants of a shader stage. Every constant is 32 bits wide:
+// VkBool32 for bool, int32_t or uint32_t for int and uint, including the local_size_*_id of compute shaders.
+class SpecializationConstants
+{
+private:
+    std::vector<VkSpecializationMapEntry> entries;
+    std::vector<uint32_t> data;
+    VkSpecializationInfo info = {};
+public:
+    // Adds a constant, or replaces its value if it was set before
+    void set(uint32_t constantId, uint32_t value);
+    void setBool(uint32_t constantId, bool value) { set(constantId, value ? VK_TRUE : VK_FALSE); }
+
+    // For VkPipelineShaderStageCreateInfo::pSpecializationInfo, valid until the next constant is added
+    const VkSpecializationInfo* getInfo();
+};
+
+// Pipeline-time constants of the cloud march in Shaders/compute-clouds.comp. maxSteps and lightConeSamples come from
+// CloudMarchBudget, which CloudRendererCPU follows as well.
+struct CloudMarchSettings : CloudMarchBudget {
+    VkExtent2D workgroup = { 32, 32 }; // local size, see VulkanApplication::tuneWorkgroups
+    bool lightVolume = false;          // light the samples from the light volume instead of the cone
+};
+
 class Shader: public VulkanObject
 {
 protected:
@@ -89,12 +113,21 @@ protected:
 
     VkShaderModule createShaderModule(const std::vector<char>& code, VkDevice device);
 
+    // Shared by every pipeline, MUST set before the first shader is created to be of any use
+    static VkPipelineCache pipelineCache;
+
     std::vector<std::string> shaderFilePaths;
 
     VkDescriptorSetLayout descriptorSetLayout;
     VkDescriptorPool descriptorPool;
     VkDescriptorSet descriptorSet;
 
+    // Uniform bindings are dynamic and point into the shared ring, MUST set before setup for shaders with uniforms.
+    // Every dynamic binding of a shader uses the same offset, the start of the current frame's FrameUniforms.
+    UniformRing* uniformRing = nullptr;
+    uint32_t currentFrame = 0;
+    std::array<uint32_t, 5> dynamicOffsets = {};
+
     VkPipeline pipeline;
     VkPipelineLayout pipelineLayout;
 
@@ -125,6 +158,14 @@ public:
     void addTexture(Texture* tex) { textures.push_back(tex); }
     void addTexture3D(Texture3D* tex) { textures3D.push_back(tex); }
 
+    static void setPipelineCache(VkPipelineCache cache) { pipelineCache = cache; }
+
+    // Selects the frame of the uniform ring bound by bindShader
+    void setFrame(uint32_t frame) {
+        currentFrame = frame;
+        if (uniformRing != nullptr) dynamicOffsets.fill(uniformRing->getFrameOffset(frame));
+    }
+
     virtual void bindShader(VkCommandBuffer& commandBuffer) = 0;
 };
 
@@ -146,6 +187,9 @@ class MeshShader : public Shader
 private:
     
 protected:
+    // Layout of the vertex buffers this pipeline draws
+    VertexFormat vertexFormat = VERTEX_FLOAT;
+
     virtual void createDescriptorSetLayout();
     virtual void createDescriptorPool();
     virtual void createDescriptorSet();
@@ -154,20 +198,6 @@ protected:
 
     virtual void createPipeline();
 
-    UniformCameraObject cameraUniforms;
-    UniformModelObject modelUniforms;
-    UniformSunObject sunUniforms;
-    UniformSkyObject skyUniforms;
-
-    VkBuffer uniformCameraBuffer;
-    VkDeviceMemory uniformCameraBufferMemory;
-    VkBuffer uniformModelBuffer;
-    VkDeviceMemory uniformModelBufferMemory;
-    VkBuffer uniformSunBuffer;
-    VkDeviceMemory uniformSunBufferMemory;
-    VkBuffer uniformSkyBuffer;
-    VkDeviceMemory uniformSkyBufferMemory;
-
     virtual void cleanupUniforms();
 public:
     void setupShader(std::string vertPath, std::string fragPath) {
@@ -182,9 +212,11 @@ public:
     }
     
     MeshShader(VkDevice device, VkPhysicalDevice physicalDevice, VkCommandPool commandPool, VkQueue queue, VkExtent2D extent) : Shader(device, physicalDevice, commandPool, queue, extent) {}
-    MeshShader(VkDevice device, VkPhysicalDevice physicalDevice, VkCommandPool commandPool, VkQueue queue, VkExtent2D extent, VkRenderPass *renderPass, std::string vertPath, std::string fragPath, Texture* tex, Texture* pbrTex, Texture* normalTex, Texture* coverageTex, Texture3D* loResCloudShape) :
+    MeshShader(VkDevice device, VkPhysicalDevice physicalDevice, VkCommandPool commandPool, VkQueue queue, VkExtent2D extent, VkRenderPass *renderPass, UniformRing* uniforms, VertexFormat vertexFormat, std::string vertPath, std::string fragPath, Texture* tex, Texture* pbrTex, Texture* normalTex, Texture* coverageTex, Texture3D* loResCloudShape) :
         Shader(device, physicalDevice, commandPool, queue, extent) {
         this->renderPass = renderPass;
+        this->uniformRing = uniforms;
+        this->vertexFormat = vertexFormat;
         addTexture(tex);
         addTexture(pbrTex);
         addTexture(normalTex);
@@ -195,28 +227,9 @@ public:
 
     virtual ~MeshShader() { cleanupUniforms(); }
 
-    void updateUniformBuffers(UniformCameraObject cam, UniformModelObject model, UniformSunObject sun, UniformSkyObject sky) {
-        void* data;
-        vkMapMemory(device, uniformCameraBufferMemory, 0, sizeof(cam), 0, &data);
-        memcpy(data, &cam, sizeof(cam));
-        vkUnmapMemory(device, uniformCameraBufferMemory);
-
-        vkMapMemory(device, uniformModelBufferMemory, 0, sizeof(model), 0, &data);
-        memcpy(data, &model, sizeof(model));
-        vkUnmapMemory(device, uniformModelBufferMemory);
-
-        vkMapMemory(device, uniformSunBufferMemory, 0, sizeof(sun), 0, &data);
-        memcpy(data, &sun, sizeof(sun));
-        vkUnmapMemory(device, uniformSunBufferMemory);
-
-        vkMapMemory(device, uniformSkyBufferMemory, 0, sizeof(sky), 0, &data);
-        memcpy(data, &sky, sizeof(sky));
-        vkUnmapMemory(device, uniformSkyBufferMemory);
-    }
-
     void bindShader(VkCommandBuffer& commandBuffer) override {
         vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 4, dynamicOffsets.data());
     }
 };
 
@@ -240,7 +253,8 @@ protected:
     virtual void cleanupUniforms();
 
     VkDescriptorSet descriptorSetB; // draws a different texture every other frame
-    bool swappedBuffers = false;
+    // Starts out of phase with the compute shaders, so each frame samples the image they are not writing
+    bool swappedBuffers = true;
 public:
     void setupShader(std::string vertPath, std::string fragPath) {
         shaderFilePaths.push_back(vertPath);
@@ -260,7 +274,6 @@ public:
         addTexture(texA);
         addTexture(texB);
         setupShader(vertPath, fragPath);
-        swappedBuffers = false;
     }
 
     virtual ~BackgroundShader() { cleanupUniforms(); }
@@ -300,17 +313,6 @@ protected:
 
     UniformStorageImageObject storageImageUniform;
     UniformStorageImageObject storageImageUniformPrev;
-    UniformCameraObject cameraUniforms;
-
-    VkBuffer uniformCameraBuffer;
-    VkDeviceMemory uniformCameraBufferMemory;
-    VkBuffer uniformCameraBufferPrev;
-    VkDeviceMemory uniformCameraBufferMemoryPrev;
-
-    VkBuffer uniformSunBuffer;
-    VkDeviceMemory uniformSunBufferMemory;
-    VkBuffer uniformSkyBuffer;
-    VkDeviceMemory uniformSkyBufferMemory;
 
     // need sets to ping-pong image buffers
     VkDescriptorSetLayout storageSetLayout;
@@ -321,6 +323,20 @@ protected:
     void createStorageDescriptorSets();
 
     bool swappedBuffers = false;
+
+    // CloudMarchCounters of the march, summed with atomics in a device local buffer, then copied into one slot per
+    // frame in flight of a host visible one
+    static const uint32_t MARCH_COUNTERS = 4;
+    VkBuffer counterBuffer;
+    DeviceAllocation counterBufferMemory;
+    VkBuffer counterReadbackBuffer;
+    DeviceAllocation counterReadbackMemory;
+
+    // Second pipeline of the same shader that bakes the light volume, only created with settings.lightVolume
+    CloudMarchSettings settings;
+    VkPipeline bakePipeline = VK_NULL_HANDLE;
+
+    void bindDescriptorSets(VkCommandBuffer commandBuffer);
 public:
     void setupShader(std::string path) {
         shaderFilePaths.push_back(path);
@@ -336,10 +352,12 @@ public:
 
     ComputeShader(VkDevice device, VkPhysicalDevice physicalDevice, VkCommandPool commandPool, VkQueue queue, VkExtent2D extent) : Shader(device, physicalDevice, commandPool, queue, extent) {}
     ComputeShader(VkDevice device, VkPhysicalDevice physicalDevice, VkCommandPool commandPool, VkQueue queue, VkExtent2D extent,
-                  VkRenderPass *renderPass, std::string path, Texture* storageTex, Texture* storageTexPrev, Texture* placementTex, Texture* nightSkyTex, Texture* curlTexture, Texture3D* lowResCloudShapeTex, Texture3D* hiResCloudShapeTex) :
+                  VkRenderPass *renderPass, UniformRing* uniforms, std::string path, Texture* storageTex, Texture* storageTexPrev, Texture* placementTex, Texture* nightSkyTex, Texture* curlTexture, Texture3D* lowResCloudShapeTex, Texture3D* hiResCloudShapeTex,
+                  Texture* skipMapTex, Texture3D* lightVolumeTex, const CloudMarchSettings& settings, Texture* ageTex, Texture* ageTexPrev) :
 
         Shader(device, physicalDevice, commandPool, queue, extent) {
         this->renderPass = renderPass;
+        this->uniformRing = uniforms;
         // Note: This texture is intended to be written to. In this application, it is set to be the sampled texture of a separate BackgroundShader.
         addTexture(storageTex);
         addTexture(storageTexPrev);
@@ -348,30 +366,37 @@ public:
         addTexture(curlTexture);
         addTexture3D(lowResCloudShapeTex);
         addTexture3D(hiResCloudShapeTex);
+        addTexture(skipMapTex);
+        addTexture3D(lightVolumeTex);
+        addTexture(ageTex);
+        addTexture(ageTexPrev);
+        this->settings = settings;
         setupShader(path);
         swappedBuffers = false;
     }
 
     virtual ~ComputeShader() { cleanupUniforms(); }
 
-    void updateUniformBuffers(UniformCameraObject& cam, UniformCameraObject& camPrev, UniformSkyObject& sky, UniformSunObject& sun);
-    void bindShader(VkCommandBuffer& commandBuffer) override {
+    // Record around the dispatch: zero the counters before it, copy them into the current frame's slot after it
+    void cmdResetCounters(VkCommandBuffer commandBuffer);
+    void cmdCopyCounters(VkCommandBuffer commandBuffer);
+    // Counters of the last frame that used this slot. Only valid once its fence has signaled.
+    CloudMarchCounters getCounters(uint32_t frame) const;
 
-        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
-        
-        if (swappedBuffers) {
-            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &storageBufferSetB, 0, nullptr);
-            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 1, 1, &storageBufferSetA, 0, nullptr);
+    // Bakes a range of light volume layers, with barriers against the march of the previous and of this frame.
+    // Record before bindShader. Does nothing without settings.lightVolume or layers.
+    void cmdBakeLightVolume(VkCommandBuffer commandBuffer, const LightVolumeBake& bake);
 
-        }
-        else {
-            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &storageBufferSetA, 0, nullptr);
-            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 1, 1, &storageBufferSetB, 0, nullptr);
+    // One invocation per blockSize x blockSize block of the extent, including the partial blocks at the right and
+    // bottom edges. Record after bindShader.
+    void cmdMarch(VkCommandBuffer commandBuffer, uint32_t blockSize);
 
-        }
+    const CloudMarchSettings& getSettings() const { return settings; }
 
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 2, 1, &descriptorSet, 0, nullptr);
+    void bindShader(VkCommandBuffer& commandBuffer) override {
 
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+        bindDescriptorSets(commandBuffer);
         swappedBuffers = !swappedBuffers;
     }
 };
@@ -398,16 +423,7 @@ protected:
     VkDescriptorSetLayout uniformSetLayout;
     VkDescriptorSet uniformSet;
 
-    VkBuffer uniformCameraBuffer;
-    VkDeviceMemory uniformCameraBufferMemory;
-    VkBuffer uniformCameraBufferPrev;
-    VkDeviceMemory uniformCameraBufferMemoryPrev;
-
-    VkBuffer uniformSkyBuffer;
-    VkDeviceMemory uniformSkyBufferMemory;
-
-    VkBuffer uniformSunBuffer;
-    VkDeviceMemory uniformSunBufferMemory;
+    VkExtent2D workgroup = { 32, 32 }; // local size, see VulkanApplication::tuneWorkgroups
 public:
     void setupShader(std::string path) {
         shaderFilePaths.push_back(path);
@@ -420,19 +436,23 @@ public:
     }
 
     ReprojectShader(VkDevice device, VkPhysicalDevice physicalDevice, VkCommandPool commandPool, VkQueue queue, VkExtent2D extent) : Shader(device, physicalDevice, commandPool, queue, extent) {}
-    ReprojectShader(VkDevice device, VkPhysicalDevice physicalDevice, VkCommandPool commandPool, VkQueue queue, VkExtent2D extent, VkRenderPass *renderPass, std::string shaderPath, Texture* texA, Texture* texB) :
+    // ageA and ageB hold the age of every pixel of texA and texB, see TemporalScheduler.h
+    ReprojectShader(VkDevice device, VkPhysicalDevice physicalDevice, VkCommandPool commandPool, VkQueue queue, VkExtent2D extent, VkRenderPass *renderPass, UniformRing* uniforms, std::string shaderPath, Texture* texA, Texture* texB,
+                    Texture* ageA, Texture* ageB, VkExtent2D workgroup) :
         Shader(device, physicalDevice, commandPool, queue, extent) {
         this->renderPass = renderPass;
+        this->uniformRing = uniforms;
+        this->workgroup = workgroup;
         addTexture(texA);
         addTexture(texB);
+        addTexture(ageA);
+        addTexture(ageB);
         setupShader(shaderPath);
         swappedBuffers = false;
     }
 
     virtual ~ReprojectShader() { cleanupUniforms(); }
 
-    void updateUniformBuffers(UniformCameraObject& cam, UniformCameraObject& camPrev, UniformSkyObject& sky, UniformSunObject& sun);
-
     void bindShader(VkCommandBuffer& commandBuffer) override {
         vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
 
@@ -445,10 +465,15 @@ public:
             vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 1, 1, &descriptorSetB, 0, nullptr);
         }
 
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 2, 1, &uniformSet, 0, nullptr);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 2, 1, &uniformSet, 4, dynamicOffsets.data());
 
         swappedBuffers = !swappedBuffers;
     }
+
+    // One invocation per pixel of the extent, record after bindShader
+    void cmdReproject(VkCommandBuffer commandBuffer) {
+        vkCmdDispatch(commandBuffer, (extent.width + workgroup.width - 1) / workgroup.width, (extent.height + workgroup.height - 1) / workgroup.height, 1);
+    }
 };
 
 /*
@@ -479,12 +504,7 @@ protected:
     // TODO: make this class's function virtual and override them in the subclass
     // need a GodRayShader class that has these uniforms:
     
-    // God ray shader uniforms
-    VkBuffer uniformSunBuffer;
-    VkDeviceMemory uniformSunBufferMemory;
-
-    VkBuffer uniformCameraBuffer;
-    VkDeviceMemory uniformCameraBufferMemory;
+    // God ray shader uniforms: sun and camera, read from the uniform ring
 
 public:
     void setupShader(std::string vertPath, std::string fragPath) {
@@ -500,17 +520,17 @@ public:
 
     //TODO: change this constructor to take an image descriptor instead of a texture, or somehow create a texture from the framebuffer image descriptor
     PostProcessShader(VkDevice device, VkPhysicalDevice physicalDevice, VkCommandPool commandPool, VkQueue queue, VkExtent2D extent) : Shader(device, physicalDevice, commandPool, queue, extent) {}
-    PostProcessShader(VkDevice device, VkPhysicalDevice physicalDevice, VkCommandPool commandPool, VkQueue queue, VkExtent2D extent, VkRenderPass *renderPass, std::string vertPath, std::string fragPath, VkDescriptorImageInfo* tex) :
+    PostProcessShader(VkDevice device, VkPhysicalDevice physicalDevice, VkCommandPool commandPool, VkQueue queue, VkExtent2D extent, VkRenderPass *renderPass, UniformRing* uniforms, std::string vertPath, std::string fragPath, VkDescriptorImageInfo* tex) :
         Shader(device, physicalDevice, commandPool, queue, extent), descriptorImageInfo(tex) {
         this->renderPass = renderPass;
+        this->uniformRing = uniforms;
         setupShader(vertPath, fragPath);
     }
 
     virtual ~PostProcessShader() { cleanupUniforms(); }
 
-    void updateUniformBuffers(UniformCameraObject& cam, UniformSunObject& sun);
     void bindShader(VkCommandBuffer& commandBuffer) override {
         vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 2, dynamicOffsets.data());
     }
 };
\ No newline at end of file
@@ -12,6 +12,8 @@ layout(binding = 0) uniform UniformCameraObject {
 layout(binding = 1) uniform UniformModelObject {
     mat4 model;
     mat4 invTranspose;
+    vec4 positionOffset;
+    vec4 positionScale;
 } model;
 
 // all of these components are calculated in SkyManager.h/.cpp
@@ -106,10 +108,11 @@ float cloudTest(in vec3 pos, in float relativeHeight, in vec3 earthCenter, inout
     float density;
 
     vec3 currentProj = getProjectedShellPoint(pos, earthCenter);
-    vec3 cloudInfo = texture(cloudPlacement, 0.00001 * (currentProj.xz - camera.cameraPosition.xz)).xyz;
+    // explicit level, derivatives are undefined inside the shadow march
+    vec3 cloudInfo = textureLod(cloudPlacement, 0.00001 * (currentProj.xz - camera.cameraPosition.xz), 0.0).xyz;
     float layerDensity = cloudLayerDensity(relativeHeight, cloudInfo.z);
 
-    vec4 densityNoise = texture(lowResCloudShape, 0.000057 * vec3(pos));
+    vec4 densityNoise = textureLod(lowResCloudShape, 0.000057 * vec3(pos), 0.0);
 
     density = layerDensity * remapClamped(densityNoise.x, 0.3, 1.0, 0.0, 1.0);
 
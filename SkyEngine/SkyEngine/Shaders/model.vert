@@ -14,11 +14,15 @@ layout(binding = 0) uniform UniformCameraObject {
 layout(binding = 1) uniform UniformModelObject {
     mat4 model;
     mat4 invTranspose;
+    vec4 positionOffset;
+    vec4 positionScale;
 } model;
 
+// VERTEX_PACKED in Geometry.h: positions are unorm fractions of the mesh bounds and normals are octahedral encoded
+layout(constant_id = 0) const bool PACKED_VERTICES = false;
 
+// the color attribute is always white, it is not read
 layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inUV;
 layout(location = 3) in vec3 inNormal;
 
@@ -30,15 +34,30 @@ layout(location = 4) out vec3 fragTangent;
 layout(location = 5) out vec3 fragBitangent;
 layout(location = 6) out vec3 fragPositionWC;
 
+vec3 decodeOctahedral(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
+
 void main() {
-    gl_Position = camera.proj * camera.view * model.model * vec4(inPosition, 1.0);
+    vec3 position = inPosition;
+    vec3 normal = inNormal;
+    if (PACKED_VERTICES) {
+        position = model.positionOffset.xyz + inPosition * model.positionScale.xyz;
+        normal = decodeOctahedral(inNormal.xy);
+    }
+
+    gl_Position = camera.proj * camera.view * model.model * vec4(position, 1.0);
     fragUV = inUV;
-	fragColor = inColor;
+	fragColor = vec3(1.0);
 
-    fragPosition = (camera.view * model.model * vec4(inPosition, 1.0)).xyz;
-    fragPositionWC = (model.model * vec4(inPosition, 1.0)).xyz;
+    fragPosition = (camera.view * model.model * vec4(position, 1.0)).xyz;
+    fragPositionWC = (model.model * vec4(position, 1.0)).xyz;
     
-    fragNormal = normalize((camera.view * vec4(normalize((model.invTranspose * vec4(inNormal, 0.0)).xyz), 0.0)).xyz);
+    fragNormal = normalize((camera.view * vec4(normalize((model.invTranspose * vec4(normal, 0.0)).xyz), 0.0)).xyz);
     vec3 up = normalize((camera.view * vec4(0.001, 1, -0.004, 0.0)).xyz);
     fragTangent = normalize(cross(fragNormal, up));
     fragBitangent = cross(fragNormal, fragTangent);
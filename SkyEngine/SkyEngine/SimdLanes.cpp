@@ -0,0 +1,29 @@
+#include "SimdLanes.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+bool cpuSupportsAVX2() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+
+    // the OS has to save the ymm registers (OSXSAVE, then XCR0 bits 1 and 2) before AVX can be used at all
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    const bool fma = (info[2] & (1 << 12)) != 0;
+    if (!osxsave || !avx || !fma) return false;
+    if ((_xgetbv(0) & 0x6) != 0x6) return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    return false;
+#endif
+}
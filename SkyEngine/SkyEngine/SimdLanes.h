@@ -0,0 +1,186 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+
+// 8-wide float lanes for the CPU-side raymarcher and noise generators.
+// Built with /arch:AVX2 (or -mavx2) every lane group is a single __m256, otherwise it falls back to plain loops
+// that the compiler is free to auto-vectorize. Masks follow the same split.
+// Only some files are built with AVX2 (see SkyEngine.vcxproj), so the two versions live in different namespaces and
+// never share an inline definition at link time, and code built with AVX2 checks cpuSupportsAVX2 before running.
+// For the same reason this header uses no glm or standard library inline functions in the AVX2 version: a file built
+// with AVX2 would emit its own copy of them, which the linker may pick for every other file too.
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_LANES_AVX2 1
+#else
+#define SIMD_LANES_AVX2 0
+#endif
+
+#define SIMD_WIDTH 8
+
+// Whether the CPU and OS support AVX2, for code built with it. Defined in SimdLanes.cpp, which is never built with AVX2.
+bool cpuSupportsAVX2();
+
+#if SIMD_LANES_AVX2
+inline namespace SimdLanesAVX2 {
+#else
+inline namespace SimdLanesScalar {
+#endif
+
+struct mask8 {
+#if SIMD_LANES_AVX2
+    __m256 m;
+    mask8() : m(_mm256_setzero_ps()) {}
+    explicit mask8(__m256 m) : m(m) {}
+    explicit mask8(bool b) : m(b ? _mm256_castsi256_ps(_mm256_set1_epi32(-1)) : _mm256_setzero_ps()) {}
+    int bits() const { return _mm256_movemask_ps(m); }
+    mask8 operator&(const mask8& o) const { return mask8(_mm256_and_ps(m, o.m)); }
+    mask8 operator|(const mask8& o) const { return mask8(_mm256_or_ps(m, o.m)); }
+    // lanes of this mask that are not in o
+    mask8 andNot(const mask8& o) const { return mask8(_mm256_andnot_ps(o.m, m)); }
+#else
+    int b;
+    mask8() : b(0) {}
+    explicit mask8(bool v) : b(v ? 0xFF : 0) {}
+    int bits() const { return b; }
+    mask8 operator&(const mask8& o) const { mask8 r; r.b = b & o.b; return r; }
+    mask8 operator|(const mask8& o) const { mask8 r; r.b = b | o.b; return r; }
+    mask8 andNot(const mask8& o) const { mask8 r; r.b = b & ~o.b; return r; }
+#endif
+    static mask8 fromBits(int laneBits) {
+#if SIMD_LANES_AVX2
+        const __m256i select = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        __m256i laneMask = _mm256_and_si256(_mm256_set1_epi32(laneBits), select);
+        return mask8(_mm256_castsi256_ps(_mm256_cmpeq_epi32(laneMask, select)));
+#else
+        mask8 r; r.b = laneBits & 0xFF; return r;
+#endif
+    }
+    bool any() const { return bits() != 0; }
+    bool lane(int i) const { return (bits() >> i) & 1; }
+    int count() const { int n = 0; for (int b = bits(); b; b &= b - 1) n++; return n; }
+};
+
+struct float8 {
+#if SIMD_LANES_AVX2
+    __m256 v;
+    float8() : v(_mm256_setzero_ps()) {}
+    float8(float s) : v(_mm256_set1_ps(s)) {}
+    explicit float8(__m256 v) : v(v) {}
+    static float8 load(const float* p) { return float8(_mm256_loadu_ps(p)); }
+    void store(float* p) const { _mm256_storeu_ps(p, v); }
+
+    float8 operator+(const float8& o) const { return float8(_mm256_add_ps(v, o.v)); }
+    float8 operator-(const float8& o) const { return float8(_mm256_sub_ps(v, o.v)); }
+    float8 operator*(const float8& o) const { return float8(_mm256_mul_ps(v, o.v)); }
+    float8 operator/(const float8& o) const { return float8(_mm256_div_ps(v, o.v)); }
+    float8 operator-() const { return float8(_mm256_sub_ps(_mm256_setzero_ps(), v)); }
+
+    mask8 operator<(const float8& o) const { return mask8(_mm256_cmp_ps(v, o.v, _CMP_LT_OQ)); }
+    mask8 operator<=(const float8& o) const { return mask8(_mm256_cmp_ps(v, o.v, _CMP_LE_OQ)); }
+    mask8 operator>(const float8& o) const { return mask8(_mm256_cmp_ps(v, o.v, _CMP_GT_OQ)); }
+    mask8 operator>=(const float8& o) const { return mask8(_mm256_cmp_ps(v, o.v, _CMP_GE_OQ)); }
+
+    float operator[](int i) const { alignas(32) float tmp[8]; _mm256_store_ps(tmp, v); return tmp[i]; }
+#else
+    float v[8];
+    float8() { for (int i = 0; i < 8; i++) v[i] = 0.0f; }
+    float8(float s) { for (int i = 0; i < 8; i++) v[i] = s; }
+    static float8 load(const float* p) { float8 r; for (int i = 0; i < 8; i++) r.v[i] = p[i]; return r; }
+    void store(float* p) const { for (int i = 0; i < 8; i++) p[i] = v[i]; }
+
+    float8 operator+(const float8& o) const { float8 r; for (int i = 0; i < 8; i++) r.v[i] = v[i] + o.v[i]; return r; }
+    float8 operator-(const float8& o) const { float8 r; for (int i = 0; i < 8; i++) r.v[i] = v[i] - o.v[i]; return r; }
+    float8 operator*(const float8& o) const { float8 r; for (int i = 0; i < 8; i++) r.v[i] = v[i] * o.v[i]; return r; }
+    float8 operator/(const float8& o) const { float8 r; for (int i = 0; i < 8; i++) r.v[i] = v[i] / o.v[i]; return r; }
+    float8 operator-() const { float8 r; for (int i = 0; i < 8; i++) r.v[i] = -v[i]; return r; }
+
+    mask8 operator<(const float8& o) const { mask8 r; for (int i = 0; i < 8; i++) r.b |= (v[i] < o.v[i]) << i; return r; }
+    mask8 operator<=(const float8& o) const { mask8 r; for (int i = 0; i < 8; i++) r.b |= (v[i] <= o.v[i]) << i; return r; }
+    mask8 operator>(const float8& o) const { mask8 r; for (int i = 0; i < 8; i++) r.b |= (v[i] > o.v[i]) << i; return r; }
+    mask8 operator>=(const float8& o) const { mask8 r; for (int i = 0; i < 8; i++) r.b |= (v[i] >= o.v[i]) << i; return r; }
+
+    float operator[](int i) const { return v[i]; }
+#endif
+};
+
+inline float8 min8(const float8& a, const float8& b) {
+#if SIMD_LANES_AVX2
+    return float8(_mm256_min_ps(a.v, b.v));
+#else
+    float8 r; for (int i = 0; i < 8; i++) r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]; return r;
+#endif
+}
+
+inline float8 max8(const float8& a, const float8& b) {
+#if SIMD_LANES_AVX2
+    return float8(_mm256_max_ps(a.v, b.v));
+#else
+    float8 r; for (int i = 0; i < 8; i++) r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return r;
+#endif
+}
+
+inline float8 sqrt8(const float8& a) {
+#if SIMD_LANES_AVX2
+    return float8(_mm256_sqrt_ps(a.v));
+#else
+    float8 r; for (int i = 0; i < 8; i++) r.v[i] = std::sqrt(a.v[i]); return r;
+#endif
+}
+
+inline float8 floor8(const float8& a) {
+#if SIMD_LANES_AVX2
+    return float8(_mm256_floor_ps(a.v));
+#else
+    float8 r; for (int i = 0; i < 8; i++) r.v[i] = std::floor(a.v[i]); return r;
+#endif
+}
+
+// Per-lane a if the mask is set, otherwise b
+inline float8 select8(const mask8& m, const float8& a, const float8& b) {
+#if SIMD_LANES_AVX2
+    return float8(_mm256_blendv_ps(b.v, a.v, m.m));
+#else
+    float8 r; for (int i = 0; i < 8; i++) r.v[i] = ((m.b >> i) & 1) ? a.v[i] : b.v[i]; return r;
+#endif
+}
+
+inline float8 clamp8(const float8& x, const float8& lo, const float8& hi) { return min8(max8(x, lo), hi); }
+inline float8 mix8(const float8& a, const float8& b, const float8& t) { return a + (b - a) * t; }
+
+// Transcendentals have no AVX2 instruction; evaluate them lane by lane with the C library functions, which are not inline.
+inline float8 exp8(const float8& a) {
+    alignas(32) float tmp[8];
+    a.store(tmp);
+    for (int i = 0; i < 8; i++) tmp[i] = expf(tmp[i]);
+    return float8::load(tmp);
+}
+
+inline float8 pow8(const float8& a, const float8& b) {
+    alignas(32) float ta[8], tb[8];
+    a.store(ta);
+    b.store(tb);
+    for (int i = 0; i < 8; i++) ta[i] = powf(ta[i], tb[i]);
+    return float8::load(ta);
+}
+
+// Structure-of-arrays vec3, one vector per lane
+struct vec3x8 {
+    float8 x, y, z;
+    vec3x8() {}
+    vec3x8(const float8& x, const float8& y, const float8& z) : x(x), y(y), z(z) {}
+    // the same vector in every lane
+    explicit vec3x8(const float* s) : x(s[0]), y(s[1]), z(s[2]) {}
+
+    vec3x8 operator+(const vec3x8& o) const { return vec3x8(x + o.x, y + o.y, z + o.z); }
+    vec3x8 operator-(const vec3x8& o) const { return vec3x8(x - o.x, y - o.y, z - o.z); }
+    vec3x8 operator*(const float8& s) const { return vec3x8(x * s, y * s, z * s); }
+    vec3x8 operator*(const vec3x8& o) const { return vec3x8(x * o.x, y * o.y, z * o.z); }
+};
+
+inline float8 dot8(const vec3x8& a, const vec3x8& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline float8 length8(const vec3x8& a) { return sqrt8(dot8(a, a)); }
+inline vec3x8 normalize8(const vec3x8& a) { return a * (float8(1.0f) / length8(a)); }
+
+} // namespace SimdLanesAVX2 / SimdLanesScalar
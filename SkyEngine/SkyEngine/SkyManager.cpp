@@ -15,13 +15,13 @@ float clamp(float t, float min, float max) {
 void SkyManager::calcSunColor() {
 
     if (sun.direction.y < 0.0f) {
-        sun.color = glm::vec4(0.8f, 0.9f, 1.0f, sun.color.a);
+        sun.color = glm::vec4(0.8f, 0.9f, 1.0f, 1.0f);
     } else {
         glm::vec3 sunset = glm::vec3(2.f, 0.33922, 0.0431f);
         float t = (sun.direction.y) * 13.f;
         t = clamp(t, 0.f, 1.f);
         glm::vec3 color = (1.f - t) * sunset + (t)* glm::vec3(1.f);
-        sun.color = glm::vec4(color, sun.color.a);
+        sun.color = glm::vec4(color, 1.0f);
     }
 }
 
@@ -88,7 +88,7 @@ SkyManager::SkyManager()
         glm::vec4(1, 0.05, 1, 0),
         0.f,
     };
-    sun.color = glm::vec4(1, 1, 1, 0); // TODO. Note, alpha channel has to start at 0 as it serves a much different purpose
+    sun.color = glm::vec4(1, 1, 1, 1); // TODO
     calcSunPosition();
     calcSunColor();
     calcSunIntensity();
@@ -0,0 +1,116 @@
+#include "TemporalScheduler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+namespace {
+    // Rank of every pixel of a size x size Bayer matrix, built by recursively tiling the 2x2 one
+    std::vector<uint32_t> bayerRanks(uint32_t size) {
+        std::vector<uint32_t> ranks = { 0 };
+        for (uint32_t n = 1; n < size; n *= 2) {
+            std::vector<uint32_t> next(4 * n * n);
+            for (uint32_t y = 0; y < 2 * n; y++) {
+                for (uint32_t x = 0; x < 2 * n; x++) {
+                    static const uint32_t quadrant[2][2] = { { 0, 2 }, { 3, 1 } };
+                    next[y * 2 * n + x] = 4 * ranks[(y % n) * n + x % n] + quadrant[y / n][x / n];
+                }
+            }
+            ranks.swap(next);
+        }
+        return ranks;
+    }
+
+    float radicalInverse(uint32_t i, uint32_t base) {
+        float result = 0.0f;
+        float digit = 1.0f / base;
+        for (; i > 0; i /= base, digit /= base) {
+            result += digit * (i % base);
+        }
+        return result;
+    }
+}
+
+void TemporalScheduler::configure(uint32_t blockSize, TemporalOrder order, bool adaptive) {
+    if (blockSize != 2 && blockSize != 4 && blockSize != 8) {
+        throw std::runtime_error("temporal block size must be 2, 4 or 8!");
+    }
+    this->blockSize = blockSize;
+    this->order = order;
+    this->adaptive = adaptive;
+    buildSequence();
+}
+
+void TemporalScheduler::buildSequence() {
+    const uint32_t n = blockSize;
+    sequence.clear();
+    frame = 0;
+
+    if (order == TEMPORAL_BAYER) {
+        std::vector<uint32_t> ranks = bayerRanks(n);
+        sequence.resize(n * n);
+        for (uint32_t i = 0; i < n * n; i++) {
+            sequence[ranks[i]] = glm::ivec2(i % n, i / n);
+        }
+    }
+    else if (order == TEMPORAL_HALTON) {
+        // skips points that land on a pixel already taken until every pixel is
+        std::vector<bool> taken(n * n, false);
+        for (uint32_t i = 1; sequence.size() < n * n; i++) {
+            glm::ivec2 pixel(static_cast<int>(radicalInverse(i, 2) * n), static_cast<int>(radicalInverse(i, 3) * n));
+            if (taken[pixel.y * n + pixel.x]) continue;
+            taken[pixel.y * n + pixel.x] = true;
+            sequence.push_back(pixel);
+        }
+    }
+    else {
+        // Ulichney's void and cluster on the wrapping block: the next pixel is always the one with the least
+        // gaussian weighted energy from the pixels before it, the center of the largest void. On a block this small
+        // many voids are equally large, ties are broken at random (with a fixed seed) so the order is not Bayer's.
+        const float sigma = 1.5f;
+        std::vector<float> energy(n * n, 0.0f);
+        std::vector<bool> taken(n * n, false);
+        std::mt19937 random(n);
+        for (uint32_t rank = 0; rank < n * n; rank++) {
+            float least = INFINITY;
+            for (uint32_t i = 0; i < n * n; i++) {
+                if (!taken[i]) least = std::min(least, energy[i]);
+            }
+            std::vector<uint32_t> voids;
+            for (uint32_t i = 0; i < n * n; i++) {
+                if (!taken[i] && energy[i] <= least + 1e-4f) voids.push_back(i);
+            }
+            uint32_t best = voids[random() % voids.size()];
+            taken[best] = true;
+            glm::ivec2 pixel(best % n, best / n);
+            sequence.push_back(pixel);
+
+            for (uint32_t i = 0; i < n * n; i++) {
+                int dx = std::abs(static_cast<int>(i % n) - pixel.x);
+                int dy = std::abs(static_cast<int>(i / n) - pixel.y);
+                dx = std::min(dx, static_cast<int>(n) - dx);
+                dy = std::min(dy, static_cast<int>(n) - dy);
+                energy[i] += std::exp(-static_cast<float>(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+            }
+        }
+    }
+}
+
+UniformTemporalObject TemporalScheduler::next() {
+    UniformTemporalObject temporal;
+    temporal.offset = sequence[frame];
+    temporal.blockSize = static_cast<int32_t>(blockSize);
+    temporal.remarchBudget = static_cast<int32_t>(getRemarchBudget());
+    frame = (frame + 1) % sequence.size();
+    return temporal;
+}
+
+const char* TemporalScheduler::getOrderName(TemporalOrder order) {
+    switch (order) {
+    case TEMPORAL_BAYER: return "bayer";
+    case TEMPORAL_HALTON: return "halton";
+    case TEMPORAL_BLUE_NOISE: return "blue-noise";
+    default: return "unknown";
+    }
+}
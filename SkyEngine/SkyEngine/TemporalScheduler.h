@@ -0,0 +1,69 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Temporal upsampling of the clouds: the march only updates one pixel of every block per frame, the reprojection
+// carries the rest over from the frames before. Bigger blocks march fewer rays but take longer to converge.
+// The reprojection keeps an age per pixel next to the cloud images: frames since the pixel was last marched, or
+// TEMPORAL_AGE_INVALID once it was carried over from outside the previous view or moved too far to trust.
+#define TEMPORAL_BLOCK_SIZE_MAX 8
+#define TEMPORAL_AGE_INVALID -1.0f
+
+// Order the pixels of a block are visited in
+enum TemporalOrder {
+    TEMPORAL_BAYER = 0,      // ordered dither matrix, consecutive pixels are as far apart as the block allows
+    TEMPORAL_HALTON,         // Halton (2, 3) points snapped to the block
+    TEMPORAL_BLUE_NOISE      // void and cluster ranking, every prefix of the sequence is evenly spread
+};
+
+struct UniformTemporalObject {
+    glm::ivec2 offset;     // pixel of each block marched this frame
+    int32_t blockSize;     // 2, 4 or 8
+    int32_t remarchBudget; // invalid pixels of each block marched besides the scheduled one, 0 unless adaptive
+
+    static VkDescriptorSetLayoutBinding getLayoutBinding(uint32_t bind)
+    {
+        VkDescriptorSetLayoutBinding uboLayoutBinding = {};
+        uboLayoutBinding.binding = bind;
+        uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        uboLayoutBinding.descriptorCount = 1;
+        uboLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        uboLayoutBinding.pImmutableSamplers = nullptr;
+
+        return uboLayoutBinding;
+    }
+};
+
+class TemporalScheduler
+{
+private:
+    uint32_t blockSize = 4;
+    TemporalOrder order = TEMPORAL_BAYER;
+    bool adaptive = false;
+
+    std::vector<glm::ivec2> sequence; // every pixel of a block once
+    uint32_t frame = 0;
+
+    void buildSequence();
+public:
+    TemporalScheduler() { buildSequence(); }
+
+    // blockSize is 2, 4 or 8. Restarts the sequence.
+    void configure(uint32_t blockSize, TemporalOrder order, bool adaptive);
+    uint32_t getBlockSize() const { return blockSize; }
+    TemporalOrder getOrder() const { return order; }
+    bool isAdaptive() const { return adaptive; }
+    // A quarter of the block, so a fast turn never costs more than about a quarter of full rate marching
+    uint32_t getRemarchBudget() const { return adaptive ? blockSize * blockSize / 4 : 0; }
+    const std::vector<glm::ivec2>& getSequence() const { return sequence; }
+
+    // Uniforms of the next frame, a full cycle over the block takes blockSize^2 frames
+    UniformTemporalObject next();
+
+    static const char* getOrderName(TemporalOrder order);
+};
@@ -1,13 +1,18 @@
 #include "Texture.h"
+#include "Mipmaps.h"
+#include "ThreadPool.h"
+#include "VolumeFile.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
+#include <chrono>
+
 
 void Texture::cleanup() {
     vkDestroySampler(device, textureSampler, nullptr);
     vkDestroyImageView(device, textureImageView, nullptr);
     vkDestroyImage(device, textureImage, nullptr);
-    vkFreeMemory(device, textureImageMemory, nullptr);
+    allocator->free(textureImageMemory);
 }
 
 VkFormat Texture::findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features) {
@@ -44,7 +49,7 @@ void Texture::createSampler() {
     samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
     samplerInfo.mipLodBias = 0.0f;
     samplerInfo.minLod = 0.0f;
-    samplerInfo.maxLod = 0.0f;
+    samplerInfo.maxLod = static_cast<float>(mipLevels);
 
     if (vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS) {
         throw std::runtime_error("failed to create texture sampler!");
@@ -66,7 +71,7 @@ void Texture::transitionImageLayout(VkImage image, VkFormat format, VkImageLayou
     barrier.image = image;
     barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.levelCount = mipLevels;
     barrier.subresourceRange.baseArrayLayer = 0;
     barrier.subresourceRange.layerCount = 1;
 
@@ -160,7 +165,7 @@ void Texture::createImageView() {
     viewInfo.format = imageFormat;
     viewInfo.subresourceRange.aspectMask = usageBit; //VK_IMAGE_USAGE_STORAGE_BIT
     viewInfo.subresourceRange.baseMipLevel = 0;
-    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.levelCount = mipLevels;
     viewInfo.subresourceRange.baseArrayLayer = 0;
     viewInfo.subresourceRange.layerCount = 1;
 
@@ -172,6 +177,13 @@ void Texture::createImageView() {
     textureImageView = imageView;
 }
 
+void Texture::setSharedQueueFamilies(uint32_t graphicsFamily, uint32_t computeFamily) {
+    sharedQueueFamilies.clear();
+    if (graphicsFamily != computeFamily) {
+        sharedQueueFamilies = { graphicsFamily, computeFamily };
+    }
+}
+
 void Texture::createImage(uint32_t width, uint32_t height, VkImageUsageFlags usage, VkFormat format,
     VkMemoryPropertyFlags properties,
     VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL) {
@@ -181,63 +193,93 @@ void Texture::createImage(uint32_t width, uint32_t height, VkImageUsageFlags usa
     imageInfo.extent.width = width;
     imageInfo.extent.height = height;
     imageInfo.extent.depth = 1;
-    imageInfo.mipLevels = 1;
+    imageInfo.mipLevels = mipLevels;
     imageInfo.arrayLayers = 1;
     imageInfo.format = format;
     imageInfo.tiling = tiling;
     imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    imageInfo.usage = usage;
+    imageInfo.usage = usage | (mipLevels > 1 ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0); // levels are blitted from each other
     imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.sharingMode = sharedQueueFamilies.empty() ? VK_SHARING_MODE_EXCLUSIVE : VK_SHARING_MODE_CONCURRENT;
+    imageInfo.queueFamilyIndexCount = static_cast<uint32_t>(sharedQueueFamilies.size());
+    imageInfo.pQueueFamilyIndices = sharedQueueFamilies.data();
 
     if (vkCreateImage(device, &imageInfo, nullptr, &textureImage) != VK_SUCCESS) {
         throw std::runtime_error("failed to create image!");
     }
 
-    VkMemoryRequirements memRequirements;
-    vkGetImageMemoryRequirements(device, textureImage, &memRequirements);
-
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-    if (vkAllocateMemory(device, &allocInfo, nullptr, &textureImageMemory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate image memory!");
-    }
-
-    vkBindImageMemory(device, textureImage, textureImageMemory, 0);
+    textureImageMemory = allocator->allocateImage(textureImage, properties, tiling);
 }
 
 void Texture::initFromFile(std::string path) {
     if (initialized) return;
 
     stbi_uc* pixels = stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
-    VkDeviceSize imageSize = width * height * 4;
+    VkDeviceSize imageSize = static_cast<VkDeviceSize>(width) * height * 4;
 
     if (!pixels) {
         throw std::runtime_error("failed to load texture image!");
     }
 
+    bool blit = planMipChain();
+    VkDeviceSize stagingSize = blit ? imageSize : getMipChainSize(width, height, 1, 4, mipLevels);
+
     VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    DeviceAllocation stagingBufferMemory;
+    createBuffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
 
-    void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(device, stagingBufferMemory);
+    memcpy(stagingBufferMemory.mapped, pixels, static_cast<size_t>(imageSize));
+    if (!blit) {
+        downsampleMipChainRGBA8(static_cast<uint8_t*>(stagingBufferMemory.mapped), width, height, 1, mipLevels);
+    }
 
     stbi_image_free(pixels);
 
     createImage(width, height, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, imageFormat, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
     transitionImageLayout(textureImage, imageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    copyBufferToImage(stagingBuffer, textureImage, static_cast<uint32_t>(width), static_cast<uint32_t>(height));
-    transitionImageLayout(textureImage, imageFormat, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    uploadMipChain(stagingBuffer, blit);
+
+    vkDestroyBuffer(device, stagingBuffer, nullptr);
+    allocator->free(stagingBufferMemory);
+
+    createImageView();
+    createSampler();
+
+    initialized = true;
+}
+
+void Texture::initFromCurlNoise(uint32_t dim, ThreadPool& pool) {
+    if (initialized) return;
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    width = height = static_cast<int>(dim);
+    channels = 4;
+    imageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+    bool blit = planMipChain();
+    VkDeviceSize imageSize = static_cast<VkDeviceSize>(width) * height * 4;
+    VkDeviceSize stagingSize = blit ? imageSize : getMipChainSize(width, height, 1, 4, mipLevels);
+
+    VkBuffer stagingBuffer;
+    DeviceAllocation stagingBufferMemory;
+    createBuffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+    GenerateCurlNoise(dim, static_cast<uint8_t*>(stagingBufferMemory.mapped), pool);
+    if (!blit) {
+        downsampleMipChainRGBA8(static_cast<uint8_t*>(stagingBufferMemory.mapped), width, height, 1, mipLevels);
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+    std::cout << "generated " << dim << "x" << dim << " curl noise in " << seconds * 1000.0 << " ms" << std::endl;
+
+    createImage(width, height, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, imageFormat, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    transitionImageLayout(textureImage, imageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    uploadMipChain(stagingBuffer, blit);
 
     vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    allocator->free(stagingBufferMemory);
 
     createImageView();
     createSampler();
@@ -245,13 +287,61 @@ void Texture::initFromFile(std::string path) {
     initialized = true;
 }
 
+void Texture::initFromSkipMap(const CloudSkipMap& map) {
+    if (initialized) return;
+
+    width = static_cast<int>(map.getWidth());
+    height = static_cast<int>(map.getHeight());
+    channels = 1;
+    imageFormat = VK_FORMAT_R8_UNORM;
+    mipLevels = map.getLevels();
+    const std::vector<uint8_t>& chain = map.getChain();
+
+    VkBuffer stagingBuffer;
+    DeviceAllocation stagingBufferMemory;
+    createBuffer(chain.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    memcpy(stagingBufferMemory.mapped, chain.data(), chain.size());
+
+    createImage(width, height, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, imageFormat, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    transitionImageLayout(textureImage, imageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    uploadMipChain(stagingBuffer, false, 1);
+
+    vkDestroyBuffer(device, stagingBuffer, nullptr);
+    allocator->free(stagingBufferMemory);
+
+    createImageView();
+    createSampler();
+
+    initialized = true;
+}
+
+bool Texture::planMipChain() {
+    bool blit = canBlitMipmaps(physicalDevice, imageFormat);
+    mipLevels = (blit || canDownsampleOnCPU(imageFormat)) ? getMipLevelCount(width, height, 1) : 1;
+    return blit;
+}
+
+void Texture::uploadMipChain(VkBuffer stagingBuffer, bool blit, uint32_t texelSize) {
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    recordMipChainCopy(commandBuffer, stagingBuffer, textureImage, width, height, 1, texelSize, blit ? 1 : mipLevels);
+    if (blit) {
+        recordMipBlits(commandBuffer, textureImage, width, height, 1, mipLevels);
+    }
+    endSingleTimeCommands(commandBuffer);
+
+    if (!blit) {
+        transitionImageLayout(textureImage, imageFormat, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
+}
+
 void Texture::initForStorage(VkExtent2D extent) {
     if (initialized) return;
 
     width = extent.width;
     height = extent.height;
     channels = 4; // RGBA
-    VkDeviceSize imageSize = width * height * 4;
+    VkDeviceSize imageSize = static_cast<VkDeviceSize>(width) * height * 4;
 
     /*for writing in compute shader*/
     createImage(width, height, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT, imageFormat, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
@@ -293,7 +383,7 @@ void Texture3D::cleanup() {
     vkDestroySampler(device, textureSampler, nullptr);
     vkDestroyImageView(device, textureImageView, nullptr);
     vkDestroyImage(device, textureImage, nullptr);
-    vkFreeMemory(device, textureImageMemory, nullptr);
+    allocator->free(textureImageMemory);
 }
 
 VkFormat Texture3D::findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features) {
@@ -330,7 +420,7 @@ void Texture3D::createSampler() {
     samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
     samplerInfo.mipLodBias = 0.0f;
     samplerInfo.minLod = 0.0f;
-    samplerInfo.maxLod = 0.0f;
+    samplerInfo.maxLod = static_cast<float>(mipLevels);
 
     if (vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS) {
         throw std::runtime_error("failed to create texture sampler!");
@@ -352,7 +442,7 @@ void Texture3D::transitionImageLayout(VkImage image, VkFormat format, VkImageLay
     barrier.image = image;
     barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.levelCount = mipLevels;
     barrier.subresourceRange.baseArrayLayer = 0;
     barrier.subresourceRange.layerCount = 1;
 
@@ -450,7 +540,7 @@ void Texture3D::createImageView() {
     viewInfo.format = imageFormat;
     viewInfo.subresourceRange.aspectMask = usageBit;
     viewInfo.subresourceRange.baseMipLevel = 0;
-    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.levelCount = mipLevels;
     viewInfo.subresourceRange.baseArrayLayer = 0;
     viewInfo.subresourceRange.layerCount = 1;
 
@@ -462,6 +552,13 @@ void Texture3D::createImageView() {
     textureImageView = imageView;
 }
 
+void Texture3D::setSharedQueueFamilies(uint32_t graphicsFamily, uint32_t computeFamily) {
+    sharedQueueFamilies.clear();
+    if (graphicsFamily != computeFamily) {
+        sharedQueueFamilies = { graphicsFamily, computeFamily };
+    }
+}
+
 void Texture3D::createImage(uint32_t width, uint32_t height, uint32_t depth, VkImageUsageFlags usage, VkFormat format,
     VkMemoryPropertyFlags properties,
     VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL) {
@@ -471,65 +568,214 @@ void Texture3D::createImage(uint32_t width, uint32_t height, uint32_t depth, VkI
     imageInfo.extent.width = width;
     imageInfo.extent.height = height;
     imageInfo.extent.depth = depth;
-    imageInfo.mipLevels = 1; // this might become something
+    imageInfo.mipLevels = mipLevels;
     imageInfo.arrayLayers = 1;
     imageInfo.format = format;
     imageInfo.tiling = tiling;
     imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    imageInfo.usage = usage;
+    imageInfo.usage = usage | (mipLevels > 1 ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0); // levels are blitted from each other
     imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.sharingMode = sharedQueueFamilies.empty() ? VK_SHARING_MODE_EXCLUSIVE : VK_SHARING_MODE_CONCURRENT;
+    imageInfo.queueFamilyIndexCount = static_cast<uint32_t>(sharedQueueFamilies.size());
+    imageInfo.pQueueFamilyIndices = sharedQueueFamilies.data();
 
     if (vkCreateImage(device, &imageInfo, nullptr, &textureImage) != VK_SUCCESS) {
         throw std::runtime_error("failed to create image!");
     }
 
-    VkMemoryRequirements memRequirements;
-    vkGetImageMemoryRequirements(device, textureImage, &memRequirements);
+    textureImageMemory = allocator->allocateImage(textureImage, properties, tiling);
+}
+
+void Texture3D::initFromFile(std::string path, ThreadPool& pool) {
+    if (initialized) return;
+    
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    bool blit = planMipChain();
+    VkDeviceSize imageSize = static_cast<VkDeviceSize>(width) * height * 4;
+    VkDeviceSize stagingSize = blit ? imageSize * depth : getMipChainSize(width, height, depth, 4, mipLevels);
 
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+    VkBuffer stagingBuffer;
+    DeviceAllocation stagingBufferMemory;
+    createBuffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    channels = 4;
+
+    // Every slice decodes on its own worker into its own region of the mapped staging buffer.
+    // Jobs can't throw, so each one records what went wrong with its slice.
+    std::vector<std::string> errors(depth);
+    pool.parallelFor(static_cast<uint32_t>(depth), [&](uint32_t i) {
+        std::string slice = path + "(" + std::to_string(i) + ").tga";
+        int sliceWidth, sliceHeight, sliceChannels;
+        stbi_uc* pixels = stbi_load(slice.c_str(), &sliceWidth, &sliceHeight, &sliceChannels, STBI_rgb_alpha);
 
-    if (vkAllocateMemory(device, &allocInfo, nullptr, &textureImageMemory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate image memory!");
+        if (!pixels) {
+            errors[i] = "failed to load texture slice " + slice + "!";
+            return;
+        }
+        if (sliceWidth != width || sliceHeight != height) {
+            errors[i] = "failed to load texture slice " + slice + ", expected " + std::to_string(width) + "x" + std::to_string(height) +
+                " but it is " + std::to_string(sliceWidth) + "x" + std::to_string(sliceHeight) + "!";
+        }
+        else {
+            char* data = static_cast<char*>(stagingBufferMemory.mapped) + static_cast<uint64_t>(i) * imageSize;
+            memcpy(data, pixels, static_cast<size_t>(imageSize));
+        }
+
+        stbi_image_free(pixels);
+    });
+
+    for (const std::string& error : errors) {
+        if (!error.empty()) {
+            vkDestroyBuffer(device, stagingBuffer, nullptr);
+            allocator->free(stagingBufferMemory);
+            throw std::runtime_error(error);
+        }
     }
 
-    vkBindImageMemory(device, textureImage, textureImageMemory, 0);
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+    double megabytes = imageSize * depth / (1024.0 * 1024.0);
+    std::cout << "decoded " << depth << " slices of " << path << " (" << megabytes << " MB) in " << seconds * 1000.0 << " ms, "
+        << megabytes / seconds << " MB/s" << std::endl;
+
+    if (!blit) {
+        downsampleMipChainRGBA8(static_cast<uint8_t*>(stagingBufferMemory.mapped), width, height, depth, mipLevels);
+    }
+
+    createImage(width, height, depth, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, imageFormat, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    transitionImageLayout(textureImage, imageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    uploadMipChain(stagingBuffer, blit);
+
+    vkDestroyBuffer(device, stagingBuffer, nullptr);
+    allocator->free(stagingBufferMemory);
+
+    createImageView();
+    createSampler();
+
+    initialized = true;
 }
 
-void Texture3D::initFromFile(std::string path) {
-    if (initialized) return;
-    
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    VkDeviceSize imageSize = width * height * 4;
-    createBuffer(imageSize * depth, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+bool Texture3D::initFromPackedFile(std::string path) {
+    if (initialized) return true;
 
-    for (uint32_t i = 0; i < static_cast<uint32_t>(depth); ++i) {
-        stbi_uc* pixels = stbi_load((path + "(" + std::to_string(i) + ").tga").c_str(), &width, &height, &channels, STBI_rgb_alpha);
+    VolumeFile volume;
+    if (!volume.open(path)) {
+        return false;
+    }
 
-        if (!pixels) {
-            throw std::runtime_error("failed to load texture image!");
+    const VolumeHeader& header = volume.getHeader();
+    width = header.width;
+    height = header.height;
+    depth = header.depth;
+    channels = header.bytesPerTexel;
+    imageFormat = static_cast<VkFormat>(header.format);
+
+    // the sizes below and the copy regions follow bytesPerTexel, the image follows the format
+    uint32_t texelSize = getFormatTexelSize(imageFormat);
+    if (texelSize == 0) {
+        throw std::runtime_error("failed to load volume " + path + ", format " + std::to_string(header.format) + " is not supported!");
+    }
+    if (header.bytesPerTexel != texelSize) {
+        throw std::runtime_error("failed to load volume " + path + ", the header has " + std::to_string(header.bytesPerTexel) +
+            " bytes per texel but its format has " + std::to_string(texelSize) + "!");
+    }
+
+    // a file with a full chain is uploaded as it is, one with only level 0 gets its chain generated
+    bool stored = header.mipCount > 1;
+    bool blit = false;
+    if (stored) {
+        if (header.mipCount > getMipLevelCount(width, height, depth)) {
+            throw std::runtime_error("failed to load volume " + path + ", too many mip levels!");
         }
+        mipLevels = header.mipCount;
+    }
+    else {
+        blit = planMipChain();
+    }
+    VkDeviceSize chainSize = getMipChainSize(width, height, depth, header.bytesPerTexel, mipLevels);
+    VkDeviceSize levelSize = getMipChainSize(width, height, depth, header.bytesPerTexel, 1);
+    if (header.dataSize < (stored ? chainSize : levelSize)) {
+        throw std::runtime_error("failed to load volume " + path + ", the header does not match the data size!");
+    }
+
+    // one copy from the file mapping into the mapped staging buffer, nothing is decoded
+    VkBuffer stagingBuffer;
+    DeviceAllocation stagingBufferMemory;
+    createBuffer(blit ? levelSize : chainSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    memcpy(stagingBufferMemory.mapped, volume.getTexels(), static_cast<size_t>(stored ? chainSize : levelSize));
+    volume.close();
+    if (!stored && !blit) {
+        downsampleMipChainRGBA8(static_cast<uint8_t*>(stagingBufferMemory.mapped), width, height, depth, mipLevels);
+    }
 
-        void* data;
-        vkMapMemory(device, stagingBufferMemory, static_cast<uint64_t>(i) * imageSize, imageSize, 0, &data);
-        memcpy(data, pixels, static_cast<size_t>(imageSize));
-        vkUnmapMemory(device, stagingBufferMemory);
+    createImage(width, height, depth, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, imageFormat, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-        stbi_image_free(pixels);
+    transitionImageLayout(textureImage, imageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    uploadMipChain(stagingBuffer, blit);
+
+    vkDestroyBuffer(device, stagingBuffer, nullptr);
+    allocator->free(stagingBufferMemory);
+
+    createImageView();
+    createSampler();
+
+    initialized = true;
+    return true;
+}
+
+bool Texture3D::planMipChain() {
+    bool blit = canBlitMipmaps(physicalDevice, imageFormat);
+    mipLevels = (blit || canDownsampleOnCPU(imageFormat)) ? getMipLevelCount(width, height, depth) : 1;
+    return blit;
+}
+
+void Texture3D::uploadMipChain(VkBuffer stagingBuffer, bool blit) {
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    recordMipChainCopy(commandBuffer, stagingBuffer, textureImage, width, height, depth, channels, blit ? 1 : mipLevels);
+    if (blit) {
+        recordMipBlits(commandBuffer, textureImage, width, height, depth, mipLevels);
+    }
+    endSingleTimeCommands(commandBuffer);
+
+    if (!blit) {
+        transitionImageLayout(textureImage, imageFormat, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
+}
+
+void Texture3D::initFromNoise(CloudNoiseVolume type, ThreadPool& pool) {
+    if (initialized) return;
+
+    if (height != width || depth != width) {
+        throw std::runtime_error("failed to generate cloud noise, the volume is not a cube!");
     }
 
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    imageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+    channels = 4;
+    bool blit = planMipChain();
+    VkDeviceSize imageSize = static_cast<VkDeviceSize>(width) * height * 4;
+    VkDeviceSize stagingSize = blit ? imageSize * depth : getMipChainSize(width, height, depth, 4, mipLevels);
+
+    VkBuffer stagingBuffer;
+    DeviceAllocation stagingBufferMemory;
+    createBuffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+    GenerateCloudNoise(type, static_cast<uint32_t>(width), static_cast<uint8_t*>(stagingBufferMemory.mapped), pool);
+    if (!blit) {
+        downsampleMipChainRGBA8(static_cast<uint8_t*>(stagingBufferMemory.mapped), width, height, depth, mipLevels);
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+    std::cout << "generated " << width << "^3 cloud noise in " << seconds * 1000.0 << " ms" << std::endl;
+
     createImage(width, height, depth, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, imageFormat, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
     transitionImageLayout(textureImage, imageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    copyBufferToImage(stagingBuffer, textureImage, static_cast<uint32_t>(width), static_cast<uint32_t>(height), static_cast<uint32_t>(depth));
-    transitionImageLayout(textureImage, imageFormat, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    uploadMipChain(stagingBuffer, blit);
 
     vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    allocator->free(stagingBufferMemory);
 
     createImageView();
     createSampler();
@@ -544,10 +790,10 @@ void Texture3D::initForStorage(VkExtent3D extent) {
     height = extent.height;
     depth = extent.depth;
     channels = 4; // RGBA
-    VkDeviceSize imageSize = width * height * depth * 4;
+    VkDeviceSize imageSize = static_cast<VkDeviceSize>(width) * height * depth * 4;
 
-    /* for writing in compute shader or elsewhere: add this to the third parameter: | VK_IMAGE_USAGE_STORAGE_BIT */
-    createImage(width, height, depth, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, imageFormat, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    /* for writing in compute shader or elsewhere */
+    createImage(width, height, depth, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT, imageFormat, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
     transitionImageLayout(textureImage, imageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL); // anything better than general? prob not
 
     createImageView();
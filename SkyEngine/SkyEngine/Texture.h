@@ -1,6 +1,8 @@
 #pragma once
 
 #include "VulkanObject.h"
+#include "ImageUtils.h"
+#include "CloudSkipMap.h"
 #include <string>
 
 class Texture : VulkanObject
@@ -9,9 +11,10 @@ private:
     int width, height, channels;
 
     VkImage textureImage;
-    VkDeviceMemory textureImageMemory;
+    DeviceAllocation textureImageMemory;
 
     VkFormat imageFormat;
+    uint32_t mipLevels = 1;
 
     virtual void cleanup();
     void createSampler();
@@ -20,11 +23,19 @@ private:
     void createImage(uint32_t width, uint32_t height, VkImageUsageFlags usage, VkFormat format, VkMemoryPropertyFlags properties, VkImageTiling tiling);
     void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout);
     void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
+    // Picks mipLevels for a texture loaded from a file, returns true if the GPU will blit the chain.
+    // Otherwise the chain is built on the CPU, or there is only one level if the CPU can't filter the format either.
+    bool planMipChain();
+    // Fills every level from a staging buffer holding level 0, or the whole chain if it was built on the CPU,
+    // and leaves the image ready to sample
+    void uploadMipChain(VkBuffer stagingBuffer, bool blit, uint32_t texelSize = 4);
 
     bool initialized = false;
     VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
 
     VkImageAspectFlagBits usageBit = VK_IMAGE_ASPECT_COLOR_BIT;
+
+    std::vector<uint32_t> sharedQueueFamilies;
 public:
     Texture(VkDevice device, VkPhysicalDevice physicalDevice, VkCommandPool commandPool, VkQueue queue, VkFormat format = VK_FORMAT_R8G8B8A8_UNORM)
         : VulkanObject(device, physicalDevice, commandPool, queue) {
@@ -36,10 +47,22 @@ public:
     }
 
     VkFormat getFormat() { return imageFormat; }
+    VkImage getImage() { return textureImage; }
+    uint32_t getMipLevels() const { return mipLevels; }
     VkImageView textureImageView;
     VkSampler textureSampler;
 
+    // Read-only textures used by both the graphics and compute queues are created concurrent, so they never need an
+    // ownership transfer. Call before init*. Does nothing if both families are the same.
+    void setSharedQueueFamilies(uint32_t graphicsFamily, uint32_t computeFamily);
+
+    // Textures loaded from files get a full mip chain, the others have a single level
     void initFromFile(std::string path);
+    // Generates a dim x dim curl noise map (see ImageUtils.h) on pool straight into the staging buffer
+    void initFromCurlNoise(uint32_t dim, ThreadPool& pool);
+    // R8 image holding the pyramid of a CloudSkipMap, one mip level per pyramid level. The levels are maxima, so they
+    // are uploaded as they are and must be read with texelFetch.
+    void initFromSkipMap(const CloudSkipMap& map);
     void initForStorage(VkExtent2D extent);
     void initForDepthAttachment(VkExtent2D extent);
 
@@ -63,9 +86,10 @@ private:
     int width, height, depth, channels;
 
     VkImage textureImage;
-    VkDeviceMemory textureImageMemory;
+    DeviceAllocation textureImageMemory;
 
     VkFormat imageFormat;
+    uint32_t mipLevels = 1;
 
     virtual void cleanup();
     void createSampler();
@@ -74,11 +98,16 @@ private:
     void createImage(uint32_t width, uint32_t height, uint32_t depth, VkImageUsageFlags usage, VkFormat format, VkMemoryPropertyFlags properties, VkImageTiling tiling);
     void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout);
     void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t depth);
+    // See Texture
+    bool planMipChain();
+    void uploadMipChain(VkBuffer stagingBuffer, bool blit);
 
     bool initialized = false;
     VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
 
     VkImageAspectFlagBits usageBit = VK_IMAGE_ASPECT_COLOR_BIT;
+
+    std::vector<uint32_t> sharedQueueFamilies;
 public:
     Texture3D(VkDevice device, VkPhysicalDevice physicalDevice, VkCommandPool commandPool, VkQueue queue,
         const uint32_t width, const uint32_t height, const uint32_t depth,
@@ -92,11 +121,21 @@ public:
     }
 
     VkFormat getFormat() { return imageFormat; }
+    VkImage getImage() { return textureImage; }
+    uint32_t getMipLevels() const { return mipLevels; }
     VkImageView textureImageView;
     VkSampler textureSampler;
 
-    // This function should supply the "base" name of each texture slice file.
-    void initFromFile(std::string path);
+    // See Texture::setSharedQueueFamilies
+    void setSharedQueueFamilies(uint32_t graphicsFamily, uint32_t computeFamily);
+
+    // This function should supply the "base" name of each texture slice file. The slices are decoded on pool.
+    void initFromFile(std::string path, ThreadPool& pool);
+    // Loads a packed volume (see VolumeFile.h), whose size and format replace the ones given to the constructor.
+    // Mip levels stored in the file are used as they are, otherwise the chain is generated. Returns false if the file does not exist.
+    bool initFromPackedFile(std::string path);
+    // Generates cloud noise (see ImageUtils.h) straight into the staging buffer, the width given to the constructor is the size of the cube
+    void initFromNoise(CloudNoiseVolume type, ThreadPool& pool);
     void initForStorage(VkExtent3D extent);
     void initForDepthAttachment(VkExtent3D extent);
 
@@ -0,0 +1,116 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned int threadCount) : queuedJobs(0), nextQueue(0) {
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (unsigned int i = 0; i < threadCount; i++) {
+        queues.push_back(new WorkQueue());
+    }
+    for (unsigned int i = 0; i < threadCount; i++) {
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(sleepLock);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    for (WorkQueue* queue : queues) {
+        delete queue;
+    }
+}
+
+bool ThreadPool::popJob(unsigned int index, std::function<void()>& job) {
+    WorkQueue* queue = queues[index];
+    std::lock_guard<std::mutex> guard(queue->lock);
+    if (queue->jobs.empty()) return false;
+
+    job = std::move(queue->jobs.back());
+    queue->jobs.pop_back();
+    queuedJobs--;
+    return true;
+}
+
+bool ThreadPool::stealJob(unsigned int index, std::function<void()>& job) {
+    const unsigned int count = static_cast<unsigned int>(queues.size());
+    for (unsigned int i = 1; i < count; i++) {
+        WorkQueue* victim = queues[(index + i) % count];
+        std::lock_guard<std::mutex> guard(victim->lock);
+        if (victim->jobs.empty()) continue;
+
+        job = std::move(victim->jobs.front());
+        victim->jobs.pop_front();
+        queuedJobs--;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(unsigned int index) {
+    std::function<void()> job;
+    while (true) {
+        if (takeJob(index, job)) {
+            job();
+            job = nullptr;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(sleepLock);
+        wake.wait(guard, [this] { return stopping || queuedJobs > 0; });
+        if (stopping && queuedJobs == 0) return;
+    }
+}
+
+void ThreadPool::submit(std::function<void()> job) {
+    unsigned int index = nextQueue++ % static_cast<unsigned int>(queues.size());
+    {
+        std::lock_guard<std::mutex> guard(queues[index]->lock);
+        queues[index]->jobs.push_back(std::move(job));
+        queuedJobs++;
+    }
+    {
+        // taking the lock keeps a worker from missing the wakeup between its check and its wait
+        std::lock_guard<std::mutex> guard(sleepLock);
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::parallelFor(uint32_t count, const std::function<void(uint32_t)>& job) {
+    if (count == 0) return;
+
+    std::atomic<uint32_t> remaining(count);
+    std::mutex doneLock;
+    std::condition_variable done;
+
+    for (uint32_t i = 0; i < count; i++) {
+        submit([&, i]() {
+            job(i);
+            // decrement and notify under the lock: the caller only returns (destroying remaining, doneLock and done)
+            // once it holds it, so the last job is done with them by then
+            std::lock_guard<std::mutex> guard(doneLock);
+            if (--remaining == 0) {
+                done.notify_all();
+            }
+        });
+    }
+
+    // help drain the queues rather than block a core
+    std::function<void()> helped;
+    while (remaining > 0 && takeJob(0, helped)) {
+        helped();
+        helped = nullptr;
+    }
+
+    // even if remaining already reads 0, wait for the lock the last job decremented it under
+    std::unique_lock<std::mutex> guard(doneLock);
+    done.wait(guard, [&remaining] { return remaining == 0; });
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+// A small work-stealing thread pool for CPU-side jobs (offline cloud rendering, texture decoding, noise generation).
+// Every worker owns a deque: it pops its own jobs from the back and steals from the front of the others when idle.
+class ThreadPool
+{
+private:
+    struct WorkQueue {
+        std::deque<std::function<void()>> jobs;
+        std::mutex lock;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<WorkQueue*> queues;
+
+    std::mutex sleepLock;
+    std::condition_variable wake;
+    std::atomic<int> queuedJobs;
+    std::atomic<unsigned int> nextQueue;
+    bool stopping = false;
+
+    void workerLoop(unsigned int index);
+    bool popJob(unsigned int index, std::function<void()>& job);
+    bool stealJob(unsigned int index, std::function<void()>& job);
+    bool takeJob(unsigned int index, std::function<void()>& job) { return popJob(index, job) || stealJob(index, job); }
+
+public:
+    // 0 threads picks one worker per hardware thread
+    ThreadPool(unsigned int threadCount = 0);
+    ~ThreadPool();
+
+    unsigned int getThreadCount() const { return static_cast<unsigned int>(workers.size()); }
+
+    void submit(std::function<void()> job);
+
+    // Runs job(i) for every i in [0, count) and blocks until all of them are done.
+    // The calling thread helps out instead of sleeping.
+    void parallelFor(uint32_t count, const std::function<void(uint32_t)>& job);
+};
@@ -0,0 +1,42 @@
+#pragma once
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <cstdint>
+
+// Uniform blocks shared by the shaders and CloudRendererCPU. This header stays free of Vulkan so the CPU renderer can
+// use them without it, getLayoutBinding is defined in Shader.cpp.
+struct VkDescriptorSetLayoutBinding;
+
+struct UniformCameraObject {
+    glm::mat4 view;
+    glm::mat4 proj;
+    glm::vec4 cameraPosition;
+    glm::vec4 cameraParams;
+
+    static VkDescriptorSetLayoutBinding getLayoutBinding(uint32_t bind);
+};
+
+struct UniformSunObject {
+
+    glm::vec4 location; // only really used for the procedural scattering. regard this as a directional light
+    glm::vec4 direction;
+    glm::vec4 color;
+    glm::mat4 directionBasis; // Equivalent to TBN, for transforming cone samples in ray marcher
+    float intensity;
+
+    static VkDescriptorSetLayoutBinding getLayoutBinding(uint32_t bind);
+};
+
+struct UniformSkyObject{
+
+    // many other constants are stored in the sky manager, minimizing the amount of stuff transferred to shader
+
+    // precalculated, depends on sun
+    glm::vec4 betaR;
+    glm::vec4 betaV;
+    glm::vec4 wind;
+    float mie_directional;
+
+    static VkDescriptorSetLayoutBinding getLayoutBinding(uint32_t bind);
+};
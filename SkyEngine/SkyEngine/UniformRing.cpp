@@ -0,0 +1,30 @@
+#include "UniformRing.h"
+#include <cstring>
+#include <stdexcept>
+
+UniformRing::UniformRing(VkDevice device, VkPhysicalDevice physicalDevice, VkCommandPool commandPool, VkQueue queue, VkDeviceSize frameSize) :
+    VulkanObject(device, physicalDevice, commandPool, queue) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+    frameStride = (frameSize + alignment - 1) / alignment * alignment;
+
+    createBuffer(frameStride * MAX_FRAMES_IN_FLIGHT, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, bufferMemory);
+    // the allocator keeps host visible memory mapped, and coherent memory needs no flushes
+}
+
+void UniformRing::cleanup() {
+    if (buffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(device, buffer, nullptr);
+        allocator->free(bufferMemory);
+        buffer = VK_NULL_HANDLE;
+    }
+}
+
+void UniformRing::write(uint32_t frame, const void* data, VkDeviceSize size) {
+    if (size > frameStride) {
+        throw std::runtime_error("failed to write uniform ring, frame data too large!");
+    }
+    memcpy(static_cast<char*>(bufferMemory.mapped) + frameStride * frame, data, static_cast<size_t>(size));
+}
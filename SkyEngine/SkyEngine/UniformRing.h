@@ -0,0 +1,27 @@
+#pragma once
+#include "VulkanObject.h"
+
+// One persistently mapped host-visible buffer holding the uniforms of every frame in flight.
+// Each frame owns a stride of the buffer starting on a minUniformBufferOffsetAlignment boundary; shaders bind it
+// as dynamic uniform buffers and select their frame with dynamic offsets, so the descriptor sets never change.
+class UniformRing : public VulkanObject
+{
+private:
+    VkBuffer buffer = VK_NULL_HANDLE;
+    DeviceAllocation bufferMemory;
+    VkDeviceSize frameStride = 0;
+
+protected:
+    virtual void cleanup();
+
+public:
+    // frameSize is the size of everything written in one frame
+    UniformRing(VkDevice device, VkPhysicalDevice physicalDevice, VkCommandPool commandPool, VkQueue queue, VkDeviceSize frameSize);
+    virtual ~UniformRing() { cleanup(); }
+
+    VkBuffer getBuffer() const { return buffer; }
+    uint32_t getFrameOffset(uint32_t frame) const { return static_cast<uint32_t>(frameStride * frame); }
+
+    // Copies the uniforms of a frame into its stride. The GPU is done with it once that frame's fence has signaled.
+    void write(uint32_t frame, const void* data, VkDeviceSize size);
+};
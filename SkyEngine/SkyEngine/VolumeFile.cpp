@@ -0,0 +1,141 @@
+#include "VolumeFile.h"
+#include <stb_image.h>
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool VolumeFile::open(std::string path) {
+    close();
+
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    file = handle;
+
+    LARGE_INTEGER size;
+    GetFileSizeEx(handle, &size);
+    fileSize = static_cast<uint64_t>(size.QuadPart);
+    if (fileSize < sizeof(VolumeHeader)) {
+        close();
+        throw std::runtime_error("failed to load volume " + path + ", file is too small!");
+    }
+
+    mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping != nullptr) {
+        view = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    }
+#else
+    file = ::open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        return false;
+    }
+
+    struct stat info;
+    fstat(file, &info);
+    fileSize = static_cast<uint64_t>(info.st_size);
+    if (fileSize < sizeof(VolumeHeader)) {
+        close();
+        throw std::runtime_error("failed to load volume " + path + ", file is too small!");
+    }
+
+    void* address = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, file, 0);
+    if (address != MAP_FAILED) {
+        view = static_cast<const char*>(address);
+        madvise(address, fileSize, MADV_SEQUENTIAL);
+    }
+#endif
+    if (view == nullptr) {
+        close();
+        throw std::runtime_error("failed to map volume " + path + "!");
+    }
+
+    memcpy(&header, view, sizeof(VolumeHeader));
+    if (header.magic != VOLUME_MAGIC || header.version != VOLUME_VERSION) {
+        close();
+        throw std::runtime_error("failed to load volume " + path + ", not a packed volume of this version!");
+    }
+    if (header.dataSize > fileSize - sizeof(VolumeHeader)) {
+        close();
+        throw std::runtime_error("failed to load volume " + path + ", file is truncated!");
+    }
+    return true;
+}
+
+void VolumeFile::close() {
+#ifdef _WIN32
+    if (view != nullptr) UnmapViewOfFile(view);
+    if (mapping != nullptr) CloseHandle(mapping);
+    if (file != nullptr) CloseHandle(file);
+    mapping = nullptr;
+    file = nullptr;
+#else
+    if (view != nullptr) munmap(const_cast<char*>(view), fileSize);
+    if (file >= 0) ::close(file);
+    file = -1;
+#endif
+    view = nullptr;
+    fileSize = 0;
+    header = VolumeHeader();
+}
+
+VolumeHeader VolumeFile::packSlices(std::string slicePath, std::string outPath) {
+    VolumeHeader result;
+    result.format = VK_FORMAT_R8G8B8A8_UNORM;
+    result.bytesPerTexel = 4;
+
+    std::vector<stbi_uc> texels;
+    for (uint32_t i = 0; ; ++i) {
+        std::string slice = slicePath + "(" + std::to_string(i) + ").tga";
+        if (!std::ifstream(slice).good()) break;
+
+        int width, height, channels;
+        stbi_uc* pixels = stbi_load(slice.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+        if (!pixels) {
+            throw std::runtime_error("failed to load texture slice " + slice + "!");
+        }
+        if (i == 0) {
+            result.width = width;
+            result.height = height;
+        }
+        else if (result.width != static_cast<uint32_t>(width) || result.height != static_cast<uint32_t>(height)) {
+            stbi_image_free(pixels);
+            throw std::runtime_error("failed to pack " + slice + ", slices differ in size!");
+        }
+
+        size_t sliceSize = static_cast<size_t>(width) * height * 4;
+        texels.insert(texels.end(), pixels, pixels + sliceSize);
+        stbi_image_free(pixels);
+        result.depth++;
+    }
+
+    if (result.depth == 0) {
+        throw std::runtime_error("failed to pack volume, no slices found at " + slicePath + "(0).tga!");
+    }
+    result.dataSize = texels.size();
+
+    std::ofstream out(outPath, std::ios::binary);
+    if (!out.is_open()) {
+        throw std::runtime_error("failed to open volume output " + outPath + "!");
+    }
+    out.write(reinterpret_cast<const char*>(&result), sizeof(result));
+    out.write(reinterpret_cast<const char*>(texels.data()), texels.size());
+    if (!out.good()) {
+        throw std::runtime_error("failed to write volume " + outPath + "!");
+    }
+    return result;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <cstdint>
+#include <string>
+
+// Packed 3D texture file: a VolumeHeader followed by the raw texels of every mip level, largest first.
+// Each level is stored slice after slice, rows tightly packed, which is the layout vkCmdCopyBufferToImage expects.
+#define VOLUME_MAGIC 0x56594B53 // "SKYV"
+#define VOLUME_VERSION 1
+
+struct VolumeHeader {
+    uint32_t magic = VOLUME_MAGIC;
+    uint32_t version = VOLUME_VERSION;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t depth = 0;
+    uint32_t format = VK_FORMAT_UNDEFINED; // VkFormat of the texels
+    uint32_t mipCount = 1;
+    uint32_t bytesPerTexel = 0;
+    uint64_t dataSize = 0; // bytes of texel data after the header
+    uint64_t reserved[3] = {};
+};
+static_assert(sizeof(VolumeHeader) == 64, "the volume header is part of the file format");
+
+// Read-only memory mapping of a packed volume. The texels are never copied on the CPU side, the caller
+// copies them straight out of the mapped file.
+class VolumeFile
+{
+private:
+    VolumeHeader header;
+    const char* view = nullptr;
+    uint64_t fileSize = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#else
+    int file = -1;
+#endif
+
+public:
+    VolumeFile() {}
+    ~VolumeFile() { close(); }
+    VolumeFile(const VolumeFile&) = delete;
+    VolumeFile& operator=(const VolumeFile&) = delete;
+
+    // Returns false if there is no such file, throws if it is not a valid volume
+    bool open(std::string path);
+    void close();
+
+    const VolumeHeader& getHeader() const { return header; }
+    const char* getTexels() const { return view + sizeof(VolumeHeader); }
+
+    // Converter from a set of slice images "<slicePath>(0).tga", "<slicePath>(1).tga", ... to a packed RGBA8 volume.
+    // The depth is the number of consecutive slices found.
+    static VolumeHeader packSlices(std::string slicePath, std::string outPath);
+};
@@ -1,5 +1,9 @@
 #include "VulkanApplication.h"
+#include "CloudRendererCPU.h"
+#include <cstdio>
 #include <sstream>
+#include <iomanip>
+#include <stb_image_write.h>
 /// --- callback proxy functions
 VkResult CreateDebugReportCallbackEXT(VkInstance instance, const VkDebugReportCallbackCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugReportCallbackEXT* pCallback) {
     auto func = (PFN_vkCreateDebugReportCallbackEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugReportCallbackEXT");
@@ -44,15 +48,25 @@ void VulkanApplication::initWindow() {
 }
 
 void VulkanApplication::initVulkan() {
+    workerPool = new ThreadPool();
+
     createInstance();
 #ifdef _DEBUG
     setupDebugCallback();
 #endif
-    createSurface();
+    if (!headless) {
+        createSurface();
+    }
     pickPhysicalDevice();
     createLogicalDevice();
-    createSwapChain(); 
-    createImageViews();
+    memoryAllocator.init(device, physicalDevice);
+    VulkanObject::setAllocator(&memoryAllocator);
+    if (headless) {
+        createHeadlessTargets();
+    } else {
+        createSwapChain();
+        createImageViews();
+    }
 
     createRenderPass();
 
@@ -66,16 +80,57 @@ void VulkanApplication::initVulkan() {
 
     initializeGeometry();
 
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    TunedWorkgroups tuned;
+    bool workgroupsTuned = false;
+    if (autoTuneWorkgroups) {
+        // the sizes an earlier launch picked on this GPU and driver, so the shaders are created with them right away
+        workgroupsTuned = WorkgroupTuner::load(WORKGROUP_CACHE_PATH, properties, getWorkgroupTuningSettings(), tuned);
+        if (workgroupsTuned) {
+            reprojectWorkgroup = tuned.reproject;
+            cloudMarchSettings.workgroup = tuned.clouds;
+            std::cout << "workgroups: reproject " << reprojectWorkgroup.width << "x" << reprojectWorkgroup.height << ", clouds "
+                << cloudMarchSettings.workgroup.width << "x" << cloudMarchSettings.workgroup.height << " from " << WORKGROUP_CACHE_PATH << std::endl;
+        }
+    }
+    else {
+        // an unsupported local size would only fail later, as an invalid pipeline
+        if (!WorkgroupTuner::isSupported(reprojectWorkgroup, properties.limits)) {
+            const VkPhysicalDeviceLimits& limits = properties.limits;
+            throw std::runtime_error("failed to use workgroup size " + std::to_string(reprojectWorkgroup.width) + "x" + std::to_string(reprojectWorkgroup.height)
+                + ", the device supports up to " + std::to_string(limits.maxComputeWorkGroupSize[0]) + "x" + std::to_string(limits.maxComputeWorkGroupSize[1])
+                + " and " + std::to_string(limits.maxComputeWorkGroupInvocations) + " invocations!");
+        }
+    }
+
+    pipelineCache.init(device, physicalDevice, PIPELINE_CACHE_PATH);
+    Shader::setPipelineCache(pipelineCache.getCache());
+    auto pipelineStart = std::chrono::high_resolution_clock::now();
     initializeShaders();
+    double pipelineMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - pipelineStart).count();
+    std::cout << pipelineCache.getReport(pipelineMs) << std::endl;
+    pipelineCache.save();
+
+    // timestamps are written by the per-frame command buffers
+    QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+    profiler.init(device, physicalDevice, indices.graphicsFamily, indices.computeFamily);
+    if (!profilerOutputPath.empty()) {
+        profiler.openCSV(profilerOutputPath);
+    }
+
+    createFrameContexts();
 
-    createCommandBuffers();
-    createPostProcessCommandBuffer();
-    createComputeCommandBuffer();
-    createSemaphores();
+    std::cout << memoryAllocator.getSummary() << std::endl;
 
     mainCamera = Camera(glm::vec3(0.f, 1.f, 1.f), glm::vec3(0.f, 0.f, 0.f), 0.1f, 1000.0f, 45.0f);
     mainCamera.setAspect((float) swapChainExtent.width, (float)swapChainExtent.height);
     skySystem = SkyManager();
+
+    if (autoTuneWorkgroups && !workgroupsTuned) {
+        tuneWorkgroups();
+        pipelineCache.save(); // with the pipelines of the winners
+    }
 }
 
 void VulkanApplication::mainLoop() {
@@ -89,7 +144,6 @@ void VulkanApplication::mainLoop() {
 
         glfwPollEvents();
         processInputs();
-        updateUniformBuffer();
         drawFrame();
 
         prevTime = time;
@@ -98,6 +152,69 @@ void VulkanApplication::mainLoop() {
     vkDeviceWaitIdle(device);
 }
 
+// Fixed timestep so a batch of headless frames is reproducible
+void VulkanApplication::headlessLoop() {
+    prevTime = 0.0f;
+    deltaTime = 1.0f / 60.0f;
+
+    if (benchmark) {
+        benchmarkReport.width = swapChainExtent.width;
+        benchmarkReport.height = swapChainExtent.height;
+        benchmarkReport.timestep = deltaTime;
+        benchmarkReport.gpuTimestamps = profiler.isEnabled();
+        for (int p = 0; p < GpuProfiler::PASS_COUNT; p++) {
+            benchmarkReport.gpuPassNames.push_back(GpuProfiler::getPassName(static_cast<GpuProfiler::Pass>(p)));
+        }
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        benchmarkReport.deviceName = properties.deviceName;
+    }
+
+    for (headlessFrameIndex = 0; headlessFrameIndex < headlessFrameCount; headlessFrameIndex++) {
+        auto frameStart = std::chrono::high_resolution_clock::now();
+        const uint32_t slot = currentFrame;
+
+        if (benchmark) {
+            applyBenchmarkKeyframe(prevTime + deltaTime);
+        }
+        drawFrameHeadless();
+
+        if (benchmark) {
+            auto frameEnd = std::chrono::high_resolution_clock::now();
+
+            BenchmarkFrame frame = {};
+            frame.time = prevTime + deltaTime;
+            frame.cpuMs = std::chrono::duration<double, std::milli>(frameSubmitted - frameStart).count();
+            frame.frameMs = std::chrono::duration<double, std::milli>(frameEnd - frameStart).count();
+
+            // the frame's fence has signaled, so this does not actually wait
+            if (profiler.collect(slot, true)) {
+                for (int p = 0; p < GpuProfiler::PASS_COUNT; p++) {
+                    GpuProfiler::Pass pass = static_cast<GpuProfiler::Pass>(p);
+                    frame.gpuPassMs.push_back(profiler.getLatest(pass));
+                    (GpuProfiler::isComputePass(pass) ? frame.gpuComputeMs : frame.gpuGraphicsMs) += profiler.getLatest(pass);
+                }
+            }
+            CloudMarchCounters counters = computeShader->getCounters(slot);
+            frame.cloudSamplesEvaluated = counters.evaluated;
+            frame.cloudSamplesSkipped = counters.skipped;
+            frame.cloudPixelsRemarched = counters.remarched;
+            frame.cloudPixelsDeferred = counters.deferred;
+            benchmarkReport.addFrame(frame);
+        }
+        prevTime += deltaTime;
+    }
+
+    while (!headlessPending.empty()) {
+        retireHeadlessFrame();
+    }
+    vkDeviceWaitIdle(device);
+    for (auto& write : readbackWrites) {
+        if (write.valid()) write.wait();
+    }
+}
+
 void VulkanApplication::cleanup() {
 
     for (size_t i = 0; i < swapChainFramebuffers.size(); i++) {
@@ -107,30 +224,44 @@ void VulkanApplication::cleanup() {
         vkDestroyImageView(device, swapChainImageViews[i], nullptr);
     }
     cleanupOffscreenPass();
+    if (headless) {
+        cleanupHeadlessTargets();
+    }
+    profiler.cleanup();
+    cleanupFrameContexts();
     vkDestroyCommandPool(device, commandPool, nullptr);
     vkDestroyCommandPool(device, computeCommandPool, nullptr);
-    vkDestroySemaphore(device, renderFinishedSemaphore, nullptr);
-    vkDestroySemaphore(device, imageAvailableSemaphore, nullptr);
 
     vkDestroyRenderPass(device, renderPass, nullptr);
-    vkDestroySwapchainKHR(device, swapChain, nullptr);
+    if (!headless) {
+        vkDestroySwapchainKHR(device, swapChain, nullptr);
+    }
 
     cleanupGeometry();
 
     cleanupTextures();
     cleanupShaders();
 
+    pipelineCache.cleanup();
+    memoryAllocator.cleanup();
     vkDestroyDevice(device, nullptr);
 
 #ifdef _DEBUG
     DestroyDebugReportCallbackEXT(instance, callback, nullptr);
 #endif
 
-    vkDestroySurfaceKHR(instance, surface, nullptr);
+    if (!headless) {
+        vkDestroySurfaceKHR(instance, surface, nullptr);
+    }
     vkDestroyInstance(instance, nullptr);
 
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    if (!headless) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
+
+    delete workerPool;
+    workerPool = nullptr;
 }
 
 void VulkanApplication::processInputs() {
@@ -161,26 +292,122 @@ void VulkanApplication::processInputs() {
     mainCamera.mouseRotate(xPos, yPos);
 }
 
-void VulkanApplication::drawFrame() {
+// Uniforms and command buffers of currentFrame. Only call once its fence has signaled.
+void VulkanApplication::recordFrame(uint32_t imageIndex) {
+    FrameContext& frame = frames[currentFrame];
+
+    // timings of the last frame that used this slot, it is finished
+    profiler.collect(currentFrame, false);
+    cloudCounters = computeShader->getCounters(currentFrame);
+
+    meshShader->setFrame(currentFrame);
+    computeShader->setFrame(currentFrame);
+    reprojectShader->setFrame(currentFrame);
+    toneMapShader->setFrame(currentFrame);
+    godRayShader->setFrame(currentFrame);
+    radialBlurShader->setFrame(currentFrame);
+    updateUniformBuffer();
+
+    recordComputeCommandBuffer(frame.computeCommandBuffer);
+    recordBackgroundCommandBuffer(frame.backgroundCommandBuffer);
+    recordOffscreenCommandBuffer(frame.offscreenCommandBuffer);
+    recordPostProcessCommandBuffer(frame.commandBuffer, imageIndex);
+}
+
+void VulkanApplication::submitComputeCommandBuffer() {
+    FrameContext& frame = frames[currentFrame];
+
+    // the clouds overwrite the image the previous frame's background pass sampled. Frame 0 waits for the initial value.
+    const uint64_t waitValue = frameNumber;
+    const uint64_t signalValue = frameNumber + 1;
+    VkTimelineSemaphoreSubmitInfoKHR timelineInfo = {};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+    timelineInfo.waitSemaphoreValueCount = 1;
+    timelineInfo.pWaitSemaphoreValues = &waitValue;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &signalValue;
 
-    // submit compute queue
-    // Compute queue submit
     VkSubmitInfo computeSubmitInfo = {};
     computeSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    computeSubmitInfo.pNext = &timelineInfo;
 
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    computeSubmitInfo.waitSemaphoreCount = 1;
+    computeSubmitInfo.pWaitSemaphores = &backgroundTimeline;
+    computeSubmitInfo.pWaitDstStageMask = &waitStage;
     computeSubmitInfo.commandBufferCount = 1;
-    computeSubmitInfo.pCommandBuffers = &computeCommandBuffers[(swapBackgroundImages ? 1 : 0)];
-    swapBackgroundImages = !swapBackgroundImages;
+    computeSubmitInfo.pCommandBuffers = &frame.computeCommandBuffer;
+    computeSubmitInfo.signalSemaphoreCount = 1;
+    computeSubmitInfo.pSignalSemaphores = &computeTimeline;
 
     if (vkQueueSubmit(computeQueue, 1, &computeSubmitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
         throw std::runtime_error("Failed to submit compute command buffer");
     }
+}
+
+void VulkanApplication::submitGraphicsCommandBuffers(VkSemaphore imageAvailable, VkSemaphore renderFinished) {
+    FrameContext& frame = frames[currentFrame];
+    std::array<VkSubmitInfo, 3> submitInfos = {};
+
+    // Background pass: the only batch that waits for the clouds, and the one the next frame's clouds wait for
+    const uint64_t timelineValue = frameNumber + 1;
+    VkTimelineSemaphoreSubmitInfoKHR timelineInfo = {};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+    timelineInfo.waitSemaphoreValueCount = 1;
+    timelineInfo.pWaitSemaphoreValues = &timelineValue;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &timelineValue;
+
+    VkPipelineStageFlags backgroundWaitStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    submitInfos[0].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfos[0].pNext = &timelineInfo;
+    submitInfos[0].waitSemaphoreCount = 1;
+    submitInfos[0].pWaitSemaphores = &computeTimeline;
+    submitInfos[0].pWaitDstStageMask = &backgroundWaitStage;
+    submitInfos[0].commandBufferCount = 1;
+    submitInfos[0].pCommandBuffers = &frame.backgroundCommandBuffer;
+    submitInfos[0].signalSemaphoreCount = 1;
+    submitInfos[0].pSignalSemaphores = &backgroundTimeline;
+
+    // God rays, radial blur and mesh, ordered after the background pass by the offscreen render pass dependencies
+    submitInfos[1].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfos[1].commandBufferCount = 1;
+    submitInfos[1].pCommandBuffers = &frame.offscreenCommandBuffer;
+
+    // Final pass
+    VkPipelineStageFlags finalWaitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT; // vertex processing can still continue
+    submitInfos[2].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    if (imageAvailable != VK_NULL_HANDLE) {
+        submitInfos[2].waitSemaphoreCount = 1;
+        submitInfos[2].pWaitSemaphores = &imageAvailable;
+        submitInfos[2].pWaitDstStageMask = &finalWaitStage;
+    }
+    submitInfos[2].commandBufferCount = 1;
+    submitInfos[2].pCommandBuffers = &frame.commandBuffer;
+    if (renderFinished != VK_NULL_HANDLE) {
+        submitInfos[2].signalSemaphoreCount = 1;
+        submitInfos[2].pSignalSemaphores = &renderFinished;
+    }
+
+    // the fence signals after all three, which already waited for this frame's compute work
+    if (vkQueueSubmit(graphicsQueue, static_cast<uint32_t>(submitInfos.size()), submitInfos.data(), frame.inFlightFence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit draw command buffer!");
+    }
+    profiler.markSubmitted(currentFrame);
+}
+
+void VulkanApplication::drawFrame() {
+    FrameContext& frame = frames[currentFrame];
+
+    // the GPU is done with this frame's command buffers and uniforms once its fence has signaled,
+    // by then the CPU is up to framesInFlight frames ahead
+    vkWaitForFences(device, 1, &frame.inFlightFence, VK_TRUE, std::numeric_limits<uint64_t>::max());
 
     // acquire image from swap chain
     // execute corresponding command buffer
     // return the image to the swap chain, presentation mode
     uint32_t imageIndex;
-    VkResult result = vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+    VkResult result = vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), frame.imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
 
     // must recreate swapchain -or- swap chain isn't working
     if (result == VK_ERROR_OUT_OF_DATE_KHR) {
@@ -190,42 +417,20 @@ void VulkanApplication::drawFrame() {
         throw std::runtime_error("failed to acquire swap chain image!");
     }
 
-    VkSubmitInfo submitInfo = {};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    // only reset once we are sure to submit work that signals it again
+    vkResetFences(device, 1, &frame.inFlightFence);
 
-    VkSemaphore waitSemaphores[] = { imageAvailableSemaphore };
-    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = waitSemaphores;
-    submitInfo.pWaitDstStageMask = waitStages; // what part of the pipeline is blocked by semaphore; vertex processing can still continue
-
-    // Do all offscreen rendering
-    submitInfo.pSignalSemaphores = { &offscreenPass.semaphore };
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &offscreenPass.commandBuffers[(swapBackgroundImages ? 1 : 0)];
-
-    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
-        throw std::runtime_error("failed to submit offscreen command buffer!");
-    }
-
-    VkSemaphore signalSemaphores[] = { renderFinishedSemaphore };
+    recordFrame(imageIndex);
 
     // Draw the scene onto the screen
-    submitInfo.pWaitSemaphores = &offscreenPass.semaphore;
-    submitInfo.pSignalSemaphores = signalSemaphores;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffers[imageIndex]; // what is executed
-
-    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
-        throw std::runtime_error("failed to submit draw command buffer!");
-    }
+    submitComputeCommandBuffer();
+    submitGraphicsCommandBuffers(frame.imageAvailableSemaphore, frame.renderFinishedSemaphore);
     
     VkPresentInfoKHR presentInfo = {};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 
     presentInfo.waitSemaphoreCount = 1;
-    presentInfo.pWaitSemaphores = signalSemaphores;
+    presentInfo.pWaitSemaphores = &frame.renderFinishedSemaphore;
     VkSwapchainKHR swapChains[] = { swapChain };
     presentInfo.swapchainCount = 1;
     presentInfo.pSwapchains = swapChains;
@@ -234,7 +439,75 @@ void VulkanApplication::drawFrame() {
 
     vkQueuePresentKHR(presentQueue, &presentInfo); // present the image
 
-    vkQueueWaitIdle(presentQueue); // sync to avoid mem leaks
+    currentFrame = (currentFrame + 1) % framesInFlight;
+    frameNumber++;
+}
+
+static_assert(HEADLESS_TARGET_COUNT >= MAX_FRAMES_IN_FLIGHT, "a frame in flight would share its readback buffer");
+
+// Same submissions as drawFrame, but the final pass targets headlessFrameIndex's offscreen target and
+// copies it into that target's readback buffer. Encoding and writing the image happens on workerPool.
+void VulkanApplication::drawFrameHeadless() {
+    FrameContext& frame = frames[currentFrame];
+    uint32_t target = headlessFrameIndex % HEADLESS_TARGET_COUNT;
+
+    // the readback buffer of this target may still be in use by a writer from HEADLESS_TARGET_COUNT frames ago
+    if (readbackWrites[target].valid()) {
+        readbackWrites[target].wait();
+    }
+
+    vkWaitForFences(device, 1, &frame.inFlightFence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+    vkResetFences(device, 1, &frame.inFlightFence);
+
+    recordFrame(target);
+
+    // the final pass also copies to the readback buffer, nothing to acquire or present
+    submitComputeCommandBuffer();
+    submitGraphicsCommandBuffers(VK_NULL_HANDLE, VK_NULL_HANDLE);
+
+    frameSubmitted = std::chrono::high_resolution_clock::now();
+    headlessPending.push_back({ headlessFrameIndex, currentFrame });
+
+    currentFrame = (currentFrame + 1) % framesInFlight;
+    frameNumber++;
+
+    // like drawFrame, leave the GPU framesInFlight - 1 frames to work on while this one is read back.
+    // Benchmark frames are timed on their own, so they are waited on right away.
+    const size_t pendingLimit = benchmark ? 0 : framesInFlight - 1;
+    while (headlessPending.size() > pendingLimit) {
+        retireHeadlessFrame();
+    }
+}
+
+void VulkanApplication::retireHeadlessFrame() {
+    HeadlessFrame pending = headlessPending.front();
+    headlessPending.pop_front();
+
+    // the fence stays signaled for the next wait on this context
+    vkWaitForFences(device, 1, &frames[pending.context].inFlightFence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+
+    if (benchmark) {
+        return; // nothing was read back
+    }
+
+    uint32_t target = pending.index % HEADLESS_TARGET_COUNT;
+    memoryAllocator.invalidate(readbackBufferMemory[target]);
+
+    std::stringstream path;
+    path << headlessOutputPrefix << std::setw(5) << std::setfill('0') << pending.index << ".png";
+
+    auto written = std::make_shared<std::promise<void>>();
+    readbackWrites[target] = written->get_future();
+
+    const void* pixels = readbackBufferMemory[target].mapped;
+    const VkExtent2D extent = swapChainExtent;
+    std::string file = path.str();
+    workerPool->submit([written, pixels, extent, file]() {
+        if (!stbi_write_png(file.c_str(), extent.width, extent.height, 4, pixels, extent.width * 4)) {
+            std::cerr << "failed to write " << file << std::endl;
+        }
+        written->set_value();
+    });
 }
 
 void VulkanApplication::initializeTextures() {
@@ -250,37 +523,100 @@ void VulkanApplication::initializeTextures() {
     backgroundTexturePrev->initForStorage(swapChainExtent);
     depthTexture = new Texture(device, physicalDevice, commandPool, graphicsQueue);
     depthTexture->initForDepthAttachment(swapChainExtent);
+
+    // read by the clouds on the compute queue, some by the mesh shader too
+    const uint32_t graphicsFamily = deviceQueueFamilies.graphicsFamily;
+    const uint32_t computeFamily = deviceQueueFamilies.computeFamily;
+    backgroundAge = new Texture(device, physicalDevice, commandPool, graphicsQueue, VK_FORMAT_R32_SFLOAT);
+    backgroundAge->setSharedQueueFamilies(graphicsFamily, computeFamily);
+    backgroundAge->initForStorage(swapChainExtent);
+    backgroundAgePrev = new Texture(device, physicalDevice, commandPool, graphicsQueue, VK_FORMAT_R32_SFLOAT);
+    backgroundAgePrev->setSharedQueueFamilies(graphicsFamily, computeFamily);
+    backgroundAgePrev->initForStorage(swapChainExtent);
     cloudPlacementTexture = new Texture(device, physicalDevice, commandPool, graphicsQueue);
+    cloudPlacementTexture->setSharedQueueFamilies(graphicsFamily, computeFamily);
     cloudPlacementTexture->initFromFile("Textures/CloudPlacement.png");
+    CloudSkipMap cloudSkipMap;
+    cloudSkipMap.initFromFile("Textures/CloudPlacement.png");
+    cloudSkipTexture = new Texture(device, physicalDevice, commandPool, graphicsQueue, VK_FORMAT_R8_UNORM);
+    cloudSkipTexture->setSharedQueueFamilies(graphicsFamily, computeFamily);
+    cloudSkipTexture->initFromSkipMap(cloudSkipMap);
     nightSkyTexture = new Texture(device, physicalDevice, commandPool, graphicsQueue);
+    nightSkyTexture->setSharedQueueFamilies(graphicsFamily, computeFamily);
     nightSkyTexture->initFromFile("Textures/NightSky/nightSky_noOrange.png");
     cloudCurlNoise = new Texture(device, physicalDevice, commandPool, graphicsQueue);
-    cloudCurlNoise->initFromFile("Textures/CurlNoiseFBM.png");
+    cloudCurlNoise->setSharedQueueFamilies(graphicsFamily, computeFamily);
+    if (curlNoiseSize > 0) {
+        cloudCurlNoise->initFromCurlNoise(curlNoiseSize, *workerPool);
+    }
+    else {
+        cloudCurlNoise->initFromFile("Textures/CurlNoiseFBM.png");
+    }
     lowResCloudShapeTexture3D = new Texture3D(device, physicalDevice, commandPool, graphicsQueue, 128, 128, 128); // 128, 128, 128
-    lowResCloudShapeTexture3D->initFromFile("Textures/3DTextures/lowResCloudShape/lowResCloud"); // note: no .png
+    lowResCloudShapeTexture3D->setSharedQueueFamilies(graphicsFamily, computeFamily);
+    initCloudVolume(lowResCloudShapeTexture3D, "Textures/3DTextures/lowResCloudShape.vol", "Textures/3DTextures/lowResCloudShape/lowResCloud"); // note: no .png
     hiResCloudShapeTexture3D = new Texture3D(device, physicalDevice, commandPool, graphicsQueue, 32, 32, 32); // 128, 128, 128
-    hiResCloudShapeTexture3D->initFromFile("Textures/3DTextures/hiResCloudShape/hiResClouds "); // note: no .png
+    hiResCloudShapeTexture3D->setSharedQueueFamilies(graphicsFamily, computeFamily);
+    initCloudVolume(hiResCloudShapeTexture3D, "Textures/3DTextures/hiResCloudShape.vol", "Textures/3DTextures/hiResCloudShape/hiResClouds "); // note: no .png
+    if (cloudLightVolumeEnabled) {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, VK_FORMAT_R32_SFLOAT, &properties);
+        if (!(properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
+            std::cout << "cloud light volume disabled, the device can not filter R32F images" << std::endl;
+            cloudLightVolumeEnabled = false;
+        }
+    }
+    // bound either way, only baked and read with --cloud-lighting volume
+    const uint32_t lightVolumeWidth = cloudLightVolumeEnabled ? LIGHT_VOLUME_WIDTH : 1;
+    const uint32_t lightVolumeLayers = cloudLightVolumeEnabled ? LIGHT_VOLUME_LAYERS : 1;
+    cloudLightVolumeTexture = new Texture3D(device, physicalDevice, commandPool, graphicsQueue, lightVolumeWidth, lightVolumeWidth, lightVolumeLayers, VK_FORMAT_R32_SFLOAT);
+    cloudLightVolumeTexture->setSharedQueueFamilies(graphicsFamily, computeFamily);
+    cloudLightVolumeTexture->initForStorage({ lightVolumeWidth, lightVolumeWidth, lightVolumeLayers });
 
 }
 
 // TODO: management
+// Packed volumes load without decoding anything. Only the slices are committed, the first run packs them the way
+// SkyEngine.exe --pack-volume does and later runs load the packed file. If it can't be written, the slices are loaded.
+void VulkanApplication::initCloudVolume(Texture3D* texture, std::string volumePath, std::string slicePath) {
+    if (texture->initFromPackedFile(volumePath)) {
+        return;
+    }
+
+    try {
+        VolumeHeader header = VolumeFile::packSlices(slicePath, volumePath);
+        std::cout << "packed " << header.width << "x" << header.height << "x" << header.depth << " volume into " << volumePath << std::endl;
+    }
+    catch (const std::runtime_error& error) {
+        std::remove(volumePath.c_str()); // never leave a partly written volume for the next run
+        std::cout << error.what() << " Loading the slices instead." << std::endl;
+        texture->initFromFile(slicePath, *workerPool);
+        return;
+    }
+    texture->initFromPackedFile(volumePath);
+}
+
 void VulkanApplication::cleanupTextures() {
     delete meshTexture;
     delete meshPBRInfo;
     delete meshNormals;
     delete backgroundTexture;
     delete backgroundTexturePrev;
+    delete backgroundAge;
+    delete backgroundAgePrev;
     delete depthTexture;
     delete cloudPlacementTexture;
+    delete cloudSkipTexture;
     delete nightSkyTexture;
     delete cloudCurlNoise;
     delete lowResCloudShapeTexture3D;
     delete hiResCloudShapeTexture3D;
+    delete cloudLightVolumeTexture;
 }
 
 void VulkanApplication::initializeGeometry() {
     sceneGeometry = new Geometry(device, physicalDevice, commandPool, graphicsQueue);
-    sceneGeometry->setupFromMesh("Models/terrain.obj");
+    sceneGeometry->setupFromMesh("Models/terrain.obj", sceneVertexFormat, TERRAIN_LOD_SCALE);
     backgroundGeometry = new Geometry(device, physicalDevice, commandPool, graphicsQueue);
     backgroundGeometry->setupAsBackgroundQuad();
 }
@@ -291,30 +627,117 @@ void VulkanApplication::cleanupGeometry() {
 }
 
 void VulkanApplication::initializeShaders() {
+    // One block of uniforms per frame in flight, shared by every shader
+    uniformRing = new UniformRing(device, physicalDevice, commandPool, graphicsQueue, sizeof(FrameUniforms));
+
     meshShader = new MeshShader(device, physicalDevice, commandPool, graphicsQueue, swapChainExtent, 
-        &offscreenPass.renderPass, std::string("Shaders/model.vert.spv"), std::string("Shaders/model.frag.spv"), meshTexture, meshPBRInfo, meshNormals, cloudPlacementTexture, lowResCloudShapeTexture3D);
+        &offscreenPass.renderPass, uniformRing, sceneGeometry->getVertexFormat(), std::string("Shaders/model.vert.spv"), std::string("Shaders/model.frag.spv"), meshTexture, meshPBRInfo, meshNormals, cloudPlacementTexture, lowResCloudShapeTexture3D);
     
     backgroundShader = new BackgroundShader(device, physicalDevice, commandPool, graphicsQueue, swapChainExtent, 
         &offscreenPass.renderPass, std::string("Shaders/background.vert.spv"), std::string("Shaders/background.frag.spv"), backgroundTexture, backgroundTexturePrev);
 
-    // Note: we pass the background shader's texture with the intention of writing to it with the compute shader
-    reprojectShader = new ReprojectShader(device, physicalDevice, commandPool, computeQueue, swapChainExtent, &offscreenPass.renderPass,
-        std::string("Shaders/reproject.comp.spv"), backgroundTexture, backgroundTexturePrev);
-
-    computeShader = new ComputeShader(device, physicalDevice, commandPool, computeQueue, swapChainExtent, 
-        &offscreenPass.renderPass, std::string("Shaders/compute-clouds.comp.spv"), backgroundTexture, backgroundTexturePrev, cloudPlacementTexture, nightSkyTexture, cloudCurlNoise,
-        lowResCloudShapeTexture3D, hiResCloudShapeTexture3D);
+    reprojectShader = createReprojectShader(reprojectWorkgroup);
+    computeShader = createCloudShader(cloudMarchSettings.workgroup);
 
     // Post shaders: there will be many
     // This is still offscreen, so the render pass is the offscreen render pass
     godRayShader = new PostProcessShader(device, physicalDevice, commandPool, graphicsQueue, swapChainExtent,
-        &offscreenPass.renderPass, std::string("Shaders/post-pass.vert.spv"), std::string("Shaders/god-ray.frag.spv"), &offscreenPass.framebuffers[0].descriptor);
+        &offscreenPass.renderPass, uniformRing, std::string("Shaders/post-pass.vert.spv"), std::string("Shaders/god-ray.frag.spv"), &offscreenPass.framebuffers[0].descriptor);
 
     radialBlurShader = new PostProcessShader(device, physicalDevice, commandPool, graphicsQueue, swapChainExtent,
-        &offscreenPass.renderPass, std::string("Shaders/post-pass.vert.spv"), std::string("Shaders/radialBlur.frag.spv"), &offscreenPass.framebuffers[1].descriptor);
+        &offscreenPass.renderPass, uniformRing, std::string("Shaders/post-pass.vert.spv"), std::string("Shaders/radialBlur.frag.spv"), &offscreenPass.framebuffers[1].descriptor);
 
     toneMapShader = new PostProcessShader(device, physicalDevice, commandPool, graphicsQueue, swapChainExtent,
-        &renderPass, std::string("Shaders/post-pass.vert.spv"), std::string("Shaders/tonemap.frag.spv"), &offscreenPass.framebuffers[2].descriptor);
+        &renderPass, uniformRing, std::string("Shaders/post-pass.vert.spv"), std::string("Shaders/tonemap.frag.spv"), &offscreenPass.framebuffers[2].descriptor);
+}
+
+// Note: we pass the background shader's texture with the intention of writing to it with the compute shaders
+ComputeShader* VulkanApplication::createCloudShader(VkExtent2D workgroup) {
+    CloudMarchSettings settings = cloudMarchSettings;
+    settings.workgroup = workgroup;
+    settings.lightVolume = cloudLightVolumeEnabled;
+    return new ComputeShader(device, physicalDevice, commandPool, computeQueue, swapChainExtent,
+        &offscreenPass.renderPass, uniformRing, std::string("Shaders/compute-clouds.comp.spv"), backgroundTexture, backgroundTexturePrev, cloudPlacementTexture, nightSkyTexture, cloudCurlNoise,
+        lowResCloudShapeTexture3D, hiResCloudShapeTexture3D, cloudSkipTexture, cloudLightVolumeTexture, settings,
+        backgroundAge, backgroundAgePrev);
+}
+
+ReprojectShader* VulkanApplication::createReprojectShader(VkExtent2D workgroup) {
+    return new ReprojectShader(device, physicalDevice, commandPool, computeQueue, swapChainExtent, &offscreenPass.renderPass, uniformRing,
+        std::string("Shaders/reproject.comp.spv"), backgroundTexture, backgroundTexturePrev, backgroundAge, backgroundAgePrev, workgroup);
+}
+
+void VulkanApplication::tuneWorkgroups() {
+    WorkgroupTuner tuner;
+    tuner.init(device, physicalDevice, deviceQueueFamilies.computeFamily, computeQueue, computeCommandPool);
+    if (!tuner.isEnabled()) return;
+
+    // uniforms of a first frame, looking at the horizon so most rays reach the clouds, without advancing the temporal
+    // pattern or the light volume
+    Camera tuningCamera(glm::vec3(0.f, 1.f, 0.f), glm::vec3(0.f, 1.25f, -1.f), 0.1f, 1000.0f, 45.0f);
+    tuningCamera.setAspect((float)swapChainExtent.width, (float)swapChainExtent.height);
+    tuningCamera.getView(); // the previous view is the same one, nothing moved
+    tuningCamera.getProj();
+    tuningCamera.getPosition();
+    FrameUniforms frameUniforms = {};
+    writeCameraUniforms(frameUniforms, tuningCamera);
+    skySystem.rebuildSkyFromNewSun(0.25f, 0.25f);
+    frameUniforms.sun = skySystem.getSun();
+    frameUniforms.sky = skySystem.getSky();
+    frameUniforms.temporal.blockSize = static_cast<int32_t>(temporalScheduler.getBlockSize());
+    frameUniforms.temporal.remarchBudget = static_cast<int32_t>(temporalScheduler.getRemarchBudget()); // adaptive runs march more
+    uniformRing->write(currentFrame, &frameUniforms, sizeof(frameUniforms));
+
+    // the candidates are not worth keeping in the pipeline cache, only the winners are created again next launch
+    Shader::setPipelineCache(VK_NULL_HANDLE);
+    float reprojectMs = 0.0f, cloudsMs = 0.0f;
+    bool first = true;
+    for (VkExtent2D workgroup : tuner.getCandidates()) {
+        ReprojectShader* reproject = createReprojectShader(workgroup);
+        reproject->setFrame(currentFrame);
+        float ms = tuner.time([&](VkCommandBuffer commandBuffer) {
+            reproject->bindShader(commandBuffer);
+            reproject->cmdReproject(commandBuffer);
+        });
+        delete reproject;
+        if (first || ms < reprojectMs) {
+            reprojectMs = ms;
+            reprojectWorkgroup = workgroup;
+        }
+
+        ComputeShader* clouds = createCloudShader(workgroup);
+        clouds->setFrame(currentFrame);
+        ms = tuner.time([&](VkCommandBuffer commandBuffer) {
+            clouds->bindShader(commandBuffer);
+            clouds->cmdMarch(commandBuffer, temporalScheduler.getBlockSize());
+        });
+        delete clouds;
+        if (first || ms < cloudsMs) {
+            cloudsMs = ms;
+            cloudMarchSettings.workgroup = workgroup;
+        }
+        first = false;
+    }
+    tuner.cleanup();
+    Shader::setPipelineCache(pipelineCache.getCache());
+
+    std::cout << "workgroups: reproject " << reprojectWorkgroup.width << "x" << reprojectWorkgroup.height << " (" << reprojectMs << " ms), clouds "
+        << cloudMarchSettings.workgroup.width << "x" << cloudMarchSettings.workgroup.height << " (" << cloudsMs << " ms)" << std::endl;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    WorkgroupTuner::save(WORKGROUP_CACHE_PATH, properties, getWorkgroupTuningSettings(), { reprojectWorkgroup, cloudMarchSettings.workgroup });
+
+    // both switch between the two cloud images every time they are bound, so they are replaced together
+    delete reprojectShader;
+    delete computeShader;
+    reprojectShader = createReprojectShader(reprojectWorkgroup);
+    computeShader = createCloudShader(cloudMarchSettings.workgroup);
+}
+
+std::vector<uint32_t> VulkanApplication::getWorkgroupTuningSettings() const {
+    return { swapChainExtent.width, swapChainExtent.height, temporalScheduler.getBlockSize(), temporalScheduler.getRemarchBudget(),
+        cloudMarchSettings.maxSteps, cloudMarchSettings.lightConeSamples, cloudLightVolumeEnabled ? 1u : 0u };
 }
 
 void VulkanApplication::cleanupShaders() {
@@ -325,6 +748,7 @@ void VulkanApplication::cleanupShaders() {
     delete toneMapShader;
     delete godRayShader;
     delete radialBlurShader;
+    delete uniformRing;
 }
 
 void VulkanApplication::cleanupOffscreenPass() {
@@ -335,63 +759,131 @@ void VulkanApplication::cleanupOffscreenPass() {
         // Attachments
         vkDestroyImageView(device, framebuffer.color.view, nullptr);
         vkDestroyImage(device, framebuffer.color.image, nullptr);
-        vkFreeMemory(device, framebuffer.color.mem, nullptr);
+        memoryAllocator.free(framebuffer.color.mem);
         vkDestroyImageView(device, framebuffer.depth.view, nullptr);
         vkDestroyImage(device, framebuffer.depth.image, nullptr);
-        vkFreeMemory(device, framebuffer.depth.mem, nullptr);
+        memoryAllocator.free(framebuffer.depth.mem);
 
         vkDestroyFramebuffer(device, framebuffer.framebuffer, nullptr);
     }
 
     vkDestroyRenderPass(device, offscreenPass.renderPass, nullptr);
-    vkFreeCommandBuffers(device, commandPool, offscreenPass.commandBuffers.size(), offscreenPass.commandBuffers.data());
-    vkDestroySemaphore(device, offscreenPass.semaphore, nullptr);
 }
 
 void VulkanApplication::updateUniformBuffer() {
     float time = prevTime + deltaTime;
 
-    UniformCameraObject ucoPrev = {};
-    ucoPrev.proj = mainCamera.getProjPrev();
-    ucoPrev.proj[1][1] *= -1;
-    ucoPrev.view = mainCamera.getViewPrev();
-    ucoPrev.cameraPosition = glm::vec4(mainCamera.getPositionPrev(), 1.0f);
+    FrameUniforms frameUniforms = {};
 
-    UniformCameraObject uco = {};
-    uco.proj = mainCamera.getProj();
-    uco.proj[1][1] *= -1; // :(
-    uco.view = mainCamera.getView();
-    uco.cameraPosition = glm::vec4(mainCamera.getPosition(), 1.0f);
-    uco.cameraParams.x = mainCamera.getAspect();
-    uco.cameraParams.y = mainCamera.getHTanFov();
+    writeCameraUniforms(frameUniforms, mainCamera);
+    const UniformCameraObject& uco = frameUniforms.camera;
 
-    UniformModelObject umo = {};
+    UniformModelObject& umo = frameUniforms.model;
     umo.model = glm::mat4(1.0f);
-    umo.model[0][0] = 100.0f;
-    umo.model[2][2] = 100.0f;
+    umo.model[0][0] = TERRAIN_SCALE;
+    umo.model[2][2] = TERRAIN_SCALE;
     umo.invTranspose = glm::inverse(glm::transpose(umo.model));
-    float interp = sin(time * 0.025f);
+    umo.positionOffset = glm::vec4(sceneGeometry->getPositionOffset(), 0.0f);
+    umo.positionScale = glm::vec4(sceneGeometry->getPositionScale(), 1.0f);
+
+    // chunks and their levels of detail for this frame
+    float pixelsPerUnit = mainCamera.getProj()[1][1] * 0.5f * static_cast<float>(swapChainExtent.height);
+    chunkStats = sceneGeometry->cullChunks(currentFrame, umo.model, uco.proj * uco.view, glm::vec3(uco.cameraPosition), pixelsPerUnit);
+
+    writeSkyUniforms(frameUniforms, time);
+    const UniformSunObject& sun = frameUniforms.sun;
 
-    skySystem.rebuildSkyFromNewSun(interp * 0.5f, 0.25f);
+    frameUniforms.temporal = temporalScheduler.next();
+    if (cloudLightVolumeEnabled) {
+        lightVolumeBake = cloudLightVolume.schedule(glm::vec3(sun.directionBasis[1]), frameUniforms.sky.wind, mainCamera.getPosition());
+    }
+    uniformRing->write(currentFrame, &frameUniforms, sizeof(frameUniforms));
+
+    if (!headless) {
+        std::stringstream ss;
+        ss << 1.0 / deltaTime;
+        if (profiler.isEnabled()) {
+            ss << " fps | " << profiler.getSummary();
+        }
+        ss << " | " << chunkStats.chunks << "/" << sceneGeometry->getChunkCount() << " chunks (" << chunkStats.coarseChunks << " coarser), "
+            << chunkStats.triangles << " triangles";
+        ss << " | " << cloudCounters.skipped << "/" << (cloudCounters.evaluated + cloudCounters.skipped) << " cloud samples skipped";
+        ss << " | " << temporalScheduler.getBlockSize() << "x" << temporalScheduler.getBlockSize() << " " << TemporalScheduler::getOrderName(temporalScheduler.getOrder());
+        if (temporalScheduler.isAdaptive()) {
+            ss << ", " << cloudCounters.remarched << " pixels remarched, " << cloudCounters.deferred << " deferred";
+        }
+        glfwSetWindowTitle(window, ss.str().c_str());
+    }
+}
+
+void VulkanApplication::writeCameraUniforms(FrameUniforms& frameUniforms, Camera& camera) {
+    UniformCameraObject& ucoPrev = frameUniforms.cameraPrev;
+    ucoPrev.proj = camera.getProjPrev();
+    ucoPrev.proj[1][1] *= -1;
+    ucoPrev.view = camera.getViewPrev();
+    ucoPrev.cameraPosition = glm::vec4(camera.getPositionPrev(), 1.0f);
+
+    UniformCameraObject& uco = frameUniforms.camera;
+    uco.proj = camera.getProj();
+    uco.proj[1][1] *= -1; // :(
+    uco.view = camera.getView();
+    uco.cameraPosition = glm::vec4(camera.getPosition(), 1.0f);
+    uco.cameraParams.x = camera.getAspect();
+    uco.cameraParams.y = camera.getHTanFov();
+}
+
+void VulkanApplication::writeSkyUniforms(FrameUniforms& frameUniforms, float time) {
+    if (benchmark) {
+        skySystem.rebuildSkyFromNewSun(benchmarkKey.sunElevation, benchmarkKey.sunAzimuth);
+    }
+    else {
+        float interp = sin(time * 0.025f);
+        skySystem.rebuildSkyFromNewSun(interp * 0.5f, 0.25f);
+    }
     skySystem.setTime(time * 2.f);
 
-    UniformSkyObject sky = skySystem.getSky();
-    UniformSunObject& sun = skySystem.getSun(); // by reference so we can update the pixel counter in sun.color.a below
-    
-    // Pass a uniform value in sun.color.a indicating which of the 16 pixels should be updated.
-    // Yes, this should have its own uniform but you would have to pad to sizeof(vec4) and we are not even using 
-    // this channel already. Will probably change later.
-    sun.color.a = ((int)sun.color.a + 1) % 16; // update every 16th pixel
+    frameUniforms.sun = skySystem.getSun();
+    frameUniforms.sky = skySystem.getSky();
+}
 
-    computeShader->updateUniformBuffers(uco, ucoPrev, sky, sun);
-    reprojectShader->updateUniformBuffers(uco, ucoPrev, sky, sun);
-    meshShader->updateUniformBuffers(uco, umo, sun, sky);
-    godRayShader->updateUniformBuffers(uco, sun);
-    radialBlurShader->updateUniformBuffers(uco, sun);
+void VulkanApplication::runCPURender(uint32_t frameCount, std::string outputPrefix) {
+    if (cloudLightVolumeEnabled) {
+        throw std::runtime_error("failed to render on the CPU, it only lights the clouds with the cone, not the light volume!");
+    }
+    // the same step budget and light cone as the compute shader, so the frames stay comparable
+    workerPool = new ThreadPool();
+    CloudRendererCPU renderer(*workerPool, cloudMarchSettings);
+    renderer.initTextures();
+
+    // what initVulkan and headlessLoop set up for runHeadless
+    mainCamera = Camera(glm::vec3(0.f, 1.f, 1.f), glm::vec3(0.f, 0.f, 0.f), 0.1f, 1000.0f, 45.0f);
+    mainCamera.setAspect((float)WIDTH, (float)HEIGHT);
+    skySystem = SkyManager();
+    prevTime = 0.0f;
+    deltaTime = 1.0f / 60.0f;
 
-    std::stringstream ss;
-    ss << 1.0 / deltaTime;
-    glfwSetWindowTitle(window, ss.str().c_str());
+    std::vector<glm::vec4> pixels;
+    for (uint32_t i = 0; i < frameCount; i++) {
+        FrameUniforms frameUniforms = {};
+        writeCameraUniforms(frameUniforms, mainCamera);
+        writeSkyUniforms(frameUniforms, prevTime + deltaTime);
+
+        auto frameStart = std::chrono::high_resolution_clock::now();
+        renderer.render(frameUniforms.camera, frameUniforms.sun, frameUniforms.sky, WIDTH, HEIGHT, pixels);
+        double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - frameStart).count();
+
+        std::stringstream path;
+        path << outputPrefix << std::setw(5) << std::setfill('0') << i << ".hdr";
+        CloudRendererCPU::saveHDR(path.str(), WIDTH, HEIGHT, pixels);
+
+        CloudMarchCounters counters = renderer.getLastCounters();
+        std::cout << path.str() << ": " << seconds << " s, " << counters.skipped << "/" << (counters.evaluated + counters.skipped)
+            << " cloud samples skipped" << std::endl;
+        prevTime += deltaTime;
+    }
+
+    delete workerPool;
+    workerPool = nullptr;
 }
 
 uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties, VkPhysicalDevice physicalDevice) {
@@ -458,13 +950,6 @@ void VulkanApplication::createInstance() {
     createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
     createInfo.pApplicationInfo = &appInfo;
 
-    // check GLFW extensions
-    unsigned int glfwExtensionCount = 0;
-    const char** glfwExtensions;
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-    createInfo.enabledExtensionCount = glfwExtensionCount;
-    createInfo.ppEnabledExtensionNames = glfwExtensions;
-
     auto allextensions = getRequiredExtensions();
     createInfo.enabledExtensionCount = static_cast<uint32_t>(allextensions.size());
     createInfo.ppEnabledExtensionNames = allextensions.data();
@@ -521,20 +1006,37 @@ bool VulkanApplication::checkValidationLayerSupport() {
 std::vector<const char*> VulkanApplication::getRequiredExtensions() {
     std::vector<const char*> extensions;
 
-    unsigned int glfwExtensionCount = 0;
-    const char** glfwExtensions;
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    // headless rendering needs no surface extensions (and GLFW is never initialized)
+    if (!headless) {
+        unsigned int glfwExtensionCount = 0;
+        const char** glfwExtensions;
+        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
-    for (unsigned int i = 0; i < glfwExtensionCount; i++) {
-        extensions.push_back(glfwExtensions[i]);
+        for (unsigned int i = 0; i < glfwExtensionCount; i++) {
+            extensions.push_back(glfwExtensions[i]);
+        }
     }
 
+    // needed by VK_KHR_timeline_semaphore on a 1.0 instance
+    extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+
 #ifdef _DEBUG
     extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
 #endif
     return extensions;
 }
 
+std::vector<const char*> VulkanApplication::getRequiredDeviceExtensions() {
+    // the compute and graphics queues are synchronized with timeline semaphores
+    std::vector<const char*> extensions = { VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME };
+
+    // headless rendering has no swapchain
+    if (!headless) {
+        extensions.insert(extensions.end(), deviceExtensions.begin(), deviceExtensions.end());
+    }
+    return extensions;
+}
+
 void VulkanApplication::setupDebugCallback() {
 #ifdef _DEBUG
     VkDebugReportCallbackCreateInfoEXT createInfo = {};
@@ -566,8 +1068,8 @@ bool VulkanApplication::isDeviceSuitable(VkPhysicalDevice device) {
 
     bool extensionsSupported = checkDeviceExtensionSupport(device);
 
-    bool swapChainAdequate = false;
-    if (extensionsSupported) {
+    bool swapChainAdequate = headless;
+    if (extensionsSupported && !headless) {
         SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
         swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
     }
@@ -609,29 +1111,37 @@ QueueFamilyIndices VulkanApplication::findQueueFamilies(VkPhysicalDevice device)
 
     int i = 0;
     for (const auto& queueFamily : queueFamilies) {
-        if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+        if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT && indices.graphicsFamily < 0) {
             indices.graphicsFamily = i;
         }
         
-        //TODO: is this correct
-        if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) {
+        // take the first compute family, unless a later one has no graphics: that is the async compute queue
+        bool dedicatedCompute = !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT);
+        if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT &&
+            (indices.computeFamily < 0 || (dedicatedCompute && queueFamilies[indices.computeFamily].queueFlags & VK_QUEUE_GRAPHICS_BIT))) {
             indices.computeFamily = i;
         }
 
         VkBool32 presentSupport = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-
-        if (queueFamily.queueCount > 0 && presentSupport) {
-            indices.presentFamily = i;
+        if (headless) {
+            // nothing is presented, so the graphics queue stands in
+            presentSupport = queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT;
+        } else {
+            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
         }
 
-        if (indices.isComplete()) {
-            break;
+        if (queueFamily.queueCount > 0 && presentSupport && indices.presentFamily < 0) {
+            indices.presentFamily = i;
         }
 
         i++;
     }
 
+    // Without a separate compute family, a second queue of the graphics family still lets the clouds overlap graphics work
+    if (indices.isComplete() && indices.computeFamily == indices.graphicsFamily && queueFamilies[indices.computeFamily].queueCount > 1) {
+        indices.computeQueueIndex = 1;
+    }
+
     return indices;
 }
 
@@ -641,30 +1151,41 @@ void VulkanApplication::createLogicalDevice() {
     QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
 
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-    std::set<int> uniqueQueueFamilies = { indices.graphicsFamily, indices.presentFamily };
+    std::set<int> uniqueQueueFamilies = { indices.graphicsFamily, indices.computeFamily, indices.presentFamily };
 
-    float queuePriority = 1.0f;
+    float queuePriorities[] = { 1.0f, 1.0f };
     for (int queueFamily : uniqueQueueFamilies) {
         VkDeviceQueueCreateInfo queueCreateInfo = {};
         queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
         queueCreateInfo.queueFamilyIndex = queueFamily;
-        queueCreateInfo.queueCount = 1;
-        queueCreateInfo.pQueuePriorities = &queuePriority;
+        queueCreateInfo.queueCount = queueFamily == indices.computeFamily ? indices.computeQueueIndex + 1 : 1;
+        queueCreateInfo.pQueuePriorities = queuePriorities;
         queueCreateInfos.push_back(queueCreateInfo);
     }
 
     // TODO : modify with specific features
     VkPhysicalDeviceFeatures deviceFeatures = {};
     deviceFeatures.samplerAnisotropy = VK_TRUE;
+    // the visible chunks of a mesh are drawn with one indirect call when this is supported, see Geometry
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+    deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+
+    // always supported along with the extension
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures = {};
+    timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+    timelineFeatures.timelineSemaphore = VK_TRUE;
 
     VkDeviceCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    createInfo.pNext = &timelineFeatures;
     createInfo.pQueueCreateInfos = queueCreateInfos.data();
     createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
     createInfo.pEnabledFeatures = &deviceFeatures;
 
-    createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-    createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+    std::vector<const char*> enabledDeviceExtensions = getRequiredDeviceExtensions();
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledDeviceExtensions.size());
+    createInfo.ppEnabledExtensionNames = enabledDeviceExtensions.data();
 
 #ifdef _DEBUG //DEBUG_VALIDATION
     
@@ -680,10 +1201,10 @@ void VulkanApplication::createLogicalDevice() {
         throw std::runtime_error("failed to create logical device!");
     }
 
-    // TODO : multiple queues
     vkGetDeviceQueue(device, indices.graphicsFamily, 0, &graphicsQueue);
-    vkGetDeviceQueue(device, indices.computeFamily, 0, &computeQueue);
+    vkGetDeviceQueue(device, indices.computeFamily, indices.computeQueueIndex, &computeQueue);
     vkGetDeviceQueue(device, indices.presentFamily, 0, &presentQueue);
+    deviceQueueFamilies = indices;
 }
 
 // Make a surface for Vulkan to draw on. GLFW handles this. (Platform-dependent)
@@ -700,6 +1221,7 @@ bool VulkanApplication::checkDeviceExtensionSupport(VkPhysicalDevice device) {
     std::vector<VkExtensionProperties> availableExtensions(extensionCount);
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
 
+    std::vector<const char*> deviceExtensions = getRequiredDeviceExtensions();
     std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
 
     for (const auto& extension : availableExtensions) {
@@ -760,7 +1282,8 @@ void VulkanApplication::createRenderPass() {
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    // headless targets are copied out to a readback buffer instead of presented
+    colorAttachment.finalLayout = headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
     VkAttachmentReference colorAttachmentRef = {};
     colorAttachmentRef.attachment = 0; // shader does layout(location = 0) for color!
@@ -786,13 +1309,22 @@ void VulkanApplication::createRenderPass() {
     subpass.pColorAttachments = &colorAttachmentRef;
     subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
-    VkSubpassDependency dependency = {};
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass = 0;
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask = 0;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    std::array<VkSubpassDependency, 2> dependencies = {};
+    // the depth attachment is shared by every frame in flight, so also order its writes after the previous frame's
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    // headless: the copy into the readback buffer has to wait for the color writes
+    dependencies[1].srcSubpass = 0;
+    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
 
     std::array<VkAttachmentDescription, 2> attachments = { colorAttachment, depthAttachment };
 
@@ -802,24 +1334,78 @@ void VulkanApplication::createRenderPass() {
     renderPassInfo.pAttachments = attachments.data();
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+    renderPassInfo.dependencyCount = headless ? 2 : 1;
+    renderPassInfo.pDependencies = dependencies.data();
 
     if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
         throw std::runtime_error("failed to create render pass!");
     }
 }
 
-void VulkanApplication::createSemaphores() {
+void VulkanApplication::createFrameContexts() {
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+
     VkSemaphoreCreateInfo semaphoreInfo = {};
     semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-    if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphore) != VK_SUCCESS ||
-        vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphore) != VK_SUCCESS) {
 
-        throw std::runtime_error("failed to create semaphores!");
+    // signaled, so the first wait on each context returns immediately
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+    for (uint32_t f = 0; f < framesInFlight; f++) {
+        FrameContext& frame = frames[f];
+
+        allocInfo.commandPool = computeCommandPool;
+        if (vkAllocateCommandBuffers(device, &allocInfo, &frame.computeCommandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate command buffers");
+        }
+        allocInfo.commandPool = commandPool;
+        if (vkAllocateCommandBuffers(device, &allocInfo, &frame.backgroundCommandBuffer) != VK_SUCCESS ||
+            vkAllocateCommandBuffers(device, &allocInfo, &frame.offscreenCommandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate offscreen command buffer!");
+        }
+        if (vkAllocateCommandBuffers(device, &allocInfo, &frame.commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate command buffers!");
+        }
+
+        if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &frame.imageAvailableSemaphore) != VK_SUCCESS ||
+            vkCreateSemaphore(device, &semaphoreInfo, nullptr, &frame.renderFinishedSemaphore) != VK_SUCCESS) {
+
+            throw std::runtime_error("failed to create semaphores!");
+        }
+
+        if (vkCreateFence(device, &fenceInfo, nullptr, &frame.inFlightFence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create fence!");
+        }
     }
 
+    // Shared by all frames, counting up with frameNumber
+    VkSemaphoreTypeCreateInfoKHR timelineInfo = {};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+    timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+    timelineInfo.initialValue = 0;
+    semaphoreInfo.pNext = &timelineInfo;
+
+    if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &computeTimeline) != VK_SUCCESS ||
+        vkCreateSemaphore(device, &semaphoreInfo, nullptr, &backgroundTimeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create timeline semaphores!");
+    }
+}
 
+// Command buffers go away with their pools
+void VulkanApplication::cleanupFrameContexts() {
+    for (uint32_t f = 0; f < framesInFlight; f++) {
+        FrameContext& frame = frames[f];
+        vkDestroySemaphore(device, frame.imageAvailableSemaphore, nullptr);
+        vkDestroySemaphore(device, frame.renderFinishedSemaphore, nullptr);
+        vkDestroyFence(device, frame.inFlightFence, nullptr);
+    }
+    vkDestroySemaphore(device, computeTimeline, nullptr);
+    vkDestroySemaphore(device, backgroundTimeline, nullptr);
 }
 
 void VulkanApplication::createCommandPool() {
@@ -828,8 +1414,7 @@ void VulkanApplication::createCommandPool() {
     VkCommandPoolCreateInfo poolInfo = {};
     poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
-    poolInfo.flags = 0; // for recording once and executing many times. 
-    // otherwise, use VK_COMMAND_POOL_CREATE_TRANSIENT_BIT -or- VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // the per-frame command buffers are re-recorded every frame
 
     if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
         throw std::runtime_error("failed to create command pool!");
@@ -839,7 +1424,7 @@ void VulkanApplication::createCommandPool() {
     VkCommandPoolCreateInfo computePoolInfo = {};
     computePoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     computePoolInfo.queueFamilyIndex = queueFamilyIndices.computeFamily; //TODO: need compute index or whatever
-    computePoolInfo.flags = 0;
+    computePoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
     if (vkCreateCommandPool(device, &computePoolInfo, nullptr, &computeCommandPool) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create command pool");
@@ -879,202 +1464,254 @@ void VulkanApplication::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
     vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
 }
 
-// This function renders everything that is offscreen. The PostProcessCommandBuffer actually renders to the screen.
-void VulkanApplication::createCommandBuffers() {
+// The first offscreen pass, in a command buffer of its own so the next frame's clouds only wait for this one
+void VulkanApplication::recordBackgroundCommandBuffer(VkCommandBuffer commandBuffer) {
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = nullptr; // Optional
 
-    if (offscreenPass.commandBuffers.size() == 0)
-    {
-        offscreenPass.commandBuffers.resize(2);
-        VkCommandBufferAllocateInfo commandBufferAllocateInfo{};
-        commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        commandBufferAllocateInfo.commandPool = commandPool;
-        commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        commandBufferAllocateInfo.commandBufferCount = 1;
-
-        if (vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &offscreenPass.commandBuffers[0]) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate offscreen command buffer!");
-        }
-        if (vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &offscreenPass.commandBuffers[1]) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate offscreen command buffer!");
-        }
-    }
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
 
-    if (offscreenPass.semaphore == VK_NULL_HANDLE)
-    {
-        VkSemaphoreCreateInfo semaphoreCreateInfo {};
-        semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-        if (vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &offscreenPass.semaphore) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate offscreen semaphore!");
-        }
-    }
+    // resets the queries of the later offscreen and post process buffers too, they run after this on the same queue
+    profiler.cmdReset(commandBuffer, currentFrame, false);
 
-     VkCommandBufferBeginInfo beginInfo = {};
-     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-     beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-     beginInfo.pInheritanceInfo = nullptr; // Optional
+    recordBackgroundOwnershipTransfer(commandBuffer, true, true);
 
-     for (int i = 0; i < offscreenPass.commandBuffers.size(); i++) {
-         vkBeginCommandBuffer(offscreenPass.commandBuffers[i], &beginInfo);
+    std::array<VkClearValue, 2> clearValues = {};
+    clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
+    clearValues[1].depthStencil = { 1.0f, 0 };
 
-         std::array<VkClearValue, 2> clearValues = {};
-         clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
-         clearValues[1].depthStencil = { 1.0f, 0 };
+    // Actual render pass creation
+    VkRenderPassBeginInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = offscreenPass.renderPass;
+    renderPassInfo.framebuffer = offscreenPass.framebuffers[0].framebuffer;
+    renderPassInfo.renderArea.offset = { 0, 0 };
+    renderPassInfo.renderArea.extent = swapChainExtent;
+    VkClearValue clearColor = { 0.0f, 0.0f, 0.0f, 0.0f };
+    renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+    renderPassInfo.pClearValues = clearValues.data();
 
-         // Actual render pass creation
-         VkRenderPassBeginInfo renderPassInfo = {};
-         renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-         renderPassInfo.renderPass = offscreenPass.renderPass;
-         renderPassInfo.framebuffer = offscreenPass.framebuffers[0].framebuffer;
-         renderPassInfo.renderArea.offset = { 0, 0 };
-         renderPassInfo.renderArea.extent = swapChainExtent;
-         VkClearValue clearColor = { 0.0f, 0.0f, 0.0f, 0.0f };
-         renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-         renderPassInfo.pClearValues = clearValues.data();
+    // Render pass recording
+    profiler.cmdBegin(commandBuffer, currentFrame, GpuProfiler::BACKGROUND);
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-         // Render pass recording
-         vkCmdBeginRenderPass(offscreenPass.commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    // Draw Background, the shader switches between the two cloud images every time it is bound
+    backgroundShader->bindShader(commandBuffer);
+    backgroundGeometry->enqueueDrawCommands(commandBuffer);
 
-         // Draw Background
-         backgroundShader->bindShader(offscreenPass.commandBuffers[i]);
-         backgroundGeometry->enqueueDrawCommands(offscreenPass.commandBuffers[i]);
+    vkCmdEndRenderPass(commandBuffer);
+    profiler.cmdEnd(commandBuffer, currentFrame, GpuProfiler::BACKGROUND);
 
-         vkCmdEndRenderPass(offscreenPass.commandBuffers[i]);
+    // hand the cloud images back for the next frame's compute work
+    recordBackgroundOwnershipTransfer(commandBuffer, false, false);
 
-         // Use the next framebuffer in the offscreen pass
-         renderPassInfo.framebuffer = offscreenPass.framebuffers[1].framebuffer;
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record background command buffer!");
+    }
+}
 
-         // God rays and mesh drawing
+// This function renders the rest of what is offscreen. The PostProcessCommandBuffer actually renders to the screen.
+void VulkanApplication::recordOffscreenCommandBuffer(VkCommandBuffer commandBuffer) {
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = nullptr; // Optional
 
-         vkCmdBeginRenderPass(offscreenPass.commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
 
-         godRayShader->bindShader(offscreenPass.commandBuffers[i]);
-         backgroundGeometry->enqueueDrawCommands(offscreenPass.commandBuffers[i]);
+    std::array<VkClearValue, 2> clearValues = {};
+    clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
+    clearValues[1].depthStencil = { 1.0f, 0 };
 
-         vkCmdEndRenderPass(offscreenPass.commandBuffers[i]);
+    VkRenderPassBeginInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = offscreenPass.renderPass;
+    renderPassInfo.renderArea.offset = { 0, 0 };
+    renderPassInfo.renderArea.extent = swapChainExtent;
+    renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+    renderPassInfo.pClearValues = clearValues.data();
 
-         // Use the next framebuffer in the offscreen pass
-         renderPassInfo.framebuffer = offscreenPass.framebuffers[2].framebuffer;
+    // Use the next framebuffer in the offscreen pass
+    renderPassInfo.framebuffer = offscreenPass.framebuffers[1].framebuffer;
 
-         // Radial Blur
-         vkCmdBeginRenderPass(offscreenPass.commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    // God rays and mesh drawing
 
-         radialBlurShader->bindShader(offscreenPass.commandBuffers[i]);
-         backgroundGeometry->enqueueDrawCommands(offscreenPass.commandBuffers[i]);
+    profiler.cmdBegin(commandBuffer, currentFrame, GpuProfiler::GOD_RAYS);
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-         // Draw Scene
-         meshShader->bindShader(offscreenPass.commandBuffers[i]);
-         sceneGeometry->enqueueDrawCommands(offscreenPass.commandBuffers[i]);
+    godRayShader->bindShader(commandBuffer);
+    backgroundGeometry->enqueueDrawCommands(commandBuffer);
 
-         vkCmdEndRenderPass(offscreenPass.commandBuffers[i]);
+    vkCmdEndRenderPass(commandBuffer);
+    profiler.cmdEnd(commandBuffer, currentFrame, GpuProfiler::GOD_RAYS);
 
-         if (vkEndCommandBuffer(offscreenPass.commandBuffers[i]) != VK_SUCCESS) {
-             throw std::runtime_error("failed to record offscreen command buffer!");
-         }
-     }
-     
-}
+    // Use the next framebuffer in the offscreen pass
+    renderPassInfo.framebuffer = offscreenPass.framebuffers[2].framebuffer;
 
-// Run the final post process that renders to the screen
-void VulkanApplication::createPostProcessCommandBuffer() {
-    commandBuffers.resize(swapChainFramebuffers.size());
-    VkCommandBufferAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.commandPool = commandPool;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandBufferCount = (uint32_t)commandBuffers.size();
+    // Radial Blur
+    profiler.cmdBegin(commandBuffer, currentFrame, GpuProfiler::RADIAL_BLUR);
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+    radialBlurShader->bindShader(commandBuffer);
+    backgroundGeometry->enqueueDrawCommands(commandBuffer);
+    profiler.cmdEnd(commandBuffer, currentFrame, GpuProfiler::RADIAL_BLUR);
+
+    // Draw Scene
+    profiler.cmdBegin(commandBuffer, currentFrame, GpuProfiler::MESH);
+    meshShader->bindShader(commandBuffer);
+    sceneGeometry->enqueueDrawCommands(commandBuffer, currentFrame);
+
+    vkCmdEndRenderPass(commandBuffer);
+    profiler.cmdEnd(commandBuffer, currentFrame, GpuProfiler::MESH);
 
-    if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate command buffers!");
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record offscreen command buffer!");
     }
+}
 
-    for (size_t i = 0; i < commandBuffers.size(); i++) {
-        VkCommandBufferBeginInfo beginInfo = {};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-        beginInfo.pInheritanceInfo = nullptr; // Optional
+// Run the final post process that renders to the screen
+void VulkanApplication::recordPostProcessCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = nullptr; // Optional
 
-        vkBeginCommandBuffer(commandBuffers[i], &beginInfo);
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
 
-        std::array<VkClearValue, 2> clearValues = {};
-        clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
-        clearValues[1].depthStencil = { 1.0f, 0 };
+    std::array<VkClearValue, 2> clearValues = {};
+    clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
+    clearValues[1].depthStencil = { 1.0f, 0 };
 
-        // Actual render pass creation
-        VkRenderPassBeginInfo renderPassInfo = {};
-        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        renderPassInfo.renderPass = renderPass;
-        renderPassInfo.framebuffer = swapChainFramebuffers[i];
-        renderPassInfo.renderArea.offset = { 0, 0 };
-        renderPassInfo.renderArea.extent = swapChainExtent;
-        VkClearValue clearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
-        renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-        renderPassInfo.pClearValues = clearValues.data();
+    // Actual render pass creation
+    VkRenderPassBeginInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = renderPass;
+    renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+    renderPassInfo.renderArea.offset = { 0, 0 };
+    renderPassInfo.renderArea.extent = swapChainExtent;
+    VkClearValue clearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
+    renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+    renderPassInfo.pClearValues = clearValues.data();
 
-        // Render pass recording
-        vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    // Render pass recording
+    profiler.cmdBegin(commandBuffer, currentFrame, GpuProfiler::TONEMAP);
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-        toneMapShader->bindShader(commandBuffers[i]);
-        backgroundGeometry->enqueueDrawCommands(commandBuffers[i]);
+    toneMapShader->bindShader(commandBuffer);
+    backgroundGeometry->enqueueDrawCommands(commandBuffer);
 
-        vkCmdEndRenderPass(commandBuffers[i]);
+    vkCmdEndRenderPass(commandBuffer);
+    profiler.cmdEnd(commandBuffer, currentFrame, GpuProfiler::TONEMAP);
 
-        if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-            throw std::runtime_error("failed to record command buffer!");
-        }
+    if (headless && !benchmark) {
+        recordReadback(commandBuffer, imageIndex);
     }
-}
-
-void VulkanApplication::createComputeCommandBuffer() {
-    computeCommandBuffers.resize(2); // need to swap back and forth for background
-    
-    // Specify the command pool and number of buffers to allocate
-    VkCommandBufferAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.commandPool = computeCommandPool;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandBufferCount = (uint32_t)computeCommandBuffers.size();
 
-    if (vkAllocateCommandBuffers(device, &allocInfo, computeCommandBuffers.data()) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to allocate command buffers");
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record command buffer!");
     }
+}
 
+void VulkanApplication::recordComputeCommandBuffer(VkCommandBuffer commandBuffer) {
     VkCommandBufferBeginInfo beginInfo = {};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     beginInfo.pInheritanceInfo = nullptr;
 
-    // need 2 buffers to ping-pong draw targets
-    for (int i = 0; i < 2; i++) {
-        // Begin recording
-        if (vkBeginCommandBuffer(computeCommandBuffers[i], &beginInfo) != VK_SUCCESS) {
-            throw std::runtime_error("Failed to begin recording compute command buffer");
-        }
+    // Begin recording
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to begin recording compute command buffer");
+    }
+
+    profiler.cmdReset(commandBuffer, currentFrame, true);
+
+    // the previous frame's background pass released the cloud images. Before that they only had their
+    // initial layout transition on the graphics queue, and the first frame does not read what is in them.
+    if (frameNumber > 0) {
+        recordBackgroundOwnershipTransfer(commandBuffer, false, true);
+    }
+
+    // both compute shaders switch between the two cloud images every time they are bound
+    profiler.cmdBegin(commandBuffer, currentFrame, GpuProfiler::REPROJECT);
+    reprojectShader->bindShader(commandBuffer);
+
+    reprojectShader->cmdReproject(commandBuffer);
+    profiler.cmdEnd(commandBuffer, currentFrame, GpuProfiler::REPROJECT);
 
-        reprojectShader->bindShader(computeCommandBuffers[i]);
-
-        const glm::ivec2 texDimsFull(swapChainExtent.width, swapChainExtent.height);
-        vkCmdDispatch(computeCommandBuffers[i],
-            static_cast<uint32_t>((texDimsFull.x + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE),
-            static_cast<uint32_t>((texDimsFull.y + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE),
-            1);
-
-        // compute shader will switch descriptor set binding inside this function
-        computeShader->bindShader(computeCommandBuffers[i]);
-
-        // TODO: dispatch according to the number of pixels, do in a 2d manner? see the raytracing example
-        // first TODO: launch this compute shader for the triangle being rendered
-        //const int IMAGE_SIZE = 32;
-        const glm::ivec2 texDims(swapChainExtent.width / 4, swapChainExtent.height / 4);
-        vkCmdDispatch(computeCommandBuffers[i], 
-            static_cast<uint32_t>((texDims.x + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE), 
-            static_cast<uint32_t>((texDims.y + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE), 
-            1);
-
-        // End recording
-        if (vkEndCommandBuffer(computeCommandBuffers[i]) != VK_SUCCESS) {
-            throw std::runtime_error("Failed to record compute command buffer");
+    // the march reads the ages the reprojection wrote and overwrites some of its pixels
+    VkMemoryBarrier reprojected = {};
+    reprojected.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    reprojected.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    reprojected.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 1, &reprojected, 0, nullptr, 0, nullptr);
+
+    // every frame, so the timestamps are written even when there is nothing to bake
+    profiler.cmdBegin(commandBuffer, currentFrame, GpuProfiler::LIGHT_VOLUME);
+    computeShader->cmdBakeLightVolume(commandBuffer, lightVolumeBake);
+    profiler.cmdEnd(commandBuffer, currentFrame, GpuProfiler::LIGHT_VOLUME);
+
+    computeShader->cmdResetCounters(commandBuffer);
+    profiler.cmdBegin(commandBuffer, currentFrame, GpuProfiler::CLOUDS);
+    computeShader->bindShader(commandBuffer);
+
+    // one invocation per block of the temporal pattern
+    computeShader->cmdMarch(commandBuffer, temporalScheduler.getBlockSize());
+
+    profiler.cmdEnd(commandBuffer, currentFrame, GpuProfiler::CLOUDS);
+    computeShader->cmdCopyCounters(commandBuffer);
+
+    recordBackgroundOwnershipTransfer(commandBuffer, true, false);
+
+    // End recording
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to record compute command buffer");
+    }
+}
+
+void VulkanApplication::recordBackgroundOwnershipTransfer(VkCommandBuffer commandBuffer, bool toGraphics, bool acquire) {
+    const uint32_t graphicsFamily = deviceQueueFamilies.graphicsFamily;
+    const uint32_t computeFamily = deviceQueueFamilies.computeFamily;
+    if (computeFamily == graphicsFamily) {
+        return; // the timeline semaphores are all the synchronization needed
+    }
+
+    // where the images are used on either side: written and read by the clouds, sampled by the background pass
+    const VkPipelineStageFlags srcUse = toGraphics ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    const VkPipelineStageFlags dstUse = toGraphics ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT : VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+    std::array<Texture*, 2> images = { backgroundTexture, backgroundTexturePrev };
+    std::array<VkImageMemoryBarrier, 2> barriers = {};
+    for (size_t i = 0; i < images.size(); i++) {
+        VkImageMemoryBarrier& barrier = barriers[i];
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL; // storage and sampling both use general, nothing to transition
+        barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.srcQueueFamilyIndex = toGraphics ? computeFamily : graphicsFamily;
+        barrier.dstQueueFamilyIndex = toGraphics ? graphicsFamily : computeFamily;
+        barrier.image = images[i]->getImage();
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = 1;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = 1;
+
+        // the release makes the compute writes available, the acquire makes them visible. Each ignores the other's mask.
+        if (acquire) {
+            barrier.dstAccessMask = toGraphics ? VK_ACCESS_SHADER_READ_BIT : VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        }
+        else {
+            barrier.srcAccessMask = toGraphics ? VK_ACCESS_SHADER_WRITE_BIT : 0;
         }
     }
+
+    // The release runs before the timeline signal, the acquire after the timeline wait at dstUse
+    vkCmdPipelineBarrier(commandBuffer,
+        acquire ? dstUse : srcUse,
+        acquire ? dstUse : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
 }
 
 void VulkanApplication::createFramebuffers() {
@@ -1120,10 +1757,6 @@ void VulkanApplication::createOffscreenFramebuffer(FrameBuffer* framebuffer, VkF
     // We will sample directly from the color attachment
     image.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
 
-    VkMemoryAllocateInfo memAlloc {};
-    memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    VkMemoryRequirements memReqs;
-
     VkImageViewCreateInfo colorImageView {};
     colorImageView.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
     colorImageView.viewType = VK_IMAGE_VIEW_TYPE_2D;
@@ -1140,16 +1773,7 @@ void VulkanApplication::createOffscreenFramebuffer(FrameBuffer* framebuffer, VkF
         throw std::runtime_error("failed to create image!");
     }
 
-    vkGetImageMemoryRequirements(device, framebuffer->color.image, &memReqs);
-    memAlloc.allocationSize = memReqs.size;
-    memAlloc.memoryTypeIndex = findMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, physicalDevice);
-    if (vkAllocateMemory(device, &memAlloc, nullptr, &framebuffer->color.mem) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate memory!");
-    }
-
-    if (vkBindImageMemory(device, framebuffer->color.image, framebuffer->color.mem, 0) != VK_SUCCESS) {
-        throw std::runtime_error("failed to bind image memory!");
-    }
+    framebuffer->color.mem = memoryAllocator.allocateImage(framebuffer->color.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
     colorImageView.image = framebuffer->color.image;
     if(vkCreateImageView(device, &colorImageView, nullptr, &framebuffer->color.view) != VK_SUCCESS) {
@@ -1175,16 +1799,7 @@ void VulkanApplication::createOffscreenFramebuffer(FrameBuffer* framebuffer, VkF
     if (vkCreateImage(device, &image, nullptr, &framebuffer->depth.image) != VK_SUCCESS) {
         throw std::runtime_error("failed to create image!");
     }
-    vkGetImageMemoryRequirements(device, framebuffer->depth.image, &memReqs);
-    memAlloc.allocationSize = memReqs.size;
-    memAlloc.memoryTypeIndex = findMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, physicalDevice);
-    if (vkAllocateMemory(device, &memAlloc, nullptr, &framebuffer->depth.mem) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate memory!");
-    }
-
-    if (vkBindImageMemory(device, framebuffer->depth.image, framebuffer->depth.mem, 0) != VK_SUCCESS) {
-        throw std::runtime_error("failed to bind image!");
-    }
+    framebuffer->depth.mem = memoryAllocator.allocateImage(framebuffer->depth.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
     depthStencilView.image = framebuffer->depth.image;
     if (vkCreateImageView(device, &depthStencilView, nullptr, &framebuffer->depth.view) != VK_SUCCESS) {
@@ -1258,19 +1873,21 @@ void VulkanApplication::setupOffscreenPass() {
 
     dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
     dependencies[0].dstSubpass = 0;
-    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-    dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    // depth attachments are reused by the next frame in flight
+    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
     dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
+    // the next pass samples the color, with no semaphore in between
     dependencies[1].srcSubpass = 0;
     dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
     dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
     dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-    dependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-    dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+    dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    dependencies[1].dependencyFlags = 0; // not by region, the god rays and radial blur sample far from each pixel
 
     // Create the actual renderpass
     VkRenderPassCreateInfo renderPassInfo = {};
@@ -1372,8 +1989,6 @@ void VulkanApplication::cleanupSwapChain() {
         vkDestroyFramebuffer(device, swapChainFramebuffers[i], nullptr);
     }
 
-    vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
-
     //vkDestroyPipeline(device, graphicsPipeline, nullptr);
     //vkDestroyPipelineLayout(device, graphicsPipelineLayout, nullptr);
     vkDestroyRenderPass(device, renderPass, nullptr);
@@ -1396,7 +2011,121 @@ void VulkanApplication::recreateSwapChain() {
     createRenderPass();
     //createGraphicsPipeline();
     createFramebuffers();
-    createCommandBuffers();
+    // command buffers are recorded every frame, nothing else refers to the old swapchain
+}
+
+/// --- Headless Rendering
+
+void VulkanApplication::createHeadlessTargets() {
+    swapChainImageFormat = VK_FORMAT_R8G8B8A8_UNORM; // written straight to png
+    swapChainExtent = { static_cast<uint32_t>(WIDTH), static_cast<uint32_t>(HEIGHT) };
+
+    swapChainImages.resize(HEADLESS_TARGET_COUNT);
+    swapChainImageViews.resize(HEADLESS_TARGET_COUNT);
+    headlessImageMemory.resize(HEADLESS_TARGET_COUNT);
+    readbackBuffers.resize(HEADLESS_TARGET_COUNT);
+    readbackBufferMemory.resize(HEADLESS_TARGET_COUNT);
+    readbackWrites.resize(HEADLESS_TARGET_COUNT);
+
+    const VkDeviceSize readbackSize = static_cast<VkDeviceSize>(swapChainExtent.width) * swapChainExtent.height * 4;
+
+    for (uint32_t i = 0; i < HEADLESS_TARGET_COUNT; i++) {
+        // Color target for the final pass
+        VkImageCreateInfo imageInfo = {};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = swapChainImageFormat;
+        imageInfo.extent = { swapChainExtent.width, swapChainExtent.height, 1 };
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        if (vkCreateImage(device, &imageInfo, nullptr, &swapChainImages[i]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create image!");
+        }
+
+        headlessImageMemory[i] = memoryAllocator.allocateImage(swapChainImages[i], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        swapChainImageViews[i] = createImageView(swapChainImages[i], swapChainImageFormat);
+
+        // Readback buffer, mapped for the lifetime of the application
+        VkBufferCreateInfo bufferInfo = {};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = readbackSize;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        if (vkCreateBuffer(device, &bufferInfo, nullptr, &readbackBuffers[i]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create buffer!");
+        }
+
+        // cached memory makes the CPU reads much faster; every implementation has host visible + coherent
+        try {
+            readbackBufferMemory[i] = memoryAllocator.allocateBuffer(readbackBuffers[i], VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+        }
+        catch (const std::runtime_error&) {
+            readbackBufferMemory[i] = memoryAllocator.allocateBuffer(readbackBuffers[i], VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        }
+    }
+}
+
+// Appended to the final pass of a headless target, the render pass leaves the image in TRANSFER_SRC_OPTIMAL
+void VulkanApplication::recordReadback(VkCommandBuffer commandBuffer, uint32_t target) {
+    VkBufferImageCopy region = {};
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = { 0, 0, 0 };
+    region.imageExtent = { swapChainExtent.width, swapChainExtent.height, 1 };
+
+    vkCmdCopyImageToBuffer(commandBuffer, swapChainImages[target], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffers[target], 1, &region);
+
+    // make the copy visible to the host once the frame's fence signals
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = readbackBuffers[target];
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+        0, nullptr,
+        1, &barrier,
+        0, nullptr);
+}
+
+void VulkanApplication::cleanupHeadlessTargets() {
+    // let the writers finish before their buffers go away
+    for (auto& write : readbackWrites) {
+        if (write.valid()) write.wait();
+    }
+
+    for (uint32_t i = 0; i < HEADLESS_TARGET_COUNT; i++) {
+        vkDestroyBuffer(device, readbackBuffers[i], nullptr);
+        memoryAllocator.free(readbackBufferMemory[i]);
+        // views are destroyed along with the swapchain image views in cleanup()
+        vkDestroyImage(device, swapChainImages[i], nullptr);
+        memoryAllocator.free(headlessImageMemory[i]);
+    }
+}
+
+/// --- Benchmark
+
+void VulkanApplication::applyBenchmarkKeyframe(float time) {
+    benchmarkKey = benchmarkPath.evaluate(time);
+    mainCamera.setPosition(benchmarkKey.position);
+    mainCamera.lookAt(benchmarkKey.target);
 }
 
 void VulkanApplication::createImageViews() {
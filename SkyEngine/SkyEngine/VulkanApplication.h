@@ -21,21 +21,41 @@
 #include <algorithm>
 #include <fstream>
 #include <array>
+#include <deque>
 #include <chrono>
+#include <future>
+#include <memory>
+#include <string>
 
 #include "camera.h"
 #include "Texture.h"
 #include "Geometry.h"
 #include "Shader.h"
+#include "ThreadPool.h"
+#include "Benchmark.h"
+#include "GpuProfiler.h"
+#include "PipelineCache.h"
+#include "WorkgroupTuner.h"
 
 #define DEBUG_VALIDATION 1
 
-#define WORKGROUP_SIZE 32
+// Written to the working directory, safe to delete
+#define PIPELINE_CACHE_PATH "pipeline.cache"
+#define WORKGROUP_CACHE_PATH "workgroups.cache"
+
+// Horizontal scale of the terrain's model matrix, which its levels of detail are simplified at
+#define TERRAIN_SCALE 100.0f
+#define TERRAIN_LOD_SCALE glm::vec3(TERRAIN_SCALE, 1.0f, TERRAIN_SCALE)
+
+// Number of offscreen targets cycled through in headless mode while earlier frames are written to disk,
+// at least one per frame in flight since each is read back only once the next ones are submitted
+#define HEADLESS_TARGET_COUNT 3
 
 struct QueueFamilyIndices {
     int graphicsFamily = -1; // capable of graphics pipeline?
-    int computeFamily = -1; // capable of compute pipeline? TODO not sure if this is done
+    int computeFamily = -1; // capable of compute pipeline? preferably without graphics, so it runs alongside it
     int presentFamily = -1; // capable of presenting image to screen surface?
+    uint32_t computeQueueIndex = 0; // 1 when compute shares the graphics family but can still have a queue of its own
 
     bool isComplete() {
         return graphicsFamily >= 0 && computeFamily >= 0 && presentFamily >= 0;
@@ -53,7 +73,7 @@ struct SwapChainSupportDetails {
 
 struct FrameBufferAttachment {
     VkImage image;
-    VkDeviceMemory mem;
+    DeviceAllocation mem;
     VkImageView view;
 };
 
@@ -67,12 +87,20 @@ struct OffscreenPass {
     int32_t width, height;
     VkRenderPass renderPass;
     VkSampler sampler;
-    std::vector<VkCommandBuffer> commandBuffers;
-    // Semaphore used to synchronize between offscreen and final scene rendering
-    VkSemaphore semaphore = VK_NULL_HANDLE;
     std::array<FrameBuffer, 3> framebuffers; // the length of the array is equal to the total number of render passes - 1
 };                                           // as in everything prior to the last pass is offscreen
 
+// Everything one frame records and submits. A context is reused framesInFlight frames later, after its fence has signaled.
+struct FrameContext {
+    VkCommandBuffer computeCommandBuffer;
+    VkCommandBuffer backgroundCommandBuffer; // the only graphics work that touches the cloud images
+    VkCommandBuffer offscreenCommandBuffer; // god rays, radial blur and mesh
+    VkCommandBuffer commandBuffer; // final pass, recorded for whichever swapchain image was acquired
+    VkSemaphore imageAvailableSemaphore;
+    VkSemaphore renderFinishedSemaphore;
+    VkFence inFlightFence;
+};
+
 class VulkanApplication
 {
 private:
@@ -81,11 +109,19 @@ private:
     void initVulkan();
     void mainLoop();
     void cleanup();
+    void headlessLoop();
 
     void updateUniformBuffer();
+    void writeCameraUniforms(FrameUniforms& frameUniforms, Camera& camera);
+    // Sun and sky at time, from the benchmark keyframe when replaying one and the default day cycle otherwise
+    void writeSkyUniforms(FrameUniforms& frameUniforms, float time);
 
     GLFWwindow* window;
 
+    // The CPU workers of the application: texture decoding and noise generation at startup, the png writes of headless
+    // runs and CloudRendererCPU all share it. Created by initVulkan and runCPURender, deleted once they are done.
+    ThreadPool* workerPool = nullptr;
+
     const int WIDTH = 1920;// 1280;
     const int HEIGHT = 1080;// 720;
 
@@ -101,26 +137,63 @@ private:
 
     bool checkValidationLayerSupport();
     std::vector<const char*> getRequiredExtensions();
+    std::vector<const char*> getRequiredDeviceExtensions();
 
     /// --- Graphics Pipeline
     void createRenderPass(); // <------ ech
     void createFramebuffers();
     void createOffscreenFramebuffer(FrameBuffer* frameBuf, VkFormat colorFormat, VkFormat depthFormat);
     void createCommandPool();
-    void createCommandBuffers();
-    void createPostProcessCommandBuffer();
+    void recordBackgroundCommandBuffer(VkCommandBuffer commandBuffer);
+    void recordOffscreenCommandBuffer(VkCommandBuffer commandBuffer);
+    void recordPostProcessCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex);
 
     // command buffer helpers
     VkCommandBuffer beginSingleTimeCommands();
     void endSingleTimeCommands(VkCommandBuffer commandBuffer);
 
     /// --- Compute Pipeline
-    void createComputeCommandBuffer(); // TODO: rename this to be plural if we end up needing more compute shaders
-
+    void recordComputeCommandBuffer(VkCommandBuffer commandBuffer);
+
+    /// --- Frames in flight
+    // The CPU records and submits up to framesInFlight frames before waiting on the oldest one's fence.
+    // Command buffers are re-recorded every frame and each shader keeps one copy of its uniforms per frame.
+    uint32_t framesInFlight = 2;
+    uint32_t currentFrame = 0; // index into frames, also the profiler query slot
+    uint64_t frameNumber = 0; // frames submitted so far
+    std::array<FrameContext, MAX_FRAMES_IN_FLIGHT> frames;
+    void createFrameContexts();
+    void cleanupFrameContexts();
+    void recordFrame(uint32_t imageIndex);
+    void submitComputeCommandBuffer();
+    // Background, offscreen and final pass in one submission that signals the frame's fence.
+    // The semaphores are VK_NULL_HANDLE in headless mode, where nothing is acquired or presented.
+    void submitGraphicsCommandBuffers(VkSemaphore imageAvailable, VkSemaphore renderFinished);
     void drawFrame();
-    VkSemaphore imageAvailableSemaphore;
-    VkSemaphore renderFinishedSemaphore;
-    void createSemaphores();
+
+    /// --- Async compute
+    // The clouds run on their own queue when the device has one. Frame N signals both timelines with N + 1:
+    // its background pass waits for computeTimeline to reach N + 1, and its clouds wait for backgroundTimeline
+    // to reach N, the previous background pass having released the image they overwrite. Nothing else on the
+    // graphics queue waits for compute, so frame N + 1's clouds overlap frame N's post chain.
+    VkSemaphore computeTimeline;
+    VkSemaphore backgroundTimeline;
+    QueueFamilyIndices deviceQueueFamilies;
+    // Queue family ownership transfer of both cloud images, a no-op when compute and graphics share a family.
+    // The queue giving them up records the release, the queue taking them over records the matching acquire.
+    void recordBackgroundOwnershipTransfer(VkCommandBuffer commandBuffer, bool toGraphics, bool acquire);
+
+    /// --- Device memory
+    // Shared by every VulkanObject, initialized right after the device and cleaned up right before it
+    DeviceAllocator memoryAllocator;
+
+    /// --- Pipeline cache
+    // Loaded before the shaders are created and saved right after, see PipelineCache
+    PipelineCache pipelineCache;
+
+    /// --- Profiling
+    GpuProfiler profiler;
+    std::string profilerOutputPath;
     
     /// Post
     void setupOffscreenPass();
@@ -131,6 +204,43 @@ private:
     void recreateSwapChain();
     void cleanupSwapChain();
 
+    /// --- Headless Rendering
+    // No window, surface or swapchain: the final pass renders into HEADLESS_TARGET_COUNT offscreen targets
+    // (stored in swapChainImages so the rest of the pipeline is unchanged) that are copied into persistently
+    // mapped readback buffers and written to disk on worker threads while the next frames render.
+    bool headless = false;
+    uint32_t headlessFrameCount = 0;
+    uint32_t headlessFrameIndex = 0;
+    std::string headlessOutputPrefix;
+    std::vector<DeviceAllocation> headlessImageMemory;
+    std::vector<VkBuffer> readbackBuffers;
+    std::vector<DeviceAllocation> readbackBufferMemory; // stays mapped
+    std::vector<std::future<void>> readbackWrites; // of the png writes on workerPool
+    // Frames submitted but not read back yet, oldest first. Up to framesInFlight - 1 stay on the GPU after a submit.
+    struct HeadlessFrame {
+        uint32_t index;   // headless frame number, the file name and target follow from it
+        uint32_t context; // frames slot whose fence signals once it is done
+    };
+    std::deque<HeadlessFrame> headlessPending;
+
+    void createHeadlessTargets();
+    void recordReadback(VkCommandBuffer commandBuffer, uint32_t target);
+    void drawFrameHeadless();
+    // Waits for the oldest pending frame and hands its readback buffer to workerPool
+    void retireHeadlessFrame();
+    void cleanupHeadlessTargets();
+
+    /// --- Benchmark
+    // Headless run that replays benchmarkPath instead of the default sun cycle, without writing images.
+    // Each frame is timed on the CPU and, where the queues support timestamps, on the GPU.
+    bool benchmark = false;
+    BenchmarkPath benchmarkPath;
+    BenchmarkKeyframe benchmarkKey;
+    BenchmarkReport benchmarkReport;
+    std::chrono::high_resolution_clock::time_point frameSubmitted; // set by drawFrameHeadless before waiting on the GPU
+
+    void applyBenchmarkKeyframe(float time);
+
     SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device);
     VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector <VkSurfaceFormatKHR>& availableFormats);
     VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR> availablePresentModes);
@@ -160,21 +270,19 @@ private:
         app->recreateSwapChain();
     }
 
-    bool swapBackgroundImages = false;
-
     /// --- Vulkan Objects and Attributes
     VkInstance instance;
     VkDebugReportCallbackEXT callback;
     VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
     VkDevice device;
-    VkSurfaceKHR surface;
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
 
     VkQueue graphicsQueue;
     VkQueue computeQueue;
     VkQueue presentQueue;
 
     // these can likely be moved to their own class
-    VkSwapchainKHR swapChain;
+    VkSwapchainKHR swapChain = VK_NULL_HANDLE;
     std::vector<VkImage> swapChainImages; 
     VkFormat swapChainImageFormat;
     VkExtent2D swapChainExtent;
@@ -184,15 +292,15 @@ private:
 
     std::vector<VkFramebuffer> swapChainFramebuffers;
     VkCommandPool commandPool;
-    std::vector<VkCommandBuffer> commandBuffers;
     // Compute
-    std::vector<VkCommandBuffer> computeCommandBuffers; // TODO: if we need multiple compute shaders for some reason,
-                                          // make this a vector like above
     VkCommandPool computeCommandPool;
 
     void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
 
     Geometry* sceneGeometry;
+    VertexFormat sceneVertexFormat = VERTEX_PACKED;
+    ChunkCullStats chunkStats; // what of the scene mesh was drawn this frame
+    CloudMarchCounters cloudCounters; // cloud march samples of the last frame that used this slot
     Geometry* backgroundGeometry;
     void initializeGeometry();
     void cleanupGeometry();
@@ -200,20 +308,42 @@ private:
     // TODO: convenient way of managing textures
     void initializeTextures();
     void cleanupTextures();
+    // Loads volumePath, packing it from the slices at slicePath first if it does not exist yet
+    void initCloudVolume(Texture3D* texture, std::string volumePath, std::string slicePath);
     Texture* meshTexture;
     Texture* meshPBRInfo;
     Texture* meshNormals;
     Texture* backgroundTexture;
     Texture* backgroundTexturePrev;
+    Texture* backgroundAge; // frames since each pixel of the cloud images was marched, see TemporalScheduler.h
+    Texture* backgroundAgePrev;
     Texture* depthTexture;
     Texture* cloudPlacementTexture;
+    Texture* cloudSkipTexture;
     Texture* nightSkyTexture;
     Texture* cloudCurlNoise;
+    uint32_t curlNoiseSize = 0; // 0 loads the curl noise map from disk, otherwise it is generated at this size
     Texture3D* lowResCloudShapeTexture3D;
     Texture3D* hiResCloudShapeTexture3D;
+    Texture3D* cloudLightVolumeTexture;
+    bool cloudLightVolumeEnabled = false; // light the clouds from the light volume instead of a cone per sample
+    CloudLightVolume cloudLightVolume;
+    LightVolumeBake lightVolumeBake; // layers the current frame bakes
+    TemporalScheduler temporalScheduler; // which pixel of each block the cloud march updates this frame
+    CloudMarchSettings cloudMarchSettings; // lightVolume is filled in from cloudLightVolumeEnabled
+    VkExtent2D reprojectWorkgroup = { 32, 32 };
+    bool autoTuneWorkgroups = true;
 
     void initializeShaders();
     void cleanupShaders();
+    ComputeShader* createCloudShader(VkExtent2D workgroup);
+    ReprojectShader* createReprojectShader(VkExtent2D workgroup);
+    // Times the reprojection and the march with every candidate local size on the compute queue, then recreates both
+    // shaders with the fastest and saves them to WORKGROUP_CACHE_PATH. Needs the shaders, the camera and the sky set up.
+    void tuneWorkgroups();
+    // What the timings of the tuning depend on besides the GPU: image size, temporal block size, adaptive remarch budget and march budget
+    std::vector<uint32_t> getWorkgroupTuningSettings() const;
+    UniformRing* uniformRing;
     MeshShader* meshShader;
     BackgroundShader* backgroundShader;
     ComputeShader* computeShader;
@@ -251,6 +381,54 @@ public:
         mainLoop();
         cleanup();
     }
+    // Render frameCount frames without a window and write them to outputPrefix00000.png, outputPrefix00001.png, ...
+    void runHeadless(uint32_t frameCount, std::string outputPrefix) {
+        headless = true;
+        headlessFrameCount = frameCount;
+        headlessOutputPrefix = outputPrefix;
+        initVulkan();
+        headlessLoop();
+        cleanup();
+    }
+    // Render frameCount frames of the clouds with CloudRendererCPU, no Vulkan involved, and write them to
+    // outputPrefix00000.hdr, ... The camera, sun cycle and fixed timestep are the ones of runHeadless.
+    void runCPURender(uint32_t frameCount, std::string outputPrefix);
+    // Replay a keyframe file for frameCount fixed-timestep frames and write the timings to outputPath as JSON
+    void runBenchmark(std::string keyframePath, uint32_t frameCount, std::string outputPath) {
+        headless = true;
+        benchmark = true;
+        headlessFrameCount = frameCount;
+        benchmarkPath.initFromFile(keyframePath);
+        benchmarkReport.keyframePath = keyframePath;
+        initVulkan();
+        headlessLoop();
+        cleanup();
+        benchmarkReport.writeJSON(outputPath);
+    }
+    // Write per-pass GPU timings of every frame to a CSV file, call before run()
+    void setProfilerOutput(std::string csvPath) { profilerOutputPath = csvPath; }
+    // How many frames the CPU may run ahead of the GPU, 1 to MAX_FRAMES_IN_FLIGHT. Call before run().
+    void setFramesInFlight(uint32_t count) { framesInFlight = std::max(1u, std::min(count, static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT))); }
+    // Generate a size x size curl noise map at startup instead of loading it, size a multiple of 4. Call before run().
+    void setCurlNoiseSize(uint32_t size) { curlNoiseSize = size; }
+    // Vertex layout of the scene mesh, VERTEX_PACKED unless full precision floats are needed. Call before run().
+    void setSceneVertexFormat(VertexFormat format) { sceneVertexFormat = format; }
+    // Light the clouds from a baked light volume (see CloudLightVolume.h) instead of a cone of samples. Call before run().
+    void setCloudLightVolume(bool enabled) { cloudLightVolumeEnabled = enabled; }
+    // Block size (2, 4 or 8) and visiting order of the pixels the cloud march updates each frame, adaptive also re-marches
+    // pixels whose reprojection is invalid (see TemporalScheduler.h). Call before run().
+    void setTemporalPattern(uint32_t blockSize, TemporalOrder order, bool adaptive) { temporalScheduler.configure(blockSize, order, adaptive); }
+    // Samples along a view ray and samples of the light cone (1 to 6) of the cloud march. Call before run().
+    void setCloudMarchBudget(uint32_t maxSteps, uint32_t lightConeSamples) {
+        cloudMarchSettings.maxSteps = maxSteps;
+        cloudMarchSettings.lightConeSamples = lightConeSamples;
+    }
+    // Local size of the reprojection and the march, instead of timing the candidates at startup. Call before run().
+    void setWorkgroupSize(VkExtent2D workgroup) {
+        autoTuneWorkgroups = false;
+        cloudMarchSettings.workgroup = workgroup;
+        reprojectWorkgroup = workgroup;
+    }
     VulkanApplication();
     ~VulkanApplication();
 };
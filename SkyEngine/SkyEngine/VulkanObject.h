@@ -1,6 +1,7 @@
 #pragma once
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
+#include "DeviceAllocator.h"
 #include <iostream>
 #include <vector>
 #include <array>
@@ -13,6 +14,10 @@
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm\gtx\hash.hpp>
 
+// Most frames the CPU may record and submit before waiting on the GPU. Anything written by the CPU every frame
+// (uniforms, command buffers, query slots) needs this many copies.
+#define MAX_FRAMES_IN_FLIGHT 3
+
 // A collection of baseline functions for objects used with vulkan.
 // Utilities for buffers, memory, etc.
 class VulkanObject
@@ -23,6 +28,9 @@ protected:
     VkCommandPool commandPool;
     VkQueue queue;
 
+    // Device memory of every object comes from here, MUST set once the device exists
+    static DeviceAllocator* allocator;
+
     VkCommandBuffer beginSingleTimeCommands();
     void endSingleTimeCommands(VkCommandBuffer commandBuffer);
 
@@ -34,6 +42,8 @@ public:
     ~VulkanObject();
 
     void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, DeviceAllocation& bufferMemory);
+
+    static void setAllocator(DeviceAllocator* allocator) { VulkanObject::allocator = allocator; }
 };
 
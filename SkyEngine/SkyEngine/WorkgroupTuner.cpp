@@ -0,0 +1,191 @@
+#include "WorkgroupTuner.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+    // Followed by settingCount uint32 settings and the TunedWorkgroups
+    struct WorkgroupCacheHeader {
+        uint32_t magic = 0x47574B53; // "SKWG"
+        uint32_t version = WORKGROUP_CACHE_VERSION;
+        uint32_t vendorID = 0;
+        uint32_t deviceID = 0;
+        uint8_t pipelineCacheUUID[VK_UUID_SIZE] = {};
+        uint32_t settingCount = 0;
+    };
+}
+
+void WorkgroupTuner::init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, VkQueue queue, VkCommandPool commandPool) {
+    this->device = device;
+    this->queue = queue;
+    this->commandPool = commandPool;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    limits = properties.limits;
+    timestampPeriod = properties.limits.timestampPeriod;
+
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    uint32_t bits = queueFamilies[queueFamily].timestampValidBits;
+    if (bits == 0) {
+        std::cerr << "timestamps are not supported on the compute queue, workgroup tuning is disabled" << std::endl;
+        return;
+    }
+    timestampMask = bits >= 64 ? ~0ull : (1ull << bits) - 1;
+
+    VkQueryPoolCreateInfo queryPoolInfo = {};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = WORKGROUP_TUNER_RUNS * 2;
+
+    if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create query pool!");
+    }
+}
+
+void WorkgroupTuner::cleanup() {
+    if (queryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, queryPool, nullptr);
+        queryPool = VK_NULL_HANDLE;
+    }
+}
+
+std::vector<VkExtent2D> WorkgroupTuner::getCandidates() const {
+    // wide shapes first: neighbouring invocations then march neighbouring rays, which share cache lines of the noise
+    const VkExtent2D shapes[] = { { 8, 4 }, { 8, 8 }, { 16, 4 }, { 16, 8 }, { 8, 16 }, { 16, 16 }, { 32, 4 }, { 32, 8 }, { 32, 16 }, { 32, 32 } };
+    std::vector<VkExtent2D> candidates;
+    for (const VkExtent2D& shape : shapes) {
+        if (isSupported(shape)) candidates.push_back(shape);
+    }
+    return candidates;
+}
+
+bool WorkgroupTuner::isSupported(VkExtent2D workgroup, const VkPhysicalDeviceLimits& limits) {
+    // the dispatches divide the image size by the local size
+    return workgroup.width > 0 && workgroup.height > 0
+        && workgroup.width <= limits.maxComputeWorkGroupSize[0] && workgroup.height <= limits.maxComputeWorkGroupSize[1]
+        && static_cast<uint64_t>(workgroup.width) * workgroup.height <= limits.maxComputeWorkGroupInvocations;
+}
+
+float WorkgroupTuner::time(const std::function<void(VkCommandBuffer)>& record) {
+    if (!isEnabled()) return 0.0f;
+
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = commandPool;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer;
+    if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate command buffer!");
+    }
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    vkCmdResetQueryPool(commandBuffer, queryPool, 0, WORKGROUP_TUNER_RUNS * 2);
+
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    // the warm-up fills the caches and gets the clocks up
+    record(commandBuffer);
+    for (uint32_t run = 0; run < WORKGROUP_TUNER_RUNS; run++) {
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+        // both at the bottom of the pipe: the first is written once the run before has finished
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, run * 2);
+        record(commandBuffer);
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, run * 2 + 1);
+    }
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record command buffer!");
+    }
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit command buffer!");
+    }
+    vkQueueWaitIdle(queue);
+    vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+
+    uint64_t timestamps[WORKGROUP_TUNER_RUNS * 2];
+    if (vkGetQueryPoolResults(device, queryPool, 0, WORKGROUP_TUNER_RUNS * 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) != VK_SUCCESS) {
+        throw std::runtime_error("failed to read timestamps!");
+    }
+
+    std::vector<float> runMs(WORKGROUP_TUNER_RUNS);
+    for (uint32_t run = 0; run < WORKGROUP_TUNER_RUNS; run++) {
+        uint64_t ticks = ((timestamps[run * 2 + 1] & timestampMask) - (timestamps[run * 2] & timestampMask)) & timestampMask;
+        runMs[run] = static_cast<float>(ticks * timestampPeriod / 1e6);
+    }
+    std::nth_element(runMs.begin(), runMs.begin() + WORKGROUP_TUNER_RUNS / 2, runMs.end());
+    return runMs[WORKGROUP_TUNER_RUNS / 2];
+}
+
+bool WorkgroupTuner::load(const std::string& path, const VkPhysicalDeviceProperties& properties, const std::vector<uint32_t>& settings, TunedWorkgroups& tuned) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) return false;
+
+    WorkgroupCacheHeader header;
+    WorkgroupCacheHeader expected;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        header.magic != expected.magic || header.version != expected.version ||
+        header.vendorID != properties.vendorID || header.deviceID != properties.deviceID ||
+        memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0 ||
+        header.settingCount != settings.size()) {
+        return false;
+    }
+
+    std::vector<uint32_t> stored(settings.size());
+    TunedWorkgroups read;
+    file.read(reinterpret_cast<char*>(stored.data()), stored.size() * sizeof(uint32_t));
+    file.read(reinterpret_cast<char*>(&read), sizeof(read));
+    if (!file || stored != settings) return false;
+
+    // a damaged file must not pick a size the device cannot run
+    if (!isSupported(read.reproject, properties.limits) || !isSupported(read.clouds, properties.limits)) return false;
+    tuned = read;
+    return true;
+}
+
+void WorkgroupTuner::save(const std::string& path, const VkPhysicalDeviceProperties& properties, const std::vector<uint32_t>& settings, const TunedWorkgroups& tuned) {
+    WorkgroupCacheHeader header;
+    header.vendorID = properties.vendorID;
+    header.deviceID = properties.deviceID;
+    memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    header.settingCount = static_cast<uint32_t>(settings.size());
+
+    // a crash halfway through writing must not leave a damaged file behind
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(settings.data()), settings.size() * sizeof(uint32_t));
+        file.write(reinterpret_cast<const char*>(&tuned), sizeof(tuned));
+        if (!file.good()) {
+            std::cerr << "failed to write " << tempPath << std::endl;
+            return;
+        }
+    }
+    std::remove(path.c_str()); // rename does not replace existing files on Windows
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        std::cerr << "failed to replace " << path << std::endl;
+    }
+}
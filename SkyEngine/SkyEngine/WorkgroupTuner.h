@@ -0,0 +1,54 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Timed runs of each candidate after an untimed warm-up, the median is kept
+#define WORKGROUP_TUNER_RUNS 5
+
+// Bump when the layout of the tuned workgroups file changes
+#define WORKGROUP_CACHE_VERSION 1
+
+// Local sizes picked by the tuning, one per shader that was timed
+struct TunedWorkgroups {
+    VkExtent2D reproject;
+    VkExtent2D clouds;
+};
+
+// Times the same compute work built with different local sizes, so the fastest one for the device can be picked at
+// startup. Every measurement is submitted on its own and waited for, so this must run before the first frame.
+class WorkgroupTuner
+{
+private:
+    VkDevice device = VK_NULL_HANDLE;
+    VkQueue queue = VK_NULL_HANDLE;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    VkPhysicalDeviceLimits limits = {};
+    float timestampPeriod = 0.0f; // nanoseconds per tick
+    uint64_t timestampMask = 0;
+
+public:
+    // Leaves the tuner disabled if the queue family has no timestamp support
+    void init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, VkQueue queue, VkCommandPool commandPool);
+    void cleanup();
+    bool isEnabled() const { return queryPool != VK_NULL_HANDLE; }
+
+    // Two dimensional local sizes worth trying, within the device limits
+    std::vector<VkExtent2D> getCandidates() const;
+    bool isSupported(VkExtent2D workgroup) const { return isSupported(workgroup, limits); }
+    // Non-zero and within the local size and invocation limits of the device
+    static bool isSupported(VkExtent2D workgroup, const VkPhysicalDeviceLimits& limits);
+
+    // Milliseconds one run of the recorded work takes on the GPU. Runs are separated by barriers, so they may read
+    // and write the same resources.
+    float time(const std::function<void(VkCommandBuffer)>& record);
+
+    // The winners of an earlier launch are kept on disk with the vendor ID, device ID and pipeline cache UUID of the GPU
+    // and the settings they were timed with. load returns false on any difference, so the candidates are timed again.
+    static bool load(const std::string& path, const VkPhysicalDeviceProperties& properties, const std::vector<uint32_t>& settings, TunedWorkgroups& tuned);
+    static void save(const std::string& path, const VkPhysicalDeviceProperties& properties, const std::vector<uint32_t>& settings, const TunedWorkgroups& tuned);
+};
@@ -1,14 +1,184 @@
 #pragma once
 #include "VulkanApplication.h"
+#include "VolumeFile.h"
+#include "ImageUtils.h"
+#include "MeshCache.h"
 
-int main() {
+// SkyEngine.exe [options]                        interactive window, GPU pass timings in the title bar
+// SkyEngine.exe [options] --headless <frames> [prefix]
+//                                                render frames offscreen to <prefix>00000.png, ...
+// SkyEngine.exe [options] --cpu-render <frames> [prefix]
+//                                                render the clouds of the same frames on the CPU to <prefix>00000.hdr, ...
+// SkyEngine.exe [options] --benchmark <keyframes> <frames> [output.json]
+//                                                replay a camera / sun path and write frame timings
+// SkyEngine.exe --pack-volume <slices> <output.vol>
+//                                                pack <slices>(0).tga, <slices>(1).tga, ... into one volume file
+// SkyEngine.exe --generate-volume <shape|detail> <size> <output.vol>
+//                                                generate a tileable size^3 cloud noise volume (see ImageUtils.h)
+// SkyEngine.exe --benchmark-noise [size]
+//                                                time the curl noise kernels on a size x size map, default 256
+// SkyEngine.exe --benchmark-mesh <model.obj> [iterations]
+//                                                time parsing an OBJ against loading its mesh cache, at the terrain's
+//                                                scale, and list the levels of detail its chunks pick by distance
+// options:
+//   --profile <timings.csv>                      also log GPU pass timings of every frame
+//   --frames-in-flight <1-3>                     how far the CPU may run ahead of the GPU, default 2
+//   --curl-noise <size>                          generate a size x size curl noise map at startup instead of loading it
+//   --vertex-format <packed|float>               vertex layout of the scene mesh, default packed (see Geometry.h)
+//   --cloud-lighting <cone|volume>               light cloud samples with a cone of samples or a baked volume, default cone
+//   --temporal-block <2|4|8>                     the clouds update one pixel per block of this size each frame, default 4
+//   --temporal-order <bayer|halton|blue-noise>   order the pixels of a block are updated in, default bayer
+//   --temporal-adaptive <on|off>                 also re-march up to a quarter of each block where the reprojection is invalid, default off
+//   --workgroup <auto|WxH>                       local size of the reprojection and the clouds, default auto: the fastest
+//                                                of several, timed on the first launch and kept in workgroups.cache
+//   --max-steps <n>                              samples along a cloud ray, default 100
+//   --light-cone-samples <1-6>                   samples towards the sun per cloud sample, default 6
+// std::stoul throws invalid_argument or out_of_range without saying which option was wrong
+static uint32_t parseCount(const std::string& option, const std::string& value) {
+    size_t end = 0;
+    unsigned long count = 0;
+    try {
+        count = std::stoul(value, &end);
+    }
+    catch (const std::exception&) {
+        end = 0;
+    }
+    if (end == 0 || end != value.size() || value[0] == '-' || count > UINT32_MAX) {
+        throw std::runtime_error("invalid value " + value + " for " + option + ", expected a whole number!");
+    }
+    return static_cast<uint32_t>(count);
+}
+
+int main(int argc, char** argv) {
     VulkanApplication app = VulkanApplication();
 
     // remove this pls
     try {
-        app.run();
+        int arg = 1;
+        uint32_t temporalBlock = 4;
+        TemporalOrder temporalOrder = TEMPORAL_BAYER;
+        bool temporalAdaptive = false;
+        uint32_t maxSteps = 100;
+        uint32_t lightConeSamples = 6;
+        while (argc > arg + 1) {
+            std::string option = argv[arg];
+            if (option == "--profile") {
+                app.setProfilerOutput(argv[arg + 1]);
+            }
+            else if (option == "--frames-in-flight") {
+                app.setFramesInFlight(parseCount(option, argv[arg + 1]));
+            }
+            else if (option == "--curl-noise") {
+                app.setCurlNoiseSize(parseCount(option, argv[arg + 1]));
+            }
+            else if (option == "--vertex-format") {
+                std::string format = argv[arg + 1];
+                if (format != "packed" && format != "float") {
+                    throw std::runtime_error("unknown vertex format " + format + ", expected packed or float!");
+                }
+                app.setSceneVertexFormat(format == "packed" ? VERTEX_PACKED : VERTEX_FLOAT);
+            }
+            else if (option == "--cloud-lighting") {
+                std::string lighting = argv[arg + 1];
+                if (lighting != "cone" && lighting != "volume") {
+                    throw std::runtime_error("unknown cloud lighting " + lighting + ", expected cone or volume!");
+                }
+                app.setCloudLightVolume(lighting == "volume");
+            }
+            else if (option == "--temporal-block") {
+                temporalBlock = parseCount(option, argv[arg + 1]);
+            }
+            else if (option == "--temporal-order") {
+                std::string order = argv[arg + 1];
+                if (order == "bayer") temporalOrder = TEMPORAL_BAYER;
+                else if (order == "halton") temporalOrder = TEMPORAL_HALTON;
+                else if (order == "blue-noise") temporalOrder = TEMPORAL_BLUE_NOISE;
+                else throw std::runtime_error("unknown temporal order " + order + ", expected bayer, halton or blue-noise!");
+            }
+            else if (option == "--temporal-adaptive") {
+                std::string adaptive = argv[arg + 1];
+                if (adaptive != "on" && adaptive != "off") {
+                    throw std::runtime_error("unknown temporal adaptive setting " + adaptive + ", expected on or off!");
+                }
+                temporalAdaptive = adaptive == "on";
+            }
+            else if (option == "--workgroup") {
+                std::string workgroup = argv[arg + 1];
+                if (workgroup != "auto") {
+                    size_t x = workgroup.find('x');
+                    if (x == std::string::npos) {
+                        throw std::runtime_error("unknown workgroup size " + workgroup + ", expected auto or WxH!");
+                    }
+                    VkExtent2D size = { parseCount(option, workgroup.substr(0, x)), parseCount(option, workgroup.substr(x + 1)) };
+                    if (size.width == 0 || size.height == 0) {
+                        throw std::runtime_error("invalid workgroup size " + workgroup + ", both sides must be at least 1!");
+                    }
+                    app.setWorkgroupSize(size); // checked against the device limits once it is picked
+                }
+            }
+            else if (option == "--max-steps") {
+                maxSteps = parseCount(option, argv[arg + 1]);
+            }
+            else if (option == "--light-cone-samples") {
+                lightConeSamples = parseCount(option, argv[arg + 1]);
+                if (lightConeSamples < 1 || lightConeSamples > 6) {
+                    throw std::runtime_error("light cone samples must be 1 to 6!");
+                }
+            }
+            else {
+                break;
+            }
+            arg += 2;
+        }
+        app.setTemporalPattern(temporalBlock, temporalOrder, temporalAdaptive);
+        app.setCloudMarchBudget(maxSteps, lightConeSamples);
+
+        if (argc > arg + 2 && std::string(argv[arg]) == "--pack-volume") {
+            VolumeHeader header = VolumeFile::packSlices(argv[arg + 1], argv[arg + 2]);
+            std::cout << "packed " << header.width << "x" << header.height << "x" << header.depth << " volume into " << argv[arg + 2] << std::endl;
+        }
+        else if (argc > arg + 3 && std::string(argv[arg]) == "--generate-volume") {
+            std::string type = argv[arg + 1];
+            if (type != "shape" && type != "detail") {
+                throw std::runtime_error("unknown volume type " + type + ", expected shape or detail!");
+            }
+            uint32_t size = parseCount(argv[arg], argv[arg + 2]);
+            auto startTime = std::chrono::high_resolution_clock::now();
+            VolumeHeader header = GenerateCloudNoiseVolume(type == "shape" ? CLOUD_SHAPE_NOISE : CLOUD_DETAIL_NOISE, size, argv[arg + 3]);
+            double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+            std::cout << "generated " << header.width << "x" << header.height << "x" << header.depth << " " << type << " volume into " << argv[arg + 3]
+                << " in " << seconds << " s" << std::endl;
+        }
+        else if (argc > arg && std::string(argv[arg]) == "--benchmark-noise") {
+            BenchmarkCurlNoise(argc > arg + 1 ? parseCount(argv[arg], argv[arg + 1]) : 256);
+        }
+        else if (argc > arg + 1 && std::string(argv[arg]) == "--benchmark-mesh") {
+            MeshCache::benchmark(argv[arg + 1], argc > arg + 2 ? parseCount(argv[arg], argv[arg + 2]) : 10, TERRAIN_LOD_SCALE);
+        }
+        else if (argc > arg + 1 && std::string(argv[arg]) == "--headless") {
+            uint32_t frameCount = parseCount(argv[arg], argv[arg + 1]);
+            std::string prefix = argc > arg + 2 ? argv[arg + 2] : "frame_";
+            app.runHeadless(frameCount, prefix);
+        }
+        else if (argc > arg + 1 && std::string(argv[arg]) == "--cpu-render") {
+            uint32_t frameCount = parseCount(argv[arg], argv[arg + 1]);
+            std::string prefix = argc > arg + 2 ? argv[arg + 2] : "cpu_frame_";
+            app.runCPURender(frameCount, prefix);
+        }
+        else if (argc > arg + 2 && std::string(argv[arg]) == "--benchmark") {
+            uint32_t frameCount = parseCount(argv[arg], argv[arg + 2]);
+            std::string output = argc > arg + 3 ? argv[arg + 3] : "benchmark.json";
+            app.runBenchmark(argv[arg + 1], frameCount, output);
+        }
+        else if (argc > arg) {
+            // a mode without its arguments, or an option without its value, must not fall back to the window
+            throw std::runtime_error("unknown or incomplete option " + std::string(argv[arg]) + ", see the usage at the top of main.cpp!");
+        }
+        else {
+            app.run();
+        }
     }
-    catch (const std::runtime_error& e) {
+    catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
         return EXIT_FAILURE;
     }